@@ -0,0 +1,221 @@
+#include <memory>
+#include <random>
+#include <numeric>
+
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include <base/data.hpp>
+#include <base/io.hpp>
+#include <base/io/file.hpp>
+#include <base/json.hpp>
+#include <base/random.hpp>
+#include <base/timer.hpp>
+#include <model/recsys/popularity.hpp>
+#include <model/recsys/itemcf.hpp>
+#include <model/recsys/usercf.hpp>
+#include <model/recsys/imf.hpp>
+#include <model/recsys/cdae.hpp>
+#include <solver/solver.hpp>
+#include <serving/model_handle.hpp>
+#include <serving/load_generator.hpp>
+
+DEFINE_string(checkpoint_file, "", "Benchmark the model of this checkpoint");
+DEFINE_string(cache_file, "./yelp.bin", "Otherwise train --method on this cached data set");
+DEFINE_string(method, "POP", "POP, ITEMCF, USERCF, MF or CDAE");
+DEFINE_int32(max_iteration, 5, "Num of training iterations");
+DEFINE_int32(num_dim, 10, "Num of latent dimensions");
+DEFINE_int32(seed, 20141119, "Random Seed");
+DEFINE_string(retrieval, "EXACT", "Top-k retrieval: BRUTE, EXACT, ANN or QUANT");
+DEFINE_string(stream, "TEST", "Request stream: TEST (replay the test set), UNIFORM, ZIPF or FILE");
+DEFINE_string(stream_file, "", "Raw user ids, one per line, for --stream=FILE");
+DEFINE_int32(stream_length, 1000000, "Num of requests of UNIFORM and ZIPF streams");
+DEFINE_double(zipf_exponent, 1., "Skew of ZIPF streams");
+DEFINE_int32(threads, 1, "Num of concurrent clients");
+DEFINE_double(rate, 0., "Requests / sec over all clients, 0 for a closed loop");
+DEFINE_double(duration, 10., "Secs measured");
+DEFINE_double(warmup, 1., "Secs run before the measurement");
+DEFINE_int32(topk, 10, "Num of items per request");
+DEFINE_string(label, "", "Free text stored with the results, e.g. a version");
+DEFINE_string(json_output, "", "Append the results as one JSON line to this file");
+
+int main(int argc, char* argv[]) {
+
+  using namespace libcf;
+
+  FLAGS_log_dir = "./log";
+  google::InitGoogleLogging(argv[0]);
+
+  gflags::SetUsageMessage("loadgen [--checkpoint_file=model.ckpt | --method=MF] --threads=8");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  RetrievalType retrieval = EXACT_MIPS;
+  if (FLAGS_retrieval == "BRUTE") {
+    retrieval = BRUTE_FORCE;
+  } else if (FLAGS_retrieval == "EXACT") {
+    retrieval = EXACT_MIPS;
+  } else if (FLAGS_retrieval == "ANN") {
+    retrieval = ANN_HNSW;
+  } else if (FLAGS_retrieval == "QUANT") {
+    retrieval = QUANTIZED;
+  } else {
+    LOG(FATAL) << "UNKNOWN RETRIEVAL TYPE";
+  }
+
+  // the model, the items to exclude and the raw user ids
+  std::unique_ptr<ModelVersion> version;
+  std::shared_ptr<RecsysModelBase> model;
+  LoadGenerator::RatedItems rated_items;
+  std::vector<size_t> test_stream;
+  std::function<size_t(const std::string&)> find_user;
+  std::string model_type = FLAGS_method;
+
+  Data data, train, test;
+  if (!FLAGS_checkpoint_file.empty()) {
+    ModelLoadConfig load_config;
+    load_config.retrieval = retrieval;
+    version.reset(new ModelVersion(FLAGS_checkpoint_file, load_config));
+    model_type = version->type;
+    auto& exclusions = version->exclusions;
+    for (size_t uid = 0; uid < exclusions.num_rows(); ++uid) {
+      for (auto& iid : exclusions.row(uid)) {
+        rated_items[uid][iid] = 1.;
+      }
+    }
+    CHECK(version->users) << "Checkpoint without a user dictionary";
+    find_user = [&](const std::string& key) { return version->users->find(key); };
+  } else {
+    Random::seed(FLAGS_seed);
+    load(FLAGS_cache_file, data);
+    data.random_split_by_feature_group(train, test, 0, 0.2);
+    rated_items = train.get_feature_pair_label_hashtable(0, 1);
+    for (auto& ins : test) {
+      test_stream.push_back(ins.get_feature_group_index(0, 0));
+    }
+    auto& users = train.get_data_info()->feature_group_infos_[0];
+    find_user = [&](const std::string& key) { return users.get_index(key, false); };
+
+    SolverConfig solver_config;
+    solver_config.max_iteration = FLAGS_max_iteration;
+    solver_config.loss_mode = NO_LOSS;
+    if (FLAGS_method == "POP") {
+      Popularity pop_model;
+      Solver<Popularity> solver(pop_model, solver_config);
+      solver.train(train, test, {TOPN});
+      model = solver.get_model();
+    } else if (FLAGS_method == "ITEMCF") {
+      ItemCF itemcf_model(Jaccard, 50);
+      Solver<ItemCF> solver(itemcf_model, solver_config);
+      solver.train(train, test, {TOPN});
+      model = solver.get_model();
+    } else if (FLAGS_method == "USERCF") {
+      UserCF usercf_model(Jaccard, 50);
+      Solver<UserCF> solver(usercf_model, solver_config);
+      solver.train(train, test, {TOPN});
+      model = solver.get_model();
+    } else if (FLAGS_method == "MF") {
+      IMFConfig config;
+      config.num_dim = FLAGS_num_dim;
+      config.retrieval = retrieval;
+      IMF imf_model(config);
+      Solver<IMF> solver(imf_model, solver_config);
+      solver.train(train, test, {TOPN});
+      model = solver.get_model();
+    } else if (FLAGS_method == "CDAE") {
+      CDAEConfig config;
+      config.num_dim = FLAGS_num_dim;
+      config.lt = SQUARE;
+      config.retrieval = retrieval;
+      CDAE cdae_model(config);
+      Solver<CDAE> solver(cdae_model, solver_config);
+      solver.train(train, test, {TOPN});
+      model = solver.get_model();
+    } else {
+      LOG(FATAL) << "UNKNOWN METHOD " << FLAGS_method;
+    }
+    model->pre_recommend();
+  }
+  const RecsysModelBase& bench_model = version ? *version->model : *model;
+  size_t num_users = bench_model.num_users();
+
+  std::vector<size_t> stream;
+  std::mt19937_64 rng(FLAGS_seed);
+  if (FLAGS_stream == "TEST") {
+    CHECK(!test_stream.empty()) << "--stream=TEST needs a --method model";
+    stream.swap(test_stream);
+  } else if (FLAGS_stream == "UNIFORM") {
+    std::uniform_int_distribution<size_t> dist(0, num_users - 1);
+    for (int idx = 0; idx < FLAGS_stream_length; ++idx) {
+      stream.push_back(dist(rng));
+    }
+  } else if (FLAGS_stream == "ZIPF") {
+    // popular users are shuffled over the uid space
+    std::vector<size_t> perm(num_users);
+    std::iota(perm.begin(), perm.end(), 0);
+    std::shuffle(perm.begin(), perm.end(), rng);
+    ZipfDistribution dist(num_users, FLAGS_zipf_exponent);
+    for (int idx = 0; idx < FLAGS_stream_length; ++idx) {
+      stream.push_back(perm[dist(rng)]);
+    }
+  } else if (FLAGS_stream == "FILE") {
+    File f(FLAGS_stream_file, "r");
+    std::string line;
+    size_t num_unknown = 0;
+    while (f.good()) {
+      f.read_line(line);
+      if (line.empty()) continue;
+      size_t uid = find_user(line);
+      if (uid < num_users) {
+        stream.push_back(uid);
+      } else {
+        ++num_unknown;
+      }
+    }
+    f.close();
+    if (num_unknown > 0) {
+      LOG(WARNING) << "Skipped " << num_unknown << " unknown users";
+    }
+  } else {
+    LOG(FATAL) << "UNKNOWN STREAM " << FLAGS_stream;
+  }
+
+  LoadConfig config;
+  config.num_threads = FLAGS_threads;
+  config.arrival_rate = FLAGS_rate;
+  config.duration = FLAGS_duration;
+  config.warmup = FLAGS_warmup;
+  config.topk = FLAGS_topk;
+  config.seed = FLAGS_seed;
+  LoadGenerator generator(bench_model, rated_items, stream, config);
+  auto result = generator.run();
+
+  LOG(INFO) << model_type << " with " << FLAGS_threads << " clients: "
+      << result.num_requests << " requests, " << result.qps() << " QPS, latency us: "
+      << "p50 " << result.latency.percentile(50.) / 1e3
+      << ", p99 " << result.latency.percentile(99.) / 1e3
+      << ", p999 " << result.latency.percentile(99.9) / 1e3
+      << ", max " << result.latency.max() / 1e3;
+
+  JsonWriter json;
+  json.begin_object();
+  json.add("label", FLAGS_label);
+  json.add("model", model_type);
+  json.add("retrieval", FLAGS_retrieval);
+  json.add("num_users", num_users);
+  json.add("num_items", bench_model.num_items());
+  json.add("stream", FLAGS_stream);
+  json.add("threads", FLAGS_threads);
+  json.add("rate", FLAGS_rate);
+  json.add("topk", FLAGS_topk);
+  result.write_json(json);
+  json.end_object();
+  if (!FLAGS_json_output.empty()) {
+    File f(FLAGS_json_output, "a");
+    f.write_line(json.str());
+    f.close();
+  } else {
+    std::cout << json.str() << std::endl;
+  }
+
+  return 0;
+}
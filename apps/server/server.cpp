@@ -0,0 +1,106 @@
+#include <csignal>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include <serving/model_handle.hpp>
+#include <serving/server.hpp>
+
+DEFINE_string(checkpoint_file, "", "Model checkpoint saved by yelp --checkpoint_file, reloaded on SIGHUP");
+DEFINE_string(socket, "", "Serve on this Unix domain socket instead of stdin / stdout");
+DEFINE_string(retrieval, "EXACT", "Top-k retrieval: BRUTE, EXACT, ANN or QUANT");
+DEFINE_int32(max_batch_size, 256, "Max num of requests scored together");
+DEFINE_int32(batch_window_us, 200, "Max wait for more requests to batch, in microseconds");
+DEFINE_int32(max_topk, 1000, "Max num of items per response");
+DEFINE_double(stats_interval, 10., "Secs between latency / QPS reports, 0 for none");
+// CDAE options that the checkpoint does not record, as used for training
+DEFINE_bool(linear, false, "Linear DAE");
+DEFINE_bool(tanh, false, "Using tanh NonLinear Function");
+DEFINE_double(cratio, 0, "Corruption Ratio");
+
+static libcf::RecommendServer* g_server = nullptr;
+
+static std::atomic<bool> g_reload(false);
+
+static void handle_signal(int) {
+  if (g_server) {
+    g_server->request_stop();
+  }
+}
+
+static void handle_reload(int) {
+  g_reload = true;
+}
+
+int main(int argc, char* argv[]) {
+
+  using namespace libcf;
+
+  FLAGS_log_dir = "./log";
+  google::InitGoogleLogging(argv[0]);
+
+  gflags::SetUsageMessage("server --checkpoint_file=model.ckpt [--socket=/tmp/libcf.sock]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK(!FLAGS_checkpoint_file.empty()) << "--checkpoint_file is required";
+
+  RetrievalType retrieval = EXACT_MIPS;
+  if (FLAGS_retrieval == "BRUTE") {
+    retrieval = BRUTE_FORCE;
+  } else if (FLAGS_retrieval == "EXACT") {
+    retrieval = EXACT_MIPS;
+  } else if (FLAGS_retrieval == "ANN") {
+    retrieval = ANN_HNSW;
+  } else if (FLAGS_retrieval == "QUANT") {
+    retrieval = QUANTIZED;
+  } else {
+    LOG(FATAL) << "UNKNOWN RETRIEVAL TYPE";
+  }
+
+  ModelLoadConfig load_config;
+  load_config.retrieval = retrieval;
+  load_config.linear = FLAGS_linear;
+  load_config.tanh = FLAGS_tanh;
+  load_config.corruption_ratio = FLAGS_cratio;
+  ModelHandle handle(std::unique_ptr<ModelVersion>(
+      new ModelVersion(FLAGS_checkpoint_file, load_config)));
+
+  ServerConfig config;
+  config.max_batch_size = FLAGS_max_batch_size;
+  config.batch_window_us = FLAGS_batch_window_us;
+  config.max_topk = FLAGS_max_topk;
+  config.stats_interval = FLAGS_stats_interval;
+  RecommendServer server(handle, config);
+
+  // SIGHUP reloads --checkpoint_file, e.g. after a retrained model is
+  // saved over it (checkpoints are replaced by an atomic rename)
+  std::atomic<bool> done(false);
+  std::thread reloader([&]() {
+    while (!done) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      if (g_reload.exchange(false)) {
+        reload_model(handle, FLAGS_checkpoint_file, load_config);
+      }
+    }
+  });
+
+  std::signal(SIGPIPE, SIG_IGN);
+  std::signal(SIGHUP, handle_reload);
+  if (FLAGS_socket.empty()) {
+    server.serve(0, 1);
+  } else {
+    g_server = &server;
+    std::signal(SIGINT, handle_signal);
+    std::signal(SIGTERM, handle_signal);
+    server.serve_unix_socket(FLAGS_socket);
+    g_server = nullptr;
+  }
+  done = true;
+  reloader.join();
+  server.stop();
+
+  return 0;
+}
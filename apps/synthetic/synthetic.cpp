@@ -0,0 +1,61 @@
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include <base/data.hpp>
+#include <base/io.hpp>
+#include <base/synthetic.hpp>
+
+DEFINE_int64(num_users, 100000, "Num of users");
+DEFINE_int64(num_items, 10000, "Num of items");
+DEFINE_int64(num_interactions, 1000000, "Approximate num of interactions");
+DEFINE_double(user_exponent, 1., "Zipf skew of the user activity");
+DEFINE_double(item_exponent, 1., "Zipf skew of the item popularity");
+DEFINE_int64(max_items_per_user, 10000, "Cap of the items of one user, USER order only");
+DEFINE_string(order, "USER", "USER (distinct items per user) or TIME (one event stream in time order)");
+DEFINE_bool(timestamps, false, "Write a third column of unix secs");
+DEFINE_int32(seed, 20141119, "Random Seed");
+DEFINE_string(output_file, "", "Write the interactions as text lines, e.g. for --online_file");
+DEFINE_string(cache_file, "", "Write the interactions as a cached data set, e.g. for yelp --cache_file");
+
+int main(int argc, char* argv[]) {
+
+  using namespace libcf;
+
+  FLAGS_log_dir = "./log";
+  google::InitGoogleLogging(argv[0]);
+
+  gflags::SetUsageMessage("synthetic --num_users=1000000 --num_interactions=100000000 "
+                          "--num_thread=8 [--output_file=data.txt] [--cache_file=data.bin]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK(!FLAGS_output_file.empty() || !FLAGS_cache_file.empty())
+      << "--output_file or --cache_file is required";
+
+  SyntheticConfig config;
+  config.num_users = FLAGS_num_users;
+  config.num_items = FLAGS_num_items;
+  config.num_interactions = FLAGS_num_interactions;
+  config.user_exponent = FLAGS_user_exponent;
+  config.item_exponent = FLAGS_item_exponent;
+  config.max_items_per_user = FLAGS_max_items_per_user;
+  config.timestamps = FLAGS_timestamps;
+  config.seed = FLAGS_seed;
+  if (FLAGS_order == "USER") {
+    config.order = USER_ORDER;
+  } else if (FLAGS_order == "TIME") {
+    config.order = TIME_ORDER;
+  } else {
+    LOG(FATAL) << "UNKNOWN ORDER " << FLAGS_order;
+  }
+
+  SyntheticDataGenerator generator(config);
+  if (!FLAGS_output_file.empty()) {
+    generator.write_text(FLAGS_output_file);
+  }
+  if (!FLAGS_cache_file.empty()) {
+    Data data;
+    generator.generate(data);
+    save(data, FLAGS_cache_file);
+  }
+
+  return 0;
+}
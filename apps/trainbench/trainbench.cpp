@@ -0,0 +1,202 @@
+#include <map>
+#include <cmath>
+
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include <base/data.hpp>
+#include <base/io.hpp>
+#include <base/io/file.hpp>
+#include <base/profiler.hpp>
+#include <base/random.hpp>
+#include <base/synthetic.hpp>
+#include <model/recsys/popularity.hpp>
+#include <model/recsys/itemcf.hpp>
+#include <model/recsys/imf.hpp>
+#include <model/recsys/pmf.hpp>
+#include <model/recsys/bpr.hpp>
+#include <model/recsys/wrmf.hpp>
+#include <model/recsys/eals.hpp>
+#include <model/recsys/cdae.hpp>
+#include <solver/solver.hpp>
+
+DEFINE_string(methods, "POP,ITEMCF,MF,BPR,CDAE", "Models to train, also PMF, WRMF and EALS");
+DEFINE_int64(num_users, 20000, "Num of users of the synthetic data set");
+DEFINE_int64(num_items, 5000, "Num of items of the synthetic data set");
+DEFINE_int64(num_interactions, 500000, "Approximate num of interactions");
+DEFINE_int32(max_iteration, 5, "Num of training iterations");
+DEFINE_int32(num_dim, 10, "Num of latent dimensions");
+DEFINE_string(wrmf_solver, "CG", "WRMF row solver: CG or CHOLESKY");
+DEFINE_int32(num_strata, 0, "Train MF, PMF and BPR by parallel SGD on num_strata^2 blocks, 0 for serial SGD");
+DEFINE_int32(seed, 20141119, "Random Seed");
+DEFINE_bool(evaluate, true, "Evaluate TOPN on the held out interactions every iteration");
+DEFINE_string(profile_file, "", "Append the per-epoch profiles as JSON lines to this file");
+DEFINE_string(baseline_file, "", "Compare the run against this baseline");
+DEFINE_bool(save_baseline, false, "Write the run to --baseline_file instead of comparing");
+DEFINE_double(tolerance, 0.2, "Allowed relative slowdown against the baseline");
+DEFINE_double(min_secs, 0.05, "Times below this are too noisy to compare");
+
+/** Timings of one model, the unit of the baseline
+ */
+struct TrainBenchResult {
+  double prep_secs = 0.;       // data_prep of epoch 0, e.g. the similarities of ITEMCF
+  double epoch_secs = 0.;      // mean training pass of the iterations
+  double updates_per_sec = 0.;
+  double interactions_per_sec = 0.;
+};
+
+template <class Model>
+TrainBenchResult train_bench(const std::string& method, Model& model,
+                             const libcf::Data& train, const libcf::Data& test) {
+  using namespace libcf;
+  SolverConfig solver_config;
+  solver_config.max_iteration = FLAGS_max_iteration;
+  solver_config.loss_mode = NO_LOSS;
+  solver_config.profile = true;
+  solver_config.profile_file = FLAGS_profile_file;
+  solver_config.profile_label = method;
+  Solver<Model> solver(model, solver_config);
+  if (FLAGS_evaluate) {
+    solver.train(train, test, {TOPN});
+  } else {
+    solver.train(train);
+  }
+
+  auto& profiler = solver.profiler();
+  auto total = profiler.total();
+  TrainBenchResult rets;
+  rets.prep_secs = profiler.epochs().front().phase_secs[PHASE_DATA_PREP];
+  rets.epoch_secs = total.train_secs() / FLAGS_max_iteration;
+  rets.updates_per_sec = total.rate(total.updates);
+  rets.interactions_per_sec = total.rate(total.interactions);
+  LOG(INFO) << method << ": prep " << rets.prep_secs << " secs, epoch "
+      << rets.epoch_secs << " secs, " << rets.updates_per_sec << " updates/sec, "
+      << rets.interactions_per_sec << " interactions/sec";
+  return rets;
+}
+
+/** Number of timings slower than the baseline by more than --tolerance
+ */
+size_t compare_baseline(const std::map<std::string, std::string>& current,
+                        const std::map<std::string, std::string>& baseline) {
+  size_t num_regressions = 0;
+  for (auto& p : current) {
+    auto it = baseline.find(p.first);
+    if (it == baseline.end()) {
+      LOG(WARNING) << p.first << " is not in the baseline";
+      continue;
+    }
+    double now = std::stod(p.second), base = std::stod(it->second);
+    // throughputs are higher-is-better, times lower-is-better
+    bool is_rate = p.first.find("_per_sec") != std::string::npos;
+    double slowdown = is_rate ? (now > 0. ? base / now - 1. : 0.) : (base > 0. ? now / base - 1. : 0.);
+    if (!is_rate && std::max(now, base) < FLAGS_min_secs) {
+      continue;
+    }
+    if (slowdown > FLAGS_tolerance) {
+      LOG(WARNING) << "REGRESSION " << p.first << ": " << p.second
+          << " vs baseline " << it->second << " (" << 100. * slowdown << "% slower)";
+      ++num_regressions;
+    } else {
+      LOG(INFO) << p.first << ": " << p.second << " vs baseline " << it->second;
+    }
+  }
+  return num_regressions;
+}
+
+int main(int argc, char* argv[]) {
+
+  using namespace libcf;
+
+  FLAGS_log_dir = "./log";
+  google::InitGoogleLogging(argv[0]);
+
+  gflags::SetUsageMessage("trainbench [--methods=MF,CDAE] [--profile_file=profile.json] "
+                          "[--baseline_file=baseline.txt [--save_baseline]]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK(!FLAGS_save_baseline || !FLAGS_baseline_file.empty())
+      << "--save_baseline requires --baseline_file";
+
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = FLAGS_num_users;
+  synthetic_config.num_items = FLAGS_num_items;
+  synthetic_config.num_interactions = FLAGS_num_interactions;
+  synthetic_config.seed = FLAGS_seed;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Random::seed(FLAGS_seed);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+  LOG(INFO) << train;
+  LOG(INFO) << test;
+
+  std::map<std::string, TrainBenchResult> results;
+  for (auto& method : split_line(FLAGS_methods, ",")) {
+    Random::seed(FLAGS_seed);
+    if (method == "POP") {
+      Popularity model;
+      results[method] = train_bench(method, model, train, test);
+    } else if (method == "ITEMCF") {
+      ItemCF model(Jaccard, 50);
+      results[method] = train_bench(method, model, train, test);
+    } else if (method == "MF") {
+      IMFConfig config;
+      config.num_dim = FLAGS_num_dim;
+      config.num_strata = FLAGS_num_strata;
+      IMF model(config);
+      results[method] = train_bench(method, model, train, test);
+    } else if (method == "PMF") {
+      PMFConfig config;
+      config.num_dim = FLAGS_num_dim;
+      config.num_strata = FLAGS_num_strata;
+      PMF model(config);
+      results[method] = train_bench(method, model, train, test);
+    } else if (method == "BPR") {
+      BPRConfig config;
+      config.num_dim = FLAGS_num_dim;
+      config.num_strata = FLAGS_num_strata;
+      BPR model(config);
+      results[method] = train_bench(method, model, train, test);
+    } else if (method == "WRMF") {
+      WRMFConfig config;
+      config.num_dim = FLAGS_num_dim;
+      config.solver = FLAGS_wrmf_solver == "CHOLESKY" ? CHOLESKY : CONJUGATE_GRADIENT;
+      WRMF model(config);
+      results[method] = train_bench(method, model, train, test);
+    } else if (method == "EALS") {
+      EALSConfig config;
+      config.num_dim = FLAGS_num_dim;
+      EALS model(config);
+      results[method] = train_bench(method, model, train, test);
+    } else if (method == "CDAE") {
+      CDAEConfig config;
+      config.num_dim = FLAGS_num_dim;
+      config.lt = SQUARE;
+      CDAE model(config);
+      results[method] = train_bench(method, model, train, test);
+    } else {
+      LOG(FATAL) << "UNKNOWN METHOD " << method;
+    }
+  }
+
+  std::map<std::string, std::string> current;
+  for (auto& p : results) {
+    current[p.first + ".prep_secs"] = std::to_string(p.second.prep_secs);
+    current[p.first + ".epoch_secs"] = std::to_string(p.second.epoch_secs);
+    if (p.second.updates_per_sec > 0.) {
+      current[p.first + ".updates_per_sec"] = std::to_string(p.second.updates_per_sec);
+    }
+  }
+
+  if (FLAGS_baseline_file.empty()) {
+    return 0;
+  }
+  if (FLAGS_save_baseline) {
+    write_config_file(current, FLAGS_baseline_file);
+    LOG(INFO) << "Saved the baseline to " << FLAGS_baseline_file;
+    return 0;
+  }
+  size_t num_regressions = compare_baseline(current, read_config_file(FLAGS_baseline_file));
+  LOG(INFO) << num_regressions << " regressions against " << FLAGS_baseline_file;
+  return num_regressions > 0 ? 1 : 0;
+}
@@ -1,5 +1,6 @@
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
+#include <numeric>
 
 #include <glog/logging.h>
 #include <gflags/gflags.h>
@@ -7,8 +8,10 @@
 #include <base/data.hpp>
 #include <base/io.hpp>
 #include <base/io/file.hpp>
+#include <base/memory.hpp>
 #include <base/timer.hpp>
 #include <base/random.hpp>
+#include <base/trace.hpp>
 #include <model/linear_model.hpp>
 #include <model/factor_model.hpp>
 #include <model/recsys/popularity.hpp>
@@ -16,6 +19,8 @@
 #include <model/recsys/usercf.hpp>
 #include <solver/sgd.hpp>
 #include <solver/solver.hpp>
+#include <solver/online.hpp>
+#include <solver/sweep.hpp>
 #include <model/recsys/imf.hpp>
 #include <model/recsys/bpr.hpp>
 #include <model/recsys/cdae.hpp>
@@ -45,6 +50,205 @@ DEFINE_int32(cnum, 1, "Num of Corruptions");
 DEFINE_double(cratio, 0, "Corruption Ratio");
 DEFINE_string(loss_type, "SQUARE", "Loss function type");
 DEFINE_double(beta, 1., "Beta for adagrad");
+DEFINE_int32(max_iteration, 50, "Num of training iterations");
+DEFINE_int32(eval_iterations, 1, "Evaluate every n iterations");
+DEFINE_string(loss_mode, "FULL", "Training loss mode: FULL, EVAL, SAMPLED, FUSED or NONE");
+DEFINE_int32(loss_sample_size, 1000, "Num of users for the SAMPLED loss mode");
+DEFINE_string(retrieval, "EXACT", "Top-k retrieval: BRUTE, EXACT, ANN or QUANT");
+DEFINE_int32(hnsw_m, 16, "Max links per node of the HNSW index");
+DEFINE_int32(hnsw_ef_construction, 100, "Candidate list size while building the HNSW index");
+DEFINE_int32(hnsw_ef_search, 50, "Candidate list size while searching the HNSW index");
+DEFINE_string(ann_index_file, "", "Save the trained model's HNSW index to this file");
+DEFINE_string(rec_output_file, "", "Write the top-k list of every user to this file");
+DEFINE_int32(rec_topk, 10, "Length of the lists written to rec_output_file");
+DEFINE_string(quant_type, "INT8", "Item vector precision for QUANT retrieval: INT8 or FP16");
+DEFINE_int32(quant_rerank, 100, "Num of QUANT candidates re-ranked in full precision");
+DEFINE_string(online_file, "", "Keep training the model on the events of this file or pipe");
+DEFINE_int32(online_batch_size, 10000, "Num of events per online update");
+DEFINE_int32(online_passes, 1, "Training passes over the affected users per online update");
+DEFINE_string(checkpoint_file, "", "Save the trained model (MF, CDAE, ITEMCF) to this checkpoint");
+DEFINE_bool(checkpoint_optimizer_state, true, "Keep the optimizer state needed to resume training");
+DEFINE_bool(checkpoint_histories, true, "Keep the training histories, serving needs them to exclude rated items");
+DEFINE_bool(memory_report, false, "Print the memory breakdown and the projected footprint, then exit");
+DEFINE_int64(project_users, 0, "Num of users of the projected footprint, 0 for the training data's");
+DEFINE_int64(project_items, 0, "Num of items of the projected footprint, 0 for the training data's");
+DEFINE_int64(project_interactions, 0, "Num of interactions of the projected footprint, 0 for the data set's");
+DEFINE_string(trace_file, "", "Write a Chrome trace of the run to this file, needs a TRACE=1 build");
+DEFINE_string(sweep_spec, "", "CDAE flags to sweep, e.g. \"cratio=0,0.5;asym=true,false\", or a file of \"name : v1,v2\" lines");
+DEFINE_int32(sweep_samples, 0, "Random search over this many configurations of the grid, 0 for the whole grid");
+DEFINE_int32(sweep_slice, 1, "Iterations a trial trains per turn, 0 to train it in one turn");
+DEFINE_int32(sweep_active, 0, "Num of trials in memory at once, 0 for twice --num_thread");
+DEFINE_string(sweep_metric, "MAP@10", "Evaluation column ordering the sweep results");
+DEFINE_string(sweep_output, "./sweep_results.tsv", "Results table of the sweep");
+DEFINE_string(sweep_scheduler, "GRID", "GRID trains every configuration fully, HALVING or HYPERBAND stop the bad ones early");
+DEFINE_int32(sweep_min_iterations, 1, "Iterations of the first HALVING / HYPERBAND rung");
+DEFINE_double(sweep_eta, 3., "HALVING / HYPERBAND keep the best 1 / eta at each rung");
+DEFINE_string(sweep_checkpoint_dir, "/tmp", "Where HALVING / HYPERBAND keep the models between rungs");
+
+/** Feed --online_file to a trained model and evaluate it again
+ */
+template <class Model>
+void train_online(libcf::Solver<Model>& solver, const libcf::Data& train, const libcf::Data& test,
+                  const libcf::Data::LineParser& parser) {
+  using namespace libcf;
+  if (FLAGS_online_file.empty()) return;
+  OnlineConfig config;
+  config.batch_size = FLAGS_online_batch_size;
+  config.num_passes = FLAGS_online_passes;
+  OnlineTrainer<Model> trainer(*solver.get_model(), train, config);
+  trainer.consume(FLAGS_online_file, parser);
+  solver.test(test, {TOPN});
+}
+
+// the flag of the same name unless params overrides it
+double sweep_param(const libcf::SweepParams& params, const std::string& name, double flag) {
+  auto fit = params.find(name);
+  return fit != params.end() ? std::stod(fit->second) : flag;
+}
+
+int sweep_param(const libcf::SweepParams& params, const std::string& name, int flag) {
+  auto fit = params.find(name);
+  return fit != params.end() ? std::stoi(fit->second) : flag;
+}
+
+bool sweep_param(const libcf::SweepParams& params, const std::string& name, bool flag) {
+  auto fit = params.find(name);
+  if (fit == params.end()) return flag;
+  CHECK(fit->second == "true" || fit->second == "false" || fit->second == "1" || fit->second == "0")
+      << "Expect a bool for " << name << " but got " << fit->second;
+  return fit->second == "true" || fit->second == "1";
+}
+
+std::string sweep_param(const libcf::SweepParams& params, const std::string& name,
+                        const std::string& flag) {
+  auto fit = params.find(name);
+  return fit != params.end() ? fit->second : flag;
+}
+
+/** CDAEConfig of the flags, params overrides the flags it names
+ */
+libcf::CDAEConfig cdae_config(const libcf::SweepParams& params = libcf::SweepParams()) {
+  using namespace libcf;
+  static const std::vector<std::string> names = {
+    "learn_rate", "num_dim", "adagrad", "asym", "cnum", "cratio", "linear", "scaled",
+    "num_neg", "user_factor", "beta", "linear_function", "tanh", "loss_type"
+  };
+  for (auto& p : params) {
+    CHECK(std::find(names.begin(), names.end(), p.first) != names.end())
+        << "Cannot sweep " << p.first;
+  }
+  CDAEConfig config;
+  config.learn_rate = sweep_param(params, "learn_rate", FLAGS_learn_rate);
+  config.num_dim = sweep_param(params, "num_dim", FLAGS_num_dim);
+  config.using_adagrad = sweep_param(params, "adagrad", FLAGS_adagrad);
+  config.asymmetric = sweep_param(params, "asym", FLAGS_asym);
+  config.num_corruptions = sweep_param(params, "cnum", FLAGS_cnum);
+  config.corruption_ratio = sweep_param(params, "cratio", FLAGS_cratio);
+  config.linear = sweep_param(params, "linear", FLAGS_linear);
+  config.scaled = sweep_param(params, "scaled", FLAGS_scaled);
+  config.num_neg = sweep_param(params, "num_neg", FLAGS_num_neg);
+  config.user_factor = sweep_param(params, "user_factor", FLAGS_user_factor);
+  config.beta = sweep_param(params, "beta", FLAGS_beta);
+  config.linear_function = sweep_param(params, "linear_function", FLAGS_linear_function);
+  config.tanh = sweep_param(params, "tanh", FLAGS_tanh);
+  std::string loss_type = sweep_param(params, "loss_type", FLAGS_loss_type);
+  if (loss_type == "SQUARE") {
+    config.lt = SQUARE;
+  } else if (loss_type == "LOG") {
+    config.lt = LOG;
+  } else if (loss_type == "HINGE") {
+    config.lt = HINGE;
+  } else if (loss_type == "LOGISTIC") {
+    config.lt = LOGISTIC;
+  } else if (loss_type == "CE") {
+    config.lt = CROSS_ENTROPY;
+  } else {
+    LOG(FATAL) << "UNKNOWN LOSS";
+  }
+  return config;
+}
+
+/** --task=sweep: train a CDAE per configuration of --sweep_spec on the
+ *  one loaded split, --num_thread trials at a time
+ */
+void run_sweep(const libcf::Data& train, const libcf::Data& test,
+               const libcf::SolverConfig& solver_config,
+               const std::function<void (libcf::CDAEConfig&)>& set_retrieval) {
+  using namespace libcf;
+  CHECK_EQ(FLAGS_method, "CDAE") << "Only CDAE can be swept";
+  CHECK(!FLAGS_sweep_spec.empty()) << "No --sweep_spec";
+  SweepSpec spec = FLAGS_sweep_spec.find('=') != std::string::npos ?
+      SweepSpec::parse(FLAGS_sweep_spec) : SweepSpec::load(FLAGS_sweep_spec);
+  Random::seed(FLAGS_seed);
+  auto points = FLAGS_sweep_samples > 0 ? spec.sample(FLAGS_sweep_samples) : spec.grid();
+  LOG(INFO) << "Sweeping " << points.size() << " of " << spec.num_points()
+      << " configurations of " << spec.num_params() << " parameters";
+
+  SweepConfig config;
+  config.num_workers = num_hardware_threads();
+  config.max_active = FLAGS_sweep_active;
+  config.slice_iterations = FLAGS_sweep_slice;
+  config.metric = FLAGS_sweep_metric;
+  config.seed = FLAGS_seed;
+  Sweep<CDAE> sweep([&](const SweepParams& params) {
+    CDAEConfig model_config = cdae_config(params);
+    set_retrieval(model_config);
+    return CDAE(model_config);
+  }, solver_config, config);
+  std::vector<SweepResult> results;
+  if (FLAGS_sweep_scheduler == "GRID") {
+    results = sweep.run(points, train, test, {TOPN});
+  } else if (FLAGS_sweep_scheduler == "HALVING" || FLAGS_sweep_scheduler == "HYPERBAND") {
+    HyperbandConfig hyperband_config;
+    hyperband_config.min_iterations = FLAGS_sweep_min_iterations;
+    hyperband_config.eta = FLAGS_sweep_eta;
+    hyperband_config.num_brackets = FLAGS_sweep_scheduler == "HALVING" ? 1 : 0;
+    hyperband_config.checkpoint_dir = FLAGS_sweep_checkpoint_dir;
+    results = sweep.run_hyperband(points, train, test, {TOPN}, hyperband_config);
+  } else {
+    LOG(FATAL) << "UNKNOWN SWEEP SCHEDULER";
+  }
+  LOG(INFO) << "Sweep results:" << Sweep<CDAE>::format_table(results);
+  Sweep<CDAE>::write_table(results, FLAGS_sweep_output);
+}
+
+/** --memory_report: what the loaded data takes and what training
+ *  --method on --project_users x --project_items would take
+ */
+void memory_report(const libcf::Data& train, const libcf::Data& test) {
+  using namespace libcf;
+  MemoryReport loaded = train.memory_usage();
+  loaded.add("data.test_instances", test.memory_usage().bytes("data.instances"));
+  LOG(INFO) << "Loaded data: \n" << loaded;
+  LOG(INFO) << "RSS: " << format_bytes(current_rss_bytes())
+      << ", peak RSS: " << format_bytes(peak_rss_bytes());
+
+  size_t num_users = FLAGS_project_users > 0 ? FLAGS_project_users
+      : train.feature_group_total_dimension(0);
+  size_t num_items = FLAGS_project_items > 0 ? FLAGS_project_items
+      : train.feature_group_total_dimension(1);
+  size_t num_interactions = FLAGS_project_interactions > 0 ? FLAGS_project_interactions
+      : train.size() + test.size();
+  size_t num_train = static_cast<size_t>(0.8 * num_interactions);
+
+  // the split copies the instances while the full data set is still loaded
+  MemoryReport projected = Data::projected_memory(num_interactions, num_users, num_items);
+  projected.add("data.split_instances",
+                Data::projected_memory(num_interactions, 0, 0).bytes("data.instances"));
+  if (FLAGS_method == "MF" || FLAGS_method == "BPR") {
+    IMFConfig config;
+    config.num_dim = FLAGS_num_dim;
+    projected.add(IMF::projected_memory(config, num_users, num_items, num_train));
+  } else if (FLAGS_method == "CDAE") {
+    CDAEConfig config = cdae_config();
+    projected.add(CDAE::projected_memory(config, num_users, num_items, num_train));
+  } else {
+    LOG(WARNING) << "No model projection for method " << FLAGS_method;
+  }
+  LOG(INFO) << "Projected footprint of " << FLAGS_method << " with " << num_users << " users, "
+      << num_items << " items, " << num_interactions << " interactions and "
+      << FLAGS_num_dim << " dims: \n" << projected;
+}
 
 int main(int argc, char* argv[]) {
   
@@ -56,6 +260,13 @@ int main(int argc, char* argv[]) {
   
   gflags::SetUsageMessage("yelp");
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (!FLAGS_trace_file.empty()) {
+#ifndef LIBCF_TRACE
+    LOG(WARNING) << "Built without LIBCF_TRACE, " << FLAGS_trace_file << " has no events";
+#endif
+    Tracer::instance().enable();
+  }
   
   auto line_parser = [&](const std::string& line) {
     auto rets = split_line(line, " ");
@@ -85,7 +296,7 @@ int main(int argc, char* argv[]) {
 
   Data train, test;
 
-  if (FLAGS_task == "train") {
+  if (FLAGS_task == "train" || FLAGS_task == "sweep") {
 
     Random::seed(FLAGS_seed); // use the same seed to split the data 
 
@@ -96,16 +307,114 @@ int main(int argc, char* argv[]) {
     LOG(INFO) << train;
     LOG(INFO) << test;
 
-  } if (FLAGS_task == "test") {
+  } else if (FLAGS_task == "test") {
     load(FLAGS_train_cache_file, train);
     load(FLAGS_test_cache_file, test);
   } else {
     return -1;
   }
 
+  if (FLAGS_memory_report) {
+    memory_report(train, test);
+    return 0;
+  }
+
 
   Random::timed_seed();
 
+  SolverConfig solver_config;
+  solver_config.max_iteration = FLAGS_max_iteration;
+  solver_config.eval_iterations = FLAGS_eval_iterations;
+  solver_config.loss_sample_size = FLAGS_loss_sample_size;
+  if (FLAGS_loss_mode == "FULL") {
+    solver_config.loss_mode = FULL_LOSS;
+  } else if (FLAGS_loss_mode == "EVAL") {
+    solver_config.loss_mode = EVAL_LOSS;
+  } else if (FLAGS_loss_mode == "SAMPLED") {
+    solver_config.loss_mode = SAMPLED_LOSS;
+  } else if (FLAGS_loss_mode == "FUSED") {
+    solver_config.loss_mode = FUSED_LOSS;
+  } else if (FLAGS_loss_mode == "NONE") {
+    solver_config.loss_mode = NO_LOSS;
+  } else {
+    LOG(FATAL) << "UNKNOWN LOSS MODE";
+  }
+
+  RetrievalType retrieval = EXACT_MIPS;
+  if (FLAGS_retrieval == "BRUTE") {
+    retrieval = BRUTE_FORCE;
+  } else if (FLAGS_retrieval == "EXACT") {
+    retrieval = EXACT_MIPS;
+  } else if (FLAGS_retrieval == "ANN") {
+    retrieval = ANN_HNSW;
+  } else if (FLAGS_retrieval == "QUANT") {
+    retrieval = QUANTIZED;
+  } else {
+    LOG(FATAL) << "UNKNOWN RETRIEVAL TYPE";
+  }
+  HNSWConfig hnsw_config;
+  hnsw_config.M = FLAGS_hnsw_m;
+  hnsw_config.ef_construction = FLAGS_hnsw_ef_construction;
+  hnsw_config.ef_search = FLAGS_hnsw_ef_search;
+  hnsw_config.seed = FLAGS_seed;
+
+  QuantizedConfig quant_config;
+  quant_config.rerank_size = FLAGS_quant_rerank;
+  if (FLAGS_quant_type == "INT8") {
+    quant_config.type = QUANT_INT8;
+  } else if (FLAGS_quant_type == "FP16") {
+    quant_config.type = QUANT_FP16;
+  } else {
+    LOG(FATAL) << "UNKNOWN QUANTIZATION TYPE";
+  }
+
+  auto save_ann_index = [&](const RecsysModelBase& model) {
+    if (retrieval == ANN_HNSW && !FLAGS_ann_index_file.empty()) {
+      model.save_ann_index(FLAGS_ann_index_file);
+    }
+  };
+
+  auto save_checkpoint = [&](const RecsysModelBase& model) {
+    if (!FLAGS_checkpoint_file.empty()) {
+      model.save_checkpoint(FLAGS_checkpoint_file, FLAGS_checkpoint_optimizer_state,
+                            FLAGS_checkpoint_histories);
+    }
+  };
+
+  // offline scoring of all users in one batch
+  auto write_recommendations = [&](const RecsysModelBase& model) {
+    if (FLAGS_rec_output_file.empty()) return;
+    Timer timer;
+    size_t num_users = train.feature_group_total_dimension(0);
+    size_t topk = FLAGS_rec_topk;
+    CSRIndex exclusions(train.get_feature_pair_label_hashtable(0, 1), num_users);
+    std::vector<size_t> uids(num_users);
+    std::iota(uids.begin(), uids.end(), 0);
+    std::vector<size_t> rec_lists(num_users * topk);
+    model.recommend_batch(uids.data(), num_users, topk, exclusions, rec_lists.data());
+    LOG(INFO) << "Recommended for " << num_users << " users in " << timer;
+
+    File f(FLAGS_rec_output_file, "w");
+    for (size_t uid = 0; uid < num_users; ++uid) {
+      std::stringstream ss;
+      ss << uid;
+      for (size_t idx = 0; idx < topk && rec_lists[uid * topk + idx] != kNoItem; ++idx) {
+        ss << " " << rec_lists[uid * topk + idx];
+      }
+      f.write_line(ss.str());
+    }
+    f.close();
+  };
+
+  if (FLAGS_task == "sweep") {
+    run_sweep(train, test, solver_config, [&](CDAEConfig& config) {
+      config.retrieval = retrieval;
+      config.hnsw = hnsw_config;
+      config.quant = quant_config;
+    });
+    return 0;
+  }
+
   {
     Popularity pop_model;
     Solver<Popularity> solver(pop_model);
@@ -116,6 +425,7 @@ int main(int argc, char* argv[]) {
     ItemCF model(Jaccard, 50);
     Solver<ItemCF> solver(model);
     solver.train(train, test, {TOPN});
+    save_checkpoint(*solver.get_model());
   }
 
 
@@ -137,9 +447,16 @@ int main(int argc, char* argv[]) {
       LOG(FATAL) << "UNKNOWN LOSS";
     }
 
+    config.retrieval = retrieval;
+    config.hnsw = hnsw_config;
+    config.quant = quant_config;
     IMF model(config);
-    Solver<IMF> solver(model, 50);
+    Solver<IMF> solver(model, solver_config);
     solver.train(train, test, {TOPN});
+    train_online(solver, train, test, line_parser);
+    save_ann_index(*solver.get_model());
+    save_checkpoint(*solver.get_model());
+    write_recommendations(*solver.get_model());
   }
 
   if (FLAGS_method == "BPR") {
@@ -159,44 +476,34 @@ int main(int argc, char* argv[]) {
       LOG(FATAL) << "UNKNOWN LOSS";
     }
 
+    config.retrieval = retrieval;
+    config.hnsw = hnsw_config;
+    config.quant = quant_config;
     BPR model(config);
-    Solver<BPR> solver(model, 50);
+    Solver<BPR> solver(model, solver_config);
     solver.train(train, test, {TOPN});
+    train_online(solver, train, test, line_parser);
+    save_ann_index(*solver.get_model());
+    write_recommendations(*solver.get_model());
   }
 
 
   if (FLAGS_method == "CDAE") {
-    CDAEConfig config;
-    config.learn_rate = FLAGS_learn_rate;
-    config.num_dim = FLAGS_num_dim;
-    config.using_adagrad = FLAGS_adagrad;
-    config.asymmetric = FLAGS_asym;
-    config.num_corruptions = FLAGS_cnum;
-    config.corruption_ratio = FLAGS_cratio;
-    config.linear = FLAGS_linear;
-    config.scaled = FLAGS_scaled;
-    config.num_neg = FLAGS_num_neg;
-    config.user_factor = FLAGS_user_factor;
-    config.beta = FLAGS_beta; 
-    config.linear_function = FLAGS_linear_function;
-    config.tanh = FLAGS_tanh;
-    if (FLAGS_loss_type == "SQUARE") {
-      config.lt = SQUARE;
-    } else if (FLAGS_loss_type == "LOG") {
-      config.lt = LOG;
-    } else if (FLAGS_loss_type == "HINGE") {
-      config.lt = HINGE;
-    } else if (FLAGS_loss_type == "LOGISTIC") {
-      config.lt = LOGISTIC;
-    } else if (FLAGS_loss_type == "CE") {
-      config.lt = CROSS_ENTROPY;
-    } else {
-      LOG(FATAL) << "UNKNOWN LOSS";
-    }
+    CDAEConfig config = cdae_config();
+    config.retrieval = retrieval;
+    config.hnsw = hnsw_config;
+    config.quant = quant_config;
     CDAE model(config);
-    Solver<CDAE> solver(model, 50);
+    Solver<CDAE> solver(model, solver_config);
     solver.train(train, test, {TOPN});
+    train_online(solver, train, test, line_parser);
+    save_ann_index(*solver.get_model());
+    save_checkpoint(*solver.get_model());
+    write_recommendations(*solver.get_model());
   }
 
+  if (!FLAGS_trace_file.empty()) {
+    Tracer::instance().write_chrome_json(FLAGS_trace_file);
+  }
   return 0;
 }
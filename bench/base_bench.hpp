@@ -0,0 +1,94 @@
+#include <string>
+#include <vector>
+#include <random>
+
+#include "benchmark.hpp"
+
+#include <base/heap.hpp>
+#include <base/trace.hpp>
+#include <base/io/file.hpp>
+#include <base/io/file_utils.hpp>
+#include <base/io/file_line_reader.hpp>
+
+LIBCF_BENCHMARK(base, heap_push_and_pop) {
+  using namespace libcf;
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<double> dist(0., 1.);
+  std::vector<std::pair<size_t, double>> values(1 << 16);
+  for (size_t idx = 0; idx < values.size(); ++idx) {
+    values[idx] = std::make_pair(idx, dist(rng));
+  }
+  auto comp = [](const std::pair<size_t, double>& a, const std::pair<size_t, double>& b) {
+    return a.second > b.second;
+  };
+
+  // a min heap keeping the topk largest, as in recommend
+  for (size_t topk : {10, 100, 1000}) {
+    runner.run("heap_push_and_pop", "topk=" + std::to_string(topk),
+               [&](size_t tid, size_t num_ops) {
+      Heap<std::pair<size_t, double>> heap(comp, topk);
+      for (size_t idx = 0; idx < topk; ++idx) {
+        heap.push(values[idx]);
+      }
+      for (size_t idx = 0; idx < num_ops; ++idx) {
+        do_not_optimize(heap.push_and_pop(values[(tid * 997 + idx) & (values.size() - 1)]));
+      }
+    });
+  }
+}
+
+LIBCF_BENCHMARK(base, split_line) {
+  using namespace libcf;
+  std::string line("1234567 89012 4.5 1400000000");
+  runner.run("split_line", "fields=4", [&](size_t tid, size_t num_ops) {
+    for (size_t idx = 0; idx < num_ops; ++idx) {
+      do_not_optimize(split_line(line, " ").size());
+    }
+  });
+}
+
+LIBCF_BENCHMARK(base, file_line_reader) {
+  using namespace libcf;
+  const size_t num_lines = 100000;
+  std::string filename("/tmp/libcf_bench_lines.txt");
+  File out(filename, "w");
+  std::mt19937_64 rng(0);
+  for (size_t idx = 0; idx < num_lines; ++idx) {
+    out.write_line(std::to_string(rng() % 1000000) + " " + std::to_string(rng() % 100000)
+                   + " 1 " + std::to_string(1400000000 + idx));
+  }
+  out.close();
+
+  // one op is one line, read and passed to the callback
+  runner.run("file_line_reader", "lines=" + std::to_string(num_lines),
+             [&](size_t tid, size_t num_ops) {
+    for (size_t idx = 0; idx < num_ops; ++idx) {
+      size_t count = 0;
+      FileLineReader reader(filename);
+      reader.set_line_callback([&](const std::string& line, size_t line_num) {
+        count += line.size();
+      });
+      reader.load();
+      do_not_optimize(count);
+    }
+  }, num_lines);
+}
+
+LIBCF_BENCHMARK(base, trace_scope) {
+  using namespace libcf;
+  // one op is one scoped event, recorded or skipped by the runtime switch
+  for (bool enabled : {false, true}) {
+    if (enabled) {
+      Tracer::instance().enable();
+    }
+    runner.run("trace_scope", enabled ? "enabled=1" : "enabled=0",
+               [&](size_t tid, size_t num_ops) {
+      for (size_t idx = 0; idx < num_ops; ++idx) {
+        TraceScope scope("bench.trace_scope");
+        do_not_optimize(idx);
+      }
+    });
+    Tracer::instance().disable();
+  }
+  Tracer::instance().clear();
+}
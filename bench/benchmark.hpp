@@ -0,0 +1,310 @@
+#ifndef _LIBCF_BENCHMARK_HPP_
+#define _LIBCF_BENCHMARK_HPP_
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include <glog/logging.h>
+
+#include <base/data.hpp>
+#include <base/json.hpp>
+#include <base/random.hpp>
+#include <base/synthetic.hpp>
+
+/////////////////////////////////////////////////////////////////
+// Allocation counting for bytes / op, only while a benchmark asks
+// for it, so that the timed runs do not pay for the atomics.
+// malloc itself is wrapped (glibc) since Eigen allocates through it
+// rather than operator new.
+//
+namespace libcf {
+namespace bench {
+static std::atomic<bool> g_count_allocs(false);
+static std::atomic<size_t> g_alloc_bytes(0);
+static std::atomic<size_t> g_alloc_count(0);
+
+inline void count_alloc(size_t size) {
+  if (g_count_allocs.load(std::memory_order_relaxed)) {
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+} // namespace bench
+} // namespace
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+void* malloc(size_t size) {
+  libcf::bench::count_alloc(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) {
+  libcf::bench::count_alloc(num * size);
+  return __libc_calloc(num, size);
+}
+
+void* realloc(void* p, size_t size) {
+  libcf::bench::count_alloc(size);
+  return __libc_realloc(p, size);
+}
+}
+
+namespace libcf {
+
+/** One measurement of a benchmark at one parameter setting
+ */
+struct BenchmarkResult {
+  std::string name;
+  std::string params;         // e.g. "dim=50 items=1000"
+  size_t threads = 1;
+  size_t ops = 0;             // per thread, per repetition
+  double ns_per_op = 0.;      // wall time per op of one thread, median of repetitions
+  double bytes_per_op = 0.;   // heap bytes allocated per op
+  double allocs_per_op = 0.;
+  double efficiency = 1.;     // throughput / (threads * single thread throughput)
+
+  double ops_per_sec() const {
+    return ns_per_op > 0. ? threads * 1e9 / ns_per_op : 0.;
+  }
+
+  void write_json(JsonWriter& json) const {
+    json.add("name", name);
+    json.add("params", params);
+    json.add("threads", threads);
+    json.add("ops", ops);
+    json.add("ns_per_op", ns_per_op);
+    json.add("bytes_per_op", bytes_per_op);
+    json.add("allocs_per_op", allocs_per_op);
+    json.add("ops_per_sec", ops_per_sec());
+    json.add("efficiency", efficiency);
+  }
+};
+
+struct BenchmarkConfig {
+  BenchmarkConfig() = default;
+  double min_time = 0.2;                          // secs per repetition
+  size_t repetitions = 3;
+  std::vector<size_t> threads = {1};
+  std::vector<size_t> dims = {10, 50, 200};
+  std::vector<size_t> items = {1000, 100000};
+  size_t num_users = 2000;
+  size_t items_per_user = 20;
+  std::string filter;                             // run the benchmarks whose name contains it
+};
+
+/**
+ *  Runs a benchmark body over the configured thread counts.
+ *
+ *  A body runs num_ops operations on thread tid; all threads start
+ *  together and ns / op is the wall time divided by the ops of one
+ *  thread, so perfect scaling keeps ns / op flat and the efficiency at 1.
+ *  The op count is calibrated single threaded to last min_time, and
+ *  bytes / op and allocs / op come from a separate single threaded run
+ *  with allocation counting on.
+ *
+ *  Example:
+ *
+ *    runner.run("split_line", "", [&](size_t tid, size_t num_ops) {
+ *      for (size_t idx = 0; idx < num_ops; ++idx) split_line(line);
+ *    });
+ */
+class BenchmarkRunner {
+ public:
+  typedef std::function<void (size_t tid, size_t num_ops)> Body;
+
+  explicit BenchmarkRunner(const BenchmarkConfig& cfg) : cfg_(cfg) {
+    CHECK(!cfg_.threads.empty());
+    CHECK_GT(cfg_.repetitions, 0);
+  }
+
+  const BenchmarkConfig& config() const { return cfg_; }
+
+  size_t max_threads() const {
+    return *std::max_element(cfg_.threads.begin(), cfg_.threads.end());
+  }
+
+  bool enabled(const std::string& name) const {
+    return cfg_.filter.empty() || name.find(cfg_.filter) != std::string::npos;
+  }
+
+  /** Single threaded only, for bodies that are not safe to run concurrently
+   */
+  void run_single(const std::string& name, const std::string& params, const Body& body,
+                  size_t ops_per_call = 1) {
+    run(name, params, body, ops_per_call, {1});
+  }
+
+  void run(const std::string& name, const std::string& params, const Body& body,
+           size_t ops_per_call = 1) {
+    run(name, params, body, ops_per_call, cfg_.threads);
+  }
+
+  const std::vector<BenchmarkResult>& results() const { return results_; }
+
+ private:
+  void run(const std::string& name, const std::string& params, const Body& body,
+           size_t ops_per_call, const std::vector<size_t>& threads) {
+    // warm up and calibrate the op count
+    size_t num_ops = 1;
+    double secs = 0.;
+    while (true) {
+      secs = time_run(body, 1, num_ops);
+      if (secs >= cfg_.min_time || num_ops >= (size_t(1) << 40)) break;
+      if (secs < cfg_.min_time / 100.) {
+        num_ops *= 10;
+      } else {
+        num_ops = static_cast<size_t>(num_ops * cfg_.min_time / secs * 1.1) + 1;
+      }
+    }
+
+    // allocations, counted on a short run
+    size_t alloc_ops = std::max<size_t>(1, num_ops / 10);
+    reset_alloc_counters();
+    bench::g_count_allocs = true;
+    body(0, alloc_ops);
+    bench::g_count_allocs = false;
+    double bytes_per_op = static_cast<double>(bench::g_alloc_bytes) / (alloc_ops * ops_per_call);
+    double allocs_per_op = static_cast<double>(bench::g_alloc_count) / (alloc_ops * ops_per_call);
+
+    // the baseline of the efficiency, replaced by the median if threads has 1
+    double single_ns = secs * 1e9 / (num_ops * ops_per_call);
+    for (size_t num_threads : threads) {
+      std::vector<double> samples;
+      for (size_t rep = 0; rep < cfg_.repetitions; ++rep) {
+        samples.push_back(time_run(body, num_threads, num_ops) * 1e9 / (num_ops * ops_per_call));
+      }
+      std::sort(samples.begin(), samples.end());
+
+      BenchmarkResult result;
+      result.name = name;
+      result.params = params;
+      result.threads = num_threads;
+      result.ops = num_ops * ops_per_call;
+      result.ns_per_op = samples[samples.size() / 2];
+      result.bytes_per_op = bytes_per_op;
+      result.allocs_per_op = allocs_per_op;
+      if (num_threads == 1) {
+        single_ns = result.ns_per_op;
+      }
+      result.efficiency = single_ns / result.ns_per_op;
+      report(result);
+      results_.push_back(result);
+    }
+  }
+
+  static void reset_alloc_counters() {
+    bench::g_alloc_bytes = 0;
+    bench::g_alloc_count = 0;
+  }
+
+  // secs of wall time for num_threads threads running num_ops each
+  static double time_run(const Body& body, size_t num_threads, size_t num_ops) {
+    typedef std::chrono::steady_clock Clock;
+    if (num_threads == 1) {
+      auto start = Clock::now();
+      body(0, num_ops);
+      return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+    for (size_t tid = 0; tid < num_threads; ++tid) {
+      workers.emplace_back([&, tid]() {
+        ++ready;
+        while (!go) {
+          std::this_thread::yield();
+        }
+        body(tid, num_ops);
+      });
+    }
+    while (ready < num_threads) {
+      std::this_thread::yield();
+    }
+    auto start = Clock::now();
+    go = true;
+    for (auto& t : workers) {
+      t.join();
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  static void report(const BenchmarkResult& r) {
+    std::ostringstream oss;
+    oss << std::left << std::setw(32) << r.name << std::setw(24) << r.params
+        << std::right << std::setw(4) << r.threads << " threads"
+        << std::fixed << std::setprecision(1)
+        << std::setw(14) << r.ns_per_op << " ns/op"
+        << std::setw(12) << r.bytes_per_op << " B/op"
+        << std::setw(8) << r.allocs_per_op << " allocs/op"
+        << std::setprecision(2) << std::setw(8) << r.efficiency << " eff";
+    std::cout << oss.str() << std::endl;
+  }
+
+ private:
+  BenchmarkConfig cfg_;
+  std::vector<BenchmarkResult> results_;
+};
+
+/** Keeps the compiler from dropping a computation whose result is unused
+ */
+template <class T>
+inline void do_not_optimize(const T& value) {
+  asm volatile("" : : "m"(value) : "memory");
+}
+
+/** Registry of the benchmark functions, see LIBCF_BENCHMARK
+ */
+typedef std::function<void (BenchmarkRunner&)> BenchmarkFunc;
+
+inline std::vector<std::pair<std::string, BenchmarkFunc>>& benchmark_registry() {
+  static std::vector<std::pair<std::string, BenchmarkFunc>> registry;
+  return registry;
+}
+
+struct BenchmarkRegistrar {
+  BenchmarkRegistrar(const std::string& name, const BenchmarkFunc& func) {
+    benchmark_registry().emplace_back(name, func);
+  }
+};
+
+#define LIBCF_BENCHMARK(group, name) \
+  static void group##_##name##_benchmark(libcf::BenchmarkRunner& runner); \
+  static libcf::BenchmarkRegistrar group##_##name##_registrar( \
+      #group "." #name, group##_##name##_benchmark); \
+  static void group##_##name##_benchmark(libcf::BenchmarkRunner& runner)
+
+/** A RECSYS data set of num_users users rating items_per_user items
+ *  each on average, with Zipf popularity over num_items items
+ */
+inline Data synthetic_data(size_t num_users, size_t num_items, size_t items_per_user,
+                           size_t seed = 20141119) {
+  SyntheticConfig config;
+  config.num_users = num_users;
+  config.num_items = num_items;
+  config.num_interactions = num_users * items_per_user;
+  config.user_exponent = 0.5;
+  config.item_exponent = 0.8;
+  config.max_items_per_user = num_items / 2;
+  config.seed = seed;
+  Data data;
+  SyntheticDataGenerator(config).generate(data);
+  return data;
+}
+
+} // namespace
+
+#endif // _LIBCF_BENCHMARK_HPP_
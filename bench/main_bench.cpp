@@ -0,0 +1,69 @@
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include <base/io/file.hpp>
+
+#include "benchmark.hpp"
+#include "base_bench.hpp"
+#include "model_bench.hpp"
+
+DEFINE_string(filter, "", "Run the benchmarks whose name, e.g. model.recommend, contains it");
+DEFINE_string(threads, "1,2,4,8", "Thread counts of the scaling runs");
+DEFINE_string(dims, "10,50,200", "Latent dimensions of the model benchmarks");
+DEFINE_string(items, "1000,100000", "Item counts of the model benchmarks");
+DEFINE_int32(num_users, 2000, "Num of users of the synthetic data sets");
+DEFINE_int32(items_per_user, 20, "Mean num of items per user of the synthetic data sets");
+DEFINE_double(min_time, 0.2, "Min secs per repetition");
+DEFINE_int32(repetitions, 3, "Repetitions per thread count, the median is reported");
+DEFINE_string(json_output, "", "Append the results as JSON lines to this file");
+
+static std::vector<size_t> parse_sizes(const std::string& str) {
+  std::vector<size_t> rets;
+  for (auto& s : libcf::split_line(str, ",")) {
+    rets.push_back(std::stoul(s));
+  }
+  CHECK(!rets.empty()) << "empty list " << str;
+  return rets;
+}
+
+int main(int argc, char* argv[]) {
+
+  using namespace libcf;
+
+  FLAGS_log_dir = "./log";
+  google::InitGoogleLogging(argv[0]);
+
+  gflags::SetUsageMessage("run_all_benchmarks [--filter=model.recommend] [--threads=1,2,4,8]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  BenchmarkConfig config;
+  config.filter = FLAGS_filter;
+  config.threads = parse_sizes(FLAGS_threads);
+  config.dims = parse_sizes(FLAGS_dims);
+  config.items = parse_sizes(FLAGS_items);
+  config.num_users = FLAGS_num_users;
+  config.items_per_user = FLAGS_items_per_user;
+  config.min_time = FLAGS_min_time;
+  config.repetitions = FLAGS_repetitions;
+
+  BenchmarkRunner runner(config);
+  for (auto& p : benchmark_registry()) {
+    if (runner.enabled(p.first)) {
+      p.second(runner);
+    }
+  }
+
+  if (!FLAGS_json_output.empty()) {
+    File f(FLAGS_json_output, "a");
+    for (auto& result : runner.results()) {
+      JsonWriter json;
+      json.begin_object();
+      result.write_json(json);
+      json.end_object();
+      f.write_line(json.str());
+    }
+    f.close();
+  }
+
+  return 0;
+}
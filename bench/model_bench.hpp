@@ -0,0 +1,208 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "benchmark.hpp"
+
+#include <model/recsys/imf.hpp>
+#include <model/recsys/bpr.hpp>
+#include <model/recsys/cdae.hpp>
+
+// Training kernels run Hogwild style on one shared model, thread tid
+// taking every num_threads-th user as a parallel SGD would, so their
+// efficiency shows the cost of the shared item rows.
+
+namespace {
+
+typedef std::unordered_map<size_t, std::unordered_map<size_t, double>> UserHistories;
+
+std::string dim_items(size_t dim, size_t num_items) {
+  return "dim=" + std::to_string(dim) + " items=" + std::to_string(num_items);
+}
+
+// the (uid, iid) pairs of all histories, in user order
+std::vector<std::pair<size_t, size_t>> user_item_pairs(const UserHistories& histories,
+                                                       size_t num_users) {
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (size_t uid = 0; uid < num_users; ++uid) {
+    auto fit = histories.find(uid);
+    if (fit == histories.end()) continue;
+    for (auto& p : fit->second) {
+      pairs.emplace_back(uid, p.first);
+    }
+  }
+  return pairs;
+}
+
+} // namespace
+
+LIBCF_BENCHMARK(model, imf_train_one_instance) {
+  using namespace libcf;
+  auto& cfg = runner.config();
+  for (size_t num_items : cfg.items) {
+    Data data = synthetic_data(cfg.num_users, num_items, cfg.items_per_user);
+    auto pairs = user_item_pairs(data.get_feature_pair_label_hashtable(0, 1), cfg.num_users);
+    for (size_t dim : cfg.dims) {
+      IMFConfig config;
+      config.num_dim = dim;
+      IMF model(config);
+      model.reset(data);
+      runner.run("imf_train_one_instance", dim_items(dim, num_items),
+                 [&](size_t tid, size_t num_ops) {
+        size_t num_threads = runner.max_threads();
+        for (size_t idx = 0; idx < num_ops; ++idx) {
+          auto& p = pairs[(tid + idx * num_threads) % pairs.size()];
+          model.train_one_instance(p.first, p.second, 1.);
+        }
+      });
+    }
+  }
+}
+
+LIBCF_BENCHMARK(model, bpr_train_one_pair) {
+  using namespace libcf;
+  auto& cfg = runner.config();
+  for (size_t num_items : cfg.items) {
+    Data data = synthetic_data(cfg.num_users, num_items, cfg.items_per_user);
+    const auto histories = data.get_feature_pair_label_hashtable(0, 1);
+    auto pairs = user_item_pairs(histories, cfg.num_users);
+    for (size_t dim : cfg.dims) {
+      BPRConfig config;
+      config.num_dim = dim;
+      BPR model(config);
+      model.reset(data);
+      // negatives sampled up front, sample_negative_item has its own benchmark
+      std::vector<size_t> negatives;
+      for (auto& p : pairs) {
+        negatives.push_back(model.sample_negative_item(histories.at(p.first)));
+      }
+      runner.run("bpr_train_one_pair", dim_items(dim, num_items),
+                 [&](size_t tid, size_t num_ops) {
+        size_t num_threads = runner.max_threads();
+        for (size_t idx = 0; idx < num_ops; ++idx) {
+          size_t pos = (tid + idx * num_threads) % pairs.size();
+          model.train_one_pair(pairs[pos].first, pairs[pos].second, negatives[pos], 1.);
+        }
+      });
+    }
+  }
+}
+
+LIBCF_BENCHMARK(model, cdae_get_hidden_values) {
+  using namespace libcf;
+  auto& cfg = runner.config();
+  for (size_t num_items : cfg.items) {
+    Data data = synthetic_data(cfg.num_users, num_items, cfg.items_per_user);
+    const auto histories = data.get_feature_pair_label_hashtable(0, 1);
+    for (size_t dim : cfg.dims) {
+      CDAEConfig config;
+      config.num_dim = dim;
+      config.lt = SQUARE;
+      CDAE model(config);
+      model.reset(data);
+      runner.run("cdae_get_hidden_values", dim_items(dim, num_items),
+                 [&](size_t tid, size_t num_ops) {
+        size_t num_threads = runner.max_threads();
+        for (size_t idx = 0; idx < num_ops; ++idx) {
+          size_t uid = (tid + idx * num_threads) % cfg.num_users;
+          do_not_optimize(model.get_hidden_values(uid, histories.at(uid))(0));
+        }
+      });
+    }
+  }
+}
+
+LIBCF_BENCHMARK(model, cdae_train_one_user_corruption) {
+  using namespace libcf;
+  auto& cfg = runner.config();
+  for (size_t num_items : cfg.items) {
+    Data data = synthetic_data(cfg.num_users, num_items, cfg.items_per_user);
+    const auto histories = data.get_feature_pair_label_hashtable(0, 1);
+    for (size_t dim : cfg.dims) {
+      CDAEConfig config;
+      config.num_dim = dim;
+      config.lt = SQUARE;
+      CDAE model(config);
+      model.reset(data);
+      // corrupted inputs drawn up front, Random is not thread-safe
+      std::vector<std::unordered_map<size_t, double>> inputs(cfg.num_users);
+      for (size_t uid = 0; uid < cfg.num_users; ++uid) {
+        inputs[uid] = model.get_corrputed_input(histories.at(uid), config.corruption_ratio);
+      }
+      runner.run("cdae_train_one_user_corruption", dim_items(dim, num_items),
+                 [&](size_t tid, size_t num_ops) {
+        size_t num_threads = runner.max_threads();
+        for (size_t idx = 0; idx < num_ops; ++idx) {
+          size_t uid = (tid + idx * num_threads) % cfg.num_users;
+          model.train_one_user_corruption(uid, inputs[uid], histories.at(uid));
+        }
+      });
+    }
+  }
+}
+
+// top-10 of untrained models, so the MIPS pruning is not representative
+// of trained factors; BRUTE scores every item
+LIBCF_BENCHMARK(model, recommend) {
+  using namespace libcf;
+  auto& cfg = runner.config();
+  for (size_t num_items : cfg.items) {
+    Data data = synthetic_data(cfg.num_users, num_items, cfg.items_per_user);
+    const auto histories = data.get_feature_pair_label_hashtable(0, 1);
+    for (size_t dim : cfg.dims) {
+      for (auto retrieval : {BRUTE_FORCE, EXACT_MIPS}) {
+        IMFConfig config;
+        config.num_dim = dim;
+        config.retrieval = retrieval;
+        IMF model(config);
+        model.reset(data);
+        model.pre_recommend();
+        std::string name(retrieval == BRUTE_FORCE ? "imf_recommend_brute" : "imf_recommend_exact");
+        runner.run(name, dim_items(dim, num_items), [&](size_t tid, size_t num_ops) {
+          size_t num_threads = runner.max_threads();
+          for (size_t idx = 0; idx < num_ops; ++idx) {
+            size_t uid = (tid + idx * num_threads) % cfg.num_users;
+            model.recommend(uid, 10, histories.at(uid));
+          }
+        });
+      }
+
+      CDAEConfig config;
+      config.num_dim = dim;
+      config.lt = SQUARE;
+      config.retrieval = BRUTE_FORCE;
+      CDAE model(config);
+      model.reset(data);
+      model.pre_recommend();
+      runner.run("cdae_recommend_brute", dim_items(dim, num_items),
+                 [&](size_t tid, size_t num_ops) {
+        size_t num_threads = runner.max_threads();
+        for (size_t idx = 0; idx < num_ops; ++idx) {
+          size_t uid = (tid + idx * num_threads) % cfg.num_users;
+          model.recommend(uid, 10, histories.at(uid));
+        }
+      });
+    }
+  }
+}
+
+LIBCF_BENCHMARK(model, sample_negative_item) {
+  using namespace libcf;
+  auto& cfg = runner.config();
+  for (size_t num_items : cfg.items) {
+    Data data = synthetic_data(cfg.num_users, num_items, cfg.items_per_user);
+    const auto histories = data.get_feature_pair_label_hashtable(0, 1);
+    IMFConfig config;
+    config.num_dim = 1;
+    IMF model(config);
+    model.reset(data);
+    runner.run("sample_negative_item", "items=" + std::to_string(num_items),
+               [&](size_t tid, size_t num_ops) {
+      size_t num_threads = runner.max_threads();
+      for (size_t idx = 0; idx < num_ops; ++idx) {
+        size_t uid = (tid + idx * num_threads) % cfg.num_users;
+        do_not_optimize(model.sample_negative_item(histories.at(uid)));
+      }
+    });
+  }
+}
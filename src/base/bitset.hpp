@@ -0,0 +1,118 @@
+#ifndef _LIBCF_BITSET_HPP_
+#define _LIBCF_BITSET_HPP_
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace libcf {
+
+/**
+ *  Dense bitset over the ids [0, size)
+ */
+class DenseBitset {
+ public:
+  DenseBitset() = default;
+  explicit DenseBitset(size_t n) { resize(n); }
+
+  /** Resize the bitset, all bits are cleared
+   */
+  void resize(size_t n) {
+    size_ = n;
+    words_.assign((n + 63) / 64, 0);
+  }
+
+  size_t size() const { return size_; }
+
+  bool test(size_t idx) const {
+    DCHECK_LT(idx, size_);
+    return (words_[idx >> 6] >> (idx & 63)) & 1;
+  }
+
+  void set(size_t idx) {
+    DCHECK_LT(idx, size_);
+    words_[idx >> 6] |= (uint64_t(1) << (idx & 63));
+  }
+
+  void reset(size_t idx) {
+    DCHECK_LT(idx, size_);
+    words_[idx >> 6] &= ~(uint64_t(1) << (idx & 63));
+  }
+
+  void clear() {
+    std::fill(words_.begin(), words_.end(), 0);
+  }
+
+  size_t count() const {
+    size_t ret = 0;
+    for (auto& w : words_) {
+      ret += __builtin_popcountll(w);
+    }
+    return ret;
+  }
+
+ private:
+  std::vector<uint64_t> words_;
+  size_t size_ = 0;
+};
+
+inline size_t bitset_key(size_t key) {
+  return key;
+}
+
+template <class V>
+inline size_t bitset_key(const std::pair<const size_t, V>& p) {
+  return p.first;
+}
+
+/**
+ *  Set the keys of a container in a bitset, and clear them again
+ *  on destruction. This keeps a reusable bitset clean in O(|keys|).
+ *  The keys often come from requests, so all of them are checked
+ *  against the size of the bitset before any is set.
+ *
+ *  Example:
+ *
+ *    ScopedBitsetMask<std::unordered_map<size_t, double>> mask(bits, rated_items);
+ *    for (size_t iid = 0; iid < num_items; ++iid) {
+ *      if (mask.test(iid)) continue;
+ *      // ...
+ *    }
+ */
+template <class Container>
+class ScopedBitsetMask {
+ public:
+  ScopedBitsetMask(DenseBitset& bits, const Container& keys)
+      : bits_(bits), keys_(keys) {
+    for (auto& k : keys_) {
+      CHECK_LT(bitset_key(k), bits_.size()) << "Key out of the range of the bitset";
+    }
+    for (auto& k : keys_) {
+      bits_.set(bitset_key(k));
+    }
+  }
+
+  ~ScopedBitsetMask() {
+    for (auto& k : keys_) {
+      bits_.reset(bitset_key(k));
+    }
+  }
+
+  ScopedBitsetMask(const ScopedBitsetMask&) = delete;
+  ScopedBitsetMask& operator=(const ScopedBitsetMask&) = delete;
+
+  bool test(size_t idx) const {
+    return bits_.test(idx);
+  }
+
+ private:
+  DenseBitset& bits_;
+  const Container& keys_;
+};
+
+} // namespace
+
+#endif // _LIBCF_BITSET_HPP_
@@ -0,0 +1,204 @@
+#ifndef _LIBCF_CSR_HPP_
+#define _LIBCF_CSR_HPP_
+
+#include <tuple>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include <glog/logging.h>
+
+namespace libcf {
+
+/**
+ *  Immutable rows of sorted ids stored back to back in compressed sparse
+ *  row layout, e.g. the rated items of every user. Reading a row touches
+ *  one contiguous range and never allocates.
+ *
+ *  Example:
+ *
+ *    CSRIndex rated(user_rated_items, num_users);
+ *    for (auto& iid : rated.row(uid)) {
+ *      // ...
+ *    }
+ */
+class CSRIndex {
+ public:
+  /** A row as a [begin, end) range of ids
+   */
+  struct Row {
+    const size_t* first;
+    const size_t* last;
+    const size_t* begin() const { return first; }
+    const size_t* end() const { return last; }
+    size_t size() const { return last - first; }
+  };
+
+  CSRIndex() : offsets_(1, 0) {}
+
+  /** Row r holds the sorted keys of rows[r], missing rows are empty
+   */
+  template <class V>
+  CSRIndex(const std::unordered_map<size_t, std::unordered_map<size_t, V>>& rows,
+           size_t num_rows) {
+    offsets_.assign(num_rows + 1, 0);
+    for (auto& p : rows) {
+      CHECK_LT(p.first, num_rows);
+      offsets_[p.first + 1] = p.second.size();
+    }
+    for (size_t r = 0; r < num_rows; ++r) {
+      offsets_[r + 1] += offsets_[r];
+    }
+    ids_.resize(offsets_.back());
+    for (auto& p : rows) {
+      size_t* first = &ids_[0] + offsets_[p.first];
+      size_t* last = first;
+      for (auto& kv : p.second) {
+        *last++ = kv.first;
+      }
+      std::sort(first, last);
+    }
+  }
+
+  /** A view of rows stored elsewhere in the same layout, e.g. in a
+   *  mapped checkpoint, which has to outlive the index and its copies
+   */
+  static CSRIndex view(const size_t* offsets, const size_t* ids, size_t num_rows) {
+    CSRIndex rets;
+    rets.offsets_view_ = offsets;
+    rets.ids_view_ = ids;
+    rets.num_rows_ = num_rows;
+    return rets;
+  }
+
+  size_t num_rows() const { return offsets_view_ ? num_rows_ : offsets_.size() - 1; }
+  size_t num_ids() const { return offsets()[num_rows()]; }
+
+  Row row(size_t r) const {
+    const size_t* base = ids();
+    return Row{base + offsets()[r], base + offsets()[r + 1]};
+  }
+
+  size_t row_size(size_t r) const {
+    return offsets()[r + 1] - offsets()[r];
+  }
+
+  /** Whether the offsets start at 0 and never decrease, and every row
+   *  is sorted, without repeats and below id_end, e.g. to check a view
+   *  of a file before using it. num_ids() has to match the ids stored.
+   */
+  bool well_formed(size_t id_end) const {
+    const size_t* offs = offsets();
+    if (offs[0] != 0) return false;
+    for (size_t r = 0; r < num_rows(); ++r) {
+      if (offs[r + 1] < offs[r]) return false;
+      size_t prev = 0;
+      for (size_t pos = offs[r]; pos < offs[r + 1]; ++pos) {
+        size_t id = ids()[pos];
+        if (id >= id_end || (pos > offs[r] && id <= prev)) return false;
+        prev = id;
+      }
+    }
+    return true;
+  }
+
+  /** Version of the histories the index was built from, 0 if unknown,
+   *  see RecsysModelBase::history_index
+   */
+  uint64_t version() const { return version_; }
+  void set_version(uint64_t version) { version_ = version; }
+
+ private:
+  const size_t* offsets() const { return offsets_view_ ? offsets_view_ : offsets_.data(); }
+  const size_t* ids() const { return offsets_view_ ? ids_view_ : ids_.data(); }
+
+ private:
+  std::vector<size_t> offsets_;
+  std::vector<size_t> ids_;
+  // set by view in place of the vectors
+  const size_t* offsets_view_ = nullptr;
+  const size_t* ids_view_ = nullptr;
+  size_t num_rows_ = 0;
+  uint64_t version_ = 0;
+};
+
+/**
+ *  Immutable sparse rows of (id, value) pairs in compressed sparse row
+ *  layout, sorted by id, e.g. the ratings of every user or, transposed,
+ *  of every item. Ids and values are stored apart so that a row can be
+ *  gathered or scaled without striding over the other.
+ *
+ *  Example:
+ *
+ *    CSRMatrix item_ratings(user_rated_items, num_items, true);
+ *    const size_t* uids = item_ratings.ids(iid);
+ *    const double* ratings = item_ratings.values(iid);
+ *    for (size_t pos = 0; pos < item_ratings.row_size(iid); ++pos) {
+ *      // ...
+ *    }
+ */
+class CSRMatrix {
+ public:
+  CSRMatrix() : offsets_(1, 0) {}
+
+  /** Row r holds rows[r]; with transpose, row c holds the (r, v) of
+   *  every rows[r][c] = v. Missing rows are empty.
+   */
+  template <class V>
+  CSRMatrix(const std::unordered_map<size_t, std::unordered_map<size_t, V>>& rows,
+            size_t num_rows, bool transpose = false) {
+    std::vector<std::tuple<size_t, size_t, double>> entries;
+    for (auto& p : rows) {
+      for (auto& kv : p.second) {
+        if (transpose) {
+          entries.emplace_back(kv.first, p.first, static_cast<double>(kv.second));
+        } else {
+          entries.emplace_back(p.first, kv.first, static_cast<double>(kv.second));
+        }
+      }
+    }
+    std::sort(entries.begin(), entries.end());
+    offsets_.assign(num_rows + 1, 0);
+    ids_.resize(entries.size());
+    values_.resize(entries.size());
+    for (size_t pos = 0; pos < entries.size(); ++pos) {
+      size_t r = std::get<0>(entries[pos]);
+      CHECK_LT(r, num_rows);
+      ++offsets_[r + 1];
+      ids_[pos] = std::get<1>(entries[pos]);
+      values_[pos] = std::get<2>(entries[pos]);
+    }
+    for (size_t r = 0; r < num_rows; ++r) {
+      offsets_[r + 1] += offsets_[r];
+    }
+  }
+
+  size_t num_rows() const { return offsets_.size() - 1; }
+  size_t num_entries() const { return ids_.size(); }
+
+  size_t row_size(size_t r) const {
+    return offsets_[r + 1] - offsets_[r];
+  }
+
+  const size_t* ids(size_t r) const {
+    return ids_.data() + offsets_[r];
+  }
+
+  const double* values(size_t r) const {
+    return values_.data() + offsets_[r];
+  }
+
+  const std::vector<size_t>& offsets() const { return offsets_; }
+  const std::vector<size_t>& ids() const { return ids_; }
+  const std::vector<double>& values() const { return values_; }
+
+ private:
+  std::vector<size_t> offsets_;
+  std::vector<size_t> ids_;
+  std::vector<double> values_;
+};
+
+} // namespace
+
+#endif // _LIBCF_CSR_HPP_
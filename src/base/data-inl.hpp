@@ -7,6 +7,7 @@
 #include <base/timer.hpp>
 #include <base/utils.hpp>
 #include <base/random.hpp>
+#include <base/trace.hpp>
 
 namespace libcf {
 
@@ -14,6 +15,7 @@ void Data::load(const std::string& filename,
                 const DataFormat& df, 
                 const LineParser& parser,
                 bool skip_header) {
+  LIBCF_TRACE_SCOPE("data.load");
   if (data_info_ == nullptr) {
     data_info_ = std::make_shared<DataInfo>(new DataInfo());
   }
@@ -67,13 +69,8 @@ void Data::load(const std::string& filename,
     }
   }
 
-  data_info_->total_dimensions_ = 0;
-  data_info_->feature_group_global_idx_.assign(num_feature_groups(), 0);
-  size_t idx = 0;
-  for (auto& fg_info : data_info_->feature_group_infos_) {
-    data_info_->feature_group_global_idx_[idx++] = data_info_->total_dimensions_;
-    data_info_->total_dimensions_ += fg_info.size();
-  }
+  reset_interaction_table();
+  data_info_->update_dimensions();
   LOG(INFO) << "Data loaded successfully.\n";
   LOG(INFO) << *this;
 
@@ -95,6 +92,12 @@ std::ostream& operator<< (std::ostream& stream, const Data& data) {
   for (auto& fg_info : data.data_info_->feature_group_infos_) {
     stream << "\tFeature group " << idx++ << " -> " << fg_info << std::endl;
   }
+  stream << "\tMemory: ";
+  MemoryReport memory = data.memory_usage();
+  for (auto& entry : memory.entries()) {
+    stream << "{" << entry.first << ": " << format_bytes(entry.second) << "} ";
+  }
+  stream << std::endl;
   stream << "Head of the data set:\n"; 
   size_t num_lines = std::min(size_t{10}, data.instances_.size());
   for (size_t line_idx = 0; line_idx < num_lines; ++line_idx) {
@@ -200,10 +203,12 @@ Data::instance_iterator Data::end(const Instance& ins) const {
 
 void Data::shuffle_data() {
   Random::shuffle(std::begin(instances_), std::end(instances_));
+  reset_interaction_table();
 }
 
 
 void Data::random_split(Data& train, Data& test, double test_ratio) const {
+  LIBCF_TRACE_SCOPE("data.random_split");
 
   CHECK_LT(test_ratio, 1.0);
   // shuffle_data();
@@ -230,6 +235,7 @@ void Data::random_split(Data& train, Data& test, double test_ratio) const {
 
 void Data::random_split_by_feature_group(Data& train, Data& test,
                                          size_t feature_group_idx, double test_ratio) const {
+  LIBCF_TRACE_SCOPE("data.random_split_by_feature_group");
 
   Timer timer;
 
@@ -273,6 +279,7 @@ void Data::random_split_by_feature_group(Data& train, Data& test,
 
 void Data::inplace_random_split_by_feature_group(Data& train, Data& test,
                                          size_t feature_group_idx, double test_ratio)  {
+  LIBCF_TRACE_SCOPE("data.inplace_random_split_by_feature_group");
 
   Timer timer;
 
@@ -307,6 +314,7 @@ void Data::inplace_random_split_by_feature_group(Data& train, Data& test,
   Random::shuffle(std::begin(train_ins_vec), std::end(train_ins_vec));
   Random::shuffle(std::begin(test_ins_vec), std::end(test_ins_vec));
 
+  reset_interaction_table();
   train = Data(std::move(train_ins_vec), data_info_);
   test = Data(std::move(test_ins_vec), data_info_);
 
@@ -317,6 +325,7 @@ void Data::inplace_random_split_by_feature_group(Data& train, Data& test,
 
 std::unordered_map<size_t, std::vector<size_t>> 
 Data::get_feature_ins_idx_hashtable(size_t feature_group_idx) const {
+  LIBCF_TRACE_SCOPE("data.feature_ins_idx_hashtable");
 
   CHECK_LT(feature_group_idx, num_feature_groups());
   std::vector<std::pair<size_t, size_t>> fg_idx_ins_id_pair_vec;
@@ -375,6 +384,7 @@ Data::get_feature_ins_idx_hashtable(size_t feature_group_idx) const {
 std::unordered_map<size_t, std::vector<size_t>> 
 Data::get_feature_to_vec_hashtable(size_t feature_group_idx_a, 
                                  size_t feature_group_idx_b) const {
+  LIBCF_TRACE_SCOPE("data.feature_to_vec_hashtable");
   auto rets = get_feature_ins_idx_hashtable(feature_group_idx_a);
   std::vector<size_t> tmp_vec;
   for (auto outer_iter = rets.begin(); outer_iter != rets.end(); ++outer_iter) {
@@ -392,6 +402,7 @@ Data::get_feature_to_vec_hashtable(size_t feature_group_idx_a,
 std::unordered_map<size_t, std::unordered_set<size_t>> 
 Data::get_feature_to_set_hashtable(size_t feature_group_idx_a, 
                                  size_t feature_group_idx_b) const {
+  LIBCF_TRACE_SCOPE("data.feature_to_set_hashtable");
   std::unordered_map<size_t, std::unordered_set<size_t>> rets;
   std::unordered_set<size_t> tmp_set;
   
@@ -410,9 +421,44 @@ Data::get_feature_to_set_hashtable(size_t feature_group_idx_a,
   return std::move(rets);
 }
 
+MemoryReport Data::memory_usage() const {
+  size_t instance_bytes = heap_bytes(instances_.capacity() * sizeof(Instance));
+  for (auto& ins : instances_) {
+    instance_bytes += ins.owned_bytes();
+  }
+  size_t dictionary_bytes = 0;
+  if (data_info_ != nullptr) {
+    for (auto& fg_info : data_info_->feature_group_infos_) {
+      dictionary_bytes += fg_info.memory_bytes();
+    }
+  }
+  MemoryReport rets;
+  rets.add("data.instances", instance_bytes);
+  rets.add("data.dictionaries", dictionary_bytes);
+  return rets;
+}
+
+MemoryReport Data::projected_memory(size_t num_instances,
+                                    size_t num_users, size_t num_items) {
+  // two SPARSE_BINARY groups of one id each, see load
+  size_t instance_bytes = heap_bytes(2 * sizeof(FeatureGroup)) + 2 * heap_bytes(sizeof(size_t));
+  // ids of up to 15 chars are stored inline
+  size_t dictionary_bytes = 0;
+  for (size_t n : {num_users, num_items}) {
+    dictionary_bytes += projected_hashtable_bytes<std::string, size_t>(n)
+        + heap_bytes(n * sizeof(std::string));
+  }
+  MemoryReport rets;
+  rets.add("data.instances", heap_bytes(num_instances * sizeof(Instance))
+           + num_instances * instance_bytes);
+  rets.add("data.dictionaries", dictionary_bytes);
+  return rets;
+}
+
 std::unordered_map<size_t, std::unordered_map<size_t, double>> 
 Data::get_feature_pair_label_hashtable(size_t feature_group_idx_a, 
                                  size_t feature_group_idx_b) const {
+  LIBCF_TRACE_SCOPE("data.feature_pair_label_hashtable");
   auto feat_ins_hashtable = get_feature_ins_idx_hashtable(feature_group_idx_a);
   std::unordered_map<size_t, std::unordered_map<size_t, double>> rets; 
   rets.reserve(feat_ins_hashtable.size());
@@ -428,5 +474,15 @@ Data::get_feature_pair_label_hashtable(size_t feature_group_idx_a,
   return std::move(rets);
 }
 
+std::shared_ptr<const InteractionTable> Data::interaction_table() const {
+  std::shared_ptr<TableCache> cache = table_cache_;
+  std::call_once(cache->once, [&]() {
+    LIBCF_TRACE_SCOPE("data.interaction_table");
+    cache->table = std::make_shared<const InteractionTable>(
+        get_feature_pair_label_hashtable(0, 1));
+  });
+  return cache->table;
+}
+
 } // namesapce 
 
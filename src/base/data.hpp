@@ -1,6 +1,8 @@
 #ifndef _LIBCF_DATA_HPP_
 #define _LIBCF_DATA_HPP_
 
+#include <mutex>
+#include <memory>
 #include <functional>
 #include <unordered_map>
 #include <unordered_set>
@@ -9,6 +11,7 @@
 
 #include <base/mat.hpp>
 #include <base/instance.hpp>
+#include <base/memory.hpp>
 
 namespace libcf {
 
@@ -40,6 +43,36 @@ class DataInfo {
   
   DataInfo(DataInfo* oth) : DataInfo(*oth) {}
 
+  /** Lay the feature groups out back to back in the global index space
+   */
+  void update_dimensions() {
+    total_dimensions_ = 0;
+    feature_group_global_idx_.assign(feature_group_infos_.size(), 0);
+    size_t idx = 0;
+    for (auto& fg_info : feature_group_infos_) {
+      feature_group_global_idx_[idx++] = total_dimensions_;
+      total_dimensions_ += fg_info.size();
+    }
+  }
+
+  /** Index of key in feature group fg_idx, added if it is new; the
+   *  groups after it then shift by one in the global index space.
+   */
+  size_t add_feature(size_t fg_idx, const std::string& key) {
+    CHECK_LT(fg_idx, feature_group_infos_.size());
+    CHECK_EQ(feature_group_global_idx_.size(), feature_group_infos_.size());
+    auto& fg_info = feature_group_infos_[fg_idx];
+    size_t old_size = fg_info.size();
+    size_t idx = fg_info.get_index(key);
+    if (fg_info.size() > old_size) {
+      ++total_dimensions_;
+      for (size_t next = fg_idx + 1; next < feature_group_global_idx_.size(); ++next) {
+        ++feature_group_global_idx_[next];
+      }
+    }
+    return idx;
+  }
+
   std::vector<FeatureGroupInfo> feature_group_infos_;
   size_t total_dimensions_ = 0;
   std::vector<size_t> feature_group_global_idx_;
@@ -47,12 +80,17 @@ class DataInfo {
   enum LabelType label_type_ = CONTINUOUS;
 };
 
+/** Label of each (user, item) pair by user, see Data::interaction_table
+ */
+typedef std::unordered_map<size_t, std::unordered_map<size_t, double>> InteractionTable;
+
 class Data {
   
   friend class boost::serialization::access;
   template<class Archive>
       void serialize(Archive& ar, const unsigned int version) {
         ar & instances_;
+        reset_interaction_table();
         if (data_info_ == nullptr) {
           data_info_ = std::make_shared<DataInfo>(new DataInfo());
         }
@@ -98,6 +136,7 @@ class Data {
                                 const Func& f) {
         Instance ins = f(line);
         instances_.push_back(std::move(ins));
+        reset_interaction_table();
       }
 
   size_t size() const { return instances_.size(); }
@@ -174,10 +213,41 @@ class Data {
       get_feature_pair_label_hashtable(size_t feature_group_idx_a, 
                                        size_t feature_group_idx_b) const;
 
+  /** get_feature_pair_label_hashtable(0, 1), built on the first call and
+   *  then shared by every reader and every copy of this data set, e.g. by
+   *  the models and evaluations of a parameter sweep. Thread safe. Changes
+   *  made through the mutable iterators afterwards are not reflected.
+   */
+  std::shared_ptr<const InteractionTable> interaction_table() const;
+
+  /** Bytes of the instances and of the feature dictionaries, which
+   *  are shared with the data sets split from this one
+   */
+  MemoryReport memory_usage() const;
+
+  /** Projected memory_usage of a RECSYS data set of user item pairs
+   */
+  static MemoryReport projected_memory(size_t num_instances,
+                                       size_t num_users, size_t num_items);
+
+
+ private:
+  void reset_interaction_table() {
+    if (table_cache_->table) {
+      table_cache_ = std::make_shared<TableCache>();
+    }
+  }
+
+  struct TableCache {
+    std::once_flag once;
+    std::shared_ptr<const InteractionTable> table;
+  };
 
  private:
   std::vector<Instance> instances_;
   std::shared_ptr<DataInfo> data_info_ = nullptr;
+  // shared by the copies, replaced when the instances change
+  std::shared_ptr<TableCache> table_cache_ = std::make_shared<TableCache>();
 };
 
 } // namespace
@@ -11,6 +11,7 @@
 
 #include <base/io.hpp>
 #include <base/utils.hpp>
+#include <base/memory.hpp>
 
 namespace libcf {
 
@@ -79,10 +80,26 @@ class FeatureGroupInfo {
 
   size_t size() const;
 
+  /** Raw string of a sparse feature index, the inverse of get_index
+   */
+  const std::string& raw_str(size_t idx) const { return raw_str_map_[idx]; }
+
+  /** Raw strings of all sparse feature indexes, in index order
+   */
+  const std::vector<std::string>& raw_strs() const { return raw_str_map_; }
+
   void set_length(size_t length) { length_ = length; }
 
+  size_t length() const { return length_; }
+
   FeatureType feature_type() const { return feat_type_; }
 
+  /** Bytes of the dictionary, i.e. the index map and the raw strings
+   */
+  size_t memory_bytes() const {
+    return sizeof(*this) + owned_bytes(idx_map_) + owned_bytes(raw_str_map_);
+  }
+
  private:
 
   std::unordered_map<std::string, size_t> idx_map_;
@@ -119,6 +136,11 @@ class FeatureGroup {
   size_t index(size_t idx) const;
   double value(size_t idx) const;
 
+  size_t owned_bytes() const {
+    return heap_bytes(feat_ids.capacity() * sizeof(size_t))
+        + heap_bytes(feat_vals.capacity() * sizeof(double));
+  }
+
  private:
   FeatureType ft_;
   std::vector<size_t> feat_ids;
@@ -216,6 +238,16 @@ class Instance {
     return feat_groups_[fg_idx].value(idx);
   }
 
+  /** Heap bytes of the feature groups, beyond sizeof(Instance)
+   */
+  size_t owned_bytes() const {
+    size_t rets = heap_bytes(feat_groups_.capacity() * sizeof(FeatureGroup));
+    for (auto& fg : feat_groups_) {
+      rets += fg.owned_bytes();
+    }
+    return rets;
+  }
+
  private:
 
   std::vector<FeatureGroup> feat_groups_;
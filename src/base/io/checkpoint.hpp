@@ -0,0 +1,524 @@
+#ifndef _LIBCF_CHECKPOINT_HPP_
+#define _LIBCF_CHECKPOINT_HPP_
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <glog/logging.h>
+
+#include <base/mat.hpp>
+#include <base/timer.hpp>
+#include <base/instance.hpp>
+#include <base/io/file.hpp>
+
+namespace libcf {
+
+/**
+ *  Versioned binary checkpoint made of named raw sections:
+ *
+ *    header   magic "LIBCFCKP", version, num of sections, table offset
+ *    table    one CheckpointSection per section
+ *    data     the sections, each aligned to 64 bytes
+ *
+ *  Matrices are stored row-major as doubles, so a reader can use them
+ *  in place (Eigen::Map) from a read-only mmap of the file, without
+ *  parsing. Dictionaries (FeatureGroupInfo) are stored as their raw
+ *  strings in index order plus the permutation sorting them, so
+ *  lookups on a mapped checkpoint are binary searches and opening one
+ *  costs the same for any catalog size.
+ *
+ *  Example:
+ *
+ *    CheckpointWriter writer;
+ *    writer.add("W", W);
+ *    writer.add_dictionary("items", item_info);
+ *    writer.save("model.ckpt");
+ *
+ *    Checkpoint ckpt("model.ckpt");
+ *    DMatrixView W = ckpt.matrix("W");  // in place, DMatrix to copy
+ *    size_t iid = ckpt.dictionary("items").find("item_42");
+ */
+
+const uint64_t kCheckpointVersion = 1;
+const size_t kCheckpointAlignment = 64;
+
+enum CheckpointSectionType {
+  CKPT_DOUBLE = 1,
+  CKPT_UINT64 = 2,
+  CKPT_BYTES = 3
+};
+
+struct CheckpointHeader {
+  char magic[8];
+  uint64_t version;
+  uint64_t num_sections;
+  uint64_t table_offset;
+  uint64_t reserved[4];
+};
+
+struct CheckpointSection {
+  char name[56];    // null terminated
+  uint32_t type;    // CheckpointSectionType
+  uint32_t reserved;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t offset;  // from the start of the file
+  uint64_t bytes;
+};
+
+static_assert(sizeof(CheckpointHeader) == 64, "unexpected checkpoint header layout");
+static_assert(sizeof(CheckpointSection) == 96, "unexpected checkpoint section layout");
+static_assert(sizeof(size_t) == sizeof(uint64_t), "checkpoints assume 64 bit size_t");
+
+inline uint64_t checkpoint_align(uint64_t offset) {
+  return (offset + kCheckpointAlignment - 1) / kCheckpointAlignment * kCheckpointAlignment;
+}
+
+/** Collects sections and writes them to a checkpoint file.
+ *  Matrices and vectors are added by reference and must outlive save.
+ */
+class CheckpointWriter {
+ public:
+  void add(const std::string& name, const DMatrix& m) {
+    add_section(name, CKPT_DOUBLE, m.rows(), m.cols(), m.data(), m.size() * sizeof(double));
+  }
+
+  void add(const std::string& name, const DVector& v) {
+    add_section(name, CKPT_DOUBLE, v.size(), 1, v.data(), v.size() * sizeof(double));
+  }
+
+  void add(const std::string& name, const DMatrixView& m) {
+    add_section(name, CKPT_DOUBLE, m.rows(), m.cols(), m.data(), m.size() * sizeof(double));
+  }
+
+  void add(const std::string& name, const DVectorView& v) {
+    add_section(name, CKPT_DOUBLE, v.size(), 1, v.data(), v.size() * sizeof(double));
+  }
+
+  void add(const std::string& name, const std::vector<double>& v) {
+    add_section(name, CKPT_DOUBLE, v.size(), 1, v.data(), v.size() * sizeof(double));
+  }
+
+  void add(const std::string& name, const std::vector<uint64_t>& v) {
+    add_section(name, CKPT_UINT64, v.size(), 1, v.data(), v.size() * sizeof(uint64_t));
+  }
+
+  /** Temporaries are moved into the writer, e.g. shapes and CSR arrays
+   */
+  void add(const std::string& name, std::vector<uint64_t>&& v) {
+    owned_ids_.push_back(std::move(v));
+    add(name, owned_ids_.back());
+  }
+
+  void add(const std::string& name, std::vector<double>&& v) {
+    owned_values_.push_back(std::move(v));
+    add(name, owned_values_.back());
+  }
+
+  void add(const std::string& name, const std::string& bytes) {
+    owned_bytes_.push_back(bytes);
+    auto& s = owned_bytes_.back();
+    add_section(name, CKPT_BYTES, s.size(), 1, s.data(), s.size());
+  }
+
+  /** Sections name.meta, name.offsets, name.chars and name.sorted,
+   *  read back with Checkpoint::dictionary
+   */
+  void add_dictionary(const std::string& name, const FeatureGroupInfo& fg_info) {
+    auto& strs = fg_info.raw_strs();
+    std::vector<uint64_t> offsets(strs.size() + 1, 0);
+    std::string chars;
+    for (size_t idx = 0; idx < strs.size(); ++idx) {
+      chars += strs[idx];
+      offsets[idx + 1] = chars.size();
+    }
+    std::vector<uint64_t> sorted(strs.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [&](uint64_t a, uint64_t b) {
+              return strs[a] < strs[b];
+              });
+    add(name + ".meta", std::vector<uint64_t>{
+        static_cast<uint64_t>(fg_info.feature_type()), fg_info.length(), strs.size()});
+    add(name + ".offsets", std::move(offsets));
+    add(name + ".chars", chars);
+    add(name + ".sorted", std::move(sorted));
+  }
+
+  /** Write to filename.tmp and rename, so readers never see a partial file
+   */
+  void save(const std::string& filename) const {
+    Timer timer;
+    std::vector<CheckpointSection> table(sections_.size());
+    uint64_t offset = checkpoint_align(sizeof(CheckpointHeader)
+                                       + table.size() * sizeof(CheckpointSection));
+    for (size_t idx = 0; idx < sections_.size(); ++idx) {
+      table[idx] = sections_[idx].section;
+      table[idx].offset = offset;
+      offset = checkpoint_align(offset + table[idx].bytes);
+    }
+
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "LIBCFCKP", 8);
+    header.version = kCheckpointVersion;
+    header.num_sections = table.size();
+    header.table_offset = sizeof(CheckpointHeader);
+
+    std::string tmp_filename = filename + ".tmp";
+    {
+      File f(tmp_filename, "wb");
+      static const char zeros[kCheckpointAlignment] = {0};
+      f.write(&header);
+      f.write(table.data(), table.size());
+      uint64_t pos = sizeof(CheckpointHeader) + table.size() * sizeof(CheckpointSection);
+      for (size_t idx = 0; idx < table.size(); ++idx) {
+        f.write(zeros, table[idx].offset - pos);
+        f.write(static_cast<const char*>(sections_[idx].data), table[idx].bytes);
+        pos = table[idx].offset + table[idx].bytes;
+      }
+      CHECK(f.ok()) << "Failed to write checkpoint " << tmp_filename;
+      f.close();
+    }
+    CHECK_EQ(std::rename(tmp_filename.c_str(), filename.c_str()), 0)
+        << "Failed to rename " << tmp_filename << " to " << filename;
+    LOG(INFO) << "Save checkpoint with " << table.size() << " sections to "
+        << filename << " in " << timer;
+  }
+
+ private:
+  struct PendingSection {
+    CheckpointSection section;
+    const void* data;
+  };
+
+  void add_section(const std::string& name, CheckpointSectionType type,
+                   uint64_t rows, uint64_t cols, const void* data, uint64_t bytes) {
+    CHECK_LT(name.size(), sizeof(CheckpointSection::name)) << "Section name too long: " << name;
+    for (auto& s : sections_) {
+      CHECK_NE(name, s.section.name) << "Duplicate checkpoint section " << name;
+    }
+    PendingSection s;
+    std::memset(&s.section, 0, sizeof(s.section));
+    std::memcpy(s.section.name, name.c_str(), name.size());
+    s.section.type = type;
+    s.section.rows = rows;
+    s.section.cols = cols;
+    s.section.bytes = bytes;
+    s.data = data;
+    sections_.push_back(s);
+  }
+
+ private:
+  std::vector<PendingSection> sections_;
+  std::list<std::vector<uint64_t>> owned_ids_;
+  std::list<std::vector<double>> owned_values_;
+  std::list<std::string> owned_bytes_;
+};
+
+class MappedDictionary;
+
+/** Read-only view of a checkpoint file, memory mapped by default.
+ *  Views returned by matrix / array / dictionary are valid as long as
+ *  the Checkpoint is alive.
+ */
+class Checkpoint {
+ public:
+  /** A section as a [begin, end) range of T
+   */
+  template <class T>
+  struct Array {
+    const T* first;
+    const T* last;
+    const T* begin() const { return first; }
+    const T* end() const { return last; }
+    size_t size() const { return last - first; }
+    const T& operator[](size_t idx) const { return first[idx]; }
+  };
+
+  explicit Checkpoint(const std::string& filename, bool use_mmap = true) {
+    std::string error;
+    CHECK(open_file(filename, use_mmap, &error)) << error;
+  }
+
+  /** As the constructor, but returns null and sets error if filename
+   *  cannot be read or is not a valid checkpoint, e.g. to reload a
+   *  served model from a file that may be corrupt or half copied
+   */
+  static std::shared_ptr<const Checkpoint> open(const std::string& filename, std::string* error,
+                                                bool use_mmap = true) {
+    std::shared_ptr<Checkpoint> rets(new Checkpoint());
+    if (!rets->open_file(filename, use_mmap, error)) return nullptr;
+    return rets;
+  }
+
+  ~Checkpoint() {
+    if (mapped_) {
+      ::munmap(const_cast<char*>(base_), size_);
+    }
+  }
+
+  Checkpoint(const Checkpoint&) = delete;
+  Checkpoint& operator=(const Checkpoint&) = delete;
+
+  bool has(const std::string& name) const {
+    return sections_.count(name) > 0;
+  }
+
+  /** Whether section name exists with type, and with rows x cols
+   */
+  bool has(const std::string& name, CheckpointSectionType type) const {
+    auto fit = sections_.find(name);
+    return fit != sections_.end() && fit->second->type == type;
+  }
+
+  bool has(const std::string& name, CheckpointSectionType type,
+           uint64_t rows, uint64_t cols) const {
+    return has(name, type) && section(name).rows == rows && section(name).cols == cols;
+  }
+
+  const CheckpointSection& section(const std::string& name) const {
+    auto fit = sections_.find(name);
+    CHECK(fit != sections_.end()) << "No checkpoint section " << name;
+    return *fit->second;
+  }
+
+  /** Raw bytes of a section, in place
+   */
+  const char* section_data(const std::string& name) const {
+    return base_ + section(name).offset;
+  }
+
+  Eigen::Map<const DMatrix> matrix(const std::string& name) const {
+    auto& s = typed_section(name, CKPT_DOUBLE);
+    return Eigen::Map<const DMatrix>(reinterpret_cast<const double*>(base_ + s.offset),
+                                     s.rows, s.cols);
+  }
+
+  Eigen::Map<const DVector> vector(const std::string& name) const {
+    auto& s = typed_section(name, CKPT_DOUBLE);
+    CHECK_EQ(s.cols, 1) << "Checkpoint section " << name << " is not a vector";
+    return Eigen::Map<const DVector>(reinterpret_cast<const double*>(base_ + s.offset), s.rows);
+  }
+
+  template <class T>
+  Array<T> array(const std::string& name) const {
+    static_assert(std::is_same<T, uint64_t>::value || std::is_same<T, double>::value,
+                  "checkpoint arrays hold uint64_t or double");
+    auto& s = typed_section(name, std::is_same<T, double>::value ? CKPT_DOUBLE : CKPT_UINT64);
+    const T* first = reinterpret_cast<const T*>(base_ + s.offset);
+    return Array<T>{first, first + s.rows * s.cols};
+  }
+
+  std::string bytes(const std::string& name) const {
+    auto& s = typed_section(name, CKPT_BYTES);
+    return std::string(base_ + s.offset, s.bytes);
+  }
+
+  MappedDictionary dictionary(const std::string& name) const;
+
+  size_t size() const { return size_; }
+  bool mapped() const { return mapped_; }
+
+ private:
+  Checkpoint() = default;
+
+  bool open_file(const std::string& filename, bool use_mmap, std::string* error) {
+    Timer timer;
+    auto fail = [&](const std::string& what) {
+      if (error) *error = what + " " + filename;
+      return false;
+    };
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return fail("Failed to open checkpoint");
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      return fail("Failed to stat checkpoint");
+    }
+    size_ = st.st_size;
+    if (size_ < sizeof(CheckpointHeader)) {
+      ::close(fd);
+      return fail("Truncated checkpoint");
+    }
+    if (use_mmap) {
+      void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (addr == MAP_FAILED) return fail("Failed to mmap checkpoint");
+      base_ = static_cast<const char*>(addr);
+      mapped_ = true;
+    } else {
+      // doubles keep the buffer 8 byte aligned
+      buffer_.resize((size_ + sizeof(double) - 1) / sizeof(double));
+      char* p = reinterpret_cast<char*>(buffer_.data());
+      size_t done = 0;
+      while (done < size_) {
+        ssize_t ret = ::read(fd, p + done, size_ - done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) break;
+        done += ret;
+      }
+      ::close(fd);
+      if (done < size_) return fail("Failed to read checkpoint");
+      base_ = p;
+    }
+
+    const CheckpointHeader* header = reinterpret_cast<const CheckpointHeader*>(base_);
+    if (std::memcmp(header->magic, "LIBCFCKP", 8) != 0) return fail("Not a checkpoint:");
+    if (header->version != kCheckpointVersion) return fail("Unknown checkpoint version of");
+    // compared without sums that could wrap around
+    if (header->table_offset > size_ || header->num_sections
+        > (size_ - header->table_offset) / sizeof(CheckpointSection)) {
+      return fail("Truncated checkpoint");
+    }
+    if (header->table_offset % alignof(CheckpointSection) != 0) return fail("Corrupted checkpoint");
+    const CheckpointSection* table =
+        reinterpret_cast<const CheckpointSection*>(base_ + header->table_offset);
+    for (size_t idx = 0; idx < header->num_sections; ++idx) {
+      auto& s = table[idx];
+      if (s.name[sizeof(s.name) - 1] != '\0') return fail("Corrupted checkpoint");
+      if (s.offset > size_ || s.bytes > size_ - s.offset) return fail("Truncated checkpoint");
+      if (s.offset % kCheckpointAlignment != 0) return fail("Corrupted checkpoint");
+      // matrix, vector and array map rows * cols elements
+      uint64_t width = element_size(s.type);
+      bool fits = width > 0 && (s.cols == 0 ? s.bytes == 0
+          : s.rows <= s.bytes / width / s.cols && s.rows * s.cols * width == s.bytes);
+      if (!fits) return fail("Corrupted checkpoint section " + std::string(s.name) + " of");
+      sections_[s.name] = &s;
+    }
+    LOG(INFO) << "Open checkpoint " << filename << " (" << size_ << " bytes, "
+        << sections_.size() << " sections) in " << timer;
+    return true;
+  }
+
+  // bytes per element of a section type, 0 for an unknown one
+  static uint64_t element_size(uint64_t type) {
+    switch (type) {
+      case CKPT_DOUBLE: return sizeof(double);
+      case CKPT_UINT64: return sizeof(uint64_t);
+      case CKPT_BYTES: return 1;
+      default: return 0;
+    }
+  }
+
+  const CheckpointSection& typed_section(const std::string& name,
+                                         CheckpointSectionType type) const {
+    auto& s = section(name);
+    CHECK_EQ(s.type, type) << "Checkpoint section " << name << " has type " << s.type;
+    return s;
+  }
+
+ private:
+  const char* base_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::vector<double> buffer_;
+  std::unordered_map<std::string, const CheckpointSection*> sections_;
+};
+
+/** Dictionary stored with CheckpointWriter::add_dictionary, used in
+ *  place: find is a binary search over the sorted raw strings.
+ */
+class MappedDictionary {
+ public:
+  MappedDictionary(const Checkpoint& ckpt, const std::string& name) {
+    CHECK(valid(ckpt, name)) << "Corrupted dictionary " << name;
+    auto meta = ckpt.array<uint64_t>(name + ".meta");
+    feat_type_ = static_cast<FeatureType>(meta[0]);
+    length_ = meta[1];
+    size_ = meta[2];
+    offsets_ = ckpt.array<uint64_t>(name + ".offsets").begin();
+    sorted_ = ckpt.array<uint64_t>(name + ".sorted").begin();
+    chars_ = ckpt.section_data(name + ".chars");
+  }
+
+  /** Whether ckpt holds a well formed dictionary name
+   */
+  static bool valid(const Checkpoint& ckpt, const std::string& name) {
+    if (!ckpt.has(name + ".meta", CKPT_UINT64, 3, 1)) return false;
+    uint64_t size = ckpt.array<uint64_t>(name + ".meta")[2];
+    if (!ckpt.has(name + ".sorted", CKPT_UINT64, size, 1)
+        || !ckpt.has(name + ".offsets", CKPT_UINT64, size + 1, 1)
+        || !ckpt.has(name + ".chars", CKPT_BYTES)) {
+      return false;
+    }
+    auto offsets = ckpt.array<uint64_t>(name + ".offsets").begin();
+    auto sorted = ckpt.array<uint64_t>(name + ".sorted").begin();
+    if (offsets[0] != 0 || offsets[size] != ckpt.section(name + ".chars").bytes) return false;
+    for (size_t idx = 0; idx < size; ++idx) {
+      if (offsets[idx] > offsets[idx + 1] || sorted[idx] >= size) return false;
+    }
+    return true;
+  }
+
+  size_t size() const { return size_; }
+
+  std::string raw_str(size_t idx) const {
+    CHECK_LT(idx, size_);
+    return std::string(chars_ + offsets_[idx], offsets_[idx + 1] - offsets_[idx]);
+  }
+
+  /** Index of key, or size_t(-1) if it is unknown (as FeatureGroupInfo::get_index)
+   */
+  size_t find(const std::string& key) const {
+    size_t lo = 0, hi = size_;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (compare(sorted_[mid], key) < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo < size_ && compare(sorted_[lo], key) == 0) {
+      return sorted_[lo];
+    }
+    return size_t(-1);
+  }
+
+  /** A mutable copy, e.g. to resume training
+   */
+  FeatureGroupInfo to_feature_group_info() const {
+    FeatureGroupInfo fg_info(feat_type_);
+    fg_info.set_length(length_);
+    for (size_t idx = 0; idx < size_; ++idx) {
+      CHECK_EQ(fg_info.get_index(raw_str(idx)), idx);
+    }
+    return fg_info;
+  }
+
+ private:
+  int compare(size_t idx, const std::string& key) const {
+    return - key.compare(0, std::string::npos, chars_ + offsets_[idx],
+                         offsets_[idx + 1] - offsets_[idx]);
+  }
+
+ private:
+  FeatureType feat_type_ = SPARSE_BINARY;
+  size_t length_ = 0;
+  size_t size_ = 0;
+  const uint64_t* offsets_ = nullptr;
+  const uint64_t* sorted_ = nullptr;
+  const char* chars_ = nullptr;
+};
+
+inline MappedDictionary Checkpoint::dictionary(const std::string& name) const {
+  return MappedDictionary(*this, name);
+}
+
+} // namespace
+
+#endif // _LIBCF_CHECKPOINT_HPP_
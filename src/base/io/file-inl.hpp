@@ -12,6 +12,9 @@ File::File(const std::string& filename, const std::string& flag) : f_(new std::f
   } else if (flag == "w") {
     read_only = false;
     mode = std::ios::out;
+  } else if (flag == "a") {
+    read_only = false;
+    mode = std::ios::out | std::ios::app;
   } else if (flag == "rb") {
     is_binary = true;
     mode = std::ios::in | std::ios::binary;
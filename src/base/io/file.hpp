@@ -34,7 +34,7 @@ class File {
     bool read(T* t, size_t n = 1) const;
 
   template <class T> 
-    bool write(T* t, size_t n = 1) const;
+    bool write(const T* t, size_t n = 1) const;
 
 
   template<class T>
@@ -76,11 +76,11 @@ bool File::read(T* t, size_t n) const {
 }
 
 template<class T> 
-bool File::write(T* t, size_t n) const {
+bool File::write(const T* t, size_t n) const {
   CHECK_EQ(is_binary, true);
   CHECK_EQ(read_only, false);
   if (good()) {
-    f_->write(reinterpret_cast<char*>(t), n * sizeof(T));
+    f_->write(reinterpret_cast<const char*>(t), n * sizeof(T));
   }
   return ok();
 }
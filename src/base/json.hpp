@@ -0,0 +1,142 @@
+#ifndef _LIBCF_JSON_HPP_
+#define _LIBCF_JSON_HPP_
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <type_traits>
+
+#include <glog/logging.h>
+
+namespace libcf {
+
+/**
+ *  Streaming writer of one JSON value, e.g. benchmark results.
+ *  Keys are given inside objects and omitted inside arrays.
+ *
+ *  Example:
+ *
+ *    JsonWriter json;
+ *    json.begin_object();
+ *    json.add("qps", 1234.5);
+ *    json.begin_array("p99").value(1).value(2).end_array();
+ *    json.end_object();
+ *    LOG(INFO) << json.str();  // {"qps":1234.5,"p99":[1,2]}
+ */
+class JsonWriter {
+ public:
+  JsonWriter() {
+    out_.precision(10);
+  }
+
+  JsonWriter& begin_object(const std::string& key = "") {
+    open(key, '{', true);
+    return *this;
+  }
+
+  JsonWriter& end_object() {
+    close('}', true);
+    return *this;
+  }
+
+  JsonWriter& begin_array(const std::string& key = "") {
+    open(key, '[', false);
+    return *this;
+  }
+
+  JsonWriter& end_array() {
+    close(']', false);
+    return *this;
+  }
+
+  template <class T>
+  JsonWriter& add(const std::string& key, const T& v) {
+    write_key(key);
+    write_value(v);
+    return *this;
+  }
+
+  // an element of the current array
+  template <class T>
+  JsonWriter& value(const T& v) {
+    CHECK(!in_object_.empty() && !in_object_.back()) << "value outside of an array";
+    write_key("");
+    write_value(v);
+    return *this;
+  }
+
+  std::string str() const {
+    CHECK(in_object_.empty()) << "unclosed JSON object or array";
+    return out_.str();
+  }
+
+ private:
+  void open(const std::string& key, char c, bool is_object) {
+    write_key(key);
+    out_ << c;
+    in_object_.push_back(is_object);
+    first_.push_back(true);
+  }
+
+  void close(char c, bool is_object) {
+    CHECK(!in_object_.empty() && in_object_.back() == is_object) << "unbalanced JSON";
+    out_ << c;
+    in_object_.pop_back();
+    first_.pop_back();
+  }
+
+  void write_key(const std::string& key) {
+    if (in_object_.empty()) return;
+    if (!first_.back()) out_ << ',';
+    first_.back() = false;
+    if (in_object_.back()) {
+      write_value(key);
+      out_ << ':';
+    }
+  }
+
+  void write_value(const std::string& s) {
+    out_ << '"';
+    for (char c : s) {
+      switch (c) {
+        case '"': out_ << "\\\""; break;
+        case '\\': out_ << "\\\\"; break;
+        case '\n': out_ << "\\n"; break;
+        case '\t': out_ << "\\t"; break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out_ << buf;
+          } else {
+            out_ << c;
+          }
+      }
+    }
+    out_ << '"';
+  }
+
+  void write_value(const char* s) { write_value(std::string(s)); }
+
+  void write_value(bool b) { out_ << (b ? "true" : "false"); }
+
+  template <class T>
+  typename std::enable_if<std::is_arithmetic<T>::value>::type write_value(T v) {
+    if (std::is_floating_point<T>::value && !std::isfinite(static_cast<double>(v))) {
+      out_ << "null";
+    } else {
+      out_ << v;
+    }
+  }
+
+ private:
+  std::ostringstream out_;
+  std::vector<bool> in_object_;
+  std::vector<bool> first_;
+};
+
+} // namespace
+
+#endif // _LIBCF_JSON_HPP_
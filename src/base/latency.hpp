@@ -0,0 +1,110 @@
+#ifndef _LIBCF_LATENCY_HPP_
+#define _LIBCF_LATENCY_HPP_
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace libcf {
+
+/**
+ *  Histogram of non-negative integer values (e.g. latencies in ns) with
+ *  log-linear buckets: values below kSubBuckets are exact, larger values
+ *  fall into kSubBuckets buckets per power of two, so every recorded
+ *  value is known within 1 / kSubBuckets (~3%). Recording is O(1) and
+ *  the memory is fixed, so it is cheap enough for every request.
+ *
+ *  Not thread-safe, keep one histogram per thread and merge them.
+ *
+ *  Example:
+ *
+ *    LatencyHistogram hist;
+ *    hist.record(latency_ns);
+ *    LOG(INFO) << "p99 " << hist.percentile(99.) << " ns";
+ */
+class LatencyHistogram {
+ public:
+  static const size_t kSubBucketBits = 5;
+  static const size_t kSubBuckets = size_t(1) << kSubBucketBits;
+  static const size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyHistogram() : counts_(kNumBuckets, 0) {}
+
+  void record(uint64_t value, uint64_t count = 1) {
+    counts_[bucket(value)] += count;
+    total_ += count;
+    sum_ += static_cast<double>(value) * count;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void merge(const LatencyHistogram& other) {
+    for (size_t idx = 0; idx < kNumBuckets; ++idx) {
+      counts_[idx] += other.counts_[idx];
+    }
+    total_ += other.total_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  void reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = 0;
+    sum_ = 0.;
+    min_ = std::numeric_limits<uint64_t>::max();
+    max_ = 0;
+  }
+
+  uint64_t count() const { return total_; }
+  uint64_t min() const { return total_ ? min_ : 0; }
+  uint64_t max() const { return max_; }
+  double mean() const { return total_ ? sum_ / total_ : 0.; }
+
+  /** The smallest value v such that q percent of the values are <= v,
+   *  up to the bucket precision (the bucket's upper bound is returned)
+   */
+  uint64_t percentile(double q) const {
+    if (total_ == 0) return 0;
+    q = std::min(std::max(q, 0.), 100.);
+    uint64_t rank = static_cast<uint64_t>(q / 100. * total_ + 0.5);
+    rank = std::min(std::max(rank, uint64_t(1)), total_);
+    uint64_t seen = 0;
+    for (size_t idx = 0; idx < kNumBuckets; ++idx) {
+      seen += counts_[idx];
+      if (seen >= rank) {
+        return std::min(std::max(upper_bound(idx), min_), max_);
+      }
+    }
+    return max_;
+  }
+
+  static size_t bucket(uint64_t value) {
+    if (value < kSubBuckets) return value;
+    size_t msb = 63 - __builtin_clzll(value);
+    size_t shift = msb - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+  }
+
+  static uint64_t upper_bound(size_t idx) {
+    CHECK_LT(idx, kNumBuckets);
+    if (idx < kSubBuckets) return idx;
+    size_t shift = idx / kSubBuckets - 1;
+    uint64_t sub = idx % kSubBuckets + kSubBuckets;
+    return ((sub + 1) << shift) - 1;
+  }
+
+ private:
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+  double sum_ = 0.;
+  uint64_t min_ = std::numeric_limits<uint64_t>::max();
+  uint64_t max_ = 0;
+};
+
+} // namespace
+
+#endif // _LIBCF_LATENCY_HPP_
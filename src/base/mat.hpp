@@ -39,6 +39,55 @@ typedef SCMatrix<bool>    BSCMatrix;
 
 typedef SRVector<double>  DSRVector;
 
+// read-only views of storage held elsewhere, e.g. of a mapped checkpoint
+typedef Eigen::Map<const DMatrix> DMatrixView;
+typedef Eigen::Map<const DVector> DVectorView;
+
+// read-only arguments bound to a matrix or a view of one without copying
+typedef Eigen::Ref<const DMatrix> DMatrixRef;
+typedef Eigen::Ref<const DVector> DVectorRef;
+
+/** A view of the storage of m
+ */
+template <class MatrixType>
+Eigen::Map<const MatrixType> view(const MatrixType& m) {
+  return Eigen::Map<const MatrixType>(m.data(), m.rows(), m.cols());
+}
+
+/** A view of the first rows rows of a row-major matrix or a vector,
+ *  e.g. the rows in use of one grown by reserve_rows
+ */
+template <class MatrixType>
+Eigen::Map<const MatrixType> view(const MatrixType& m, size_t rows) {
+  return Eigen::Map<const MatrixType>(m.data(), rows, m.cols());
+}
+
+/** Grow a row-major matrix or a vector to rows rows, keeping the
+ *  existing rows and setting the new ones to value. Eigen reallocates
+ *  the storage in place, so the existing rows are only copied when the
+ *  allocator cannot extend the block.
+ */
+template <class MatrixType>
+void grow_rows(MatrixType& m, size_t rows, typename MatrixType::Scalar value) {
+  size_t old_rows = m.rows();
+  if (rows <= old_rows) return;
+  m.conservativeResize(rows, m.cols());
+  m.bottomRows(rows - old_rows).setConstant(value);
+}
+
+/** Make sure a row-major matrix or a vector has at least rows rows, as
+ *  grow_rows, but growing it geometrically by at least half its rows:
+ *  growing one row at a time copies each row O(1) times amortized. The
+ *  rows past the ones in use, which the caller keeps track of, are
+ *  spare capacity and stay at value until used.
+ */
+template <class MatrixType>
+void reserve_rows(MatrixType& m, size_t rows, typename MatrixType::Scalar value) {
+  size_t capacity = m.rows();
+  if (rows <= capacity) return;
+  grow_rows(m, std::max(rows, capacity + capacity / 2), value);
+}
+
 } // namespace
 
 #endif // _LIBCF_MAT_HPP_
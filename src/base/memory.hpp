@@ -0,0 +1,203 @@
+#ifndef _LIBCF_MEMORY_HPP_
+#define _LIBCF_MEMORY_HPP_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <ostream>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <base/mat.hpp>
+
+namespace libcf {
+
+/**
+ *  Explicit byte accounting of the big structures. The estimates follow
+ *  glibc malloc (16 byte aligned chunks with an 8 byte header) and the
+ *  node layout of libstdc++ hash tables, which is close enough to tell
+ *  the structures apart; RSS is what the kernel actually charged.
+ */
+
+// heap bytes taken by one malloc of n bytes
+inline size_t heap_bytes(size_t n) {
+  if (n == 0) return 0;
+  return std::max<size_t>(32, (n + 8 + 15) & ~size_t(15));
+}
+
+inline size_t memory_bytes(const DMatrix& m) {
+  return heap_bytes(m.size() * sizeof(double));
+}
+
+inline size_t memory_bytes(const DVector& v) {
+  return heap_bytes(v.size() * sizeof(double));
+}
+
+// heap owned by a value, i.e. beyond its sizeof
+template <class T>
+typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value, size_t>::type
+owned_bytes(const T&) {
+  return 0;
+}
+
+inline size_t owned_bytes(const std::string& s) {
+  // short strings are stored inline
+  return s.capacity() > 15 ? heap_bytes(s.capacity() + 1) : 0;
+}
+
+template <class T>
+size_t owned_bytes(const std::vector<T>& vec);
+template <class K, class V, class H, class E, class A>
+size_t owned_bytes(const std::unordered_map<K, V, H, E, A>& map);
+template <class K, class H, class E, class A>
+size_t owned_bytes(const std::unordered_set<K, H, E, A>& set);
+
+template <class T>
+size_t owned_bytes(const std::vector<T>& vec) {
+  size_t rets = heap_bytes(vec.capacity() * sizeof(T));
+  for (auto& v : vec) {
+    rets += owned_bytes(v);
+  }
+  return rets;
+}
+
+// a hash node is the next pointer, the value and the hash unless the key is integral
+template <class K, class Value>
+size_t hash_node_bytes() {
+  return heap_bytes(sizeof(void*) + sizeof(Value) + (std::is_integral<K>::value ? 0 : sizeof(size_t)));
+}
+
+template <class K, class V, class H, class E, class A>
+size_t owned_bytes(const std::unordered_map<K, V, H, E, A>& map) {
+  size_t rets = heap_bytes(map.bucket_count() * sizeof(void*))
+      + map.size() * hash_node_bytes<K, std::pair<const K, V>>();
+  for (auto& p : map) {
+    rets += owned_bytes(p.first) + owned_bytes(p.second);
+  }
+  return rets;
+}
+
+template <class K, class H, class E, class A>
+size_t owned_bytes(const std::unordered_set<K, H, E, A>& set) {
+  size_t rets = heap_bytes(set.bucket_count() * sizeof(void*))
+      + set.size() * hash_node_bytes<K, K>();
+  for (auto& k : set) {
+    rets += owned_bytes(k);
+  }
+  return rets;
+}
+
+template <class T>
+size_t memory_bytes(const T& v) {
+  return sizeof(T) + owned_bytes(v);
+}
+
+/** Projected bytes of a hash table of n entries without owned heap
+ */
+template <class K, class V>
+size_t projected_hashtable_bytes(size_t n) {
+  // the bucket count stays a prime >= n at the max load factor 1
+  return heap_bytes(n * sizeof(void*)) + n * hash_node_bytes<K, std::pair<const K, V>>();
+}
+
+inline size_t projected_dense_bytes(size_t rows, size_t cols) {
+  return heap_bytes(rows * cols * sizeof(double));
+}
+
+/** Peak resident set size of the process
+ */
+inline size_t peak_rss_bytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;  // KB on Linux
+}
+
+/** Current resident set size of the process
+ */
+inline size_t current_rss_bytes() {
+  size_t pages = 0, resident = 0;
+  FILE* f = std::fopen("/proc/self/statm", "r");
+  if (f == nullptr) return 0;
+  if (std::fscanf(f, "%zu %zu", &pages, &resident) != 2) {
+    resident = 0;
+  }
+  std::fclose(f);
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+inline std::string format_bytes(size_t bytes) {
+  static const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+  double value = static_cast<double>(bytes);
+  size_t unit = 0;
+  while (value >= 1024. && unit < 4) {
+    value /= 1024.;
+    ++unit;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+  return buf;
+}
+
+/**
+ *  Bytes per named structure, e.g. "model.adagrad", in insertion order.
+ *  Adding a name again accumulates.
+ */
+class MemoryReport {
+ public:
+  MemoryReport& add(const std::string& name, size_t bytes) {
+    for (auto& entry : entries_) {
+      if (entry.first == name) {
+        entry.second += bytes;
+        return *this;
+      }
+    }
+    entries_.emplace_back(name, bytes);
+    return *this;
+  }
+
+  MemoryReport& add(const MemoryReport& oth) {
+    for (auto& entry : oth.entries_) {
+      add(entry.first, entry.second);
+    }
+    return *this;
+  }
+
+  size_t bytes(const std::string& name) const {
+    for (auto& entry : entries_) {
+      if (entry.first == name) return entry.second;
+    }
+    return 0;
+  }
+
+  size_t total() const {
+    size_t rets = 0;
+    for (auto& entry : entries_) {
+      rets += entry.second;
+    }
+    return rets;
+  }
+
+  const std::vector<std::pair<std::string, size_t>>& entries() const {
+    return entries_;
+  }
+
+  friend std::ostream& operator<< (std::ostream& stream, const MemoryReport& report) {
+    for (auto& entry : report.entries_) {
+      stream << "\t" << entry.first << ": " << format_bytes(entry.second) << std::endl;
+    }
+    stream << "\ttotal: " << format_bytes(report.total());
+    return stream;
+  }
+
+ private:
+  std::vector<std::pair<std::string, size_t>> entries_;
+};
+
+} // namespace
+
+#endif // _LIBCF_MEMORY_HPP_
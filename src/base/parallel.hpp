@@ -15,11 +15,20 @@ namespace libcf {
 //////////////////////////////////////////////
 // some global functions
 
+/** Threads the parallel helpers may use when called from this thread,
+ *  0 for no limit. Workers running many jobs side by side set it so the
+ *  jobs do not oversubscribe the cores.
+ */
+inline size_t& thread_parallelism_limit() {
+  static thread_local size_t limit = 0;
+  return limit;
+}
+
 inline size_t num_hardware_threads() {
-  if (FLAGS_num_thread) {
-    return FLAGS_num_thread;
-  }
-  return std::thread::hardware_concurrency();
+  size_t num_threads = FLAGS_num_thread ? FLAGS_num_thread
+      : std::thread::hardware_concurrency();
+  size_t limit = thread_parallelism_limit();
+  return limit && limit < num_threads ? limit : num_threads;
 }
 
 }
@@ -0,0 +1,181 @@
+#ifndef _LIBCF_EPOCH_HPP_
+#define _LIBCF_EPOCH_HPP_
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <limits>
+#include <utility>
+#include <functional>
+
+#include <glog/logging.h>
+
+#include <base/parallel.hpp>
+
+namespace libcf {
+
+/**
+ *  A pointer to an immutable T that can be replaced while other threads
+ *  read it, with RCU-style epoch reclamation.
+ *
+ *  Readers hold a ReadGuard: entering publishes the current epoch in a
+ *  reader slot, which is one atomic CAS and never waits for writers.
+ *  reset publishes a new value and retires the old one, tagged with the
+ *  next epoch. A retired value is deleted by reclaim / synchronize once
+ *  no reader that entered before the swap is left, so in-flight reads
+ *  finish on the old value and new reads see the new one.
+ *
+ *  Writers are serialized; readers may run on any number of threads
+ *  (at most num_slots at the same time).
+ *
+ *  Example:
+ *
+ *    EpochPtr<Model> handle(std::unique_ptr<Model>(new Model(...)));
+ *    {
+ *      auto model = handle.read();   // on request threads
+ *      model->recommend(...);
+ *    }
+ *    handle.reset(std::move(new_model));  // on a reload thread
+ *    handle.synchronize();                // the old model is freed
+ */
+template <class T>
+class EpochPtr {
+ public:
+  class ReadGuard {
+   public:
+    ReadGuard(ReadGuard&& other) : slot_(other.slot_), value_(other.value_) {
+      other.slot_ = nullptr;
+    }
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    ~ReadGuard() {
+      if (slot_) {
+        slot_->store(kIdle);
+      }
+    }
+
+    const T* get() const { return value_; }
+    const T& operator*() const { return *value_; }
+    const T* operator->() const { return value_; }
+
+   private:
+    friend class EpochPtr;
+    ReadGuard(std::atomic<uint64_t>* slot, const T* value) : slot_(slot), value_(value) {}
+
+    std::atomic<uint64_t>* slot_;
+    const T* value_;
+  };
+
+  explicit EpochPtr(std::unique_ptr<T> value = nullptr, size_t num_slots = 256) :
+      slots_(num_slots) {
+    CHECK_GT(num_slots, 0);
+    for (auto& s : slots_) {
+      s.epoch = kIdle;
+    }
+    current_ = value.release();
+  }
+
+  ~EpochPtr() {
+    for (auto& s : slots_) {
+      CHECK_EQ(s.epoch.load(), uint64_t(kIdle)) << "EpochPtr destroyed while being read";
+    }
+    delete current_.load();
+    for (auto& r : retired_) {
+      delete r.second;
+    }
+  }
+
+  EpochPtr(const EpochPtr&) = delete;
+  EpochPtr& operator=(const EpochPtr&) = delete;
+
+  /** Pin the current value until the guard is destroyed
+   */
+  ReadGuard read() const {
+    size_t idx = std::hash<std::thread::id>()(std::this_thread::get_id()) % slots_.size();
+    while (true) {
+      uint64_t epoch = epoch_.load();
+      uint64_t expected = kIdle;
+      auto& slot = slots_[idx].epoch;
+      if (slot.compare_exchange_strong(expected, epoch)) {
+        // loaded after the slot is published, so a writer that has not
+        // seen the slot has not retired this value yet
+        return ReadGuard(&slot, current_.load());
+      }
+      idx = (idx + 1) % slots_.size();
+      if (idx == 0) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  /** Publish value and retire the previous one, never waits for readers
+   */
+  void reset(std::unique_ptr<T> value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    T* old = current_.exchange(value.release());
+    uint64_t tag = epoch_.fetch_add(1) + 1;
+    if (old) {
+      retired_.emplace_back(tag, old);
+    }
+    reclaim_locked();
+  }
+
+  /** Delete the retired values no reader can see, returns the num of
+   *  values still retired
+   */
+  size_t reclaim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reclaim_locked();
+  }
+
+  /** Wait until every retired value is deleted
+   */
+  void synchronize() {
+    while (reclaim() > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  uint64_t epoch() const { return epoch_.load(); }
+
+ private:
+  static const uint64_t kIdle = std::numeric_limits<uint64_t>::max();
+
+  struct Slot {
+    std::atomic<uint64_t> epoch;
+    char padding[64 - sizeof(std::atomic<uint64_t>)];  // one cache line each
+  };
+
+  size_t reclaim_locked() {
+    uint64_t min_epoch = kIdle;
+    for (auto& s : slots_) {
+      min_epoch = std::min(min_epoch, s.epoch.load());
+    }
+    size_t kept = 0;
+    for (auto& r : retired_) {
+      // readers that entered at epoch >= tag see a newer value
+      if (r.first <= min_epoch) {
+        delete r.second;
+      } else {
+        retired_[kept++] = r;
+      }
+    }
+    retired_.resize(kept);
+    return kept;
+  }
+
+ private:
+  mutable std::vector<Slot> slots_;
+  std::atomic<T*> current_;
+  std::atomic<uint64_t> epoch_{1};
+  std::mutex mutex_;
+  std::vector<std::pair<uint64_t, T*>> retired_;
+};
+
+} // namespace
+
+#endif // _LIBCF_EPOCH_HPP_
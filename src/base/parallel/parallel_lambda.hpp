@@ -7,6 +7,8 @@
 #include <functional>
 
 #include <base/parallel.hpp>
+#include <base/random.hpp>
+#include <base/trace.hpp>
 
 namespace libcf { 
 
@@ -41,9 +43,15 @@ inline void in_parallel(const std::function<void (size_t, size_t)>& fn) {
   //std::vector<std::future<void>> workers(num_threads - 1);
   std::vector<std::thread> workers(num_threads);
   size_t thread_id = 0;
+  // workers draw from streams forked off the calling thread's
+  uint64_t seed_base = Random::fork();
   // set async workers
   for (auto& worker : workers) {
-    worker = std::move(std::thread(std::cref(fn), thread_id, num_threads));
+    worker = std::move(std::thread([&fn, seed_base](size_t thread_id, size_t num_threads) {
+                                     LIBCF_TRACE_SCOPE("parallel.worker");
+                                     Random::seed_worker(seed_base, thread_id);
+                                     fn(thread_id, num_threads);
+                                   }, thread_id, num_threads));
     thread_id++;
   }
 
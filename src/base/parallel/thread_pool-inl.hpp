@@ -1,12 +1,18 @@
 #include <base/parallel/thread_pool.hpp> 
+#include <base/random.hpp>
+#include <base/trace.hpp>
 
 namespace libcf {
 
 ThreadPool::ThreadPool(size_t num_workers) 
     : num_workers_(num_workers), has_started_(false)
 {
+  // workers draw from streams forked off the calling thread's
+  uint64_t seed_base = Random::fork();
   // define job for each thread
-  auto worker_job = [&] () {
+  auto worker_job = [this, seed_base] (size_t thread_idx) {
+    LIBCF_TRACE_SCOPE("thread_pool.worker");
+    Random::seed_worker(seed_base, thread_idx);
     // keep running, until some conditions changed 
     for (; ;) { 
       std::unique_lock<std::mutex> lock(mut_);
@@ -31,7 +37,7 @@ ThreadPool::ThreadPool(size_t num_workers)
 
   workers_.reserve(num_workers_);
   for (size_t idx = 0; idx < num_workers_; idx++) {
-    workers_.push_back(std::thread(worker_job));
+    workers_.push_back(std::thread(worker_job, idx));
   }
 }
 
@@ -2,6 +2,7 @@
 #define _LIBCF_THREADSAFE_QUEUE_HPP_
 
 #include <queue>
+#include <chrono>
 
 #include <base/parallel.hpp>
 
@@ -17,20 +18,52 @@ class ThreadsafeQueue {
   void push(T v) {
     {
       std::unique_lock<std::mutex> lock(m);
-      q.push(v);
+      q.push(std::move(v));
     }
-    cv.notify_all();
+    cv.notify_one();
   }
 
   T wait_and_pop() {
     std::unique_lock<std::mutex> lock(m);
     cv.wait(lock, [this]{ return !q.empty(); });
-    T ret = std::move(p.front());
-    p.pop();
+    T ret = std::move(q.front());
+    q.pop();
+    return ret;
+  }
+
+  /** Pop into v, waiting until deadline at most. Returns false on timeout.
+   */
+  template <class Clock, class Duration>
+  bool wait_and_pop_until(T& v, const std::chrono::time_point<Clock, Duration>& deadline) {
+    std::unique_lock<std::mutex> lock(m);
+    if (!cv.wait_until(lock, deadline, [this]{ return !q.empty(); })) {
+      return false;
+    }
+    v = std::move(q.front());
+    q.pop();
+    return true;
+  }
+
+  template <class Rep, class Period>
+  bool wait_and_pop_for(T& v, const std::chrono::duration<Rep, Period>& timeout) {
+    return wait_and_pop_until(v, std::chrono::steady_clock::now() + timeout);
+  }
+
+  bool try_pop(T& v) {
+    std::unique_lock<std::mutex> lock(m);
+    if (q.empty()) return false;
+    v = std::move(q.front());
+    q.pop();
+    return true;
+  }
+
+  size_t size() const {
+    std::unique_lock<std::mutex> lock(m);
+    return q.size();
   }
 
  private:
-  std::mutex m;
+  mutable std::mutex m;
   std::condition_variable cv;
   std::queue<T> q;
 };
@@ -0,0 +1,114 @@
+#ifndef _LIBCF_WORKER_POOL_HPP_
+#define _LIBCF_WORKER_POOL_HPP_
+
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include <base/parallel.hpp>
+#include <base/trace.hpp>
+
+namespace libcf {
+
+/**
+ *  Persistent pool of workers taking tasks first in, first out. Unlike
+ *  ThreadPool it outlives one batch: tasks may be submitted at any time,
+ *  also from inside a running task, and wait() returns once the queue has
+ *  drained. A task that resubmits its continuation goes to the back of
+ *  the queue, so long jobs cut into slices share the workers round robin.
+ *
+ *  Each worker limits the parallel helpers called from its tasks to
+ *  threads_per_task threads, see thread_parallelism_limit.
+ *
+ *  Example:
+ *
+ *    WorkerPool pool(4);
+ *    std::function<void ()> step = [&]() {
+ *      if (job.run_slice()) pool.submit(step);   // not done, requeue
+ *    };
+ *    pool.submit(step);
+ *    pool.wait();
+ */
+class WorkerPool {
+ public:
+  typedef std::function<void ()> task_t;
+
+  explicit WorkerPool(size_t num_workers, size_t threads_per_task = 1) {
+    CHECK_GT(num_workers, 0);
+    workers_.reserve(num_workers);
+    for (size_t idx = 0; idx < num_workers; ++idx) {
+      workers_.emplace_back([this, threads_per_task]() {
+        thread_parallelism_limit() = threads_per_task;
+        work();
+      });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::unique_lock<std::mutex> lock(mut_);
+      stopped_ = true;
+    }
+    task_cond_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  void submit(task_t task) {
+    {
+      std::unique_lock<std::mutex> lock(mut_);
+      tasks_.push_back(std::move(task));
+      ++num_pending_;
+    }
+    task_cond_.notify_one();
+  }
+
+  /** Wait until every submitted task, and the ones they submit, has run
+   */
+  void wait() {
+    std::unique_lock<std::mutex> lock(mut_);
+    done_cond_.wait(lock, [this]{ return num_pending_ == 0; });
+  }
+
+  size_t num_workers() const { return workers_.size(); }
+
+ private:
+  void work() {
+    LIBCF_TRACE_SCOPE("worker_pool.worker");
+    for (;;) {
+      task_t task;
+      {
+        std::unique_lock<std::mutex> lock(mut_);
+        task_cond_.wait(lock, [this]{ return stopped_ || !tasks_.empty(); });
+        if (tasks_.empty()) return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+      std::unique_lock<std::mutex> lock(mut_);
+      if (--num_pending_ == 0) {
+        done_cond_.notify_all();
+      }
+    }
+  }
+
+ private:
+  std::mutex mut_;
+  std::condition_variable task_cond_;
+  std::condition_variable done_cond_;
+  std::list<task_t> tasks_;
+  size_t num_pending_ = 0;   // queued or running
+  bool stopped_ = false;
+  std::vector<std::thread> workers_;
+};
+
+} // namespace
+
+#endif // _LIBCF_WORKER_POOL_HPP_
@@ -0,0 +1,172 @@
+#ifndef _LIBCF_PROFILER_HPP_
+#define _LIBCF_PROFILER_HPP_
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+
+#include <base/json.hpp>
+
+namespace libcf {
+
+/** Phases of a training epoch, see PhaseProfiler
+ */
+enum TrainPhase {
+  PHASE_DATA_PREP = 0,   // model reset and pre_train, in epoch 0
+  PHASE_SAMPLING,        // negative items and corrupted inputs
+  PHASE_FORWARD,         // predictions / hidden values before the gradients
+  PHASE_UPDATE,          // the rest of the training pass
+  PHASE_LOSS,
+  PHASE_EVALUATION,
+  NUM_TRAIN_PHASES
+};
+
+inline const char* train_phase_name(size_t phase) {
+  static const char* names[NUM_TRAIN_PHASES] = {
+    "data_prep", "sampling", "forward", "update", "loss", "evaluation"
+  };
+  return names[phase];
+}
+
+/** Time and counters of one epoch
+ */
+struct EpochProfile {
+  size_t iteration = 0;
+  double phase_secs[NUM_TRAIN_PHASES] = {};
+  size_t users = 0;          // users trained
+  size_t updates = 0;        // parameter updates, e.g. one per (user, item) gradient step
+  size_t interactions = 0;   // training interactions passed over
+
+  // the training pass: sampling, forward and update
+  double train_secs() const {
+    return phase_secs[PHASE_SAMPLING] + phase_secs[PHASE_FORWARD] + phase_secs[PHASE_UPDATE];
+  }
+
+  double total_secs() const {
+    double rets = 0.;
+    for (size_t phase = 0; phase < NUM_TRAIN_PHASES; ++phase) {
+      rets += phase_secs[phase];
+    }
+    return rets;
+  }
+
+  double rate(size_t count) const {
+    return train_secs() > 0. ? count / train_secs() : 0.;
+  }
+
+  void write_json(JsonWriter& json) const {
+    json.add("iteration", iteration);
+    json.add("secs", total_secs());
+    json.begin_object("phase_secs");
+    for (size_t phase = 0; phase < NUM_TRAIN_PHASES; ++phase) {
+      json.add(train_phase_name(phase), phase_secs[phase]);
+    }
+    json.end_object();
+    json.add("users", users);
+    json.add("updates", updates);
+    json.add("interactions", interactions);
+    json.add("users_per_sec", rate(users));
+    json.add("updates_per_sec", rate(updates));
+    json.add("interactions_per_sec", rate(interactions));
+  }
+};
+
+/**
+ *  Per-phase time and throughput counters of a training run, one
+ *  EpochProfile per iteration. Solver profiles the phases it runs;
+ *  models given the profiler by set_profiler time their sampling and
+ *  forward steps with ScopedPhase and count their updates, and the rest
+ *  of the training pass is the update phase.
+ *
+ *  Training is single threaded, so nothing here is synchronized.
+ */
+class PhaseProfiler {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  void begin_epoch(size_t iteration) {
+    current_ = EpochProfile();
+    current_.iteration = iteration;
+  }
+
+  void end_epoch() {
+    epochs_.push_back(current_);
+  }
+
+  void add(TrainPhase phase, Clock::duration elapsed) {
+    current_.phase_secs[phase] += std::chrono::duration<double>(elapsed).count();
+  }
+
+  void add_users(size_t n) { current_.users += n; }
+  void add_updates(size_t n) { current_.updates += n; }
+  void add_interactions(size_t n) { current_.interactions += n; }
+
+  EpochProfile& current() { return current_; }
+
+  const std::vector<EpochProfile>& epochs() const { return epochs_; }
+
+  /** Sum of the epochs after epoch 0, i.e. of the training iterations
+   */
+  EpochProfile total() const {
+    EpochProfile rets;
+    for (auto& epoch : epochs_) {
+      if (epoch.iteration == 0) continue;
+      rets.iteration = epoch.iteration;
+      for (size_t phase = 0; phase < NUM_TRAIN_PHASES; ++phase) {
+        rets.phase_secs[phase] += epoch.phase_secs[phase];
+      }
+      rets.users += epoch.users;
+      rets.updates += epoch.updates;
+      rets.interactions += epoch.interactions;
+    }
+    return rets;
+  }
+
+  static std::string summary(const EpochProfile& epoch) {
+    std::stringstream ss;
+    ss << std::setprecision(3);
+    for (size_t phase = 0; phase < NUM_TRAIN_PHASES; ++phase) {
+      ss << train_phase_name(phase) << " " << epoch.phase_secs[phase] << "s, ";
+    }
+    ss << epoch.rate(epoch.users) << " users/s, "
+        << epoch.rate(epoch.updates) << " updates/s, "
+        << epoch.rate(epoch.interactions) << " interactions/s";
+    return ss.str();
+  }
+
+ private:
+  EpochProfile current_;
+  std::vector<EpochProfile> epochs_;
+};
+
+/** Adds the lifetime of the scope to a phase, nothing if profiler is null
+ */
+class ScopedPhase {
+ public:
+  ScopedPhase(PhaseProfiler* profiler, TrainPhase phase) :
+      profiler_(profiler), phase_(phase) {
+    if (profiler_) {
+      start_ = PhaseProfiler::Clock::now();
+    }
+  }
+
+  ~ScopedPhase() {
+    if (profiler_) {
+      profiler_->add(phase_, PhaseProfiler::Clock::now() - start_);
+    }
+  }
+
+  ScopedPhase(const ScopedPhase&) = delete;
+  ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+ private:
+  PhaseProfiler* profiler_;
+  TrainPhase phase_;
+  PhaseProfiler::Clock::time_point start_;
+};
+
+} // namespace
+
+#endif // _LIBCF_PROFILER_HPP_
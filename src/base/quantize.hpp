@@ -0,0 +1,172 @@
+#ifndef _LIBCF_QUANTIZE_HPP_
+#define _LIBCF_QUANTIZE_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace libcf {
+
+/**
+ *  Low precision storage and dot product kernels for scoring.
+ *
+ *  int8 vectors are symmetric with one scale per vector, x ~ scale * q
+ *  with q in [-127, 127]. fp16 vectors are IEEE half precision.
+ *  The kernels use AVX512-VNNI / AVX-VNNI or AVX2 for int8 and F16C
+ *  for fp16 when compiled with the matching -m flags (e.g. -march=native),
+ *  and fall back to scalar code otherwise.
+ */
+
+/** Quantize x[0..n) into out[0..n), returns the scale
+ */
+inline float quantize_int8(const double* x, size_t n, int8_t* out) {
+  double max_abs = 0.;
+  for (size_t idx = 0; idx < n; ++idx) {
+    max_abs = std::max(max_abs, std::abs(x[idx]));
+  }
+  if (max_abs == 0.) {
+    std::fill(out, out + n, 0);
+    return 0.f;
+  }
+  double inv_scale = 127. / max_abs;
+  for (size_t idx = 0; idx < n; ++idx) {
+    long v = std::lround(x[idx] * inv_scale);
+    out[idx] = static_cast<int8_t>(std::max(-127L, std::min(127L, v)));
+  }
+  return static_cast<float>(max_abs / 127.);
+}
+
+#ifdef __AVX2__
+inline int32_t hsum_epi32(__m256i v) {
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+}
+#endif
+
+/** Integer dot product of two int8 vectors with entries in [-127, 127]
+ */
+inline int32_t dot_int8(const int8_t* a, const int8_t* b, size_t n) {
+  size_t idx = 0;
+  int32_t ret = 0;
+#if defined(__AVX2__) && (defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__)))
+  // vpdpbusd multiplies unsigned by signed bytes: use |a| * (b * sign(a))
+  __m256i acc = _mm256_setzero_si256();
+  for (; idx + 32 <= n; idx += 32) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + idx));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + idx));
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    acc = _mm256_dpbusd_epi32(acc, _mm256_abs_epi8(va), _mm256_sign_epi8(vb, va));
+#else
+    acc = _mm256_dpbusd_avx_epi32(acc, _mm256_abs_epi8(va), _mm256_sign_epi8(vb, va));
+#endif
+  }
+  ret += hsum_epi32(acc);
+#elif defined(__AVX2__)
+  __m256i acc = _mm256_setzero_si256();
+  for (; idx + 16 <= n; idx += 16) {
+    __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + idx)));
+    __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + idx)));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+  }
+  ret += hsum_epi32(acc);
+#endif
+  for (; idx < n; ++idx) {
+    ret += static_cast<int32_t>(a[idx]) * static_cast<int32_t>(b[idx]);
+  }
+  return ret;
+}
+
+/** float -> IEEE half, round to nearest even
+ */
+inline uint16_t float_to_half(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t raw_exp = (x >> 23) & 0xff;
+  uint32_t mant = x & 0x7fffff;
+  if (raw_exp == 0xff) {
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  }
+  int32_t exp = static_cast<int32_t>(raw_exp) - 127 + 15;
+  if (exp >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exp <= 0) {
+    // subnormal half
+    if (exp < -10) return sign;
+    mant |= 0x800000;
+    uint32_t shift = 14 - exp;
+    uint32_t half_mant = mant >> shift;
+    uint32_t rem = mant & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (half_mant & 1))) {
+      ++half_mant;
+    }
+    return sign | half_mant;
+  }
+  uint32_t half = sign | (exp << 10) | (mant >> 13);
+  uint32_t rem = mant & 0x1fff;
+  // a carry into the exponent is the correctly rounded result
+  if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return half;
+}
+
+/** IEEE half -> float
+ */
+inline float half_to_float(uint16_t h) {
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+  if (exp == 0) {
+    float f = std::ldexp(static_cast<float>(mant), -24);
+    return sign ? -f : f;
+  } else if (exp == 31) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else {
+    x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/** Dot product of an fp16 vector with a float vector
+ */
+inline float dot_fp16(const uint16_t* a, const float* b, size_t n) {
+  size_t idx = 0;
+  float ret = 0.f;
+#if defined(__F16C__) && defined(__AVX__)
+  __m256 acc = _mm256_setzero_ps();
+  for (; idx + 8 <= n; idx += 8) {
+    __m256 va = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + idx)));
+    __m256 vb = _mm256_loadu_ps(b + idx);
+#ifdef __FMA__
+    acc = _mm256_fmadd_ps(va, vb, acc);
+#else
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(va, vb));
+#endif
+  }
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  ret += _mm_cvtss_f32(s);
+#endif
+  for (; idx < n; ++idx) {
+    ret += half_to_float(a[idx]) * b[idx];
+  }
+  return ret;
+}
+
+} // namespace
+
+#endif // _LIBCF_QUANTIZE_HPP_
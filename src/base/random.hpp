@@ -1,14 +1,30 @@
 #ifndef _LIBCF_RANDOM_HPP_
 #define _LIBCF_RANDOM_HPP_
 
+#include <cmath>
+#include <atomic>
+#include <cstdint>
 #include <random>
+#include <algorithm>
 #include <initializer_list>
 #include <time.h>  
 
+#include <glog/logging.h>
+
 namespace libcf {
 
 /**
- *  Random number generator
+ *  Random number generator. Each thread has its own engine, so
+ *  concurrent jobs draw without a data race.
+ *
+ *  seed() sets the engine of the calling thread and the global seed.
+ *  The workers of in_parallel and ThreadPool are seeded from the thread
+ *  that starts them: it draws one base value by fork(), and worker
+ *  thread_idx seeds its engine from (base, thread_idx) by seed_worker.
+ *  So a run seeded on its main thread is reproducible wherever its
+ *  workers draw the same work, and no two workers share a stream. Any
+ *  other thread starts from the global seed and the order in which
+ *  threads first draw.
  */
 class Random {
  public:
@@ -16,20 +32,33 @@ class Random {
   
   static inline void seed() {
     std::random_device rd;
-    rng.seed(rd());
+    seed(rd());
   }
    
   /* set seed */
   static inline void timed_seed()  {
-    rng.seed(time(NULL));
+    seed(time(NULL));
   }
 
  
   /* set seed */
   static inline void seed(size_t number)  {
+    global_seed() = number;
     rng.seed(number);
   }
 
+  /* Draw the base value that the workers started next are seeded from */
+  static inline uint64_t fork() {
+    return rng();
+  }
+
+  /* Seed the engine of worker thread_idx from the base of fork() */
+  static inline void seed_worker(uint64_t base, size_t thread_idx) {
+    std::seed_seq seq{static_cast<uint32_t>(base), static_cast<uint32_t>(base >> 32),
+                      static_cast<uint32_t>(thread_idx)};
+    rng.seed(seq);
+  }
+
   /* Generate a random number in [min, max) */
   static inline double uniform(double min = 0., double max = 1.) {
     std::uniform_real_distribution<> dist(min, max);
@@ -74,12 +103,97 @@ class Random {
   
 
  public:
-  // random number generator
-  static rng_type rng;
+  // random number generator of the calling thread
+  static thread_local rng_type rng;
+
+ private:
+  static inline std::atomic<uint64_t>& global_seed() {
+    static std::atomic<uint64_t> value(rng_type::default_seed);
+    return value;
+  }
+
+  // engine of a thread that was not seeded: the first thread to draw
+  // starts from the global seed itself, the n-th from (seed, n)
+  static inline rng_type thread_engine() {
+    static std::atomic<uint32_t> num_threads(0);
+    uint32_t idx = num_threads++;
+    uint64_t number = global_seed();
+    if (idx == 0) {
+      return rng_type(number);
+    }
+    std::seed_seq seq{static_cast<uint32_t>(number), static_cast<uint32_t>(number >> 32), idx};
+    return rng_type(seq);
+  }
 };
 
 // set static member
-Random::rng_type Random::rng;
+thread_local Random::rng_type Random::rng = Random::thread_engine();
+
+/**
+ *  Zipf distribution over [0, n): P(k) is proportional to 1 / (k + 1)^exponent,
+ *  so 0 is the most popular. Sampled by rejection-inversion (Hormann and
+ *  Derflinger, 1996) in O(1) time and memory, so n can be in the billions.
+ */
+class ZipfDistribution {
+ public:
+  ZipfDistribution(size_t n, double exponent) : n_(n), exponent_(exponent) {
+    CHECK_GT(n, 0);
+    CHECK_GE(exponent, 0.);
+    h_integral_x1_ = h_integral(1.5) - 1.;
+    h_integral_n_ = h_integral(n + 0.5);
+    s_ = 2. - h_integral_inverse(h_integral(2.5) - h(2.));
+  }
+
+  template <class RNG>
+  size_t operator()(RNG& rng) const {
+    std::uniform_real_distribution<> dist(0., 1.);
+    while (true) {
+      double u = h_integral_n_ + dist(rng) * (h_integral_x1_ - h_integral_n_);
+      double x = h_integral_inverse(u);
+      double k = std::floor(x + 0.5);
+      k = std::min(std::max(k, 1.), static_cast<double>(n_));
+      if (k - x <= s_ || u >= h_integral(k + 0.5) - h(k)) {
+        return static_cast<size_t>(k) - 1;
+      }
+    }
+  }
+
+  size_t size() const { return n_; }
+
+ private:
+  // h(x) = x^-exponent, and its integral (x^(1 - exponent) - 1) / (1 - exponent)
+  double h(double x) const {
+    return std::exp(-exponent_ * std::log(x));
+  }
+
+  double h_integral(double x) const {
+    double log_x = std::log(x);
+    return expm1_over_x((1. - exponent_) * log_x) * log_x;
+  }
+
+  double h_integral_inverse(double x) const {
+    double t = std::max(x * (1. - exponent_), -1.);
+    return std::exp(log1p_over_x(t) * x);
+  }
+
+  // log(1 + x) / x and (exp(x) - 1) / x, stable around 0
+  static double log1p_over_x(double x) {
+    if (std::abs(x) > 1e-8) return std::log1p(x) / x;
+    return 1. - x * (0.5 - x * (1. / 3. - 0.25 * x));
+  }
+
+  static double expm1_over_x(double x) {
+    if (std::abs(x) > 1e-8) return std::expm1(x) / x;
+    return 1. + x * 0.5 * (1. + x / 3. * (1. + 0.25 * x));
+  }
+
+ private:
+  size_t n_;
+  double exponent_;
+  double h_integral_x1_;
+  double h_integral_n_;
+  double s_;
+};
 
 } // namespace
 
@@ -0,0 +1,341 @@
+#ifndef _LIBCF_SYNTHETIC_HPP_
+#define _LIBCF_SYNTHETIC_HPP_
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+
+#include <glog/logging.h>
+
+#include <base/data.hpp>
+#include <base/random.hpp>
+#include <base/timer.hpp>
+#include <base/parallel.hpp>
+#include <base/io/file.hpp>
+
+namespace libcf {
+
+enum SyntheticOrder {
+  USER_ORDER,   // user by user, distinct items per user
+  TIME_ORDER    // one event stream in time order, items may repeat
+};
+
+struct SyntheticConfig {
+  SyntheticConfig() = default;
+  size_t num_users = 100000;
+  size_t num_items = 10000;
+  size_t num_interactions = 1000000;    // about, see SyntheticDataGenerator
+  double user_exponent = 1.;            // Zipf skew of the user activity
+  double item_exponent = 1.;            // Zipf skew of the item popularity
+  size_t max_items_per_user = 10000;    // USER_ORDER only
+  SyntheticOrder order = USER_ORDER;
+  bool timestamps = false;              // write a third column of unix secs
+  size_t start_time = 1400000000;
+  size_t time_span = 365 * 86400;       // secs
+  size_t block_size = 1 << 16;          // users or events per seeded block
+  size_t seed = 20141119;
+};
+
+struct Interaction {
+  size_t user;
+  size_t item;
+  size_t time;
+};
+
+/**
+ *  Generates implicit feedback with power-law user activity and item
+ *  popularity, for scale tests without the real data sets.
+ *
+ *  USER_ORDER draws the number of items of every user from a Poisson
+ *  proportional to Zipf(rank of the user), between one and
+ *  max_items_per_user with the excess of the capped users spread over
+ *  the others, and then distinct items by popularity; timestamps are
+ *  uniform over the time span and sorted within each user. TIME_ORDER draws
+ *  num_interactions events of a Zipf user and a Zipf item at evenly
+ *  spaced times, e.g. for OnlineTrainer streams.
+ *
+ *  Popularity ranks are scattered over the ids by a fixed permutation.
+ *  The output is split into blocks of block_size users (USER_ORDER) or
+ *  events (TIME_ORDER) with their own seeds, generated num_thread blocks
+ *  at a time in parallel, so the output depends on the seed only.
+ *
+ *  Example:
+ *
+ *    SyntheticConfig config;
+ *    config.num_users = 1000000;
+ *    config.num_interactions = 100000000;
+ *    SyntheticDataGenerator gen(config);
+ *    gen.write_text("synthetic.txt");  // or gen.generate(data) and save
+ */
+class SyntheticDataGenerator {
+ public:
+  explicit SyntheticDataGenerator(const SyntheticConfig& cfg) :
+      cfg_(cfg),
+      user_zipf_(std::max<size_t>(cfg.num_users, 1), cfg.user_exponent),
+      item_zipf_(std::max<size_t>(cfg.num_items, 1), cfg.item_exponent) {
+    CHECK_GT(cfg_.num_users, 0);
+    CHECK_GT(cfg_.num_items, 0);
+    CHECK_GT(cfg_.block_size, 0);
+    user_multiplier_ = permutation_multiplier(cfg_.num_users);
+    item_multiplier_ = permutation_multiplier(cfg_.num_items);
+    user_inverse_ = cfg_.num_users > 1 ? modular_inverse(user_multiplier_, cfg_.num_users) : 1;
+    max_items_per_user_ = std::max<size_t>(1, std::min(cfg_.max_items_per_user, cfg_.num_items));
+    activity_scale_ = activity_scale();
+  }
+
+  size_t num_blocks() const {
+    size_t n = cfg_.order == USER_ORDER ? cfg_.num_users : cfg_.num_interactions;
+    return (n + cfg_.block_size - 1) / cfg_.block_size;
+  }
+
+  /** The interactions of block idx
+   */
+  std::vector<Interaction> block(size_t idx) const {
+    std::mt19937_64 rng(cfg_.seed * 0x9E3779B97F4A7C15ULL + idx);
+    std::vector<Interaction> rets;
+    if (cfg_.order == USER_ORDER) {
+      size_t end = std::min(cfg_.num_users, (idx + 1) * cfg_.block_size);
+      for (size_t uid = idx * cfg_.block_size; uid < end; ++uid) {
+        user_interactions(uid, rng, rets);
+      }
+    } else {
+      size_t end = std::min(cfg_.num_interactions, (idx + 1) * cfg_.block_size);
+      rets.reserve(end - idx * cfg_.block_size);
+      double step = static_cast<double>(cfg_.time_span) / cfg_.num_interactions;
+      for (size_t k = idx * cfg_.block_size; k < end; ++k) {
+        size_t uid = permute(user_zipf_(rng), cfg_.num_users, user_multiplier_);
+        size_t iid = permute(item_zipf_(rng), cfg_.num_items, item_multiplier_);
+        rets.push_back({uid, iid, cfg_.start_time + static_cast<size_t>(k * step)});
+      }
+    }
+    return rets;
+  }
+
+  /** Lines of "user item" or "user item time", returns the num of lines
+   */
+  size_t write_text(const std::string& filename) const {
+    Timer timer;
+    File f(filename, "w");
+    size_t num_lines = 0;
+    for_each_block<std::string>([&](size_t idx, std::string& buf) {
+      auto interactions = block(idx);
+      buf.clear();
+      for (auto& x : interactions) {
+        buf += std::to_string(x.user);
+        buf += ' ';
+        buf += std::to_string(x.item);
+        if (cfg_.timestamps) {
+          buf += ' ';
+          buf += std::to_string(x.time);
+        }
+        buf += '\n';
+      }
+    }, [&](std::string& buf) {
+      f.write_str(buf);
+      num_lines += std::count(buf.begin(), buf.end(), '\n');
+    });
+    f.close();
+    LOG(INFO) << num_lines << " synthetic interactions written to " << filename
+        << " in " << timer;
+    return num_lines;
+  }
+
+  /** RECSYS data of rating 1, as Data::load would give for write_text's output
+   */
+  void generate(Data& data) const {
+    Timer timer;
+    auto data_info = std::make_shared<DataInfo>();
+    data_info->feature_group_infos_.push_back(FeatureGroupInfo(SPARSE_BINARY));
+    data_info->feature_group_infos_.push_back(FeatureGroupInfo(SPARSE_BINARY));
+    data_info->label_info_ = FeatureGroupInfo(DENSE);
+    auto& users = data_info->feature_group_infos_[0];
+    auto& items = data_info->feature_group_infos_[1];
+
+    std::vector<Instance> instances;
+    for_each_block<std::vector<Interaction>>([&](size_t idx, std::vector<Interaction>& interactions) {
+      interactions = block(idx);
+    }, [&](std::vector<Interaction>& interactions) {
+      for (auto& x : interactions) {
+        Instance ins;
+        ins.add_feat_group(users, std::to_string(x.user));
+        ins.add_feat_group(items, std::to_string(x.item));
+        ins.set_label(1.);
+        instances.push_back(std::move(ins));
+      }
+    });
+
+    data_info->update_dimensions();
+    data = Data(std::move(instances), data_info);
+    LOG(INFO) << "Synthetic data generated in " << timer;
+    LOG(INFO) << data;
+  }
+
+ private:
+  // produce(block, result) runs for num_thread blocks at a time in
+  // parallel, then consume(result) for each of them in block order
+  template <class T>
+  void for_each_block(const std::function<void (size_t, T&)>& produce,
+                      const std::function<void (T&)>& consume) const {
+    std::vector<T> results(num_hardware_threads());
+    for (size_t first = 0; first < num_blocks(); first += results.size()) {
+      size_t last = std::min(num_blocks(), first + results.size());
+      parallel_for(first, last, [&](size_t idx) {
+        produce(idx, results[idx - first]);
+      });
+      for (size_t idx = first; idx < last; ++idx) {
+        consume(results[idx - first]);
+      }
+    }
+  }
+
+  template <class RNG>
+  void user_interactions(size_t uid, RNG& rng, std::vector<Interaction>& rets) const {
+    size_t rank = inverse_rank(uid);
+    double mean = std::min<double>(activity_scale_ * std::pow(rank + 1., -cfg_.user_exponent),
+                                   max_items_per_user_);
+    size_t n = mean > 0. ? std::poisson_distribution<size_t>(mean)(rng) : 0;
+    n = std::min(std::max<size_t>(n, 1), max_items_per_user_);
+
+    // distinct items by popularity, uniform once the head is exhausted
+    std::unordered_set<size_t> items;
+    size_t max_tries = 10 * n + 100;
+    for (size_t tries = 0; items.size() < n && tries < max_tries; ++tries) {
+      items.insert(permute(item_zipf_(rng), cfg_.num_items, item_multiplier_));
+    }
+    std::uniform_int_distribution<size_t> uniform_item(0, cfg_.num_items - 1);
+    while (items.size() < n) {
+      items.insert(uniform_item(rng));
+    }
+
+    std::vector<size_t> times(n, cfg_.start_time);
+    if (cfg_.timestamps) {
+      std::uniform_int_distribution<size_t> uniform_time(0, cfg_.time_span - 1);
+      for (auto& t : times) {
+        t += uniform_time(rng);
+      }
+      std::sort(times.begin(), times.end());
+    }
+    size_t idx = 0;
+    for (auto& iid : items) {
+      rets.push_back({uid, iid, times[idx++]});
+    }
+  }
+
+  // x -> (x * multiplier + 1) mod n is a permutation of [0, n)
+  static size_t permute(size_t x, size_t n, size_t multiplier) {
+    return static_cast<size_t>((static_cast<unsigned __int128>(x) * multiplier + 1) % n);
+  }
+
+  size_t inverse_rank(size_t uid) const {
+    // the rank whose permutation is uid, by the modular inverse
+    size_t n = cfg_.num_users;
+    if (n == 1) return 0;
+    size_t y = (uid + n - 1) % n;
+    return static_cast<size_t>(static_cast<unsigned __int128>(y) * user_inverse_ % n);
+  }
+
+  static size_t permutation_multiplier(size_t n) {
+    if (n <= 2) return 1;
+    size_t a = static_cast<size_t>(n * 0.6180339887498949) | 1;
+    while (gcd(a, n) != 1) {
+      a += 2;
+    }
+    return a % n;
+  }
+
+  static size_t gcd(size_t a, size_t b) {
+    while (b != 0) {
+      size_t t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
+
+  static size_t modular_inverse(size_t a, size_t n) {
+    __int128 t = 0, new_t = 1;
+    __int128 r = n, new_r = a;
+    while (new_r != 0) {
+      __int128 q = r / new_r;
+      __int128 tmp = t - q * new_t;
+      t = new_t;
+      new_t = tmp;
+      tmp = r - q * new_r;
+      r = new_r;
+      new_r = tmp;
+    }
+    CHECK(r == 1);
+    if (t < 0) t += n;
+    return static_cast<size_t>(t);
+  }
+
+  // the c of E[num of items of rank r] = min(c * (r + 1)^-exponent, max
+  // items per user), so that the expected total is num_interactions
+  // with the activity of the capped head users moved to the others
+  double activity_scale() const {
+    double s = cfg_.user_exponent;
+    double cap = static_cast<double>(max_items_per_user_);
+    auto expected_total = [&](double c) {
+      // the ranks below num_capped are capped
+      double num_capped = s > 0. ? std::pow(c / cap, 1. / s) : (c > cap ? 1e300 : 0.);
+      size_t head = static_cast<size_t>(std::min<double>(num_capped, cfg_.num_users));
+      return cap * head + c * (zipf_sum(cfg_.num_users, s) - zipf_sum(head, s));
+    };
+    double target = static_cast<double>(cfg_.num_interactions);
+    if (expected_total(cap) >= target) {
+      // no user is capped
+      return target / zipf_sum(cfg_.num_users, s);
+    }
+    if (cap * cfg_.num_users <= target) {
+      // every user capped
+      return cap * std::pow(static_cast<double>(cfg_.num_users), s);
+    }
+    double lo = cap, hi = cap;
+    while (expected_total(hi) < target) {
+      lo = hi;
+      hi *= 2.;
+    }
+    for (size_t iter = 0; iter < 100; ++iter) {
+      double mid = 0.5 * (lo + hi);
+      (expected_total(mid) < target ? lo : hi) = mid;
+    }
+    return hi;
+  }
+
+  // sum of (k + 1)^-exponent over [0, n): the head exactly, the tail by
+  // the midpoint integral
+  static double zipf_sum(size_t n, double exponent) {
+    size_t head = std::min<size_t>(n, 10000);
+    double sum = 0.;
+    for (size_t k = 1; k <= head; ++k) {
+      sum += std::pow(static_cast<double>(k), -exponent);
+    }
+    if (n > head) {
+      double a = head + 0.5, b = n + 0.5;
+      if (std::abs(exponent - 1.) < 1e-12) {
+        sum += std::log(b / a);
+      } else {
+        sum += (std::pow(b, 1. - exponent) - std::pow(a, 1. - exponent)) / (1. - exponent);
+      }
+    }
+    return sum;
+  }
+
+ private:
+  SyntheticConfig cfg_;
+  ZipfDistribution user_zipf_;
+  ZipfDistribution item_zipf_;
+  size_t user_multiplier_;
+  size_t item_multiplier_;
+  size_t user_inverse_;
+  double activity_scale_;
+  size_t max_items_per_user_;
+};
+
+} // namespace
+
+#endif // _LIBCF_SYNTHETIC_HPP_
@@ -0,0 +1,226 @@
+#ifndef _LIBCF_TOPK_HPP_
+#define _LIBCF_TOPK_HPP_
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <glog/logging.h>
+
+namespace libcf {
+
+/**
+ *  Fixed-capacity top-k selector.
+ *
+ *  Keeps the k best (score, id) pairs, where "better" is defined by
+ *  Compare (std::greater keeps the largest scores). Scores and ids are
+ *  stored as two separate arrays organized as a heap with the worst
+ *  kept score at the root, so that once the selector is full most
+ *  candidates are rejected with a single compare against threshold().
+ *  On ties the candidate pushed first is kept.
+ *
+ *  Example:
+ *
+ *    TopK<double> topk_items(10);
+ *    for (size_t iid = 0; iid < num_items; ++iid) {
+ *      topk_items.push(iid, scores[iid]);
+ *    }
+ *    std::vector<size_t> rec_list = topk_items.get_sorted_ids();
+ */
+template <class Score = double, class Compare = std::greater<Score>>
+class TopK {
+ public:
+  explicit TopK(size_t capacity = 0) {
+    reset(capacity);
+  }
+
+  /** Clear the selector, reusing the allocated buffers
+   */
+  void reset(size_t capacity) {
+    capacity_ = capacity;
+    scores_.clear();
+    ids_.clear();
+    scores_.reserve(capacity_);
+    ids_.reserve(capacity_);
+  }
+
+  size_t size() const { return scores_.size(); }
+  size_t capacity() const { return capacity_; }
+  bool full() const { return scores_.size() >= capacity_; }
+
+  /** Worst score currently kept; only meaningful when full()
+   */
+  Score threshold() const {
+    return scores_.front();
+  }
+
+  /** Whether a candidate with this score would be kept
+   */
+  bool accepts(const Score& score) const {
+    return !full() || comp_(score, scores_.front());
+  }
+
+  void push(size_t id, const Score& score) {
+    if (scores_.size() < capacity_) {
+      scores_.push_back(score);
+      ids_.push_back(id);
+      sift_up(scores_.size() - 1);
+      return;
+    }
+    if (capacity_ == 0 || !comp_(score, scores_.front())) {
+      return;
+    }
+    scores_.front() = score;
+    ids_.front() = id;
+    sift_down(0);
+  }
+
+  /** Push a contiguous block of scores for the ids [first_id, first_id + n).
+   *  Candidates are first filtered against the current threshold, using
+   *  AVX2 when available for double scores kept by std::greater.
+   */
+  void push_block(const Score* scores, size_t first_id, size_t n) {
+    size_t idx = 0;
+    for (; idx < n && !full(); ++idx) {
+      push(first_id + idx, scores[idx]);
+    }
+    if (capacity_ == 0) return;
+    filter_block(scores + idx, first_id + idx, n - idx,
+                 std::is_same<Compare, std::greater<double>>());
+  }
+
+  /** Ids ordered from the best score to the worst
+   */
+  std::vector<size_t> get_sorted_ids() const {
+    auto order = sorted_positions();
+    std::vector<size_t> ret(order.size());
+    for (size_t idx = 0; idx < order.size(); ++idx) {
+      ret[idx] = ids_[order[idx]];
+    }
+    return std::move(ret);
+  }
+
+  /** Write the ids ordered from the best score to the worst into
+   *  out[0, size()), without allocating once warmed up
+   */
+  void copy_sorted_ids(size_t* out) const {
+    sorted_positions(order_);
+    for (size_t idx = 0; idx < order_.size(); ++idx) {
+      out[idx] = ids_[order_[idx]];
+    }
+  }
+
+  /** (id, score) pairs ordered from the best score to the worst
+   */
+  std::vector<std::pair<size_t, Score>> get_sorted_data() const {
+    auto order = sorted_positions();
+    std::vector<std::pair<size_t, Score>> ret(order.size());
+    for (size_t idx = 0; idx < order.size(); ++idx) {
+      ret[idx] = std::make_pair(ids_[order[idx]], scores_[order[idx]]);
+    }
+    return std::move(ret);
+  }
+
+ private:
+
+  // a is strictly worse than b: worse scores sit closer to the root
+  bool worse(size_t a, size_t b) const {
+    return comp_(scores_[b], scores_[a]);
+  }
+
+  void swap_entries(size_t a, size_t b) {
+    std::swap(scores_[a], scores_[b]);
+    std::swap(ids_[a], ids_[b]);
+  }
+
+  void sift_up(size_t pos) {
+    while (pos > 0) {
+      size_t parent = (pos - 1) / 2;
+      if (!worse(pos, parent)) break;
+      swap_entries(pos, parent);
+      pos = parent;
+    }
+  }
+
+  void sift_down(size_t pos) {
+    size_t n = scores_.size();
+    for (;;) {
+      size_t child = 2 * pos + 1;
+      if (child >= n) break;
+      if (child + 1 < n && worse(child + 1, child)) {
+        ++child;
+      }
+      if (!worse(child, pos)) break;
+      swap_entries(pos, child);
+      pos = child;
+    }
+  }
+
+  std::vector<size_t> sorted_positions() const {
+    std::vector<size_t> order;
+    sorted_positions(order);
+    return std::move(order);
+  }
+
+  void sorted_positions(std::vector<size_t>& order) const {
+    order.resize(scores_.size());
+    for (size_t idx = 0; idx < order.size(); ++idx) {
+      order[idx] = idx;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+              if (comp_(scores_[a], scores_[b])) return true;
+              if (comp_(scores_[b], scores_[a])) return false;
+              return ids_[a] < ids_[b];
+              });
+  }
+
+  // generic filter pass
+  void filter_block(const Score* scores, size_t first_id, size_t n, std::false_type) {
+    for (size_t idx = 0; idx < n; ++idx) {
+      if (comp_(scores[idx], scores_.front())) {
+        push(first_id + idx, scores[idx]);
+      }
+    }
+  }
+
+  // filter pass for double scores kept by std::greater
+  void filter_block(const Score* scores, size_t first_id, size_t n, std::true_type) {
+    size_t idx = 0;
+#ifdef __AVX2__
+    for (; idx + 4 <= n; idx += 4) {
+      __m256d thres = _mm256_set1_pd(scores_.front());
+      __m256d vals = _mm256_loadu_pd(scores + idx);
+      int mask = _mm256_movemask_pd(_mm256_cmp_pd(vals, thres, _CMP_GT_OQ));
+      while (mask) {
+        int bit = __builtin_ctz(mask);
+        mask &= mask - 1;
+        if (scores[idx + bit] > scores_.front()) {
+          push(first_id + idx + bit, scores[idx + bit]);
+        }
+      }
+    }
+#endif
+    for (; idx < n; ++idx) {
+      if (scores[idx] > scores_.front()) {
+        push(first_id + idx, scores[idx]);
+      }
+    }
+  }
+
+ private:
+  std::vector<Score> scores_;
+  std::vector<size_t> ids_;
+  size_t capacity_ = 0;
+  Compare comp_;
+  mutable std::vector<size_t> order_;  // scratch for copy_sorted_ids
+};
+
+} // namespace
+
+#endif // _LIBCF_TOPK_HPP_
@@ -0,0 +1,259 @@
+#ifndef _LIBCF_TRACE_HPP_
+#define _LIBCF_TRACE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <glog/logging.h>
+
+#include <base/json.hpp>
+#include <base/io/file.hpp>
+
+namespace libcf {
+
+/** One complete event, in ticks of trace_now()
+ */
+struct TraceEvent {
+  const char* name;   // a string literal, never copied
+  uint64_t begin;
+  uint64_t end;
+};
+
+/** Ticks of the cheapest monotonic clock, the TSC on x86
+ */
+inline uint64_t trace_now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ *  Fixed size ring of the latest events of one thread. Only the owning
+ *  thread writes, so recording is two stores and a release of the head.
+ */
+class TraceBuffer {
+ public:
+  TraceBuffer(size_t lane, size_t capacity) :
+      lane_(lane), mask_(capacity - 1), events_(capacity) {
+    CHECK(capacity > 0 && (capacity & mask_) == 0) << "capacity must be a power of 2";
+  }
+
+  void record(const char* name, uint64_t begin, uint64_t end) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    events_[head & mask_] = TraceEvent{name, begin, end};
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  /** Events still in the ring, oldest first
+   */
+  std::vector<TraceEvent> events() const {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t first = head > events_.size() ? head - events_.size() : 0;
+    std::vector<TraceEvent> rets;
+    rets.reserve(head - first);
+    for (uint64_t idx = first; idx < head; ++idx) {
+      rets.push_back(events_[idx & mask_]);
+    }
+    return rets;
+  }
+
+  uint64_t num_recorded() const { return head_.load(std::memory_order_acquire); }
+  size_t lane() const { return lane_; }
+
+  void clear() { head_.store(0, std::memory_order_release); }
+
+ private:
+  size_t lane_;
+  uint64_t mask_;
+  std::atomic<uint64_t> head_{0};
+  std::vector<TraceEvent> events_;
+};
+
+/**
+ *  Process wide tracer. Each thread records into its own TraceBuffer,
+ *  taken on its first event; the buffer goes back to a free list when the
+ *  thread exits, so the short-lived workers of in_parallel reuse a few
+ *  lanes instead of growing one per thread. Flush after the traced work
+ *  has finished, events of running threads may be torn.
+ *
+ *  Example:
+ *
+ *    Tracer::instance().enable();
+ *    {
+ *      LIBCF_TRACE_SCOPE("train");   // nothing unless built with -DLIBCF_TRACE
+ *      ...
+ *    }
+ *    Tracer::instance().write_chrome_json("trace.json");  // chrome://tracing or Perfetto
+ */
+class Tracer {
+ public:
+  static Tracer& instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  void enable(size_t capacity = 1 << 16) {
+    std::lock_guard<std::mutex> lock(mut_);
+    capacity_ = capacity;
+    enabled_.store(true, std::memory_order_relaxed);
+  }
+
+  void disable() { enabled_.store(false, std::memory_order_relaxed); }
+
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  void record(const char* name, uint64_t begin, uint64_t end) {
+    thread_buffer().record(name, begin, end);
+  }
+
+  size_t num_lanes() const {
+    std::lock_guard<std::mutex> lock(mut_);
+    return buffers_.size();
+  }
+
+  /** Events of every lane, in nanoseconds since the tracer started
+   */
+  template <class Fn>
+  void for_each_event(Fn fn) const {
+    std::lock_guard<std::mutex> lock(mut_);
+    double ns_per_tick = this->ns_per_tick();
+    for (auto& buffer : buffers_) {
+      for (auto& event : buffer->events()) {
+        double begin_ns = event.begin > start_ticks_ ? (event.begin - start_ticks_) * ns_per_tick : 0.;
+        double dur_ns = event.end > event.begin ? (event.end - event.begin) * ns_per_tick : 0.;
+        fn(buffer->lane(), event.name, begin_ns, dur_ns);
+      }
+    }
+  }
+
+  /** Chrome trace event format, one complete event per line
+   */
+  size_t write_chrome_json(const std::string& filename) const {
+    File f(filename, "w");
+    CHECK(f.good()) << "Cannot open " << filename;
+    f.write_line("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    size_t num_events = 0;
+    for_each_event([&](size_t lane, const char* name, double begin_ns, double dur_ns) {
+      JsonWriter json;
+      json.begin_object();
+      json.add("name", name).add("ph", "X").add("pid", 1).add("tid", lane);
+      json.add("ts", begin_ns / 1e3).add("dur", dur_ns / 1e3);
+      json.end_object();
+      f.write_line((num_events++ ? "," : "") + json.str());
+    });
+    f.write_line("]}");
+    f.close();
+    LOG(INFO) << "Wrote " << num_events << " trace events of " << num_lanes()
+        << " threads to " << filename;
+    return num_events;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mut_);
+    for (auto& buffer : buffers_) {
+      buffer->clear();
+    }
+  }
+
+ private:
+  Tracer() : start_ticks_(trace_now()), start_time_(std::chrono::steady_clock::now()) {}
+
+  // ticks are converted with the rate measured since the tracer started
+  double ns_per_tick() const {
+    double ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start_time_).count();
+    uint64_t ticks = trace_now() - start_ticks_;
+    return ticks > 0 ? ns / ticks : 1.;
+  }
+
+  // returns the buffer to the free list when the thread exits
+  struct ThreadSlot {
+    TraceBuffer* buffer = nullptr;
+    ~ThreadSlot() {
+      if (buffer) Tracer::instance().release(buffer);
+    }
+  };
+
+  TraceBuffer& thread_buffer() {
+    static thread_local ThreadSlot slot;
+    if (!slot.buffer) {
+      slot.buffer = acquire();
+    }
+    return *slot.buffer;
+  }
+
+  TraceBuffer* acquire() {
+    std::lock_guard<std::mutex> lock(mut_);
+    if (!free_.empty()) {
+      TraceBuffer* buffer = free_.back();
+      free_.pop_back();
+      return buffer;
+    }
+    buffers_.emplace_back(new TraceBuffer(buffers_.size(), capacity_));
+    return buffers_.back().get();
+  }
+
+  void release(TraceBuffer* buffer) {
+    std::lock_guard<std::mutex> lock(mut_);
+    free_.push_back(buffer);
+  }
+
+ private:
+  mutable std::mutex mut_;
+  std::atomic<bool> enabled_{false};
+  size_t capacity_ = 1 << 16;
+  uint64_t start_ticks_;
+  std::chrono::steady_clock::time_point start_time_;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers_;
+  std::vector<TraceBuffer*> free_;
+};
+
+/** Records the lifetime of the scope if the tracer is enabled
+ */
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name) :
+      name_(Tracer::instance().enabled() ? name : nullptr),
+      begin_(name_ ? trace_now() : 0) {}
+
+  ~TraceScope() {
+    if (name_) {
+      Tracer::instance().record(name_, begin_, trace_now());
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const char* name_;
+  uint64_t begin_;
+};
+
+} // namespace
+
+#define LIBCF_TRACE_CONCAT_(a, b) a##b
+#define LIBCF_TRACE_CONCAT(a, b) LIBCF_TRACE_CONCAT_(a, b)
+
+// trace events are compiled out unless built with -DLIBCF_TRACE
+#ifdef LIBCF_TRACE
+#define LIBCF_TRACE_SCOPE(name) \
+  ::libcf::TraceScope LIBCF_TRACE_CONCAT(libcf_trace_scope_, __LINE__)(name)
+#else
+#define LIBCF_TRACE_SCOPE(name) do {} while (0)
+#endif
+
+#endif // _LIBCF_TRACE_HPP_
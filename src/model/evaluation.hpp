@@ -7,6 +7,8 @@
 
 #include <base/parallel.hpp>
 #include <base/data.hpp>
+#include <base/trace.hpp>
+#include <base/io/file_utils.hpp>
 
 namespace libcf {
 
@@ -31,6 +33,20 @@ class Evaluation {
     return std::string();
   }
 
+  /** Names of the columns of evaluation_type, e.g. "MAP@10"
+   */
+  std::vector<std::string> columns() const {
+    return split_line(evaluation_type(), " |");
+  }
+
+  /** The numbers of the last evaluate, one per column
+   */
+  const std::vector<double>& last_values() const {
+    return last_values_;
+  }
+
+ protected:
+  mutable std::vector<double> last_values_;
 };
 
 template<class Model>
@@ -45,6 +61,7 @@ class RMSE_Evaluation : public Evaluation<Model> {
   //TODO
   std::string evaluate(Model& model, const Data& validation_data,
                        const Data& train_data = Data()) const {
+    LIBCF_TRACE_SCOPE("eval.rmse");
     double ret = 0;
     double err;
     for (auto iter = validation_data.begin(); 
@@ -55,6 +72,7 @@ class RMSE_Evaluation : public Evaluation<Model> {
     }
     if (validation_data.size() > 0)
       ret = std::sqrt(ret / static_cast<double>(validation_data.size()));
+    this->last_values_.assign(1, ret);
     std::stringstream ss;
     ss << std::setw(8) << std::setprecision(5) << ret;
     return ss.str();
@@ -73,6 +91,7 @@ class MAE_Evaluation : public Evaluation<Model> {
   
   std::string evaluate(Model& model, const Data& validation_data,
                        const Data& train_data = Data()) const {
+    LIBCF_TRACE_SCOPE("eval.mae");
     double ret = 0;
     double err;
     for (auto iter = validation_data.begin(); 
@@ -83,6 +102,7 @@ class MAE_Evaluation : public Evaluation<Model> {
     }
     if (validation_data.size() > 0)
       ret = ret / static_cast<double>(validation_data.size());
+    this->last_values_.assign(1, ret);
     std::stringstream ss;
     ss << std::setw(8) << std::setprecision(5) << ret;
     return ss.str();
@@ -113,14 +133,16 @@ class TOPN_Evaluation : public Evaluation<Model> {
   std::string evaluate(Model& model, 
                        const Data& validation_data,
                        const Data& train_data = Data()) const {
+    LIBCF_TRACE_SCOPE("eval.topn");
 
     CHECK_GT(validation_data.size(), 0);
-    auto validation_user_itemset = validation_data.get_feature_pair_label_hashtable(0, 1);
+    // built once per data set, not on every evaluation
+    auto validation_table = validation_data.interaction_table();
+    auto& validation_user_itemset = *validation_table;
 
-    std::unordered_map<size_t, std::unordered_map<size_t, double>> train_user_itemset;
-    if (train_data.size() != 0) {
-      train_user_itemset = train_data.get_feature_pair_label_hashtable(0, 1);
-    }
+    auto train_table = train_data.size() != 0 ? train_data.interaction_table()
+        : std::make_shared<const InteractionTable>();
+    auto& train_user_itemset = *train_table;
     
     size_t num_users = train_data.feature_group_total_dimension(0);
     CHECK_EQ(num_users, train_user_itemset.size());
@@ -165,6 +187,10 @@ class TOPN_Evaluation : public Evaluation<Model> {
               }
     });
 
+    double elapsed = t.elapsed();
+    this->last_values_ = rets;
+    this->last_values_.push_back(elapsed);
+
     std::stringstream ss;
     ss << std::setw(8) << std::setprecision(5) << rets[0] << "|"
         << std::setw(8) << std::setprecision(5) << rets[1]  << "|"
@@ -174,7 +200,7 @@ class TOPN_Evaluation : public Evaluation<Model> {
         << std::setw(8) << std::setprecision(5) << rets[5] << "|"
         << std::setw(8) << std::setprecision(5) << rets[6] << "|"
         << std::setw(8) << std::setprecision(5) << rets[7] << "|"
-        << std::setw(8) << std::setprecision(3) << t.elapsed();
+        << std::setw(8) << std::setprecision(3) << elapsed;
         //<< std::setw(8) << std::setprecision(5) << rets[8] << "|"
         //<< std::setw(8) << std::setprecision(5) << rets[9]; 
     return ss.str(); 
@@ -239,14 +265,16 @@ class RANKING_Evaluation : public Evaluation<Model> {
   std::string evaluate(Model& model, 
                        const Data& validation_data,
                        const Data& train_data = Data()) const {
+    LIBCF_TRACE_SCOPE("eval.ranking");
 
     CHECK_GT(validation_data.size(), 0);
-    auto validation_user_itemset = validation_data.get_feature_pair_label_hashtable(0, 1);
+    // built once per data set, not on every evaluation
+    auto validation_table = validation_data.interaction_table();
+    auto& validation_user_itemset = *validation_table;
 
-    std::unordered_map<size_t, std::unordered_map<size_t, double>> train_user_itemset;
-    if (train_data.size() != 0) {
-      train_user_itemset = train_data.get_feature_pair_label_hashtable(0, 1);
-    }
+    auto train_table = train_data.size() != 0 ? train_data.interaction_table()
+        : std::make_shared<const InteractionTable>();
+    auto& train_user_itemset = *train_table;
     
     size_t num_users = train_data.feature_group_total_dimension(0);
     CHECK_EQ(num_users, train_user_itemset.size());
@@ -291,6 +319,10 @@ class RANKING_Evaluation : public Evaluation<Model> {
               }
     });
 
+    double elapsed = t.elapsed();
+    this->last_values_ = rets;
+    this->last_values_.push_back(elapsed);
+
     std::stringstream ss;
     ss << std::setw(8) << std::setprecision(5) << rets[0] << "|"
         << std::setw(8) << std::setprecision(5) << rets[1]  << "|"
@@ -300,7 +332,7 @@ class RANKING_Evaluation : public Evaluation<Model> {
         << std::setw(8) << std::setprecision(5) << rets[5] << "|"
         << std::setw(8) << std::setprecision(5) << rets[6] << "|"
         << std::setw(8) << std::setprecision(5) << rets[7] << "|"
-        << std::setw(8) << std::setprecision(3) << t.elapsed();
+        << std::setw(8) << std::setprecision(3) << elapsed;
         //<< std::setw(8) << std::setprecision(5) << rets[8] << "|"
         //<< std::setw(8) << std::setprecision(5) << rets[9]; 
     return ss.str(); 
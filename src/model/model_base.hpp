@@ -4,8 +4,11 @@
 #include <unordered_set>
 
 #include <base/mat.hpp>
+#include <base/memory.hpp>
 #include <base/data.hpp>
 #include <base/heap.hpp>
+#include <base/profiler.hpp>
+#include <base/trace.hpp>
 #include <model/loss.hpp>
 #include <model/penalty.hpp>
 
@@ -43,6 +46,31 @@ class ModelBase {
   virtual double penalty_loss() const {
     return 0.0; 
   }
+
+  /** Accumulate the data loss during train_one_iteration 
+   */
+  virtual void set_loss_accumulation(bool flag) {
+    accumulate_loss_ = flag;
+  }
+
+  /** Data loss accumulated in the last training pass.
+   *  Models which do not track it fall back to a full pass.
+   */
+  virtual double accumulated_data_loss(const Data& data_set) const {
+    return data_loss(data_set);
+  }
+
+  /** Time the phases of train_one_iteration into profiler, null for none
+   */
+  virtual void set_profiler(PhaseProfiler* profiler) {
+    profiler_ = profiler;
+  }
+
+  /** Add the bytes of the model's structures to report
+   */
+  virtual void memory_usage(MemoryReport& report) const {
+    // nothing
+  }
   
   // required by evaluation measures RMSE/MAE
   virtual double predict(const Instance& ins) const {
@@ -63,6 +91,9 @@ class ModelBase {
   const Data* data_ = nullptr;
   std::shared_ptr<Loss> loss_ = nullptr;
   std::shared_ptr<Penalty> penalty_ = nullptr;  
+  bool accumulate_loss_ = false;
+  double accumulated_loss_ = 0.;
+  PhaseProfiler* profiler_ = nullptr;
 };
 
 // required for SGD solver
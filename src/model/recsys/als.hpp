@@ -1,34 +1,41 @@
 #ifndef _LIBCF_ALS_HPP_
-#define _LIBCF_ALS_HPP_ 
+#define _LIBCF_ALS_HPP_
 
-#include <base/parallel.hpp>
-#include <model/model_base.hpp>
+#include <base/csr.hpp>
+#include <model/recsys/als_engine.hpp>
+#include <model/recsys/batch_topk.hpp>
+#include <model/recsys/recsys_model_base.hpp>
 
 
 namespace libcf {
 
 struct ALSConfig {
   ALSConfig() = default;
-  double lambda = 0.01;  // regularization coefficient 
+  double lambda = 0.01;  // regularization coefficient
   LossType lt = SQUARE; // loss type
   PenaltyType pt = L2;  // penalty type
   size_t num_dim = 10;
 };
 
 /**
- *  Implementation of the paper :
- *  Collaborative filtering for implicit feedback datasets, ICDM'11
+ *  Alternating least squares over the observed ratings only,
+ *  Large-scale parallel collaborative filtering for the Netflix prize,
+ *  AAIM'08. Row u solves
+ *
+ *    (Y_u^T Y_u + lambda I) x_u = Y_u^T r_u
+ *
+ *  on ALSEngine.
  */
-class ALS : public ModelBase {
+class ALS : public RecsysModelBase {
  public:
-  ALS(const ALSConfig& mcfg) 
-      : ModelBase(),
-      lambda_(mcfg.lambda), num_dim_(mcfg.num_dim)
-  {  
+  ALS(const ALSConfig& mcfg)
+      : lambda_(mcfg.lambda), num_dim_(mcfg.num_dim)
+  {
     loss_ = Loss::create(mcfg.lt);
     penalty_ = Penalty::create(mcfg.pt);
-    
-    LOG(INFO) << "ALS Configure: \n" 
+    retrieval_ = BRUTE_FORCE;
+
+    LOG(INFO) << "ALS Configure: \n"
         << "\t{lambda: " << lambda_ << "}, "
         << "{Loss: " << loss_->loss_type() << "}, "
         << "{Penalty: " << penalty_->penalty_type() << "}\n"
@@ -38,93 +45,84 @@ class ALS : public ModelBase {
   ALS() : ALS(ALSConfig()) {}
 
   virtual void reset(const Data& data_set) {
-    data_ = std::make_shared<const Data>(data_set);
-       
-    num_users_ = data_->feature_group_total_dimension(0);
-    num_items_ = data_->feature_group_total_dimension(1);
-  
+    RecsysModelBase::reset(data_set);
+
     p_ = DMatrix::Random(num_users_, num_dim_) * 0.001;
     q_ = DMatrix::Random(num_items_, num_dim_) * 0.001;
-      
-    user_idx_map_ = data_->get_feature_pair_label_hashtable(0, 1);
-    item_idx_map_ = data_->get_feature_pair_label_hashtable(1, 0);
+
+    user_rows_ = CSRMatrix(user_rated_items_.table(), num_users_);
+    item_rows_ = CSRMatrix(user_rated_items_.table(), num_items_, true);
+  }
+
+  virtual void memory_usage(MemoryReport& report) const {
+    RecsysModelBase::memory_usage(report);
+    report.add("model.matrices", memory_bytes(p_) + memory_bytes(q_));
+    report.add("model.rating_rows", owned_bytes(user_rows_.offsets()) + owned_bytes(user_rows_.ids())
+               + owned_bytes(user_rows_.values()) + owned_bytes(item_rows_.offsets())
+               + owned_bytes(item_rows_.ids()) + owned_bytes(item_rows_.values()));
+  }
+
+  /** Squared error over the observed ratings
+   */
+  virtual double data_loss(const Data& data_set, size_t sample_size=0) const {
+    double rets = 0.;
+    for (size_t uid = 0; uid < num_users_; ++uid) {
+      const size_t* iids = user_rows_.ids(uid);
+      const double* ratings = user_rows_.values(uid);
+      for (size_t pos = 0; pos < user_rows_.row_size(uid); ++pos) {
+        double err = ratings[pos] - predict_user_item_rating(uid, iids[pos]);
+        rets += err * err;
+      }
+    }
+    return rets;
   }
 
   virtual double penalty_loss() const {
-    return lambda_ * (penalty_->evaluate(p_) + penalty_->evaluate(q_)); 
+    return lambda_ * (penalty_->evaluate(p_) + penalty_->evaluate(q_));
   };
 
-  virtual double predict(const Instance& ins) const {
-    double ret = 0;
-    size_t user_id = ins.get_feature_group_index(0, 0);
-    size_t item_id = ins.get_feature_group_index(1, 0);
-    ret = p_.row(user_id).dot(q_.row(item_id));
-    return ret;
+  virtual double predict_user_item_rating(size_t uid, size_t iid) const {
+    return p_.row(uid).dot(q_.row(iid));
   }
 
-  void train_one_index(size_t idx, 
-                       const std::unordered_map<size_t, double>& index_vec, 
-                       const DMatrix& Y, DMatrix& X) {
-
-    size_t vec_size = index_vec.size();
-    DMatrix YCY = DMatrix::Zero(num_dim_, num_dim_);
-    for (size_t k = 0; k < num_dim_; ++k) {
-      YCY(k, k) += lambda_;
-    }
+  virtual void recommend_batch(const size_t* uids, size_t num_requests, size_t topk,
+                               const CSRIndex& exclusions, size_t* rec_lists) const {
+    LIBCF_TRACE_SCOPE("als.recommend_batch");
+    batch_inner_product_topk(q_, DVector(),
+                             [&](size_t uid, DMatrix::RowXpr row) { row = p_.row(uid); },
+                             uids, num_requests, topk, exclusions, rec_lists);
+  }
 
-    for (auto& p : index_vec) {
-      size_t oth_idx = p.first;
-      CHECK_LT(oth_idx, Y.rows());
-      CHECK_GE(oth_idx, 0);
-      //double rating = p.second;
-      //CHECK_EQ(rating, 1.0);
-      for (size_t i = 0; i < num_dim_; ++i)
-        for (size_t j = 0; j < num_dim_; ++j)
-          YCY(i,j) += Y(oth_idx, i) * Y(oth_idx, j);
-    }
-    YCY = YCY.inverse();
-    
-    X.row(idx) = DVector::Zero(num_dim_);
-
-    size_t i = 0;
-    for (auto& p : index_vec) {
-      size_t oth_idx = p.first;
-      double rating = p.second;
-      for (size_t k = 0; k < num_dim_; ++k)
-        X(idx, k) += YCY.col(k).dot(Y.row(oth_idx) * rating);
-      i++;
+  virtual void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("als.train_one_iteration");
+    solve_rows(user_rows_, q_, p_);
+    solve_rows(item_rows_, p_, q_);
+    if (profiler_) {
+      profiler_->add_users(num_users_);
+      profiler_->add_interactions(2 * user_rows_.num_entries());
     }
-    CHECK_EQ(i, vec_size);
   }
-  
-  virtual void train_one_iteration(const Data& trian_data) {
-    dynamic_parallel_for(0, num_users_, [&](size_t user_id) {
-                          train_one_user(user_id);                          
-                         });
-    dynamic_parallel_for(0, num_items_, [&](size_t item_id) {
-                          train_one_item(item_id);                          
-                         });
+
+  /** Half-sweep: solve every row of X given Y
+   */
+  void solve_rows(const CSRMatrix& rows, const DMatrix& Y, DMatrix& X) const {
+    DMatrix base = DMatrix::Identity(num_dim_, num_dim_) * lambda_;
+    engine_.solve(rows, Y, base, [](double) { return 1.; },
+                  [](double rating) { return rating; }, X);
   }
 
-  void train_one_user(size_t uid) {
-    auto fit = user_idx_map_.find(uid);
-    if (fit == user_idx_map_.end()) 
-      return;
-    train_one_index(uid, fit->second, q_, p_);
+  DMatrix get_user_vecs() {
+    return p_;
   }
 
-  void train_one_item(size_t iid) {
-    auto fit = item_idx_map_.find(iid);
-    if (fit == item_idx_map_.end()) 
-      return;
-    train_one_index(iid, fit->second, p_, q_);
+  DMatrix get_item_vecs() {
+    return q_;
   }
 
  private:
-  std::unordered_map<size_t, std::unordered_map<size_t, double>> user_idx_map_, item_idx_map_;
+  ALSEngine engine_;
+  CSRMatrix user_rows_, item_rows_;
   double lambda_ = 0.;
-  size_t num_users_ = 0;
-  size_t num_items_ = 0;
   size_t num_dim_ = 0;
   DMatrix p_;
   DMatrix q_;
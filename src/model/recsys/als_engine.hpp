@@ -0,0 +1,148 @@
+#ifndef _LIBCF_ALS_ENGINE_HPP_
+#define _LIBCF_ALS_ENGINE_HPP_
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <base/mat.hpp>
+#include <base/csr.hpp>
+#include <base/parallel.hpp>
+
+namespace libcf {
+
+/** How the k x k system of each row is solved
+ */
+enum ImplicitSolverType {
+  CONJUGATE_GRADIENT,  // cg_steps steps warm-started from the current row
+  CHOLESKY             // exact, forms the system and factors it by LLT
+};
+
+/**
+ *  Row solver of alternating least squares. Row r of X solves
+ *
+ *    (base + Y_r^T diag(w_r) Y_r) x_r = Y_r^T t_r
+ *
+ *  where Y_r are the rows of Y at the ids of rows.row(r), and w_r and
+ *  t_r the weights and targets of its values, e.g. base = lambda I,
+ *  w = 1 and t = r for explicit ALS. base is shared by all rows, so
+ *  terms every row has, like the Y^T Y of implicit feedback, are
+ *  computed once per half-sweep.
+ *
+ *  Each row gathers Y_r into scratch. CHOLESKY assembles the system
+ *  with one rank update of the gathered rows and factors it in place;
+ *  CONJUGATE_GRADIENT applies it to a vector without forming it. Rows
+ *  are cut into batches of about the same work, and a batch reuses one
+ *  scratch for all its rows.
+ */
+class ALSEngine {
+ public:
+  ALSEngine(ImplicitSolverType solver = CHOLESKY, size_t cg_steps = 3) :
+      solver_(solver), cg_steps_(cg_steps) {}
+
+  /** Solve every row of X given Y. weight(v) and target(v) map the
+   *  values of rows to w and t.
+   */
+  template <class WeightFn, class TargetFn>
+  void solve(const CSRMatrix& rows, const DMatrix& Y, const DMatrix& base,
+             const WeightFn& weight, const TargetFn& target, DMatrix& X) const {
+    CHECK_EQ(static_cast<size_t>(X.rows()), rows.num_rows());
+    CHECK_EQ(Y.cols(), X.cols());
+    auto cuts = batch_cuts(rows, 8 * num_hardware_threads());
+    dynamic_parallel_for(0, cuts.size() - 1, [&](size_t batch) {
+      Scratch scratch;
+      for (size_t idx = cuts[batch]; idx < cuts[batch + 1]; ++idx) {
+        solve_row(idx, rows, Y, base, weight, target, scratch, X);
+      }
+    });
+  }
+
+ private:
+  struct Scratch {
+    DMatrix ys, scaled, A;
+    DVector weights, targets, b, x, r, p, ap, t;
+  };
+
+  template <class WeightFn, class TargetFn>
+  void solve_row(size_t idx, const CSRMatrix& rows, const DMatrix& Y, const DMatrix& base,
+                 const WeightFn& weight, const TargetFn& target, Scratch& s, DMatrix& X) const {
+    size_t n = rows.row_size(idx);
+    if (n == 0) {
+      // nothing observed: the optimum is 0
+      X.row(idx).setZero();
+      return;
+    }
+    s.ys.resize(n, Y.cols());
+    s.weights.resize(n);
+    s.targets.resize(n);
+    const size_t* ids = rows.ids(idx);
+    const double* values = rows.values(idx);
+    for (size_t pos = 0; pos < n; ++pos) {
+      s.ys.row(pos) = Y.row(ids[pos]);
+      s.weights(pos) = weight(values[pos]);
+      s.targets(pos) = target(values[pos]);
+    }
+    s.b.noalias() = s.ys.transpose() * s.targets;
+    if (solver_ == CHOLESKY) {
+      s.scaled = s.weights.cwiseSqrt().asDiagonal() * s.ys;
+      s.A = base;
+      s.A.selfadjointView<Eigen::Lower>().rankUpdate(s.scaled.transpose());
+      Eigen::LLT<Eigen::Ref<DMatrix>, Eigen::Lower> llt(s.A);
+      CHECK(llt.info() == Eigen::Success) << "ALS system is not positive definite";
+      llt.solveInPlace(s.b);
+      X.row(idx) = s.b.transpose();
+    } else {
+      s.x = X.row(idx).transpose();
+      solve_cg(base, s);
+      X.row(idx) = s.x.transpose();
+    }
+  }
+
+  void solve_cg(const DMatrix& base, Scratch& s) const {
+    // s.ap = A v without forming A
+    auto apply = [&](const DVector& v) {
+      s.t.noalias() = s.ys * v;
+      s.t.array() *= s.weights.array();
+      s.ap.noalias() = base * v;
+      s.ap.noalias() += s.ys.transpose() * s.t;
+    };
+    apply(s.x);
+    s.r = s.b - s.ap;
+    s.p = s.r;
+    double rs = s.r.squaredNorm();
+    for (size_t step = 0; step < cg_steps_ && rs > 1e-20; ++step) {
+      apply(s.p);
+      double alpha = rs / s.p.dot(s.ap);
+      s.x.noalias() += alpha * s.p;
+      s.r.noalias() -= alpha * s.ap;
+      double rs_next = s.r.squaredNorm();
+      s.p = s.r + (rs_next / rs) * s.p;
+      rs = rs_next;
+    }
+  }
+
+  // cut the rows into about num_batches ranges of equal entries + rows
+  static std::vector<size_t> batch_cuts(const CSRMatrix& rows, size_t num_batches) {
+    size_t num_rows = rows.num_rows();
+    size_t work = rows.num_entries() + num_rows;
+    std::vector<size_t> rets(1, 0);
+    for (size_t idx = 0; idx < num_rows; ++idx) {
+      size_t done = rows.offsets()[idx + 1] + idx + 1;
+      if (done * num_batches >= work * rets.size()) {
+        rets.push_back(idx + 1);
+      }
+    }
+    if (rets.back() != num_rows) {
+      rets.push_back(num_rows);
+    }
+    return rets;
+  }
+
+ private:
+  ImplicitSolverType solver_;
+  size_t cg_steps_;
+};
+
+} // namespace
+
+#endif // _LIBCF_ALS_ENGINE_HPP_
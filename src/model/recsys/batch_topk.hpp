@@ -0,0 +1,97 @@
+#ifndef _LIBCF_BATCH_TOPK_HPP_
+#define _LIBCF_BATCH_TOPK_HPP_
+
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include <base/mat.hpp>
+#include <base/csr.hpp>
+#include <base/topk.hpp>
+#include <base/parallel.hpp>
+
+namespace libcf {
+
+/** Padding for batch recommendation lists shorter than topk
+ */
+const size_t kNoItem = static_cast<size_t>(-1);
+
+/**
+ *  Exact top-k items for a batch of users under
+ *
+ *    score(u, i) = user_vec(u) . x_i + b_i
+ *
+ *  Users are gathered in tiles of tile_users rows and scored against
+ *  blocks of tile_items items with one GEMM per tile pair, so each block
+ *  of item vectors is read once per tile instead of once per user. Items
+ *  in exclusions.row(uid) are skipped. The list of request idx is written
+ *  to rec_lists[idx * topk, (idx + 1) * topk), best first; a user with
+ *  fewer than topk items left gets all of them, padded with kNoItem.
+ *
+ *  user_vec(uid, row) writes the user's vector into row, a DMatrix::RowXpr
+ *  of the tile; all scratch buffers are per thread and reused, so the
+ *  batch itself does no per-user allocation.
+ */
+template <class UserVecFn>
+void batch_inner_product_topk(const DMatrixRef& item_vecs, const DVectorRef& item_bias,
+                              const UserVecFn& user_vec,
+                              const size_t* uids, size_t num_requests, size_t topk,
+                              const CSRIndex& exclusions, size_t* rec_lists,
+                              size_t tile_users = 64, size_t tile_items = 2048) {
+  size_t num_items = item_vecs.rows();
+  size_t num_dim = item_vecs.cols();
+  size_t num_tiles = (num_requests + tile_users - 1) / tile_users;
+  const double neg_inf = - std::numeric_limits<double>::infinity();
+
+  parallel_for(0, num_tiles, [&](size_t tile_id) {
+    static thread_local DMatrix users;
+    static thread_local DMatrix scores;
+    static thread_local std::vector<TopK<double>> selectors;
+    static thread_local std::vector<const size_t*> cursors;
+    users.resize(tile_users, num_dim);
+    scores.resize(tile_users, tile_items);
+    if (selectors.size() < tile_users) {
+      selectors.resize(tile_users);
+    }
+    cursors.resize(tile_users);
+
+    size_t begin = tile_id * tile_users;
+    size_t n = std::min(tile_users, num_requests - begin);
+    for (size_t r = 0; r < n; ++r) {
+      size_t uid = uids[begin + r];
+      // keep no more than the items left, so excluded ones never fill the list
+      size_t num_left = num_items - std::min(exclusions.row_size(uid), num_items);
+      user_vec(uid, users.row(r));
+      selectors[r].reset(std::min(topk, num_left));
+      cursors[r] = exclusions.row(uid).begin();
+    }
+
+    for (size_t item_begin = 0; item_begin < num_items; item_begin += tile_items) {
+      size_t m = std::min(tile_items, num_items - item_begin);
+      auto block = scores.topLeftCorner(n, m);
+      block.noalias() = users.topRows(n) * item_vecs.middleRows(item_begin, m).transpose();
+      if (item_bias.size() > 0) {
+        block.rowwise() += item_bias.segment(item_begin, m).transpose();
+      }
+      for (size_t r = 0; r < n; ++r) {
+        // exclusion rows are sorted, so walk them along with the blocks
+        const size_t* row_end = exclusions.row(uids[begin + r]).end();
+        auto& cur = cursors[r];
+        for (; cur != row_end && *cur < item_begin + m; ++cur) {
+          scores(r, *cur - item_begin) = neg_inf;
+        }
+        selectors[r].push_block(scores.row(r).data(), item_begin, m);
+      }
+    }
+
+    for (size_t r = 0; r < n; ++r) {
+      size_t* out = rec_lists + (begin + r) * topk;
+      selectors[r].copy_sorted_ids(out);
+      std::fill(out + selectors[r].size(), out + topk, kNoItem);
+    }
+  });
+}
+
+} // namespace
+
+#endif // _LIBCF_BATCH_TOPK_HPP_
@@ -1,6 +1,7 @@
 #ifndef _LIBCF_BPR_HPP_
 #define _LIBCF_BPR_HPP_
 
+#include <numeric>
 #include <algorithm>
 #include <base/heap.hpp>
 #include <base/utils.hpp>
@@ -18,8 +19,12 @@ struct BPRConfig {
   PenaltyType pt = L2;  // penalty type
   size_t num_dim = 10;
   size_t num_neg = 5;
+  size_t num_strata = 0;  // > 0 for parallel SGD on num_strata^2 blocks, see StrataSchedule
   bool using_bias_term = true;
   bool using_adagrad = true;
+  RetrievalType retrieval = EXACT_MIPS;
+  HNSWConfig hnsw;
+  QuantizedConfig quant;
 };
 
 class BPR : public IMF {
@@ -31,8 +36,12 @@ class BPR : public IMF {
     lambda_ = mcfg.lambda;
     num_dim_ = mcfg.num_dim;
     num_neg_ = mcfg.num_neg;
+    num_strata_ = mcfg.num_strata;
     using_bias_term_ = mcfg.using_bias_term;
     using_adagrad_ = mcfg.using_adagrad;
+    retrieval_ = mcfg.retrieval;
+    hnsw_config_ = mcfg.hnsw;
+    quant_index_ = QuantizedIndex(mcfg.quant);
     loss_ = Loss::create(mcfg.lt);
     penalty_ = Penalty::create(mcfg.pt);
 
@@ -45,7 +54,9 @@ class BPR : public IMF {
         << "\t{Dim: " << num_dim_ << "}, "
         << "{BiasTerm: " << using_bias_term_ << "}, "
         << "{Using AdaGrad: " << using_adagrad_ << "}, "
-        << "{Num Negative: " << num_neg_ << "}";
+        << "{Num Negative: " << num_neg_ << "}, "
+        << "{Num Strata: " << num_strata_ << "}, "
+        << "{Retrieval: " << retrieval_ << "}";
   }
 
   //BPR() : BPR(BPRConfig()) {}
@@ -55,25 +66,109 @@ class BPR : public IMF {
   }
  
   virtual void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("bpr.train_one_iteration");
+    accumulated_loss_ = 0.;
+    mips_index_.clear();
+    ann_index_.reset();
+    quant_index_.clear();
+    if (num_strata_ > 0) {
+      train_strata();
+      return;
+    }
     for (size_t uid = 0; uid < num_users_; ++uid) {
+      train_one_user(uid);
+    }
+  }
+
+  /** One epoch of parallel SGD over the strata, pairing each positive
+   *  item with negative ones of the same item block.
+   */
+  void train_strata() {
+    strata_.build(user_rated_items_.table(), num_users_, num_items_, num_strata_);
+    std::vector<size_t> block_updates(num_strata_, 0);
+    accumulated_loss_ = strata_.run(Random::rng(), [&](size_t ub, size_t ib, Random::rng_type& rng) {
+      auto& block = strata_.block(ub, ib);
+      double loss = 0.;
+      for (auto& user : block.users) {
+        if (!strata_.has_negative_item(ib, user)) continue;
+        for (size_t pos = user.begin; pos < user.end; ++pos) {
+          for (size_t idx = 0; idx < num_neg_; ++idx) {
+            size_t jid = strata_.sample_negative_item(ib, *user.rated, rng);
+            loss += sgd_update_pair(user.uid, block.entries[pos].first, jid, 1.);
+            ++block_updates[ub];
+          }
+        }
+      }
+      return loss;
+    });
+    if (profiler_) {
+      profiler_->add_users(user_rated_items_.size());
+      profiler_->add_updates(std::accumulate(block_updates.begin(), block_updates.end(), size_t(0)));
+    }
+  }
+
+  /** Loss of num_neg_ pairs per positive item, the objective
+   *  train_one_user accumulates, see IMF::data_loss
+   */
+  virtual double data_loss(const Data& data_set, size_t sample_size=0) const {
+    return sum_user_losses(sample_size, [&](size_t uid) {
       auto fit = user_rated_items_.find(uid);
-      CHECK(fit != user_rated_items_.end());
+      if (fit == user_rated_items_.end()) return 0.;
       auto& item_map = fit->second;
+      if (item_map.size() >= num_items_) return 0.;
+      Random::rng_type rng(uid);
+      double rets = 0.;
       for (auto& p : item_map) {
-        auto& iid = p.first;
+        double pred_i = predict_user_item_rating(uid, p.first);
         for (size_t idx = 0; idx < num_neg_; ++idx) {
-          size_t jid = sample_negative_item(item_map);
-          train_one_pair(uid, iid, jid, 1.);
+          size_t jid = sample_negative_item(item_map, rng);
+          rets += loss_->evaluate(pred_i - predict_user_item_rating(uid, jid), 1.);
         }
       }
+      return rets;
+    });
+  }
+
+  virtual void train_one_user(size_t uid) {
+    auto fit = user_rated_items_.find(uid);
+    CHECK(fit != user_rated_items_.end());
+    auto& item_map = fit->second;
+    for (auto& p : item_map) {
+      auto& iid = p.first;
+      for (size_t idx = 0; idx < num_neg_; ++idx) {
+        size_t jid;
+        {
+          ScopedPhase scope(profiler_, PHASE_SAMPLING);
+          jid = sample_negative_item(item_map);
+        }
+        train_one_pair(uid, iid, jid, 1.);
+      }
+    }
+    if (profiler_) {
+      profiler_->add_users(1);
+      profiler_->add_updates(item_map.size() * num_neg_);
     }
   }
 
   virtual void train_one_pair(size_t uid, size_t iid, size_t jid, double rui) {
-    double pred_i = predict_user_item_rating(uid, iid);
-    double pred_j = predict_user_item_rating(uid, jid);
-    double pred_ij = pred_i - pred_j;
-    double gradient = loss_->gradient(pred_ij, rui);
+    accumulated_loss_ += sgd_update_pair(uid, iid, jid, rui, profiler_);
+    touch_item(iid);
+    touch_item(jid);
+  }
+
+  /** One SGD step on the pair, returns its loss if accumulate_loss_.
+   *  Writes only the rows of uid, iid and jid.
+   */
+  double sgd_update_pair(size_t uid, size_t iid, size_t jid, double rui,
+                         PhaseProfiler* profiler = nullptr) {
+    double pred_ij, gradient;
+    {
+      ScopedPhase scope(profiler, PHASE_FORWARD);
+      double pred_i = predict_user_item_rating(uid, iid);
+      double pred_j = predict_user_item_rating(uid, jid);
+      pred_ij = pred_i - pred_j;
+      gradient = loss_->gradient(pred_ij, rui);
+    }
 
     double ib_grad = gradient + 2. * lambda_ * ib_(iid);
     double jb_grad = - gradient + 2. * lambda_ * ib_(jid);
@@ -103,6 +198,7 @@ class BPR : public IMF {
     uv_.row(uid) -= learn_rate_ * uv_grad;
     iv_.row(iid) -= learn_rate_ * iv_grad;
     iv_.row(jid) -= learn_rate_ * jv_grad;
+    return accumulate_loss_ ? loss_->evaluate(pred_ij, rui) : 0.;
   }
 };
 
@@ -6,6 +6,10 @@
 #include <base/instance.hpp>
 #include <base/data.hpp>
 #include <base/parallel.hpp>
+#include <model/recsys/mips.hpp>
+#include <model/recsys/hnsw.hpp>
+#include <model/recsys/quantized.hpp>
+#include <model/recsys/batch_topk.hpp>
 #include <model/recsys/recsys_model_base.hpp>
 
 namespace libcf {
@@ -28,6 +32,9 @@ struct CDAEConfig {
   double beta = 0.;
   bool linear_function = false;
   bool tanh = false;
+  RetrievalType retrieval = EXACT_MIPS;
+  HNSWConfig hnsw;
+  QuantizedConfig quant;
 };
 
 /* Denoising Auto-Encoder
@@ -53,6 +60,9 @@ class CDAE : public RecsysModelBase {
     beta_ = mcfg.beta;
     linear_function_ = mcfg.linear_function;
     tanh_ = mcfg.tanh;
+    retrieval_ = mcfg.retrieval;
+    hnsw_config_ = mcfg.hnsw;
+    quant_index_ = QuantizedIndex(mcfg.quant);
 
     LOG(INFO) << "CDAE Configure: \n" 
         << "\t{lambda: " << lambda_ << "}, "
@@ -70,15 +80,24 @@ class CDAE : public RecsysModelBase {
         << "{Scaled: " << scaled_ << "}\n"
         << "\t{Beta: " << beta_ << "}, "
         << "{LinearFunction: " << linear_function_ << "}, "
-        << "{tanh: " << tanh_ << "}"; 
+        << "{tanh: " << tanh_ << "}, "
+        << "{Retrieval: " << retrieval_ << "}"; 
   }
 
   CDAE() : CDAE(CDAEConfig()) {}
   
   double data_loss(const Data& data_set, size_t sample_size=0) const {
     std::atomic<double> rets(0.);
+
+    // with sample_size > 0, estimate the loss on a fixed, evenly strided
+    // subset of users and scale it up to the full user set
+    size_t num_samples = num_users_;
+    if (sample_size > 0 && sample_size < num_users_) {
+      num_samples = sample_size;
+    }
     
-    parallel_for (0, num_users_, [&](size_t uid) {
+    parallel_for (0, num_samples, [&](size_t sample_idx) {
+      size_t uid = sample_idx * num_users_ / num_samples;
       auto fit = user_rated_items_.find(uid);
       CHECK(fit != user_rated_items_.end());
       auto& item_set = fit->second;
@@ -97,7 +116,11 @@ class CDAE : public RecsysModelBase {
       }
       rets = rets + user_rets / num_corruptions_;
     });
-    return rets;
+    return rets * static_cast<double>(num_users_) / num_samples;
+  }
+
+  double accumulated_data_loss(const Data& data_set) const {
+    return accumulated_loss_;
   }
    
   double penalty_loss() const {
@@ -131,20 +154,271 @@ class CDAE : public RecsysModelBase {
       Uu = DMatrix::Constant(num_users_, num_dim_, 1.);
       Uu_ag = DMatrix::Constant(num_users_, num_dim_, 0.0001);
     }
+    mapped_.reset();
+    mips_index_.clear();
+    ann_index_.reset();
+    quant_index_.clear();
+    clear_hidden_cache();
+
+    MemoryReport report;
+    memory_usage(report);
+    LOG(INFO) << "CDAE Memory: \n" << report;
   } 
 
+  void memory_usage(MemoryReport& report) const {
+    RecsysModelBase::memory_usage(report);
+    report.add("model.matrices", memory_bytes(W) + memory_bytes(V) + memory_bytes(Wu)
+               + memory_bytes(Uu) + memory_bytes(b) + memory_bytes(b_prime) + memory_bytes(bu));
+    report.add("model.adagrad", memory_bytes(W_ag) + memory_bytes(V_ag) + memory_bytes(Wu_ag)
+               + memory_bytes(Uu_ag) + memory_bytes(b_ag) + memory_bytes(b_prime_ag)
+               + memory_bytes(bu_ag));
+    report.add("model.hidden_cache", memory_bytes(hidden_input_) + memory_bytes(hidden_)
+               + owned_bytes(hidden_cached_));
+  }
+
+  /** Projected memory_usage after reset, before the hidden cache and any
+   *  retrieval index, which pre_recommend adds
+   */
+  static MemoryReport projected_memory(const CDAEConfig& mcfg, size_t num_users,
+                                       size_t num_items, size_t num_interactions) {
+    size_t item_matrices = (mcfg.asymmetric ? 2 : 1) * projected_dense_bytes(num_items, mcfg.num_dim);
+    size_t user_matrices = ((mcfg.user_factor ? 1 : 0) + (mcfg.linear_function ? 1 : 0))
+        * projected_dense_bytes(num_users, mcfg.num_dim);
+    size_t params = item_matrices + user_matrices + projected_dense_bytes(mcfg.num_dim, 1)
+        + projected_dense_bytes(num_items, 1) + projected_dense_bytes(num_users, 1);
+    MemoryReport rets;
+    rets.add("model.user_rated_items", projected_history_bytes(num_users, num_interactions));
+    rets.add("model.matrices", params);
+    rets.add("model.adagrad", params);
+    rets.add("model.hidden_cache", 0);
+    return rets;
+  }
+
   void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("cdae.train_one_iteration");
+    accumulated_loss_ = 0.;
+    mips_index_.clear();
+    ann_index_.reset();
+    quant_index_.clear();
+    clear_hidden_cache();
     for (size_t uid = 0; uid < num_users_; ++uid) {
-      auto fit = user_rated_items_.find(uid);
-      CHECK(fit != user_rated_items_.end());
-      auto& item_set = fit->second;
-      for (size_t idx = 0; idx < num_corruptions_; ++idx) {
-        auto corrpted_item_set = get_corrputed_input(item_set, corruption_ratio_);
-        train_one_user_corruption(uid, corrpted_item_set, item_set);
+      train_one_user(uid);
+    }
+  }
+
+  void train_one_user(size_t uid) {
+    check_trainable();
+    auto fit = user_rated_items_.find(uid);
+    CHECK(fit != user_rated_items_.end());
+    auto& item_set = fit->second;
+    for (size_t idx = 0; idx < num_corruptions_; ++idx) {
+      std::unordered_map<size_t, double> corrpted_item_set;
+      {
+        ScopedPhase scope(profiler_, PHASE_SAMPLING);
+        corrpted_item_set = get_corrputed_input(item_set, corruption_ratio_);
       }
+      train_one_user_corruption(uid, corrpted_item_set, item_set);
+    }
+    if (profiler_) {
+      profiler_->add_users(1);
+      profiler_->add_updates(num_corruptions_ * item_set.size() * (1 + num_neg_));
+    }
+  }
+
+  /** The parameters grow by reserve_rows. Inference and checkpoints
+   *  read the rows in use only, and the spare rows add 0 to the penalty.
+   */
+  void grow(size_t num_users, size_t num_items) {
+    size_t old_num_users = num_users_;
+    size_t old_num_items = num_items_;
+    size_t new_users = num_users - num_users_;
+    size_t new_items = num_items - num_items_;
+    RecsysModelBase::grow(num_users, num_items);
+
+    double init_scale = 4. * std::sqrt(6. / static_cast<double>(num_items_ + num_dim_));
+    reserve_rows(W, num_items_, 0.);
+    W.middleRows(old_num_items, new_items) = DMatrix::Random(new_items, num_dim_) * init_scale;
+    reserve_rows(W_ag, num_items_, 0.0001);
+    if (asymmetric_) {
+      reserve_rows(V, num_items_, 0.);
+      V.middleRows(old_num_items, new_items) = DMatrix::Random(new_items, num_dim_) * init_scale;
+      reserve_rows(V_ag, num_items_, 0.0001);
+    }
+    if (user_factor_) {
+      reserve_rows(Wu, num_users_, 0.);
+      Wu.middleRows(old_num_users, new_users) = DMatrix::Random(new_users, num_dim_) * init_scale;
+      reserve_rows(Wu_ag, num_users_, 0.0001);
+    }
+    reserve_rows(b_prime, num_items_, 0.);
+    reserve_rows(b_prime_ag, num_items_, 0.0001);
+    reserve_rows(bu, num_users_, 0.);
+    reserve_rows(bu_ag, num_users_, 0.0001);
+    if (linear_function_) {
+      reserve_rows(Uu, num_users_, 1.);
+      reserve_rows(Uu_ag, num_users_, 0.0001);
+    }
+
+    if (!hidden_cached_.empty()) {
+      reserve_rows(hidden_input_, num_users_, 0.);
+      reserve_rows(hidden_, num_users_, 0.);
+      hidden_cached_.resize(num_users_, 0);
+      for (size_t uid = old_num_users; uid < num_users_; ++uid) {
+        cache_hidden(uid);
+      }
+    }
+  }
+
+  /** Patches the retrieval indexes with the changed items and refreshes
+   *  the cached hidden values of the trained users. Other users' cached
+   *  values drift with the shared parameters until the cache is rebuilt.
+   */
+  void end_online_update(const std::vector<size_t>& uids) {
+    RecsysModelBase::end_online_update(uids);
+    DMatrixView item_vecs = output_weights();
+    if (!mips_index_.empty()) {
+      mips_index_.update(item_vecs, output_bias(), updated_items_);
+    }
+    if (!quant_index_.empty()) {
+      quant_index_.update(item_vecs, output_bias(), updated_items_);
+    }
+    update_ann_index(item_vecs, output_bias());
+    if (!hidden_cached_.empty()) {
+      parallel_for(0, uids.size(), [&](size_t idx) {
+                   cache_hidden(uids[idx]);
+                   });
     }
   }
   
+  void recommend_batch(const size_t* uids, size_t num_requests, size_t topk,
+                       const CSRIndex& exclusions, size_t* rec_lists) const {
+    LIBCF_TRACE_SCOPE("cdae.recommend_batch");
+    if (ann_index_ || !quant_index_.empty()) {
+      // approximate retrieval works one user at a time
+      RecsysModelBase::recommend_batch(uids, num_requests, topk, exclusions, rec_lists);
+      return;
+    }
+    // the cached rows hold the training histories, so they stand in for
+    // the exclusion rows only if those are the current histories
+    bool history_exclusions = exclusions.version() == user_rated_items_.version();
+    auto user_vec = [&](size_t uid, DMatrix::RowXpr row) {
+      if (has_cached_hidden(uid) && (corruption_ratio_ == 1. || history_exclusions)) {
+        row = hidden_.row(uid);
+        return;
+      }
+      if (corruption_ratio_ != 1.) {
+        get_hidden_input(uid, exclusions.row(uid), 1., row);
+      } else {
+        get_hidden_input(uid, empty_history(), 1., row);
+      }
+      activate(row);
+    };
+    batch_inner_product_topk(output_weights(), output_bias(), user_vec,
+                             uids, num_requests, topk, exclusions, rec_lists);
+  }
+
+  void write_checkpoint(CheckpointWriter& ckpt, bool optimizer_state) const {
+    RecsysModelBase::write_checkpoint(ckpt, optimizer_state);
+    ckpt.add("model.type", std::string("CDAE"));
+    ckpt.add("W", item_weights());
+    ckpt.add("b", hidden_bias());
+    ckpt.add("b_prime", output_bias());
+    ckpt.add("bu", mapped_ ? mapped_->bu : view(bu, num_users_));
+    if (asymmetric_) ckpt.add("V", output_weights());
+    if (user_factor_) ckpt.add("Wu", user_factors());
+    if (linear_function_) ckpt.add("Uu", user_scales());
+    if (!optimizer_state) return;
+    if (mapped_) {
+      // a loaded model passes on the state of its checkpoint
+      for (auto& name : {"W_ag", "b_ag", "b_prime_ag", "bu_ag", "V_ag", "Wu_ag", "Uu_ag"}) {
+        if (checkpoint_->has(name)) ckpt.add(name, checkpoint_->matrix(name));
+      }
+      return;
+    }
+    ckpt.add("W_ag", view(W_ag, num_items_));
+    ckpt.add("b_ag", b_ag);
+    ckpt.add("b_prime_ag", view(b_prime_ag, num_items_));
+    ckpt.add("bu_ag", view(bu_ag, num_users_));
+    if (asymmetric_) ckpt.add("V_ag", view(V_ag, num_items_));
+    if (user_factor_) ckpt.add("Wu_ag", view(Wu_ag, num_users_));
+    if (linear_function_) ckpt.add("Uu_ag", view(Uu_ag, num_users_));
+  }
+
+  bool check_checkpoint(const Checkpoint& ckpt, std::string* error) const {
+    if (!RecsysModelBase::check_checkpoint(ckpt, error)) return false;
+    if (!ckpt.has("model.type", CKPT_BYTES) || ckpt.bytes("model.type") != "CDAE") {
+      return checkpoint_error(error, "Not a CDAE checkpoint");
+    }
+    if (ckpt.has("V") != asymmetric_) {
+      return checkpoint_error(error, "Checkpoint asymmetric differs from the config");
+    }
+    if (ckpt.has("Wu") != user_factor_) {
+      return checkpoint_error(error, "Checkpoint user_factor differs from the config");
+    }
+    if (ckpt.has("Uu") != linear_function_) {
+      return checkpoint_error(error, "Checkpoint linear_function differs from the config");
+    }
+    auto shape = ckpt.array<uint64_t>("model.shape");
+    auto shaped = [&](const std::string& suffix) {
+      return ckpt.has("W" + suffix, CKPT_DOUBLE, shape[1], num_dim_)
+          && ckpt.has("b" + suffix, CKPT_DOUBLE, num_dim_, 1)
+          && ckpt.has("b_prime" + suffix, CKPT_DOUBLE, shape[1], 1)
+          && ckpt.has("bu" + suffix, CKPT_DOUBLE, shape[0], 1)
+          && (!asymmetric_ || ckpt.has("V" + suffix, CKPT_DOUBLE, shape[1], num_dim_))
+          && (!user_factor_ || ckpt.has("Wu" + suffix, CKPT_DOUBLE, shape[0], num_dim_))
+          && (!linear_function_ || ckpt.has("Uu" + suffix, CKPT_DOUBLE, shape[0], num_dim_));
+    };
+    if (!shaped("")) {
+      return checkpoint_error(error, "CDAE parameters differ from model.shape or the config num_dim");
+    }
+    if (ckpt.has("W_ag") && !shaped("_ag")) {
+      return checkpoint_error(error, "Corrupted CDAE optimizer state");
+    }
+    return true;
+  }
+
+  /** The parameters are read in place from ckpt, see own_parameters
+   */
+  void read_checkpoint(const Checkpoint& ckpt) {
+    RecsysModelBase::read_checkpoint(ckpt);
+    mapped_ = std::make_shared<const MappedParameters>(ckpt);
+    for (auto m : {&W, &V, &Wu, &Uu, &W_ag, &V_ag, &Wu_ag, &Uu_ag}) {
+      m->resize(0, 0);
+    }
+    for (auto v : {&b, &b_prime, &bu, &b_ag, &b_prime_ag, &bu_ag}) {
+      v->resize(0);
+    }
+
+    mips_index_.clear();
+    quant_index_.clear();
+    clear_hidden_cache();
+  }
+
+  void own_parameters() {
+    CHECK(mapped_ != nullptr);
+    W = mapped_->W;
+    b = mapped_->b;
+    b_prime = mapped_->b_prime;
+    bu = mapped_->bu;
+    if (asymmetric_) V = mapped_->V;
+    if (user_factor_) Wu = mapped_->Wu;
+    if (linear_function_) Uu = mapped_->Uu;
+
+    // without the optimizer state training restarts AdaGrad
+    bool optimizer_state = checkpoint_->has("W_ag");
+    auto read_or_init = [&](const std::string& name, size_t rows, size_t cols) -> DMatrix {
+      return optimizer_state ? DMatrix(checkpoint_->matrix(name))
+          : DMatrix::Constant(rows, cols, 0.0001);
+    };
+    W_ag = read_or_init("W_ag", num_items_, num_dim_);
+    b_ag = read_or_init("b_ag", num_dim_, 1);
+    b_prime_ag = read_or_init("b_prime_ag", num_items_, 1);
+    bu_ag = read_or_init("bu_ag", num_users_, 1);
+    if (asymmetric_) V_ag = read_or_init("V_ag", num_items_, num_dim_);
+    if (user_factor_) Wu_ag = read_or_init("Wu_ag", num_users_, num_dim_);
+    if (linear_function_) Uu_ag = read_or_init("Uu_ag", num_users_, num_dim_);
+    mapped_.reset();
+  }
+
   DMatrix get_user_representations() {
     
     DMatrix user_vec(num_users_, num_dim_);
@@ -158,41 +432,262 @@ class CDAE : public RecsysModelBase {
     return std::move(user_vec);
   }
 
+  /** Materialize the hidden values of all users from their training
+   *  histories. recommend reads a user's row instead of summing W over
+   *  the history when it is given the user's own history row, and
+   *  recommend_batch when its exclusions are the current history_index.
+   */
+  void build_hidden_cache() {
+    Timer timer;
+    CSRIndex histories = history_index();
+    hidden_input_.resize(num_users_, num_dim_);
+    hidden_.resize(num_users_, num_dim_);
+    hidden_cached_.assign(num_users_, 0);
+    parallel_for(0, num_users_, [&](size_t uid) {
+      cache_hidden(uid, histories.row(uid));
+    });
+    LOG(INFO) << "Cached hidden values of " << num_users_ << " users in " << timer;
+  }
+
+  void clear_hidden_cache() {
+    hidden_input_.resize(0, 0);
+    hidden_.resize(0, 0);
+    hidden_cached_.clear();
+  }
+
+  // cache the hidden values of one user from the training history,
+  // users without one are cached with an empty history
+  void cache_hidden(size_t uid) {
+    auto fit = user_rated_items_.find(uid);
+    if (fit != user_rated_items_.end()) {
+      cache_hidden(uid, fit->second);
+    } else {
+      cache_hidden(uid, empty_history());
+    }
+  }
+
+  // history is a hashtable of (iid, rating) or a range of iids
+  template <class ItemSet>
+  void cache_hidden(size_t uid, const ItemSet& history) {
+    if (corruption_ratio_ != 1.) {
+      get_hidden_input(uid, history, 1., hidden_input_.row(uid));
+    } else {
+      get_hidden_input(uid, empty_history(), 1., hidden_input_.row(uid));
+    }
+    hidden_.row(uid) = hidden_input_.row(uid);
+    activate(hidden_.row(uid));
+    hidden_cached_[uid] = 1;
+  }
+
+  /** Whether the cached hidden values of the user match the current
+   *  training history
+   */
+  bool has_cached_hidden(size_t uid) const {
+    return uid < hidden_cached_.size() && hidden_cached_[uid];
+  }
+
+  /** Appends to the history and drops the user's cached hidden values,
+   *  which end_online_update rebuilds for the trained users
+   */
+  bool add_interaction(size_t uid, size_t iid, double rating = 1.) {
+    if (uid < hidden_cached_.size()) {
+      hidden_cached_[uid] = 0;
+    }
+    return RecsysModelBase::add_interaction(uid, iid, rating);
+  }
+
+  /** Append items to a known user's history. The cached hidden values
+   *  of the user are updated in O(|iids| x dim) instead of being rebuilt.
+   *  Not safe to call concurrently with recommend.
+   */
+  void add_user_items(size_t uid, const std::vector<size_t>& iids) {
+    check_trainable();
+    CHECK_LT(uid, num_users_);
+    bool cached = has_cached_hidden(uid);
+    auto& item_map = user_rated_items_[uid];
+    DVector delta = DVector::Zero(num_dim_);
+    for (auto& iid : iids) {
+      CHECK_LT(iid, num_items_);
+      if (item_map.count(iid)) continue;
+      item_map[iid] = 1.;
+      delta += W.row(iid);
+    }
+    if (!cached) return;
+    if (corruption_ratio_ != 1.) {
+      if (linear_function_) {
+        delta = Uu.row(uid).transpose().cwiseProduct(delta);
+      }
+      hidden_input_.row(uid) += delta.transpose();
+      hidden_.row(uid) = hidden_input_.row(uid);
+      activate(hidden_.row(uid));
+    }
+  }
+
+  /** Fold in a user from an arbitrary item list without retraining.
+   *
+   *  uid is the user's row for users known at reset time, or kNoUser for
+   *  new users, whose user factor starts at zero. With num_steps > 0 the
+   *  user factor is fitted by num_steps gradient steps on reconstructing
+   *  iids (with num_neg sampled negatives each, drawn from Random), on a
+   *  local copy and with all item parameters frozen. Returns the hidden
+   *  values. iids usually come from a request, so they are all checked
+   *  before any is used.
+   */
+  DVector fold_in(const std::vector<size_t>& iids, size_t num_steps = 0,
+                  size_t uid = kNoUser) const {
+    bool known_user = (uid != kNoUser);
+    if (known_user) {
+      CHECK_LT(uid, num_users_);
+    }
+    for (auto& iid : iids) {
+      CHECK_LT(iid, num_items_) << "Unknown item in the fold-in history";
+    }
+
+    DVector h_input = DVector::Zero(num_dim_);
+    if (corruption_ratio_ != 1.) {
+      DMatrixView W_in = item_weights();
+      for (auto& iid : iids) {
+        h_input += W_in.row(iid);
+      }
+      if (linear_function_ && known_user) {
+        // new users keep the initial all-ones Uu row
+        h_input = user_scales().row(uid).transpose().cwiseProduct(h_input);
+      }
+    }
+    h_input += hidden_bias();
+
+    DVector wu = DVector::Zero(num_dim_);
+    if (user_factor_ && known_user) {
+      wu = user_factors().row(uid);
+    }
+
+    if (user_factor_ && num_steps > 0 && !iids.empty()) {
+      ScopedBitsetMask<std::vector<size_t>> rated_mask(item_mask(), iids);
+      DVector wu_ag = DVector::Constant(num_dim_, 0.0001);
+      // no negatives to draw when iids may cover every item
+      size_t num_negatives = iids.size() < num_items_ ? iids.size() * num_neg_ : 0;
+      std::vector<size_t> negatives(num_negatives);
+      for (size_t step = 0; step < num_steps; ++step) {
+        DVector z = h_input + wu;
+        activate(z);
+        DVector z_1_z = DVector::Ones(num_dim_);
+        if (! linear_) {
+          if (! tanh_) {
+            z_1_z = z - z.cwiseProduct(z);
+          } else {
+            z_1_z = DVector::Ones(num_dim_) - z.cwiseProduct(z); 
+          }
+        }
+        for (auto& jid : negatives) {
+          do {
+            jid = Random::rng() % num_items_;
+          } while (rated_mask.test(jid));
+        }
+
+        DVector hidden_gradient = DVector::Zero(num_dim_);
+        DMatrixView item_vecs = output_weights();
+        for (auto& iid : iids) {
+          hidden_gradient += loss_->gradient(get_output_values(z, iid), 1.) * item_vecs.row(iid);
+        }
+        for (auto& jid : negatives) {
+          hidden_gradient += loss_->gradient(get_output_values(z, jid), 0.) * item_vecs.row(jid);
+        }
+
+        DVector grad = hidden_gradient.cwiseProduct(z_1_z) + lambda_ * wu;
+        if (using_adagrad_) {
+          wu_ag += grad.cwiseProduct(grad);
+          grad = grad.cwiseQuotient((wu_ag.cwiseSqrt().array() + beta_).matrix());
+        }
+        wu -= learn_rate_ * grad;
+      }
+    }
+
+    DVector z = h_input + wu;
+    activate(z);
+    return z;
+  }
+
+  /** Top-k items for a folded-in user, excluding iids, see fold_in.
+   *  With fewer than topk items left the list is padded with kNoItem.
+   */
+  std::vector<size_t> recommend_fold_in(const std::vector<size_t>& iids, size_t topk,
+                                        size_t num_steps = 0, size_t uid = kNoUser) const {
+    DVector z = fold_in(iids, num_steps, uid);
+    // iids may repeat items, count each once
+    std::vector<size_t> rated(iids);
+    std::sort(rated.begin(), rated.end());
+    rated.erase(std::unique(rated.begin(), rated.end()), rated.end());
+    size_t num_left = num_items_ - rated.size();
+    auto rets = recommend_hidden(z, std::min(topk, num_left), rated);
+    rets.resize(topk, kNoItem);
+    return rets;
+  }
+
+  void pre_recommend() {
+    LIBCF_TRACE_SCOPE("cdae.pre_recommend");
+    build_hidden_cache();
+    DMatrixView item_vecs = output_weights();
+    if (retrieval_ == ANN_HNSW) {
+      build_ann_index(item_vecs, output_bias());
+    } else if (retrieval_ == EXACT_MIPS) {
+      mips_index_.build(item_vecs, output_bias());
+    } else if (retrieval_ == QUANTIZED) {
+      quant_index_.build(item_vecs, output_bias());
+    }
+  }
+
   // required by evaluation measure TOPN
   std::vector<size_t> recommend(size_t uid, size_t topk,
                                 const std::unordered_map<size_t, double>& rated_item_set) const {
     size_t item_id = 0;
-    size_t item_id_end = item_id + data_->feature_group_total_dimension(1);
+    size_t item_id_end = item_id + num_items_;
      
+    // the cache holds the training history, so it answers only for the
+    // user's own history row, not for any set of the same size
+    auto fit = user_rated_items_.find(uid);
+    bool own_history = fit != user_rated_items_.end() && &fit->second == &rated_item_set;
     DVector z = DVector::Zero(num_dim_);
-    if (corruption_ratio_ != 1.) { 
+    if (has_cached_hidden(uid) && (corruption_ratio_ == 1. || own_history)) {
+      z = hidden_.row(uid).transpose();
+    } else if (corruption_ratio_ != 1.) { 
       z = get_hidden_values(uid, rated_item_set);
     } else { 
-      z = get_hidden_values(uid, std::unordered_map<size_t, double>{});
+      z = get_hidden_values(uid, empty_history());
     }
 
-    Heap<std::pair<size_t, double>> topk_heap(sort_by_second_desc<size_t, double>, topk);
-    double pred;
-    for (; item_id != item_id_end; ++item_id) {
-      if (rated_item_set.count(item_id)) {
-        continue;
-      }
-      pred = get_output_values(z, item_id);
-      if (topk_heap.size() < topk) {
-        topk_heap.push({item_id, pred});
-      } else {
-        topk_heap.push_and_pop({item_id, pred});
-      }
+    CHECK_GE(item_id_end - rated_item_set.size(), topk);
+    return recommend_hidden(z, topk, rated_item_set);
+  }
+
+  // top-k items for the hidden values z, rated_items is a hashtable of
+  // (iid, rating) or a range of iids
+  template <class ItemSet>
+  std::vector<size_t> recommend_hidden(const DVector& z, size_t topk,
+                                       const ItemSet& rated_items) const {
+    if (ann_index_) {
+      ScopedBitsetMask<ItemSet> rated_mask(item_mask(), rated_items);
+      return ann_index_->search(z, topk, rated_mask);
     }
-    CHECK_EQ(topk_heap.size(), topk);
-    auto topk_heap_vec = topk_heap.get_sorted_data();
-    std::vector<size_t> ret(topk);
-    std::transform(topk_heap_vec.begin(), topk_heap_vec.end(),
-                   ret.begin(),
-                   [](const std::pair<size_t, double>& p) {
-                   return p.first;
-                   });
-    return std::move(ret);
+    if (!mips_index_.empty()) {
+      ScopedBitsetMask<ItemSet> rated_mask(item_mask(), rated_items);
+      return mips_index_.search(z, topk, rated_mask);
+    }
+    if (!quant_index_.empty()) {
+      ScopedBitsetMask<ItemSet> rated_mask(item_mask(), rated_items);
+      return quant_index_.search(z, topk, rated_mask, output_weights(), output_bias());
+    }
+
+    // score all items at once, then mask out the rated ones
+    static thread_local DVector scores;
+    scores.noalias() = output_weights() * z;
+    scores += output_bias();
+    for (auto& p : rated_items) {
+      scores(bitset_key(p)) = - std::numeric_limits<double>::infinity();
+    }
+
+    TopK<double> topk_items(topk);
+    topk_items.push_block(scores.data(), 0, num_items_);
+    return topk_items.get_sorted_ids();
   }
 
   void train_one_user_corruption(size_t uid, 
@@ -204,19 +699,37 @@ class CDAE : public RecsysModelBase {
       scale /= (1. - corruption_ratio_);
     }
 
-    DVector z = get_hidden_values(uid, input_set, scale);
-    DVector z_1_z =  DVector::Ones(num_dim_);
-    if (! linear_) {
-      if (! tanh_) {
-        z_1_z = z - z.cwiseProduct(z);
-      } else {
-        z_1_z = DVector::Ones(num_dim_) - z.cwiseProduct(z); 
+    DVector z, z_1_z;
+    {
+      ScopedPhase scope(profiler_, PHASE_FORWARD);
+      z = get_hidden_values(uid, input_set, scale);
+      z_1_z = DVector::Ones(num_dim_);
+      if (! linear_) {
+        if (! tanh_) {
+          z_1_z = z - z.cwiseProduct(z);
+        } else {
+          z_1_z = DVector::Ones(num_dim_) - z.cwiseProduct(z); 
+        }
       }
     }
     
     std::vector<size_t> negative_sampels(output_set.size() * num_neg_);
-    for (size_t idx = 0; idx < negative_sampels.size(); ++idx) {
-      negative_sampels[idx] = sample_negative_item(output_set);
+    {
+      ScopedPhase scope(profiler_, PHASE_SAMPLING);
+      for (size_t idx = 0; idx < negative_sampels.size(); ++idx) {
+        negative_sampels[idx] = sample_negative_item(output_set);
+      }
+    }
+    if (tracking_updates_) {
+      for (auto& p : output_set) {
+        touch_item(p.first);
+      }
+      for (auto& p : input_set) {
+        touch_item(p.first);
+      }
+      for (auto& iid : negative_sampels) {
+        touch_item(iid);
+      }
     }
     
     std::unordered_map<size_t, DVector> input_gradient;
@@ -226,6 +739,9 @@ class CDAE : public RecsysModelBase {
       size_t iid = p.first;
       double y = get_output_values(z, iid);
       double gradient = loss_->gradient(y, 1.);
+      if (accumulate_loss_) {
+        accumulated_loss_ += loss_->evaluate(y, 1.) / num_corruptions_;
+      }
       
       {
         double grad = gradient + lambda_ * b_prime(iid);
@@ -370,24 +886,54 @@ class CDAE : public RecsysModelBase {
     return rets;
   }
 
-  DVector get_hidden_values(size_t uid, const std::unordered_map<size_t, double>& item_set,
+  // item_set is a hashtable of (iid, rating) or a range of iids
+  template <class ItemSet>
+  DVector get_hidden_values(size_t uid, const ItemSet& item_set,
                             double scale = 1.0) const {
-    DVector h1 = DVector::Zero(num_dim_);
+    DVector h1 = get_hidden_input(uid, item_set, scale);
+    activate(h1);
+    return h1;
+  }
+
+  // hidden values before the activation function
+  template <class ItemSet>
+  DVector get_hidden_input(size_t uid, const ItemSet& item_set,
+                           double scale = 1.0) const {
+    DVector h1(num_dim_);
+    get_hidden_input(uid, item_set, scale, h1);
+    return h1;
+  }
+
+  // the same, written in place into out, a DVector or a row of a DMatrix
+  template <class ItemSet, class Vector>
+  void get_hidden_input(size_t uid, const ItemSet& item_set, double scale,
+                        Vector&& out) const {
+    Eigen::Map<DVector> h1(out.data(), num_dim_);
+    h1.setZero();
     
+    DMatrixView W_in = item_weights();
     for (auto& p : item_set) {
-      size_t iid = p.first;
-      h1 += W.row(iid) * scale;
+      size_t iid = bitset_key(p);
+      h1 += W_in.row(iid) * scale;
     }
     
     if (linear_function_) {
-      h1 = Uu.row(uid).transpose().cwiseProduct(h1);
+      h1 = user_scales().row(uid).transpose().cwiseProduct(h1);
     }
 
-    h1 += b; 
+    h1 += hidden_bias(); 
     if (user_factor_) {
-      h1 += Wu.row(uid);
+      h1 += user_factors().row(uid);
     }
+  }
+
+  static const std::unordered_map<size_t, double>& empty_history() {
+    static const std::unordered_map<size_t, double> empty;
+    return empty;
+  }
 
+  template <class Vector>
+  void activate(Vector&& h1) const {
     if (! linear_) {
       if (! tanh_) {
       h1 = h1.unaryExpr([](double x) {
@@ -412,20 +958,41 @@ class CDAE : public RecsysModelBase {
                         });
       }
     }
-    return h1;
   }
 
   double get_output_values(const DVector& z, size_t idx) const {
-    double h2 = 0; 
-    if (asymmetric_) {
-      h2 += V.row(idx).dot(z) + b_prime(idx);
-    } else {
-      h2 += W.row(idx).dot(z) + b_prime(idx);
-    }
-    return h2;
+    return output_weights().row(idx).dot(z) + output_bias()(idx);
   }
 
  private:
+  // the parameters read in place from checkpoint_ after load_checkpoint,
+  // absent ones are empty
+  struct MappedParameters {
+    explicit MappedParameters(const Checkpoint& ckpt) :
+        W(ckpt.matrix("W")), V(optional_matrix(ckpt, "V")),
+        Wu(optional_matrix(ckpt, "Wu")), Uu(optional_matrix(ckpt, "Uu")),
+        b(ckpt.vector("b")), b_prime(ckpt.vector("b_prime")), bu(ckpt.vector("bu")) {}
+
+    static DMatrixView optional_matrix(const Checkpoint& ckpt, const std::string& name) {
+      return ckpt.has(name) ? ckpt.matrix(name) : DMatrixView(nullptr, 0, 0);
+    }
+
+    DMatrixView W, V, Wu, Uu;
+    DVectorView b, b_prime, bu;
+  };
+
+  // what inference reads: the rows in use of the parameters below, or
+  // the mapped ones
+  DMatrixView item_weights() const { return mapped_ ? mapped_->W : view(W, num_items_); }
+  DMatrixView user_factors() const { return mapped_ ? mapped_->Wu : view(Wu, num_users_); }
+  DMatrixView user_scales() const { return mapped_ ? mapped_->Uu : view(Uu, num_users_); }
+  DVectorView hidden_bias() const { return mapped_ ? mapped_->b : view(b); }
+  DVectorView output_bias() const { return mapped_ ? mapped_->b_prime : view(b_prime, num_items_); }
+  DMatrixView output_weights() const {
+    if (!asymmetric_) return item_weights();
+    return mapped_ ? mapped_->V : view(V, num_items_);
+  }
+
 
   DMatrix W;
   DMatrix V;
@@ -437,6 +1004,12 @@ class CDAE : public RecsysModelBase {
   DVector b_ag, b_prime_ag, bu_ag;
   DMatrix Uu;
   DMatrix Uu_ag;
+  MIPSIndex mips_index_;
+  QuantizedIndex quant_index_;
+  std::shared_ptr<const MappedParameters> mapped_;
+  DMatrix hidden_input_;  // cached hidden values before activation
+  DMatrix hidden_;        // cached hidden values
+  std::vector<uint8_t> hidden_cached_;  // 1 if the row matches the user's history
   size_t num_dim_ = 0.;
   double learn_rate_ = 0.;
   double lambda_ = 0.;  
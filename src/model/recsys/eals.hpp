@@ -0,0 +1,301 @@
+#ifndef _LIBCF_EALS_HPP_
+#define _LIBCF_EALS_HPP_
+
+#include <cmath>
+#include <memory>
+
+#include <base/csr.hpp>
+#include <base/parallel.hpp>
+#include <base/parallel/worker_pool.hpp>
+#include <model/recsys/batch_topk.hpp>
+#include <model/recsys/recsys_model_base.hpp>
+
+namespace libcf {
+
+struct EALSConfig {
+  EALSConfig() = default;
+  double lambda = 0.01;  // regularization coefficient
+  double weight = 1.;    // weight of an observed interaction
+  double c0 = 512.;      // total weight of the missing data
+  double alpha = 0.4;    // popularity exponent of the missing data weights
+  LossType lt = SQUARE; // loss type
+  PenaltyType pt = L2;  // penalty type
+  size_t num_dim = 10;
+};
+
+/**
+ *  Element-wise ALS, the paper :
+ *  Fast Matrix Factorization for Online Recommendation with Implicit
+ *  Feedback, SIGIR'16
+ *
+ *  Observed pairs are 1 targets of weight `weight`, missing pairs 0
+ *  targets of weight c_i = c0 f_i^alpha / sum_j f_j^alpha, f_i the
+ *  popularity of item i. Each row is solved one latent dimension at a
+ *  time in closed form. The missing pairs only enter through the Gram
+ *  caches S^q = Q^T diag(c) Q and S^p = P^T P, computed once per
+ *  half-sweep by a GEMM, and the predictions of the observed pairs are
+ *  cached and patched after every coordinate, so a sweep takes
+ *  O(|R| k + (M + N) k^2) instead of O(k^3) a row.
+ *
+ *  Rows only write their own vector and the cached predictions of
+ *  their own pairs, so users, then items, are solved in parallel on a
+ *  persistent WorkerPool.
+ */
+class EALS : public RecsysModelBase {
+ public:
+  EALS(const EALSConfig& mcfg)
+      : lambda_(mcfg.lambda), weight_(mcfg.weight), c0_(mcfg.c0), alpha_(mcfg.alpha),
+      num_dim_(mcfg.num_dim)
+  {
+    loss_ = Loss::create(mcfg.lt);
+    penalty_ = Penalty::create(mcfg.pt);
+    retrieval_ = BRUTE_FORCE;
+
+    LOG(INFO) << "EALS Configure: \n"
+        << "\t{lambda: " << lambda_ << "}, "
+        << "{Loss: " << loss_->loss_type() << "}, "
+        << "{Penalty: " << penalty_->penalty_type() << "}\n"
+        << "\t{Dim: " << num_dim_ << "}, "
+        << "{Weight: " << weight_ << "}, "
+        << "{c0: " << c0_ << "}, "
+        << "{alpha: " << alpha_ << "}\n";
+  }
+
+  EALS() : EALS(EALSConfig()) {}
+
+  virtual void reset(const Data& data_set) {
+    RecsysModelBase::reset(data_set);
+
+    p_ = DMatrix::Random(num_users_, num_dim_) * 0.01;
+    q_ = DMatrix::Random(num_items_, num_dim_) * 0.01;
+
+    user_rows_ = CSRMatrix(user_rated_items_.table(), num_users_);
+    // the pairs of each item as positions into the user rows
+    item_offsets_.assign(num_items_ + 1, 0);
+    for (auto& iid : user_rows_.ids()) {
+      ++item_offsets_[iid + 1];
+    }
+    for (size_t iid = 0; iid < num_items_; ++iid) {
+      item_offsets_[iid + 1] += item_offsets_[iid];
+    }
+    item_users_.resize(user_rows_.num_entries());
+    item_pos_.resize(user_rows_.num_entries());
+    std::vector<size_t> cursors(item_offsets_.begin(), item_offsets_.end() - 1);
+    for (size_t uid = 0; uid < num_users_; ++uid) {
+      size_t begin = user_rows_.offsets()[uid];
+      for (size_t pos = begin; pos < user_rows_.offsets()[uid + 1]; ++pos) {
+        size_t slot = cursors[user_rows_.ids()[pos]]++;
+        item_users_[slot] = uid;
+        item_pos_[slot] = pos;
+      }
+    }
+
+    // missing data weights by popularity
+    c_ = DVector::Zero(num_items_);
+    for (size_t iid = 0; iid < num_items_; ++iid) {
+      c_(iid) = std::pow(static_cast<double>(item_offsets_[iid + 1] - item_offsets_[iid]), alpha_);
+    }
+    if (c_.sum() > 0.) {
+      c_ *= c0_ / c_.sum();
+    }
+
+    preds_.resize(user_rows_.num_entries());
+    for (size_t uid = 0; uid < num_users_; ++uid) {
+      for (size_t pos = user_rows_.offsets()[uid]; pos < user_rows_.offsets()[uid + 1]; ++pos) {
+        preds_[pos] = predict_user_item_rating(uid, user_rows_.ids()[pos]);
+      }
+    }
+
+    pool_ = std::make_shared<WorkerPool>(num_hardware_threads());
+
+    MemoryReport report;
+    memory_usage(report);
+    LOG(INFO) << "EALS Memory: \n" << report;
+  }
+
+  virtual void memory_usage(MemoryReport& report) const {
+    RecsysModelBase::memory_usage(report);
+    report.add("model.matrices", memory_bytes(p_) + memory_bytes(q_) + memory_bytes(c_));
+    report.add("model.rating_rows", owned_bytes(user_rows_.offsets()) + owned_bytes(user_rows_.ids())
+               + owned_bytes(user_rows_.values()) + owned_bytes(item_offsets_)
+               + owned_bytes(item_users_) + owned_bytes(item_pos_));
+    report.add("model.prediction_cache", owned_bytes(preds_));
+  }
+
+  /** The weighted loss over every user-item pair of the training data
+   */
+  virtual double data_loss(const Data& data_set, size_t sample_size=0) const {
+    DMatrix user_gram = p_.transpose() * p_;
+    DMatrix item_gram = q_.transpose() * c_.asDiagonal() * q_;
+    // every pair as a missing one
+    double rets = user_gram.cwiseProduct(item_gram).sum();
+    for (size_t uid = 0; uid < num_users_; ++uid) {
+      for (size_t pos = user_rows_.offsets()[uid]; pos < user_rows_.offsets()[uid + 1]; ++pos) {
+        double pred = predict_user_item_rating(uid, user_rows_.ids()[pos]);
+        rets += weight_ * (1. - pred) * (1. - pred) - c_(user_rows_.ids()[pos]) * pred * pred;
+      }
+    }
+    return rets;
+  }
+
+  virtual double penalty_loss() const {
+    return lambda_ * (p_.squaredNorm() + q_.squaredNorm());
+  }
+
+  virtual double predict_user_item_rating(size_t uid, size_t iid) const {
+    return p_.row(uid).dot(q_.row(iid));
+  }
+
+  virtual void recommend_batch(const size_t* uids, size_t num_requests, size_t topk,
+                               const CSRIndex& exclusions, size_t* rec_lists) const {
+    LIBCF_TRACE_SCOPE("eals.recommend_batch");
+    batch_inner_product_topk(q_, DVector(),
+                             [&](size_t uid, DMatrix::RowXpr row) { row = p_.row(uid); },
+                             uids, num_requests, topk, exclusions, rec_lists);
+  }
+
+  virtual void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("eals.train_one_iteration");
+    gram_.noalias() = q_.transpose() * c_.asDiagonal() * q_;
+    for_rows(num_users_, [&](size_t uid) { train_one_user(uid); });
+    gram_.noalias() = p_.transpose() * p_;
+    for_rows(num_items_, [&](size_t iid) { train_one_item(iid); });
+    if (profiler_) {
+      profiler_->add_users(num_users_);
+      profiler_->add_interactions(2 * user_rows_.num_entries());
+    }
+  }
+
+  /** Coordinate descent on p_u given S^q in gram_
+   */
+  void train_one_user(size_t uid) {
+    size_t begin = user_rows_.offsets()[uid];
+    size_t n = user_rows_.offsets()[uid + 1] - begin;
+    const size_t* iids = user_rows_.ids().data() + begin;
+    auto& scratch = row_scratch(n);
+    for (size_t pos = 0; pos < n; ++pos) {
+      scratch.vecs.row(pos) = q_.row(iids[pos]);
+      scratch.weights(pos) = weight_ - c_(iids[pos]);
+      scratch.preds(pos) = preds_[begin + pos];
+    }
+    for (size_t f = 0; f < num_dim_; ++f) {
+      double old = p_(uid, f);
+      double next = solve_coordinate(scratch, f, old,
+                                     p_.row(uid).dot(gram_.row(f)) - old * gram_(f, f),
+                                     gram_(f, f));
+      p_(uid, f) = next;
+    }
+    for (size_t pos = 0; pos < n; ++pos) {
+      preds_[begin + pos] = scratch.preds(pos);
+    }
+  }
+
+  /** Coordinate descent on q_i given S^p in gram_
+   */
+  void train_one_item(size_t iid) {
+    size_t begin = item_offsets_[iid];
+    size_t n = item_offsets_[iid + 1] - begin;
+    double c = c_(iid);
+    auto& scratch = row_scratch(n);
+    for (size_t slot = 0; slot < n; ++slot) {
+      scratch.vecs.row(slot) = p_.row(item_users_[begin + slot]);
+      scratch.preds(slot) = preds_[item_pos_[begin + slot]];
+    }
+    scratch.weights.setConstant(weight_ - c);
+    for (size_t f = 0; f < num_dim_; ++f) {
+      double old = q_(iid, f);
+      double next = solve_coordinate(scratch, f, old,
+                                     c * (q_.row(iid).dot(gram_.row(f)) - old * gram_(f, f)),
+                                     c * gram_(f, f));
+      q_(iid, f) = next;
+    }
+    for (size_t slot = 0; slot < n; ++slot) {
+      preds_[item_pos_[begin + slot]] = scratch.preds(slot);
+    }
+  }
+
+  /** Largest gap between the cached and the actual predictions
+   */
+  double max_prediction_drift() const {
+    double rets = 0.;
+    for (size_t uid = 0; uid < num_users_; ++uid) {
+      for (size_t pos = user_rows_.offsets()[uid]; pos < user_rows_.offsets()[uid + 1]; ++pos) {
+        double pred = predict_user_item_rating(uid, user_rows_.ids()[pos]);
+        rets = std::max(rets, std::abs(preds_[pos] - pred));
+      }
+    }
+    return rets;
+  }
+
+  DMatrix get_user_vecs() {
+    return p_;
+  }
+
+  DMatrix get_item_vecs() {
+    return q_;
+  }
+
+ private:
+  // the observed pairs of the row being solved, gathered
+  struct RowScratch {
+    Eigen::MatrixXd vecs;   // column major, so a dimension is contiguous
+    Eigen::ArrayXd weights; // observed weight - missing weight
+    Eigen::ArrayXd preds;
+  };
+
+  RowScratch& row_scratch(size_t n) const {
+    static thread_local RowScratch scratch;
+    scratch.vecs.resize(n, num_dim_);
+    scratch.weights.resize(n);
+    scratch.preds.resize(n);
+    return scratch;
+  }
+
+  /** The minimizer of dimension f of the row given the others and the
+   *  missing data terms: cross = sum_{k != f} x_k S_kf and diag = S_ff,
+   *  both weighted for items. Patches the cached predictions.
+   */
+  double solve_coordinate(RowScratch& scratch, size_t f, double old, double cross, double diag) const {
+    auto col = scratch.vecs.col(f).array();
+    auto pred_f = scratch.preds - old * col;
+    double numer = ((weight_ - scratch.weights * pred_f) * col).sum() - cross;
+    double denom = (scratch.weights * col.square()).sum() + diag + lambda_;
+    double next = denom > 0. ? numer / denom : 0.;
+    scratch.preds += (next - old) * col;
+    return next;
+  }
+
+  // fn(row) for every row on the pool, in chunks of rows
+  void for_rows(size_t num_rows, const std::function<void (size_t)>& fn) {
+    size_t num_chunks = std::min(num_rows, 8 * pool_->num_workers());
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+      size_t first = chunk * num_rows / num_chunks;
+      size_t last = (chunk + 1) * num_rows / num_chunks;
+      pool_->submit([&fn, first, last]() {
+        for (size_t row = first; row < last; ++row) {
+          fn(row);
+        }
+      });
+    }
+    pool_->wait();
+  }
+
+ private:
+  CSRMatrix user_rows_;
+  std::vector<size_t> item_offsets_, item_users_, item_pos_;
+  std::vector<double> preds_;   // predictions of the pairs of user_rows_
+  double lambda_ = 0.;
+  double weight_ = 1.;
+  double c0_ = 512.;
+  double alpha_ = 0.4;
+  size_t num_dim_ = 0;
+  DMatrix p_;
+  DMatrix q_;
+  DVector c_;
+  DMatrix gram_;   // S^q in the user half-sweep, S^p in the item one
+  std::shared_ptr<WorkerPool> pool_;
+};
+
+} // namespace
+
+#endif // _LIBCF_EALS_HPP_
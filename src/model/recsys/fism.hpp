@@ -174,28 +174,20 @@ class FISM : public RecsysModelBase, public SGDBase{
     
     double scale = 1. / static_cast<double>(std::pow(rated_item_map.size(), alpha_));
 
-    Heap<std::pair<size_t, double>> topk_heap(sort_by_second_desc<size_t, double>, topk);
-    double pred;
-    for (; item_id != item_id_end; ++item_id) {
-      if (rated_item_map.count(item_id)) {
-        continue;
-      }
-      pred = bu_(uid) + bi_(item_id) + scale * x_.row(uid).dot(q_.row(item_id));
-      if (topk_heap.size() < topk) {
-        topk_heap.push({item_id, pred});
-      } else {
-        topk_heap.push_and_pop({item_id, pred});
-      }
+    // score all items at once, then mask out the rated ones
+    CHECK_GE(item_id_end - rated_item_map.size(), topk);
+    static thread_local DVector scores;
+    scores.noalias() = q_ * x_.row(uid).transpose();
+    scores *= scale;
+    scores += bi_;
+    scores.array() += bu_(uid);
+    for (auto& p : rated_item_map) {
+      scores(p.first) = - std::numeric_limits<double>::infinity();
     }
-    CHECK_EQ(topk_heap.size(), topk);
-    auto topk_heap_vec = topk_heap.get_sorted_data();
-    std::vector<size_t> ret(topk);
-    std::transform(topk_heap_vec.begin(), topk_heap_vec.end(),
-                   ret.begin(),
-                   [](const std::pair<size_t, double>& p) {
-                   return p.first;
-                   });
-    return std::move(ret);
+
+    TopK<double> topk_items(topk);
+    topk_items.push_block(scores.data(), item_id, item_id_end - item_id);
+    return topk_items.get_sorted_ids();
   }
 
   virtual double predict(const Instance& ins) const {
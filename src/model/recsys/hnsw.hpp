@@ -0,0 +1,479 @@
+#ifndef _LIBCF_HNSW_HPP_
+#define _LIBCF_HNSW_HPP_
+
+#include <cmath>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <base/mat.hpp>
+#include <base/io.hpp>
+#include <base/parallel.hpp>
+
+namespace libcf {
+
+struct HNSWConfig {
+  HNSWConfig() = default;
+  size_t M = 16;                // max links per node (2 * M on the bottom layer)
+  size_t ef_construction = 100; // candidate list size while building
+  size_t ef_search = 50;        // candidate list size while searching
+  size_t seed = 20141119;
+};
+
+/**
+ *  Approximate top-k maximum inner product search with a Hierarchical
+ *  Navigable Small World graph:
+ *
+ *    Efficient and robust approximate nearest neighbor search using
+ *    Hierarchical Navigable Small World graphs, Malkov and Yashunin.
+ *
+ *  Inner products with biases are reduced to Euclidean nearest neighbour
+ *  search by augmenting the item vectors as
+ *
+ *    x_i -> [x_i, b_i, sqrt(R^2 - |x_i|^2 - b_i^2)],   q -> [q, 1, 0]
+ *
+ *  where R is the largest augmented norm, so that
+ *  |x_i' - q'|^2 = R^2 + |q|^2 + 1 - 2 (q . x_i + b_i).
+ *
+ *  Larger ef_search gives higher recall at the cost of latency.
+ */
+class HNSWIndex {
+ public:
+  explicit HNSWIndex(const HNSWConfig& cfg = HNSWConfig()) : cfg_(cfg) {}
+
+  void build(const DMatrixRef& item_vecs, const DVectorRef& item_bias = DVector());
+
+  /** Refresh the items in iids from item_vecs / item_bias and insert the
+   *  rows of item_vecs past size() as new nodes.
+   *
+   *  Refreshed items keep their links, so recall degrades slowly as the
+   *  items drift and a full build restores it. Augmented norms keep the
+   *  R of the last build; items that outgrow it are ranked a bit low.
+   */
+  void update(const DMatrixRef& item_vecs, const DVectorRef& item_bias,
+              const std::vector<size_t>& iids);
+
+  /** Approximate top-k item ids for the query, best first. Items for
+   *  which excluded.test(iid) is true are skipped.
+   */
+  template <class Mask>
+  std::vector<size_t> search(const DVector& q, size_t topk, const Mask& excluded) const;
+
+  void set_ef_search(size_t ef_search) { cfg_.ef_search = ef_search; }
+  const HNSWConfig& config() const { return cfg_; }
+
+  void save(const std::string& filename) const;
+  void load(const std::string& filename);
+
+  void clear() {
+    num_items_ = 0;
+    data_.resize(0, 0);
+    levels_.clear();
+    links0_.clear();
+    upper_links_.clear();
+    max_level_ = -1;
+    max_sq_norm_ = 0.;
+  }
+
+  bool empty() const { return num_items_ == 0; }
+  size_t size() const { return num_items_; }
+
+ private:
+  typedef std::pair<double, uint32_t> dist_id;
+
+  size_t max_links(size_t level) const {
+    return level == 0 ? 2 * cfg_.M : cfg_.M;
+  }
+
+  // [count, id_0, id_1, ...] for node at level
+  uint32_t* links(uint32_t node, size_t level) {
+    if (level == 0) {
+      return &links0_[node * (max_links(0) + 1)];
+    }
+    return &upper_links_[node][(level - 1) * (max_links(1) + 1)];
+  }
+
+  const uint32_t* links(uint32_t node, size_t level) const {
+    return const_cast<HNSWIndex*>(this)->links(node, level);
+  }
+
+  double distance(const double* q, uint32_t node) const {
+    return (Eigen::Map<const DRowVector>(q, dim_) - data_.row(node)).squaredNorm();
+  }
+
+  void copy_links(uint32_t node, size_t level, std::vector<uint32_t>& out,
+                  std::mutex* locks) const {
+    std::unique_lock<std::mutex> lock;
+    if (locks) lock = std::unique_lock<std::mutex>(locks[node]);
+    const uint32_t* ptr = links(node, level);
+    out.assign(ptr + 1, ptr + 1 + ptr[0]);
+  }
+
+  uint32_t greedy_search(const double* q, uint32_t entry, int from_level, int to_level,
+                         std::mutex* locks) const;
+
+  std::vector<dist_id> search_layer(const double* q, uint32_t entry, size_t ef,
+                                    size_t level, std::mutex* locks) const;
+
+  void select_neighbors(std::vector<dist_id>& candidates, size_t max_m) const;
+
+  void insert(uint32_t node, std::mutex* locks, std::mutex& global_lock);
+
+  void set_row(size_t node, const DMatrixRef& item_vecs, const DVectorRef& item_bias);
+
+  int random_level(std::mt19937_64& rng) const {
+    std::uniform_real_distribution<double> dist(0., 1.);
+    double ml = 1. / std::log(static_cast<double>(cfg_.M));
+    return static_cast<int>(- std::log(std::max(dist(rng), 1e-12)) * ml);
+  }
+
+ private:
+  HNSWConfig cfg_;
+  size_t num_items_ = 0;
+  size_t dim_ = 0;
+  DMatrix data_;                 // augmented item vectors
+  std::vector<int> levels_;
+  std::vector<uint32_t> links0_; // bottom layer links, fixed size per node
+  std::vector<std::vector<uint32_t>> upper_links_;
+  uint32_t entry_point_ = 0;
+  int max_level_ = -1;
+  double max_sq_norm_ = 0.;      // R^2
+};
+
+inline void HNSWIndex::build(const DMatrixRef& item_vecs, const DVectorRef& item_bias) {
+  Timer timer;
+  num_items_ = item_vecs.rows();
+  dim_ = item_vecs.cols() + 2;
+  CHECK(item_bias.size() == 0 || static_cast<size_t>(item_bias.size()) == num_items_);
+  CHECK_GT(cfg_.M, 1);
+
+  data_ = DMatrix::Zero(num_items_, dim_);
+  data_.leftCols(dim_ - 2) = item_vecs;
+  if (item_bias.size() > 0) {
+    data_.col(dim_ - 2) = item_bias;
+  }
+  DVector sq_norms = data_.rowwise().squaredNorm();
+  max_sq_norm_ = sq_norms.size() > 0 ? sq_norms.maxCoeff() : 0.;
+  for (size_t idx = 0; idx < num_items_; ++idx) {
+    data_(idx, dim_ - 1) = std::sqrt(std::max(0., max_sq_norm_ - sq_norms(idx)));
+  }
+
+  // assign levels up front so the graph only depends on the seed
+  std::mt19937_64 rng(cfg_.seed);
+  levels_.resize(num_items_);
+  upper_links_.assign(num_items_, {});
+  for (size_t idx = 0; idx < num_items_; ++idx) {
+    levels_[idx] = random_level(rng);
+    upper_links_[idx].assign(levels_[idx] * (max_links(1) + 1), 0);
+  }
+  links0_.assign(num_items_ * (max_links(0) + 1), 0);
+  max_level_ = -1;
+  if (num_items_ == 0) return;
+
+  entry_point_ = 0;
+  max_level_ = levels_[0];
+
+  std::unique_ptr<std::mutex[]> locks(new std::mutex[num_items_]);
+  std::mutex global_lock;
+  parallel_for(1, num_items_, [&](size_t idx) {
+               insert(static_cast<uint32_t>(idx), locks.get(), global_lock);
+               });
+  LOG(INFO) << "Built HNSW index over " << num_items_ << " items in " << timer;
+}
+
+inline void HNSWIndex::set_row(size_t node, const DMatrixRef& item_vecs, const DVectorRef& item_bias) {
+  data_.row(node).head(dim_ - 2) = item_vecs.row(node);
+  data_(node, dim_ - 2) = item_bias.size() > 0 ? item_bias(node) : 0.;
+  data_(node, dim_ - 1) = 0.;
+  double sq_norm = data_.row(node).squaredNorm();
+  data_(node, dim_ - 1) = std::sqrt(std::max(0., max_sq_norm_ - sq_norm));
+}
+
+inline void HNSWIndex::update(const DMatrixRef& item_vecs, const DVectorRef& item_bias,
+                       const std::vector<size_t>& iids) {
+  if (empty()) {
+    build(item_vecs, item_bias);
+    return;
+  }
+  Timer timer;
+  size_t num_items = item_vecs.rows();
+  CHECK_GE(num_items, num_items_);
+  CHECK_EQ(static_cast<size_t>(item_vecs.cols()) + 2, dim_);
+  CHECK(item_bias.size() == 0 || static_cast<size_t>(item_bias.size()) == num_items);
+
+  for (auto& iid : iids) {
+    if (iid < num_items_) {
+      set_row(iid, item_vecs, item_bias);
+    }
+  }
+  if (num_items == num_items_) return;
+
+  size_t first_new = num_items_;
+  grow_rows(data_, num_items, 0.);
+  levels_.resize(num_items);
+  upper_links_.resize(num_items);
+  links0_.resize(num_items * (max_links(0) + 1), 0);
+  // new nodes draw their levels from a stream of their own
+  std::mt19937_64 rng(cfg_.seed + first_new);
+  for (size_t idx = first_new; idx < num_items; ++idx) {
+    set_row(idx, item_vecs, item_bias);
+    levels_[idx] = random_level(rng);
+    upper_links_[idx].assign(levels_[idx] * (max_links(1) + 1), 0);
+  }
+  num_items_ = num_items;
+
+  std::unique_ptr<std::mutex[]> locks(new std::mutex[num_items_]);
+  std::mutex global_lock;
+  parallel_for(first_new, num_items_, [&](size_t idx) {
+               insert(static_cast<uint32_t>(idx), locks.get(), global_lock);
+               });
+  LOG(INFO) << "Inserted " << num_items_ - first_new << " items into the HNSW index in " << timer;
+}
+
+inline uint32_t HNSWIndex::greedy_search(const double* q, uint32_t entry, int from_level, int to_level,
+                                  std::mutex* locks) const {
+  uint32_t cur = entry;
+  double cur_dist = distance(q, cur);
+  std::vector<uint32_t> neighbors;
+  for (int level = from_level; level > to_level; --level) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      copy_links(cur, level, neighbors, locks);
+      for (auto& nb : neighbors) {
+        double d = distance(q, nb);
+        if (d < cur_dist) {
+          cur_dist = d;
+          cur = nb;
+          changed = true;
+        }
+      }
+    }
+  }
+  return cur;
+}
+
+inline std::vector<HNSWIndex::dist_id> HNSWIndex::search_layer(const double* q, uint32_t entry, size_t ef,
+                                                        size_t level, std::mutex* locks) const {
+  // visited marks, reset by bumping the tag
+  static thread_local std::vector<uint32_t> visited;
+  static thread_local uint32_t tag = 0;
+  if (visited.size() < num_items_) {
+    visited.assign(num_items_, 0);
+    tag = 0;
+  }
+  if (++tag == 0) {
+    std::fill(visited.begin(), visited.end(), 0);
+    tag = 1;
+  }
+
+  std::priority_queue<dist_id, std::vector<dist_id>, std::greater<dist_id>> candidates;
+  std::priority_queue<dist_id> top;
+
+  double d = distance(q, entry);
+  candidates.emplace(d, entry);
+  top.emplace(d, entry);
+  visited[entry] = tag;
+
+  std::vector<uint32_t> neighbors;
+  while (!candidates.empty()) {
+    auto cur = candidates.top();
+    if (top.size() >= ef && cur.first > top.top().first) {
+      break;
+    }
+    candidates.pop();
+    copy_links(cur.second, level, neighbors, locks);
+    for (auto& nb : neighbors) {
+      if (visited[nb] == tag) continue;
+      visited[nb] = tag;
+      d = distance(q, nb);
+      if (top.size() < ef || d < top.top().first) {
+        candidates.emplace(d, nb);
+        top.emplace(d, nb);
+        if (top.size() > ef) {
+          top.pop();
+        }
+      }
+    }
+  }
+
+  std::vector<dist_id> rets(top.size());
+  for (size_t idx = rets.size(); idx-- > 0; ) {
+    rets[idx] = top.top();
+    top.pop();
+  }
+  return std::move(rets);
+}
+
+inline void HNSWIndex::select_neighbors(std::vector<dist_id>& candidates, size_t max_m) const {
+  // candidates are sorted by their distance to the base node; keep a
+  // candidate only if it is closer to the base than to every kept one
+  if (candidates.size() <= max_m) return;
+  std::vector<dist_id> selected;
+  selected.reserve(max_m);
+  for (auto& c : candidates) {
+    bool good = true;
+    for (auto& s : selected) {
+      if (distance(data_.row(c.second).data(), s.second) < c.first) {
+        good = false;
+        break;
+      }
+    }
+    if (good) {
+      selected.push_back(c);
+      if (selected.size() >= max_m) break;
+    }
+  }
+  candidates = std::move(selected);
+}
+
+inline void HNSWIndex::insert(uint32_t node, std::mutex* locks, std::mutex& global_lock) {
+  const double* q = data_.row(node).data();
+  int level = levels_[node];
+
+  uint32_t entry;
+  int max_level;
+  {
+    std::unique_lock<std::mutex> lock(global_lock);
+    entry = entry_point_;
+    max_level = max_level_;
+  }
+
+  uint32_t cur = greedy_search(q, entry, max_level, level, locks);
+
+  for (int l = std::min(level, max_level); l >= 0; --l) {
+    auto candidates = search_layer(q, cur, cfg_.ef_construction, l, locks);
+    cur = candidates.front().second;
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                    [&](const dist_id& c) { return c.second == node; }),
+                     candidates.end());
+    select_neighbors(candidates, cfg_.M);
+
+    {
+      std::unique_lock<std::mutex> lock(locks[node]);
+      uint32_t* ptr = links(node, l);
+      ptr[0] = candidates.size();
+      for (size_t idx = 0; idx < candidates.size(); ++idx) {
+        ptr[idx + 1] = candidates[idx].second;
+      }
+    }
+
+    // add the reverse links, shrinking full neighbour lists
+    size_t max_m = max_links(l);
+    for (auto& c : candidates) {
+      uint32_t nb = c.second;
+      std::unique_lock<std::mutex> lock(locks[nb]);
+      uint32_t* ptr = links(nb, l);
+      if (ptr[0] < max_m) {
+        ptr[++ptr[0]] = node;
+        continue;
+      }
+      const double* nb_vec = data_.row(nb).data();
+      std::vector<dist_id> nb_candidates;
+      nb_candidates.reserve(max_m + 1);
+      nb_candidates.emplace_back(c.first, node);
+      for (size_t idx = 1; idx <= ptr[0]; ++idx) {
+        nb_candidates.emplace_back(distance(nb_vec, ptr[idx]), ptr[idx]);
+      }
+      std::sort(nb_candidates.begin(), nb_candidates.end());
+      select_neighbors(nb_candidates, max_m);
+      ptr[0] = nb_candidates.size();
+      for (size_t idx = 0; idx < nb_candidates.size(); ++idx) {
+        ptr[idx + 1] = nb_candidates[idx].second;
+      }
+    }
+  }
+
+  if (level > max_level) {
+    std::unique_lock<std::mutex> lock(global_lock);
+    if (level > max_level_) {
+      entry_point_ = node;
+      max_level_ = level;
+    }
+  }
+}
+
+template <class Mask>
+std::vector<size_t> HNSWIndex::search(const DVector& q, size_t topk, const Mask& excluded) const {
+  std::vector<size_t> rets;
+  if (empty()) return rets;
+
+  DVector qa = DVector::Zero(dim_);
+  qa.head(dim_ - 2) = q;
+  qa(dim_ - 2) = 1.;
+
+  uint32_t cur = greedy_search(qa.data(), entry_point_, max_level_, 0, nullptr);
+
+  // widen the search until enough items survive the exclusion mask
+  size_t ef = std::max(cfg_.ef_search, topk);
+  for (;;) {
+    auto candidates = search_layer(qa.data(), cur, ef, 0, nullptr);
+    rets.clear();
+    for (auto& c : candidates) {
+      if (excluded.test(c.second)) continue;
+      rets.push_back(c.second);
+      if (rets.size() == topk) break;
+    }
+    if (rets.size() == topk || ef >= num_items_) break;
+    ef *= 2;
+  }
+  return std::move(rets);
+}
+
+inline void HNSWIndex::save(const std::string& filename) const {
+  Timer timer;
+  File f(filename, "wb");
+  uint64_t header[8] = {1, cfg_.M, cfg_.ef_construction, cfg_.ef_search, cfg_.seed,
+    num_items_, dim_, entry_point_};
+  f.write(header, 8);
+  int32_t max_level = max_level_;
+  f.write(&max_level);
+  f.write(data_.data(), data_.size());
+  f.write_vector(levels_);
+  f.write_vector(links0_);
+  for (auto& node_links : upper_links_) {
+    f.write_vector(node_links);
+  }
+  CHECK(f.ok()) << "Failed to write HNSW index to " << filename;
+  f.close();
+  LOG(INFO) << "Save HNSW index to " << filename << " in " << timer;
+}
+
+inline void HNSWIndex::load(const std::string& filename) {
+  Timer timer;
+  File f(filename, "rb");
+  uint64_t header[8];
+  f.read(header, 8);
+  CHECK_EQ(header[0], 1) << "Unknown HNSW index version";
+  cfg_.M = header[1];
+  cfg_.ef_construction = header[2];
+  cfg_.ef_search = header[3];
+  cfg_.seed = header[4];
+  num_items_ = header[5];
+  dim_ = header[6];
+  entry_point_ = header[7];
+  int32_t max_level;
+  f.read(&max_level);
+  max_level_ = max_level;
+  data_.resize(num_items_, dim_);
+  f.read(data_.data(), data_.size());
+  // items that outgrew R in updates are the only rows longer than R
+  max_sq_norm_ = num_items_ > 0 ? data_.rowwise().squaredNorm().minCoeff() : 0.;
+  f.read_vector(levels_);
+  f.read_vector(links0_);
+  upper_links_.resize(num_items_);
+  for (auto& node_links : upper_links_) {
+    f.read_vector(node_links);
+  }
+  CHECK(f.ok()) << "Failed to read HNSW index from " << filename;
+  f.close();
+  LOG(INFO) << "Load HNSW index from " << filename << " in " << timer;
+}
+
+} // namespace
+
+#endif // _LIBCF_HNSW_HPP_
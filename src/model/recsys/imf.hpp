@@ -1,10 +1,16 @@
 #ifndef _LIBCF_IMF_HPP_
 #define _LIBCF_IMF_HPP_
 
+#include <numeric>
 #include <algorithm>
 #include <base/heap.hpp>
 #include <base/utils.hpp>
 #include <model/loss.hpp>
+#include <model/recsys/mips.hpp>
+#include <model/recsys/hnsw.hpp>
+#include <model/recsys/quantized.hpp>
+#include <model/recsys/batch_topk.hpp>
+#include <model/recsys/strata.hpp>
 #include <model/recsys/recsys_model_base.hpp>
 
 namespace libcf {
@@ -18,8 +24,12 @@ struct IMFConfig {
   PenaltyType pt = L2;  
   size_t num_dim = 10;
   size_t num_neg = 5;
+  size_t num_strata = 0;  // > 0 for parallel SGD on num_strata^2 blocks, see StrataSchedule
   bool using_bias_term = true;
   bool using_adagrad = true;
+  RetrievalType retrieval = EXACT_MIPS;
+  HNSWConfig hnsw;
+  QuantizedConfig quant;
 };
 
 /** Matrix Factorization with Implicit Feedback
@@ -34,8 +44,12 @@ class IMF : public RecsysModelBase {
     lambda_ = mcfg.lambda;
     num_dim_ = mcfg.num_dim;
     num_neg_ = mcfg.num_neg;
+    num_strata_ = mcfg.num_strata;
     using_bias_term_ = mcfg.using_bias_term;
     using_adagrad_ = mcfg.using_adagrad;
+    retrieval_ = mcfg.retrieval;
+    hnsw_config_ = mcfg.hnsw;
+    quant_index_ = QuantizedIndex(mcfg.quant);
     loss_ = Loss::create(mcfg.lt);
     penalty_ = Penalty::create(mcfg.pt);
 
@@ -48,7 +62,9 @@ class IMF : public RecsysModelBase {
         << "\t{Dim: " << num_dim_ << "}, "
         << "{BiasTerm: " << using_bias_term_ << "}, "
         << "{Using AdaGrad: " << using_adagrad_ << "}, "
-        << "{Num Negative: " << num_neg_ << "}";
+        << "{Num Negative: " << num_neg_ << "}, "
+        << "{Num Strata: " << num_strata_ << "}, "
+        << "{Retrieval: " << retrieval_ << "}";
   }
 
   IMF() = default;
@@ -65,27 +81,126 @@ class IMF : public RecsysModelBase {
     ib_ = DVector::Zero(num_items_);
     ub_ag_ = DVector::Ones(num_users_) * 0.0001;
     ib_ag_ = DVector::Ones(num_items_) * 0.0001;
+    mapped_.reset();
+    mips_index_.clear();
+    ann_index_.reset();
+    quant_index_.clear();
+
+    MemoryReport report;
+    memory_usage(report);
+    LOG(INFO) << "IMF Memory: \n" << report;
+  }
+
+  virtual void memory_usage(MemoryReport& report) const {
+    RecsysModelBase::memory_usage(report);
+    report.add("model.matrices", memory_bytes(uv_) + memory_bytes(iv_)
+               + memory_bytes(ub_) + memory_bytes(ib_));
+    report.add("model.adagrad", memory_bytes(uv_ag_) + memory_bytes(iv_ag_)
+               + memory_bytes(ub_ag_) + memory_bytes(ib_ag_));
+    if (!strata_.empty()) {
+      report.add("model.strata", strata_.memory_bytes());
+    }
+  }
+
+  /** Projected memory_usage after reset, before any retrieval index
+   */
+  static MemoryReport projected_memory(const IMFConfig& mcfg, size_t num_users,
+                                       size_t num_items, size_t num_interactions) {
+    size_t params = projected_dense_bytes(num_users, mcfg.num_dim)
+        + projected_dense_bytes(num_items, mcfg.num_dim)
+        + projected_dense_bytes(num_users, 1) + projected_dense_bytes(num_items, 1);
+    MemoryReport rets;
+    rets.add("model.user_rated_items", projected_history_bytes(num_users, num_interactions));
+    rets.add("model.matrices", params);
+    // the accumulators are allocated with or without using_adagrad
+    rets.add("model.adagrad", params);
+    return rets;
   }
 
   virtual void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("imf.train_one_iteration");
+    check_trainable();
+    accumulated_loss_ = 0.;
+    mips_index_.clear();
+    ann_index_.reset();
+    quant_index_.clear();
+    if (num_strata_ > 0) {
+      train_strata();
+      return;
+    }
     for (size_t uid = 0; uid < num_users_; ++uid) {
-      auto fit = user_rated_items_.find(uid);
-      CHECK(fit != user_rated_items_.end());
-      auto& item_map = fit->second;
-      for (auto& p : item_map) {
-        auto& iid = p.first;
-        train_one_instance(uid, iid, loss_->positive_label());
-        for (size_t idx = 0; idx < num_neg_; ++idx) {
-          size_t jid = sample_negative_item(item_map);
-          train_one_instance(uid, jid, loss_->negative_label());
+      train_one_user(uid);
+    }
+  }
+
+  /** One epoch of parallel SGD over the strata. Negative items are
+   *  drawn from the item block of the positive one.
+   */
+  void train_strata() {
+    strata_.build(user_rated_items_.table(), num_users_, num_items_, num_strata_);
+    // the per-step phases are not timed, the pass counts as the update phase
+    std::vector<size_t> block_updates(num_strata_, 0);
+    accumulated_loss_ = strata_.run(Random::rng(), [&](size_t ub, size_t ib, Random::rng_type& rng) {
+      auto& block = strata_.block(ub, ib);
+      double loss = 0.;
+      for (auto& user : block.users) {
+        bool has_negative = strata_.has_negative_item(ib, user);
+        for (size_t pos = user.begin; pos < user.end; ++pos) {
+          loss += sgd_update(user.uid, block.entries[pos].first, loss_->positive_label());
+          ++block_updates[ub];
+          for (size_t idx = 0; has_negative && idx < num_neg_; ++idx) {
+            size_t jid = strata_.sample_negative_item(ib, *user.rated, rng);
+            loss += sgd_update(user.uid, jid, loss_->negative_label());
+            ++block_updates[ub];
+          }
+        }
+      }
+      return loss;
+    });
+    if (profiler_) {
+      profiler_->add_users(user_rated_items_.size());
+      profiler_->add_updates(std::accumulate(block_updates.begin(), block_updates.end(), size_t(0)));
+    }
+  }
+
+  virtual void train_one_user(size_t uid) {
+    check_trainable();
+    auto fit = user_rated_items_.find(uid);
+    CHECK(fit != user_rated_items_.end());
+    auto& item_map = fit->second;
+    for (auto& p : item_map) {
+      auto& iid = p.first;
+      train_one_instance(uid, iid, loss_->positive_label());
+      for (size_t idx = 0; idx < num_neg_; ++idx) {
+        size_t jid;
+        {
+          ScopedPhase scope(profiler_, PHASE_SAMPLING);
+          jid = sample_negative_item(item_map);
         }
+        train_one_instance(uid, jid, loss_->negative_label());
       }
     }
+    if (profiler_) {
+      profiler_->add_users(1);
+      profiler_->add_updates(item_map.size() * (1 + num_neg_));
+    }
   }
 
   virtual void train_one_instance(size_t uid, size_t iid, double rui) {
-    double pred = predict_user_item_rating(uid, iid);
-    double gradient = loss_->gradient(pred, rui);
+    accumulated_loss_ += sgd_update(uid, iid, rui, profiler_);
+    touch_item(iid);
+  }
+
+  /** One SGD step on (uid, iid), returns its loss if accumulate_loss_.
+   *  Writes only the rows of uid and iid.
+   */
+  double sgd_update(size_t uid, size_t iid, double rui, PhaseProfiler* profiler = nullptr) {
+    double pred, gradient;
+    {
+      ScopedPhase scope(profiler, PHASE_FORWARD);
+      pred = predict_user_item_rating(uid, iid);
+      gradient = loss_->gradient(pred, rui);
+    }
 
     double ub_grad = gradient + 2. * lambda_ * ub_(uid);
     double ib_grad = gradient + 2. * lambda_ * ib_(iid);
@@ -112,24 +227,230 @@ class IMF : public RecsysModelBase {
 
     uv_.row(uid) -= learn_rate_ * uv_grad;
     iv_.row(iid) -= learn_rate_ * iv_grad;
+    return accumulate_loss_ ? loss_->evaluate(pred, rui) : 0.;
+  }
+
+  /** The parameters grow by reserve_rows, inference and checkpoints
+   *  read the rows in use only
+   */
+  virtual void grow(size_t num_users, size_t num_items) {
+    size_t old_num_users = num_users_;
+    size_t old_num_items = num_items_;
+    size_t new_users = num_users - num_users_;
+    size_t new_items = num_items - num_items_;
+    RecsysModelBase::grow(num_users, num_items);
+
+    reserve_rows(uv_, num_users_, 0.);
+    reserve_rows(iv_, num_items_, 0.);
+    uv_.middleRows(old_num_users, new_users) = DMatrix::Random(new_users, num_dim_) * 0.01;
+    iv_.middleRows(old_num_items, new_items) = DMatrix::Random(new_items, num_dim_) * 0.01;
+    reserve_rows(uv_ag_, num_users_, 0.0001);
+    reserve_rows(iv_ag_, num_items_, 0.0001);
+    reserve_rows(ub_, num_users_, 0.);
+    reserve_rows(ib_, num_items_, 0.);
+    reserve_rows(ub_ag_, num_users_, 0.0001);
+    reserve_rows(ib_ag_, num_items_, 0.0001);
+  }
+
+  virtual void end_online_update(const std::vector<size_t>& uids) {
+    RecsysModelBase::end_online_update(uids);
+    DVector bias = using_bias_term_ ? DVector(item_bias()) : DVector();
+    if (!mips_index_.empty()) {
+      mips_index_.update(item_vecs(), bias, updated_items_);
+    }
+    if (!quant_index_.empty()) {
+      quant_index_.update(item_vecs(), bias, updated_items_);
+    }
+    update_ann_index(item_vecs(), bias);
+  }
+
+  /** Loss of every positive item and num_neg_ negative items per
+   *  positive, the objective train_one_user accumulates. The negatives
+   *  are drawn from an engine seeded by the user id, so the loss of a
+   *  model does not change between calls.
+   */
+  virtual double data_loss(const Data& data_set, size_t sample_size=0) const {
+    return sum_user_losses(sample_size, [&](size_t uid) {
+      auto fit = user_rated_items_.find(uid);
+      if (fit == user_rated_items_.end()) return 0.;
+      auto& item_map = fit->second;
+      bool has_negative = item_map.size() < num_items_;
+      Random::rng_type rng(uid);
+      double rets = 0.;
+      for (auto& p : item_map) {
+        rets += loss_->evaluate(predict_user_item_rating(uid, p.first), loss_->positive_label());
+        for (size_t idx = 0; has_negative && idx < num_neg_; ++idx) {
+          size_t jid = sample_negative_item(item_map, rng);
+          rets += loss_->evaluate(predict_user_item_rating(uid, jid), loss_->negative_label());
+        }
+      }
+      return rets;
+    });
+  }
+
+  virtual double accumulated_data_loss(const Data& data_set) const {
+    return accumulated_loss_;
   }
 
   double predict_user_item_rating(size_t uid, size_t iid) const {
-    return ub_(uid) + ib_(iid) + uv_.row(uid).dot(iv_.row(iid));
+    return user_bias()(uid) + item_bias()(iid) + user_vecs().row(uid).dot(item_vecs().row(iid));
+  }
+
+  virtual void pre_recommend() {
+    LIBCF_TRACE_SCOPE("imf.pre_recommend");
+    DVector bias = using_bias_term_ ? DVector(item_bias()) : DVector();
+    if (retrieval_ == ANN_HNSW) {
+      build_ann_index(item_vecs(), bias);
+    } else if (retrieval_ == EXACT_MIPS) {
+      mips_index_.build(item_vecs(), bias);
+    } else if (retrieval_ == QUANTIZED) {
+      quant_index_.build(item_vecs(), bias);
+    }
+  }
+
+  // required by evaluation measure TOPN
+  virtual std::vector<size_t> recommend(size_t uid, size_t topk,
+                                        const std::unordered_map<size_t, double>& rated_item_map) const {
+    if (!ann_index_ && mips_index_.empty() && quant_index_.empty()) {
+      return RecsysModelBase::recommend(uid, topk, rated_item_map);
+    }
+    CHECK_GE(num_items_ - rated_item_map.size(), topk);
+    ItemMask rated_mask(item_mask(), rated_item_map);
+    // the user bias does not change the ranking
+    DVector q = user_vecs().row(uid).transpose();
+    if (ann_index_) {
+      return ann_index_->search(q, topk, rated_mask);
+    }
+    if (!quant_index_.empty()) {
+      return quant_index_.search(q, topk, rated_mask, item_vecs(), item_bias());
+    }
+    return mips_index_.search(q, topk, rated_mask);
+  }
+
+  virtual void recommend_batch(const size_t* uids, size_t num_requests, size_t topk,
+                               const CSRIndex& exclusions, size_t* rec_lists) const {
+    LIBCF_TRACE_SCOPE("imf.recommend_batch");
+    if (ann_index_ || !quant_index_.empty()) {
+      // approximate retrieval works one user at a time
+      RecsysModelBase::recommend_batch(uids, num_requests, topk, exclusions, rec_lists);
+      return;
+    }
+    // the user bias does not change the ranking
+    DMatrixView uv = user_vecs();
+    batch_inner_product_topk(item_vecs(), item_bias(),
+                             [&](size_t uid, DMatrix::RowXpr row) { row = uv.row(uid); },
+                             uids, num_requests, topk, exclusions, rec_lists);
+  }
+
+  virtual void write_checkpoint(CheckpointWriter& ckpt, bool optimizer_state) const {
+    RecsysModelBase::write_checkpoint(ckpt, optimizer_state);
+    ckpt.add("model.type", std::string("IMF"));
+    ckpt.add("uv", user_vecs());
+    ckpt.add("iv", item_vecs());
+    ckpt.add("ub", user_bias());
+    ckpt.add("ib", item_bias());
+    if (!optimizer_state) return;
+    if (mapped_) {
+      // a loaded model passes on the state of its checkpoint
+      for (auto& name : {"uv_ag", "iv_ag", "ub_ag", "ib_ag"}) {
+        if (checkpoint_->has(name)) ckpt.add(name, checkpoint_->matrix(name));
+      }
+      return;
+    }
+    ckpt.add("uv_ag", view(uv_ag_, num_users_));
+    ckpt.add("iv_ag", view(iv_ag_, num_items_));
+    ckpt.add("ub_ag", view(ub_ag_, num_users_));
+    ckpt.add("ib_ag", view(ib_ag_, num_items_));
+  }
+
+  virtual bool check_checkpoint(const Checkpoint& ckpt, std::string* error) const {
+    if (!RecsysModelBase::check_checkpoint(ckpt, error)) return false;
+    if (!ckpt.has("model.type", CKPT_BYTES) || ckpt.bytes("model.type") != "IMF") {
+      return checkpoint_error(error, "Not an IMF checkpoint");
+    }
+    auto shape = ckpt.array<uint64_t>("model.shape");
+    auto shaped = [&](const std::string& suffix) {
+      return ckpt.has("uv" + suffix, CKPT_DOUBLE, shape[0], num_dim_)
+          && ckpt.has("iv" + suffix, CKPT_DOUBLE, shape[1], num_dim_)
+          && ckpt.has("ub" + suffix, CKPT_DOUBLE, shape[0], 1)
+          && ckpt.has("ib" + suffix, CKPT_DOUBLE, shape[1], 1);
+    };
+    if (!shaped("")) {
+      return checkpoint_error(error, "IMF parameters differ from model.shape or the config num_dim");
+    }
+    if (ckpt.has("uv_ag") && !shaped("_ag")) {
+      return checkpoint_error(error, "Corrupted IMF optimizer state");
+    }
+    return true;
+  }
+
+  /** The parameters are read in place from ckpt, see own_parameters
+   */
+  virtual void read_checkpoint(const Checkpoint& ckpt) {
+    RecsysModelBase::read_checkpoint(ckpt);
+    mapped_ = std::make_shared<const MappedParameters>(ckpt);
+    for (auto m : {&uv_, &iv_, &uv_ag_, &iv_ag_}) {
+      m->resize(0, 0);
+    }
+    for (auto v : {&ub_, &ib_, &ub_ag_, &ib_ag_}) {
+      v->resize(0);
+    }
+    mips_index_.clear();
+    quant_index_.clear();
+  }
+
+  virtual void own_parameters() {
+    CHECK(mapped_ != nullptr);
+    uv_ = mapped_->uv;
+    iv_ = mapped_->iv;
+    ub_ = mapped_->ub;
+    ib_ = mapped_->ib;
+    if (checkpoint_->has("uv_ag")) {
+      uv_ag_ = checkpoint_->matrix("uv_ag");
+      iv_ag_ = checkpoint_->matrix("iv_ag");
+      ub_ag_ = checkpoint_->vector("ub_ag");
+      ib_ag_ = checkpoint_->vector("ib_ag");
+    } else {
+      uv_ag_ = DMatrix::Ones(num_users_, num_dim_) * 0.0001;
+      iv_ag_ = DMatrix::Ones(num_items_, num_dim_) * 0.0001;
+      ub_ag_ = DVector::Ones(num_users_) * 0.0001;
+      ib_ag_ = DVector::Ones(num_items_) * 0.0001;
+    }
+    mapped_.reset();
   }
 
   DMatrix get_user_vecs() {
-    return uv_;
+    return user_vecs();
   }
 
   DMatrix get_item_vecs() {
-    return iv_;
+    return item_vecs();
   }
 
  protected:
 
+  // the parameters read in place from checkpoint_ after load_checkpoint
+  struct MappedParameters {
+    explicit MappedParameters(const Checkpoint& ckpt) :
+        uv(ckpt.matrix("uv")), iv(ckpt.matrix("iv")),
+        ub(ckpt.vector("ub")), ib(ckpt.vector("ib")) {}
+    DMatrixView uv, iv;
+    DVectorView ub, ib;
+  };
+
+  // what inference reads: the rows in use of the parameters below, or
+  // the mapped ones
+  DMatrixView user_vecs() const { return mapped_ ? mapped_->uv : view(uv_, num_users_); }
+  DMatrixView item_vecs() const { return mapped_ ? mapped_->iv : view(iv_, num_items_); }
+  DVectorView user_bias() const { return mapped_ ? mapped_->ub : view(ub_, num_users_); }
+  DVectorView item_bias() const { return mapped_ ? mapped_->ib : view(ib_, num_items_); }
+
   DMatrix uv_, iv_, uv_ag_, iv_ag_;
   DVector ub_, ib_, ub_ag_, ib_ag_;
+  std::shared_ptr<const MappedParameters> mapped_;
+  MIPSIndex mips_index_;
+  QuantizedIndex quant_index_;
+  StrataSchedule strata_;
 
   double learn_rate_ = 0.1;
   double beta_ = 1.;
@@ -139,6 +460,7 @@ class IMF : public RecsysModelBase {
   bool using_factor_term_ = true;  
   bool using_adagrad_ = true;
   size_t num_neg_;
+  size_t num_strata_ = 0;
 };
 
 } // namespace
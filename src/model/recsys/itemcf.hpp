@@ -23,11 +23,12 @@ class ItemCF : public SimilarityBase {
                                         const std::unordered_map<size_t, double>& rated_map) const {
 
     std::unordered_map<size_t, double> topk_rets;
+    ItemMask rated_mask(item_mask(), rated_map);
 
     for (auto& p : rated_map) {
       auto& rated_iid = p.first;
       for (auto& item_sim_pair : topk_neighbors_[rated_iid]) {
-        if (rated_map.count(item_sim_pair.first)) 
+        if (rated_mask.test(item_sim_pair.first)) 
           continue;
         if (topk_rets.count(item_sim_pair.first)) {
           topk_rets[item_sim_pair.first] += item_sim_pair.second;
@@ -0,0 +1,203 @@
+#ifndef _LIBCF_MIPS_HPP_
+#define _LIBCF_MIPS_HPP_
+
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+#include <base/mat.hpp>
+#include <base/topk.hpp>
+
+namespace libcf {
+
+/**
+ *  Exact top-k maximum inner product search over item vectors with
+ *  an optional per-item bias:
+ *
+ *    score(q, i) = q . x_i + b_i
+ *
+ *  Items are sorted by norm in decreasing order and grouped into blocks.
+ *  By Cauchy-Schwarz no item in block k or after it can score more than
+ *  |q| * |x_first(k)| + max_{i >= first(k)} b_i, so the scan stops as soon
+ *  as this bound cannot beat the current top-k threshold.
+ */
+class MIPSIndex {
+ public:
+  explicit MIPSIndex(size_t block_size = 64) : block_size_(block_size) {}
+
+  /** Build the index from the rows of item_vecs.
+   *  item_bias is either empty or has one entry per row.
+   */
+  void build(const DMatrixRef& item_vecs, const DVectorRef& item_bias = DVector()) {
+    size_t num_items = item_vecs.rows();
+    CHECK(item_bias.size() == 0 || static_cast<size_t>(item_bias.size()) == num_items);
+    num_items_ = num_items;
+    updated_pos_.clear();
+    updated_ids_.clear();
+    updated_vecs_.resize(0, 0);
+    updated_bias_.resize(0);
+
+    DVector norms = item_vecs.rowwise().norm();
+    order_.resize(num_items);
+    std::iota(order_.begin(), order_.end(), 0);
+    std::sort(order_.begin(), order_.end(), [&](size_t a, size_t b) {
+              return norms(a) > norms(b);
+              });
+
+    vecs_.resize(num_items, item_vecs.cols());
+    bias_ = DVector::Zero(num_items);
+    norms_.resize(num_items);
+    for (size_t idx = 0; idx < num_items; ++idx) {
+      vecs_.row(idx) = item_vecs.row(order_[idx]);
+      norms_(idx) = norms(order_[idx]);
+      if (item_bias.size() > 0) {
+        bias_(idx) = item_bias(order_[idx]);
+      }
+    }
+
+    // max bias over every suffix of blocks
+    size_t num_blocks = (num_items + block_size_ - 1) / block_size_;
+    block_bias_bound_.assign(num_blocks, 0.);
+    double max_bias = - std::numeric_limits<double>::infinity();
+    for (size_t bid = num_blocks; bid-- > 0; ) {
+      size_t begin = bid * block_size_;
+      size_t end = std::min(begin + block_size_, num_items);
+      for (size_t idx = begin; idx < end; ++idx) {
+        max_bias = std::max(max_bias, bias_(idx));
+      }
+      block_bias_bound_[bid] = max_bias;
+    }
+  }
+
+  /** Refresh the items in iids from item_vecs / item_bias, the rows of
+   *  item_vecs past size() are new items.
+   *
+   *  Updated and new items leave the norm-sorted blocks, whose bounds
+   *  stay valid for the remaining items, and are scored exhaustively
+   *  from a side list, so the search stays exact without re-sorting.
+   *  The index is rebuilt once the side list holds more than
+   *  max_update_ratio of the items.
+   */
+  void update(const DMatrixRef& item_vecs, const DVectorRef& item_bias,
+              const std::vector<size_t>& iids, double max_update_ratio = 0.1) {
+    size_t num_items = item_vecs.rows();
+    CHECK_GE(num_items, num_items_);
+    CHECK(item_bias.size() == 0 || static_cast<size_t>(item_bias.size()) == num_items);
+    updated_pos_.resize(num_items, size_t(kNotUpdated));
+    auto add = [&](size_t iid) {
+      if (updated_pos_[iid] == kNotUpdated) {
+        updated_pos_[iid] = updated_ids_.size();
+        updated_ids_.push_back(iid);
+      }
+    };
+    for (auto& iid : iids) {
+      CHECK_LT(iid, num_items);
+      add(iid);
+    }
+    for (size_t iid = num_items_; iid < num_items; ++iid) {
+      add(iid);
+    }
+    num_items_ = num_items;
+
+    if (updated_ids_.size() > std::max(block_size_, static_cast<size_t>(max_update_ratio * num_items))) {
+      build(item_vecs, item_bias);
+      return;
+    }
+    updated_vecs_.resize(updated_ids_.size(), item_vecs.cols());
+    updated_bias_ = DVector::Zero(updated_ids_.size());
+    for (size_t idx = 0; idx < updated_ids_.size(); ++idx) {
+      updated_vecs_.row(idx) = item_vecs.row(updated_ids_[idx]);
+      if (item_bias.size() > 0) {
+        updated_bias_(idx) = item_bias(updated_ids_[idx]);
+      }
+    }
+  }
+
+  void clear() {
+    num_items_ = 0;
+    updated_pos_.clear();
+    updated_ids_.clear();
+    updated_vecs_.resize(0, 0);
+    updated_bias_.resize(0);
+    order_.clear();
+    vecs_.resize(0, 0);
+    bias_.resize(0);
+    norms_.resize(0);
+    block_bias_bound_.clear();
+  }
+
+  bool empty() const {
+    return num_items_ == 0;
+  }
+
+  size_t size() const {
+    return num_items_;
+  }
+
+  /** Num of items scored from the side list, see update
+   */
+  size_t num_updated() const {
+    return updated_ids_.size();
+  }
+
+  /** Top-k item ids for the query, best first. Items for which
+   *  excluded.test(iid) is true are skipped.
+   */
+  template <class Mask>
+  std::vector<size_t> search(const DVector& q, size_t topk,
+                             const Mask& excluded) const {
+    double qnorm = q.norm();
+    size_t num_items = order_.size();
+    TopK<double> topk_items(topk);
+    static thread_local DVector scores;
+
+    // updated items first, their sorted slots are stale
+    bool has_updates = !updated_ids_.empty();
+    if (has_updates) {
+      scores.noalias() = updated_vecs_ * q;
+      scores += updated_bias_;
+      for (size_t idx = 0; idx < updated_ids_.size(); ++idx) {
+        size_t iid = updated_ids_[idx];
+        if (excluded.test(iid)) continue;
+        topk_items.push(iid, scores(idx));
+      }
+    }
+
+    for (size_t begin = 0, bid = 0; begin < num_items; begin += block_size_, ++bid) {
+      if (topk_items.full() &&
+          qnorm * norms_(begin) + block_bias_bound_[bid] <= topk_items.threshold()) {
+        break;
+      }
+      size_t n = std::min(block_size_, num_items - begin);
+      scores.noalias() = vecs_.middleRows(begin, n) * q;
+      scores += bias_.segment(begin, n);
+      for (size_t idx = 0; idx < n; ++idx) {
+        size_t iid = order_[begin + idx];
+        if (excluded.test(iid)) continue;
+        if (has_updates && updated_pos_[iid] != kNotUpdated) continue;
+        topk_items.push(iid, scores(idx));
+      }
+    }
+    return topk_items.get_sorted_ids();
+  }
+
+ private:
+  static const size_t kNotUpdated = static_cast<size_t>(-1);
+
+  size_t block_size_ = 64;
+  size_t num_items_ = 0;
+  std::vector<size_t> order_;  // sorted position -> item id
+  DMatrix vecs_;               // item vectors in sorted order
+  DVector bias_;               // item biases in sorted order
+  DVector norms_;              // item norms in sorted order
+  std::vector<double> block_bias_bound_;
+  std::vector<size_t> updated_pos_;  // item id -> side list position
+  std::vector<size_t> updated_ids_;  // side list of updated and new items
+  DMatrix updated_vecs_;
+  DVector updated_bias_;
+};
+
+} // namespace
+
+#endif // _LIBCF_MIPS_HPP_
@@ -93,7 +93,7 @@ class NegMF : public FactorModel {
     auto& user_rated_items_set = fit->second;
     size_t random_item;
     while(true) {
-      random_item = rand() % num_items_;
+      random_item = Random::rng() % num_items_;
       if (user_rated_items_set.count(random_item)) {
         continue;
       } else {
@@ -2,9 +2,12 @@
 #define _LIBCF_PMF_HPP_
 
 #include <algorithm>
+#include <numeric>
 #include <base/heap.hpp>
 #include <base/utils.hpp>
 #include <model/loss.hpp>
+#include <model/recsys/quantized.hpp>
+#include <model/recsys/strata.hpp>
 #include <model/recsys/recsys_model_base.hpp>
 
 namespace libcf {
@@ -17,8 +20,11 @@ struct PMFConfig {
   LossType lt = SQUARE; 
   PenaltyType pt = L2;  
   size_t num_dim = 10;
+  size_t num_strata = 0;  // > 0 for parallel SGD on num_strata^2 blocks, see StrataSchedule
   bool using_bias_term = true;
   bool using_adagrad = true;
+  RetrievalType retrieval = BRUTE_FORCE;
+  QuantizedConfig quant;
 };
 
 /** Matrix Factorization with Implicit Feedback
@@ -32,8 +38,11 @@ class PMF : public RecsysModelBase {
     beta_ = mcfg.beta;
     lambda_ = mcfg.lambda;
     num_dim_ = mcfg.num_dim;
+    num_strata_ = mcfg.num_strata;
     using_bias_term_ = mcfg.using_bias_term;
     using_adagrad_ = mcfg.using_adagrad;
+    retrieval_ = mcfg.retrieval;
+    quant_index_ = QuantizedIndex(mcfg.quant);
     loss_ = Loss::create(mcfg.lt);
     penalty_ = Penalty::create(mcfg.pt);
 
@@ -45,7 +54,9 @@ class PMF : public RecsysModelBase {
         << "{Penalty: " << penalty_->penalty_type() << "}\n"
         << "\t{Dim: " << num_dim_ << "}, "
         << "{BiasTerm: " << using_bias_term_ << "}, "
-        << "{Using AdaGrad: " << using_adagrad_ << "}";
+        << "{Using AdaGrad: " << using_adagrad_ << "}, "
+        << "{Num Strata: " << num_strata_ << "}, "
+        << "{Retrieval: " << retrieval_ << "}";
   }
 
   PMF() : PMF(PMFConfig()) {}
@@ -62,9 +73,17 @@ class PMF : public RecsysModelBase {
     iv_ag_ = DMatrix::Ones(num_items_, num_dim_) * 0.0001; 
     ub_ag_ = DVector::Ones(num_users_) * 0.0001;
     ib_ag_ = DVector::Ones(num_items_) * 0.0001;
+    quant_index_.clear();
   }
   
   virtual void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("pmf.train_one_iteration");
+    accumulated_loss_ = 0.;
+    quant_index_.clear();
+    if (num_strata_ > 0) {
+      train_strata();
+      return;
+    }
     for (size_t uid = 0; uid < num_users_; ++uid) {
       auto fit = user_rated_items_.find(uid);
       CHECK(fit != user_rated_items_.end());
@@ -74,13 +93,47 @@ class PMF : public RecsysModelBase {
         auto& yui = p.second;
         train_one_instance(uid, iid, yui);
       }
+      if (profiler_) {
+        profiler_->add_users(1);
+        profiler_->add_updates(item_map.size());
+      }
+    }
+  }
+
+  /** One epoch of parallel SGD over the strata
+   */
+  void train_strata() {
+    strata_.build(user_rated_items_.table(), num_users_, num_items_, num_strata_);
+    // the per-step phases are not timed, the pass counts as the update phase
+    std::vector<size_t> block_updates(num_strata_, 0);
+    accumulated_loss_ = strata_.run(Random::rng(), [&](size_t ub, size_t ib, Random::rng_type& rng) {
+      auto& block = strata_.block(ub, ib);
+      double loss = 0.;
+      for (auto& user : block.users) {
+        for (size_t pos = user.begin; pos < user.end; ++pos) {
+          loss += sgd_update(user.uid, block.entries[pos].first, block.entries[pos].second);
+          ++block_updates[ub];
+        }
+      }
+      return loss;
+    });
+    if (profiler_) {
+      profiler_->add_users(user_rated_items_.size());
+      profiler_->add_updates(std::accumulate(block_updates.begin(), block_updates.end(), size_t(0)));
     }
   }
 
   virtual void train_one_instance(size_t uid, size_t iid, double rui) {
+    accumulated_loss_ += sgd_update(uid, iid, rui);
+  }
+
+  /** One SGD step on (uid, iid), returns its loss if accumulate_loss_.
+   *  Writes only the rows of uid and iid.
+   */
+  double sgd_update(size_t uid, size_t iid, double rui) {
     double pred = predict_user_item_rating(uid, iid);
     double gradient = loss_->gradient(pred, rui);
-    
+
     double ub_grad = gradient + 2. * lambda_ * ub_(uid);
     double ib_grad = gradient + 2. * lambda_ * ib_(iid);
     DVector uv_grad = gradient * iv_.row(iid) + 2. * lambda_ * uv_.row(uid);
@@ -101,12 +154,51 @@ class PMF : public RecsysModelBase {
     ib_(iid) -= learn_rate_ * ib_grad;
     uv_.row(uid) -= learn_rate_ * uv_grad;
     iv_.row(iid) -= learn_rate_ * iv_grad;
+    return accumulate_loss_ ? loss_->evaluate(pred, rui) : 0.;
+  }
+
+  /** Loss of the observed ratings, the objective train_one_iteration
+   *  accumulates
+   */
+  virtual double data_loss(const Data& data_set, size_t sample_size=0) const {
+    return sum_user_losses(sample_size, [&](size_t uid) {
+      auto fit = user_rated_items_.find(uid);
+      if (fit == user_rated_items_.end()) return 0.;
+      double rets = 0.;
+      for (auto& p : fit->second) {
+        rets += loss_->evaluate(predict_user_item_rating(uid, p.first), p.second);
+      }
+      return rets;
+    });
+  }
+
+  virtual double accumulated_data_loss(const Data& data_set) const {
+    return accumulated_loss_;
   }
 
   double predict_user_item_rating(size_t uid, size_t iid) const {
     return ub_(uid) + ib_(iid) + uv_.row(uid).dot(iv_.row(iid));
   }
 
+  virtual void pre_recommend() {
+    LIBCF_TRACE_SCOPE("pmf.pre_recommend");
+    if (retrieval_ == QUANTIZED) {
+      quant_index_.build(iv_, ib_);
+    }
+  }
+
+  // required by evaluation measure TOPN
+  virtual std::vector<size_t> recommend(size_t uid, size_t topk,
+                                        const std::unordered_map<size_t, double>& rated_item_map) const {
+    if (quant_index_.empty()) {
+      return RecsysModelBase::recommend(uid, topk, rated_item_map);
+    }
+    CHECK_GE(num_items_ - rated_item_map.size(), topk);
+    ItemMask rated_mask(item_mask(), rated_item_map);
+    // the user bias does not change the ranking
+    return quant_index_.search(uv_.row(uid).transpose(), topk, rated_mask, iv_, ib_);
+  }
+
   DMatrix get_user_vecs() {
     return uv_;
   }
@@ -119,6 +211,8 @@ class PMF : public RecsysModelBase {
 
   DMatrix uv_, iv_, uv_ag_, iv_ag_;
   DVector ub_, ib_, ub_ag_, ib_ag_;
+  QuantizedIndex quant_index_;
+  StrataSchedule strata_;
  
   double learn_rate_ = 0.1;
   double beta_ = 1.;
@@ -127,6 +221,7 @@ class PMF : public RecsysModelBase {
   bool using_bias_term_ = true;
   bool using_factor_term_ = true;  
   bool using_adagrad_ = true;
+  size_t num_strata_ = 0;
 };
 
 } // namespace
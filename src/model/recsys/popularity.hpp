@@ -17,6 +17,7 @@ class Popularity : public RecsysModelBase{
   }
 
   virtual void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("popularity.train_one_iteration");
     // do nothing
   }
     
@@ -0,0 +1,202 @@
+#ifndef _LIBCF_QUANTIZED_HPP_
+#define _LIBCF_QUANTIZED_HPP_
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+
+#include <base/mat.hpp>
+#include <base/topk.hpp>
+#include <base/quantize.hpp>
+
+namespace libcf {
+
+enum QuantizationType {
+  QUANT_INT8,   // int8 with one scale per item
+  QUANT_FP16    // IEEE half precision
+};
+
+struct QuantizedConfig {
+  QuantizedConfig() = default;
+  QuantizationType type = QUANT_INT8;
+  size_t rerank_size = 100;  // candidates re-scored in full precision, 0 to disable
+};
+
+/**
+ *  Top-k inner product search over low precision item vectors:
+ *
+ *    score(q, i) = q . x_i + b_i
+ *
+ *  Every item is scored with int8 or fp16 kernels (see base/quantize.hpp),
+ *  which reads 8x / 4x less item data than double precision. With
+ *  rerank_size > 0 the best max(topk, rerank_size) approximate candidates
+ *  are re-scored exactly against the full precision vectors, which
+ *  recovers most of the recall lost to quantization.
+ */
+class QuantizedIndex {
+ public:
+  explicit QuantizedIndex(const QuantizedConfig& cfg = QuantizedConfig()) : cfg_(cfg) {}
+
+  /** Quantize the rows of item_vecs.
+   *  item_bias is either empty or has one entry per row.
+   */
+  void build(const DMatrixRef& item_vecs, const DVectorRef& item_bias = DVector()) {
+    num_items_ = item_vecs.rows();
+    num_dim_ = item_vecs.cols();
+    CHECK(item_bias.size() == 0 || static_cast<size_t>(item_bias.size()) == num_items_);
+    // pad rows to 32 bytes so the kernels run without tails
+    stride_ = (num_dim_ + 31) / 32 * 32;
+
+    bias_.assign(num_items_, 0.f);
+    int8_rows_.clear();
+    fp16_rows_.clear();
+    scales_.clear();
+    if (cfg_.type == QUANT_INT8) {
+      int8_rows_.assign(num_items_ * stride_, 0);
+      scales_.resize(num_items_);
+    } else {
+      fp16_rows_.assign(num_items_ * stride_, 0);
+    }
+    for (size_t iid = 0; iid < num_items_; ++iid) {
+      set_row(iid, item_vecs, item_bias);
+    }
+  }
+
+  /** Re-quantize the items in iids and append the rows of item_vecs
+   *  past size() as new items, without touching the other rows.
+   */
+  void update(const DMatrixRef& item_vecs, const DVectorRef& item_bias,
+              const std::vector<size_t>& iids) {
+    size_t num_items = item_vecs.rows();
+    CHECK_GE(num_items, num_items_);
+    CHECK_EQ(static_cast<size_t>(item_vecs.cols()), num_dim_);
+    CHECK(item_bias.size() == 0 || static_cast<size_t>(item_bias.size()) == num_items);
+    size_t old_num_items = num_items_;
+    num_items_ = num_items;
+    bias_.resize(num_items_, 0.f);
+    if (cfg_.type == QUANT_INT8) {
+      int8_rows_.resize(num_items_ * stride_, 0);
+      scales_.resize(num_items_);
+    } else {
+      fp16_rows_.resize(num_items_ * stride_, 0);
+    }
+    for (auto& iid : iids) {
+      if (iid < old_num_items) {
+        set_row(iid, item_vecs, item_bias);
+      }
+    }
+    for (size_t iid = old_num_items; iid < num_items_; ++iid) {
+      set_row(iid, item_vecs, item_bias);
+    }
+  }
+
+  void clear() {
+    num_items_ = 0;
+    int8_rows_.clear();
+    fp16_rows_.clear();
+    scales_.clear();
+    bias_.clear();
+  }
+
+  bool empty() const { return num_items_ == 0; }
+  size_t size() const { return num_items_; }
+  const QuantizedConfig& config() const { return cfg_; }
+
+  /** Bytes of item data read per query
+   */
+  size_t memory_bytes() const {
+    return int8_rows_.size() * sizeof(int8_t) + fp16_rows_.size() * sizeof(uint16_t)
+        + (scales_.size() + bias_.size()) * sizeof(float);
+  }
+
+  /** Approximate top-k item ids for the query, best first. Items for
+   *  which excluded.test(iid) is true are skipped.
+   */
+  template <class Mask>
+  std::vector<size_t> search(const DVector& q, size_t topk, const Mask& excluded) const {
+    return approximate_topk(q, topk, excluded).get_sorted_ids();
+  }
+
+  /** As above, re-ranking the best rerank_size candidates exactly with
+   *  the full precision item_vecs / item_bias the index was built from.
+   */
+  template <class Mask>
+  std::vector<size_t> search(const DVector& q, size_t topk, const Mask& excluded,
+                             const DMatrixRef& item_vecs,
+                             const DVectorRef& item_bias = DVector()) const {
+    if (cfg_.rerank_size == 0) {
+      return search(q, topk, excluded);
+    }
+    auto candidates = approximate_topk(q, std::max(topk, cfg_.rerank_size), excluded);
+    TopK<double> topk_items(topk);
+    for (auto& iid : candidates.get_sorted_ids()) {
+      if (excluded.test(iid)) continue;
+      double score = item_vecs.row(iid).dot(q.transpose());
+      if (item_bias.size() > 0) {
+        score += item_bias(iid);
+      }
+      topk_items.push(iid, score);
+    }
+    return topk_items.get_sorted_ids();
+  }
+
+ private:
+  void set_row(size_t iid, const DMatrixRef& item_vecs, const DVectorRef& item_bias) {
+    bias_[iid] = item_bias.size() > 0 ? static_cast<float>(item_bias(iid)) : 0.f;
+    if (cfg_.type == QUANT_INT8) {
+      scales_[iid] = quantize_int8(item_vecs.row(iid).data(), num_dim_,
+                                   &int8_rows_[iid * stride_]);
+    } else {
+      for (size_t d = 0; d < num_dim_; ++d) {
+        fp16_rows_[iid * stride_ + d] = float_to_half(static_cast<float>(item_vecs(iid, d)));
+      }
+    }
+  }
+
+  template <class Mask>
+  TopK<double> approximate_topk(const DVector& q, size_t topk, const Mask& excluded) const {
+    static thread_local std::vector<double> scores;
+    scores.resize(num_items_);
+    const double neg_inf = - std::numeric_limits<double>::infinity();
+
+    if (cfg_.type == QUANT_INT8) {
+      static thread_local std::vector<int8_t> qq;
+      qq.assign(stride_, 0);
+      double qscale = quantize_int8(q.data(), num_dim_, qq.data());
+      for (size_t iid = 0; iid < num_items_; ++iid) {
+        int32_t dot = dot_int8(&int8_rows_[iid * stride_], qq.data(), stride_);
+        scores[iid] = excluded.test(iid) ? neg_inf
+            : qscale * scales_[iid] * dot + bias_[iid];
+      }
+    } else {
+      static thread_local std::vector<float> qf;
+      qf.assign(stride_, 0.f);
+      for (size_t d = 0; d < num_dim_; ++d) {
+        qf[d] = static_cast<float>(q(d));
+      }
+      for (size_t iid = 0; iid < num_items_; ++iid) {
+        float dot = dot_fp16(&fp16_rows_[iid * stride_], qf.data(), stride_);
+        scores[iid] = excluded.test(iid) ? neg_inf : dot + bias_[iid];
+      }
+    }
+
+    TopK<double> topk_items(topk);
+    topk_items.push_block(scores.data(), 0, num_items_);
+    return std::move(topk_items);
+  }
+
+ private:
+  QuantizedConfig cfg_;
+  size_t num_items_ = 0;
+  size_t num_dim_ = 0;
+  size_t stride_ = 0;
+  std::vector<int8_t> int8_rows_;
+  std::vector<uint16_t> fp16_rows_;
+  std::vector<float> scales_;
+  std::vector<float> bias_;
+};
+
+} // namespace
+
+#endif // _LIBCF_QUANTIZED_HPP_
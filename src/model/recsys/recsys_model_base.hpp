@@ -1,17 +1,108 @@
 #ifndef _LIBCF_RECSYS_MODEL_BASE_HPP_
 #define _LIBCF_RECSYS_MODEL_BASE_HPP_
 
+#include <atomic>
+#include <numeric>
+#include <algorithm>
 #include <unordered_map>
 
 #include <base/mat.hpp>
+#include <base/bitset.hpp>
+#include <base/csr.hpp>
 #include <base/data.hpp>
 #include <base/heap.hpp>
+#include <base/topk.hpp>
+#include <base/parallel.hpp>
+#include <base/random.hpp>
+#include <base/io/checkpoint.hpp>
 #include <model/loss.hpp>
 #include <model/penalty.hpp>
 #include <model/model_base.hpp>
+#include <model/recsys/hnsw.hpp>
+#include <model/recsys/batch_topk.hpp>
 
 namespace libcf {
 
+/** How factor models retrieve the top-k items at recommend time
+ */
+enum RetrievalType {
+  BRUTE_FORCE,  // score every item
+  EXACT_MIPS,   // norm-pruned exact search, see MIPSIndex
+  ANN_HNSW,     // approximate search, see HNSWIndex
+  QUANTIZED     // int8 / fp16 scan with exact re-rank, see QuantizedIndex
+};
+
+/** User id for users unknown to a trained model
+ */
+const size_t kNoUser = static_cast<size_t>(-1);
+
+/**
+ *  The training histories of a model, user -> {item -> rating}. Models
+ *  reset on the same data set share one read-only InteractionTable, see
+ *  Data::interaction_table; the first change through operator[] or clear
+ *  copies the table, so online updates never touch the shared one.
+ *
+ *  version() changes on every access through operator[] or clear, to a
+ *  value no other index has had, so caches derived from the histories
+ *  can tell whether they are still current.
+ */
+class InteractionIndex {
+ public:
+  typedef InteractionTable::const_iterator const_iterator;
+
+  InteractionIndex() : table_(std::make_shared<const InteractionTable>()),
+      version_(next_version()) {}
+
+  explicit InteractionIndex(const std::shared_ptr<const InteractionTable>& table) :
+      table_(table), version_(next_version()) {
+    CHECK(table_ != nullptr);
+  }
+
+  const_iterator find(size_t uid) const { return table_->find(uid); }
+  const_iterator begin() const { return table_->begin(); }
+  const_iterator end() const { return table_->end(); }
+  size_t size() const { return table_->size(); }
+
+  const InteractionTable& table() const { return *table_; }
+
+  uint64_t version() const { return version_; }
+
+  /** Whether anything besides this index holds the table
+   */
+  bool is_shared() const { return table_.use_count() > (owned_ ? 2 : 1); }
+
+  std::unordered_map<size_t, double>& operator[](size_t uid) {
+    return mutable_table()[uid];
+  }
+
+  void clear() {
+    owned_ = std::make_shared<InteractionTable>();
+    table_ = owned_;
+    version_ = next_version();
+  }
+
+ private:
+  InteractionTable& mutable_table() {
+    if (!owned_ || is_shared()) {
+      owned_ = std::make_shared<InteractionTable>(*table_);
+      table_ = owned_;
+    }
+    version_ = next_version();
+    return *owned_;
+  }
+
+  static uint64_t next_version() {
+    static std::atomic<uint64_t> num_versions(0);
+    return ++num_versions;
+  }
+
+ private:
+  std::shared_ptr<const InteractionTable> table_;
+  // table_ again, non-const, once this index has a copy of its own
+  std::shared_ptr<InteractionTable> owned_;
+  uint64_t version_;
+};
+
 /**
  * Recsys Model base
  */
@@ -28,7 +119,9 @@ class RecsysModelBase : public ModelBase {
 
   virtual void reset(const Data& data_set) {
     ModelBase::reset(data_set);
-    user_rated_items_ = data_->get_feature_pair_label_hashtable(0, 1);
+    checkpoint_.reset();
+    history_view_ = CSRIndex();
+    user_rated_items_ = InteractionIndex(data_->interaction_table());
     num_users_ = data_->feature_group_total_dimension(0);
     num_items_ = data_->feature_group_total_dimension(1);
   }
@@ -37,6 +130,89 @@ class RecsysModelBase : public ModelBase {
     return 0.;
   }
 
+  /** Online training, see OnlineTrainer.
+   *
+   *  grow makes room for users and items added to the dictionaries
+   *  after reset, add_interaction appends to a user's history and
+   *  train_one_user runs one training pass over a user's history.
+   *  Between begin_online_update and end_online_update the model records
+   *  the items whose parameters change, so that end_online_update can
+   *  patch caches and retrieval indexes instead of rebuilding them.
+   */
+  virtual void grow(size_t num_users, size_t num_items) {
+    check_trainable();
+    CHECK_GE(num_users, num_users_);
+    CHECK_GE(num_items, num_items_);
+    for (size_t uid = num_users_; uid < num_users; ++uid) {
+      user_rated_items_[uid];
+    }
+    num_users_ = num_users;
+    num_items_ = num_items;
+  }
+
+  /** Returns false if the user has already rated the item
+   */
+  virtual bool add_interaction(size_t uid, size_t iid, double rating = 1.) {
+    check_trainable();
+    CHECK_LT(uid, num_users_);
+    CHECK_LT(iid, num_items_);
+    return user_rated_items_[uid].emplace(iid, rating).second;
+  }
+
+  virtual void train_one_user(size_t uid) {
+    LOG(FATAL) << "Unimplemented!";
+  }
+
+  virtual void begin_online_update() {
+    tracking_updates_ = true;
+    updated_items_.clear();
+  }
+
+  /** uids are the users trained since begin_online_update
+   */
+  virtual void end_online_update(const std::vector<size_t>& uids) {
+    tracking_updates_ = false;
+    std::sort(updated_items_.begin(), updated_items_.end());
+    updated_items_.erase(std::unique(updated_items_.begin(), updated_items_.end()),
+                         updated_items_.end());
+  }
+
+  size_t num_users() const { return num_users_; }
+  size_t num_items() const { return num_items_; }
+
+  virtual void memory_usage(MemoryReport& report) const {
+    // counted here although shared with the other models reset on the data set
+    report.add("model.user_rated_items", owned_bytes(user_rated_items_.table()));
+  }
+
+  /** Projected bytes of user_rated_items_
+   */
+  static size_t projected_history_bytes(size_t num_users, size_t num_interactions) {
+    size_t items_per_user = num_users > 0 ? num_interactions / num_users : 0;
+    return projected_hashtable_bytes<size_t, std::unordered_map<size_t, double>>(num_users)
+        + num_users * heap_bytes(items_per_user * sizeof(void*))
+        + num_interactions * hash_node_bytes<size_t, std::pair<const size_t, double>>();
+  }
+
+  /** The training histories, user -> {item -> rating}, empty for a
+   *  model loaded by load_checkpoint, see history_index
+   */
+  const InteractionTable& history_table() const {
+    return user_rated_items_.table();
+  }
+
+  /** The training histories as exclusions for recommend_batch. A model
+   *  loaded by load_checkpoint returns a view of its checkpoint's.
+   */
+  CSRIndex history_index() const {
+    if (checkpoint_) {
+      return history_view_;
+    }
+    CSRIndex rets(user_rated_items_.table(), num_users_);
+    rets.set_version(user_rated_items_.version());
+    return rets;
+  }
+
   virtual double predict(const Instance& ins) const {
     size_t uid = ins.get_feature_group_index(0, 0);
     size_t iid = ins.get_feature_group_index(1, 0);
@@ -46,7 +222,7 @@ class RecsysModelBase : public ModelBase {
   virtual size_t sample_negative_item(const std::unordered_map<size_t, double>& user_map) const {
     size_t random_item;
     while(true) {
-      random_item = rand() % num_items_;
+      random_item = Random::rng() % num_items_;
       if (user_map.count(random_item)) {
         continue;
       } else {
@@ -59,7 +235,7 @@ class RecsysModelBase : public ModelBase {
   virtual size_t sample_negative_item(const std::unordered_set<size_t>& user_set) const {
     size_t random_item;
     while(true) {
-      random_item = rand() % num_items_;
+      random_item = Random::rng() % num_items_;
       if (user_set.count(random_item)) {
         continue;
       } else {
@@ -69,43 +245,320 @@ class RecsysModelBase : public ModelBase {
     return random_item;
   }
 
+  /** As sample_negative_item, drawing from rng, e.g. for a loss that
+   *  has to draw the same items on every call
+   */
+  size_t sample_negative_item(const std::unordered_map<size_t, double>& user_map,
+                              Random::rng_type& rng) const {
+    size_t random_item;
+    do {
+      random_item = rng() % num_items_;
+    } while (user_map.count(random_item));
+    return random_item;
+  }
+
+  /** Sum of user_loss(uid) over the users for data_loss. With 0 <
+   *  sample_size < num_users_ it is estimated on a fixed, evenly
+   *  strided subset of sample_size users and scaled up to all of them.
+   */
+  template <class UserLoss>
+  double sum_user_losses(size_t sample_size, const UserLoss& user_loss) const {
+    size_t num_samples = num_users_;
+    if (sample_size > 0 && sample_size < num_users_) {
+      num_samples = sample_size;
+    }
+    if (num_samples == 0) return 0.;
+    std::vector<double> losses(num_samples, 0.);
+    parallel_for (0, num_samples, [&](size_t sample_idx) {
+      losses[sample_idx] = user_loss(sample_idx * num_users_ / num_samples);
+    });
+    double rets = std::accumulate(losses.begin(), losses.end(), 0.);
+    return rets * static_cast<double>(num_users_) / num_samples;
+  }
+
   virtual void pre_recommend() {
+    LIBCF_TRACE_SCOPE("recsys.pre_recommend");
     // do nothing
   }
 
+  /** Persist the approximate retrieval index built by pre_recommend
+   */
+  void save_ann_index(const std::string& filename) const {
+    CHECK(ann_index_) << "No ANN index to save, call pre_recommend first";
+    ann_index_->save(filename);
+  }
+
+  /** Load a previously saved approximate retrieval index. It is used
+   *  by recommend until the model is trained again.
+   */
+  void load_ann_index(const std::string& filename) {
+    ann_index_ = std::make_shared<HNSWIndex>(hnsw_config_);
+    ann_index_->load(filename);
+    CHECK_EQ(ann_index_->size(), num_items_);
+    retrieval_ = ANN_HNSW;
+  }
+
+  /** Save the model to a checkpoint (see base/io/checkpoint.hpp) along
+   *  with the user and item dictionaries of its training data.
+   *  optimizer_state keeps the AdaGrad accumulators, which only resuming
+   *  training needs. histories keeps the users' training histories,
+   *  which serving needs to exclude rated items and CDAE to encode users.
+   */
+  void save_checkpoint(const std::string& filename, bool optimizer_state = true,
+                       bool histories = true) const {
+    CheckpointWriter ckpt;
+    if (data_ != nullptr) {
+      auto data_info = data_->get_data_info();
+      ckpt.add_dictionary("users", data_info->feature_group_infos_[0]);
+      ckpt.add_dictionary("items", data_info->feature_group_infos_[1]);
+    }
+    if (histories) {
+      write_histories(ckpt);
+    }
+    write_checkpoint(ckpt, optimizer_state);
+    ckpt.save(filename);
+  }
+
+  /** Restore the parameters saved by save_checkpoint. The model is
+   *  ready for pre_recommend / recommend without any training data.
+   */
+  void load_checkpoint(const std::string& filename, bool use_mmap = true) {
+    load_checkpoint(std::make_shared<const Checkpoint>(filename, use_mmap));
+  }
+
+  /** The same from an open checkpoint, which the model keeps: the
+   *  parameters and histories are read in place, so loading costs the
+   *  same for any catalog size. The model is read-only until reset.
+   */
+  void load_checkpoint(const std::shared_ptr<const Checkpoint>& ckpt) {
+    checkpoint_ = ckpt;
+    read_checkpoint(*checkpoint_);
+  }
+
+  /** Continue training on data_set from a checkpoint saved with the
+   *  optimizer state, in place of reset. The parameters are copied out
+   *  of the checkpoint and the histories are taken from data_set, which
+   *  has to be the data set the model was trained on.
+   */
+  void resume_checkpoint(const std::string& filename, const Data& data_set) {
+    load_checkpoint(filename);
+    CHECK_EQ(num_users_, data_set.feature_group_total_dimension(0));
+    CHECK_EQ(num_items_, data_set.feature_group_total_dimension(1));
+    own_parameters();
+    checkpoint_.reset();
+    history_view_ = CSRIndex();
+    data_ = &data_set;
+    user_rated_items_ = InteractionIndex(data_set.interaction_table());
+  }
+
+  virtual void write_checkpoint(CheckpointWriter& ckpt, bool optimizer_state) const {
+    ckpt.add("model.shape", std::vector<uint64_t>{num_users_, num_items_});
+  }
+
+  // training histories in CSR layout, each row sorted by item so that
+  // history_index can view them in place
+  void write_histories(CheckpointWriter& ckpt) const {
+    std::vector<uint64_t> offsets(num_users_ + 1, 0);
+    std::vector<uint64_t> ids;
+    std::vector<double> ratings;
+    if (checkpoint_) {
+      // a loaded model saves the histories it read
+      if (!checkpoint_->has("history.offsets")) return;
+      auto o = checkpoint_->array<uint64_t>("history.offsets");
+      auto i = checkpoint_->array<uint64_t>("history.ids");
+      auto r = checkpoint_->array<double>("history.ratings");
+      offsets.assign(o.begin(), o.end());
+      ids.assign(i.begin(), i.end());
+      ratings.assign(r.begin(), r.end());
+    } else {
+      std::vector<std::pair<size_t, double>> row;
+      for (size_t uid = 0; uid < num_users_; ++uid) {
+        auto fit = user_rated_items_.find(uid);
+        if (fit != user_rated_items_.end()) {
+          row.assign(fit->second.begin(), fit->second.end());
+          std::sort(row.begin(), row.end());
+          for (auto& p : row) {
+            ids.push_back(p.first);
+            ratings.push_back(p.second);
+          }
+        }
+        offsets[uid + 1] = ids.size();
+      }
+    }
+    ckpt.add("history.offsets", std::move(offsets));
+    ckpt.add("history.ids", std::move(ids));
+    ckpt.add("history.ratings", std::move(ratings));
+  }
+
+  /** Whether ckpt holds a checkpoint this model can read, else false
+   *  with the reason in error. read_checkpoint CHECKs it; loaders that
+   *  have to survive a bad file call it first, see ModelVersion::load.
+   *  Overrides check their own sections after these.
+   */
+  virtual bool check_checkpoint(const Checkpoint& ckpt, std::string* error) const {
+    if (!ckpt.has("model.shape", CKPT_UINT64, 2, 1)) {
+      return checkpoint_error(error, "Checkpoint without model.shape");
+    }
+    auto shape = ckpt.array<uint64_t>("model.shape");
+    size_t num_users = shape[0];
+    size_t num_items = shape[1];
+    if (!ckpt.has("history.offsets")) return true;
+    // served in place, so a corrupt file must not reach recommend_batch
+    if (num_users == size_t(-1) || !ckpt.has("history.offsets", CKPT_UINT64, num_users + 1, 1)) {
+      return checkpoint_error(error, "Corrupted training histories in checkpoint");
+    }
+    auto offsets = ckpt.array<uint64_t>("history.offsets");
+    size_t num_ids = offsets[num_users];
+    if (!ckpt.has("history.ids", CKPT_UINT64, num_ids, 1)
+        || !ckpt.has("history.ratings", CKPT_DOUBLE, num_ids, 1)
+        || !CSRIndex::view(offsets.begin(), ckpt.array<uint64_t>("history.ids").begin(),
+                           num_users).well_formed(num_items)) {
+      return checkpoint_error(error, "Corrupted training histories in checkpoint");
+    }
+    return true;
+  }
+
+  virtual void read_checkpoint(const Checkpoint& ckpt) {
+    std::string error;
+    CHECK(check_checkpoint(ckpt, &error)) << error;
+    auto shape = ckpt.array<uint64_t>("model.shape");
+    num_users_ = shape[0];
+    num_items_ = shape[1];
+    ann_index_.reset();
+    user_rated_items_.clear();
+    if (ckpt.has("history.offsets")) {
+      auto offsets = ckpt.array<uint64_t>("history.offsets");
+      auto ids = ckpt.array<uint64_t>("history.ids");
+      history_view_ = CSRIndex::view(offsets.begin(), ids.begin(), num_users_);
+    } else {
+      history_view_ = CSRIndex(user_rated_items_.table(), num_users_);
+    }
+    history_view_.set_version(user_rated_items_.version());
+  }
+
+  // false, with what in error, for check_checkpoint
+  static bool checkpoint_error(std::string* error, const std::string& what) {
+    if (error) *error = what;
+    return false;
+  }
+
+  /** Copy the parameters a model loaded by load_checkpoint reads in
+   *  place into its own storage, so that it can be trained
+   */
+  virtual void own_parameters() {}
+
   // required by evaluation measure TOPN
   virtual std::vector<size_t> recommend(size_t uid, size_t topk,
                                         const std::unordered_map<size_t, double>& rated_item_map) const {
     size_t item_id = 0;
-    size_t item_id_end = data_->feature_group_total_dimension(1);
+    size_t item_id_end = num_items_;
   
-    Heap<std::pair<size_t, double>> topk_heap(sort_by_second_desc<size_t, double>, topk);
-    double pred;
+    ItemMask rated_mask(item_mask(), rated_item_map);
+    TopK<double> topk_items(topk);
     for (; item_id != item_id_end; ++item_id) {
-      if (rated_item_map.count(item_id)) {
+      if (rated_mask.test(item_id)) {
         continue;
       }
-      pred = predict_user_item_rating(uid, item_id);
-      if (topk_heap.size() < topk) {
-        topk_heap.push({item_id, pred});
-      } else {
-        topk_heap.push_and_pop({item_id, pred});
+      topk_items.push(item_id, predict_user_item_rating(uid, item_id));
+    }
+    CHECK_EQ(topk_items.size(), topk);
+    return topk_items.get_sorted_ids();
+  }
+
+  /** Recommend for a batch of users at once.
+   *
+   *  The list of uids[idx] is written to rec_lists[idx * topk, (idx + 1) * topk),
+   *  best first; rec_lists is owned by the caller and holds num_requests * topk
+   *  entries. Items in exclusions.row(uid) are never recommended. Models that
+   *  return fewer than topk items fill the rest with kNoItem.
+   *
+   *  This default calls recommend for every user in parallel; factor models
+   *  override it with tiled matrix scoring (see batch_inner_product_topk).
+   */
+  virtual void recommend_batch(const size_t* uids, size_t num_requests, size_t topk,
+                               const CSRIndex& exclusions, size_t* rec_lists) const {
+    LIBCF_TRACE_SCOPE("recsys.recommend_batch");
+    parallel_for(0, num_requests, [&](size_t idx) {
+      static thread_local std::unordered_map<size_t, double> rated_item_map;
+      rated_item_map.clear();
+      size_t uid = uids[idx];
+      for (auto& iid : exclusions.row(uid)) {
+        rated_item_map[iid] = 1.;
       }
+      size_t num_left = num_items_ - std::min(rated_item_map.size(), num_items_);
+      auto rec_list = recommend(uid, std::min(topk, num_left), rated_item_map);
+      CHECK_LE(rec_list.size(), topk);
+      size_t* out = rec_lists + idx * topk;
+      std::copy(rec_list.begin(), rec_list.end(), out);
+      std::fill(out + rec_list.size(), out + topk, kNoItem);
+    });
+  }
+
+ protected:
+  typedef ScopedBitsetMask<std::unordered_map<size_t, double>> ItemMask;
+
+  /** Per-thread reusable bitset over the items, used with ItemMask to
+   *  exclude rated items without hashtable probes. All bits are clear
+   *  whenever no ItemMask is alive on the calling thread.
+   */
+  DenseBitset& item_mask() const {
+    static thread_local DenseBitset mask;
+    if (mask.size() < num_items_) {
+      mask.resize(num_items_);
+    }
+    return mask;
+  }
+
+  /** Record an item whose parameters changed in an online update
+   */
+  void touch_item(size_t iid) {
+    if (tracking_updates_) {
+      updated_items_.push_back(iid);
+    }
+  }
+
+  /** Training, and online updates, need the model's own parameters
+   */
+  void check_trainable() const {
+    CHECK(checkpoint_ == nullptr) << "A model loaded by load_checkpoint reads the checkpoint "
+        << "in place, train it from resume_checkpoint instead";
+  }
+
+  /** Build the approximate retrieval index, unless one is already
+   *  built or loaded. The index is shared by copies of the model and
+   *  dropped (never modified) when the item vectors change in training;
+   *  online updates patch a private copy, see update_ann_index.
+   */
+  void build_ann_index(const DMatrixRef& item_vecs, const DVectorRef& item_bias = DVector()) {
+    if (ann_index_) return;
+    auto index = std::make_shared<HNSWIndex>(hnsw_config_);
+    index->build(item_vecs, item_bias);
+    ann_index_ = index;
+  }
+
+  /** Patch the approximate retrieval index with the items changed
+   *  in the current online update, copying it first if it is shared.
+   */
+  void update_ann_index(const DMatrixRef& item_vecs, const DVectorRef& item_bias = DVector()) {
+    if (!ann_index_) return;
+    if (ann_index_.use_count() > 1) {
+      ann_index_ = std::make_shared<HNSWIndex>(*ann_index_);
     }
-    CHECK_EQ(topk_heap.size(), topk);
-    auto topk_heap_vec = topk_heap.get_sorted_data();
-    std::vector<size_t> ret(topk);
-    std::transform(topk_heap_vec.begin(), topk_heap_vec.end(),
-                   ret.begin(),
-                   [](const std::pair<size_t, double>& p) {
-                   return p.first;
-                   });
-    return std::move(ret);
+    ann_index_->update(item_vecs, item_bias, updated_items_);
   }
 
  protected:
-  size_t num_users_, num_items_;
-  std::unordered_map<size_t, std::unordered_map<size_t, double>> user_rated_items_;
+  size_t num_users_ = 0, num_items_ = 0;
+  RetrievalType retrieval_ = EXACT_MIPS;
+  HNSWConfig hnsw_config_;
+  std::shared_ptr<HNSWIndex> ann_index_;
+  InteractionIndex user_rated_items_;
+  bool tracking_updates_ = false;
+  std::vector<size_t> updated_items_;  // items changed in the current online update
+  // set by load_checkpoint: the checkpoint read in place and a view of
+  // its histories
+  std::shared_ptr<const Checkpoint> checkpoint_;
+  CSRIndex history_view_;
 };
 
 } // namespace
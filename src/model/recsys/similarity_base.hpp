@@ -41,6 +41,8 @@ class SimilarityBase : public RecsysModelBase {
 
   virtual void reset(const Data& data_set) {
     data_ = &data_set;
+    num_users_ = data_set.feature_group_total_dimension(0);
+    num_items_ = data_set.feature_group_total_dimension(1);
     Timer timer;
     CHECK_LT(index_feature_group_, data_set.num_feature_groups());
     CHECK_LT(data_feature_group_, data_set.num_feature_groups());
@@ -107,6 +109,7 @@ class SimilarityBase : public RecsysModelBase {
   }
 
   virtual void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("similarity.train_one_iteration");
     // do nothing
   }
   
@@ -114,6 +117,99 @@ class SimilarityBase : public RecsysModelBase {
     return topk_neighbors_;
   } 
 
+  // neighbour lists and the index -> data lists in CSR layout
+  virtual void write_checkpoint(CheckpointWriter& ckpt, bool optimizer_state) const {
+    RecsysModelBase::write_checkpoint(ckpt, optimizer_state);
+    ckpt.add("model.type", std::string("SIMILARITY"));
+    ckpt.add("model.groups", std::vector<uint64_t>{index_feature_group_, data_feature_group_});
+    std::vector<uint64_t> offsets(1, 0);
+    std::vector<uint64_t> ids;
+    std::vector<double> sims;
+    for (auto& neighbors : topk_neighbors_) {
+      for (auto& p : neighbors) {
+        ids.push_back(p.first);
+        sims.push_back(p.second);
+      }
+      offsets.push_back(ids.size());
+    }
+    ckpt.add("neighbors.offsets", std::move(offsets));
+    ckpt.add("neighbors.ids", std::move(ids));
+    ckpt.add("neighbors.sims", std::move(sims));
+
+    offsets.assign(1, 0);
+    ids.clear();
+    for (size_t idx = 0; idx < topk_neighbors_.size(); ++idx) {
+      auto fit = index_data_pair.find(idx);
+      if (fit != index_data_pair.end()) {
+        ids.insert(ids.end(), fit->second.begin(), fit->second.end());
+      }
+      offsets.push_back(ids.size());
+    }
+    ckpt.add("index_data.offsets", std::move(offsets));
+    ckpt.add("index_data.ids", std::move(ids));
+  }
+
+  virtual bool check_checkpoint(const Checkpoint& ckpt, std::string* error) const {
+    if (!RecsysModelBase::check_checkpoint(ckpt, error)) return false;
+    if (!ckpt.has("model.type", CKPT_BYTES) || ckpt.bytes("model.type") != "SIMILARITY") {
+      return checkpoint_error(error, "Not a similarity checkpoint");
+    }
+    if (!ckpt.has("model.groups", CKPT_UINT64, 2, 1)
+        || ckpt.array<uint64_t>("model.groups")[0] != index_feature_group_
+        || ckpt.array<uint64_t>("model.groups")[1] != data_feature_group_) {
+      return checkpoint_error(error, "Checkpoint of a different similarity model");
+    }
+    // offsets start at 0, never decrease and end at the number of ids
+    auto csr_layout = [&](const std::string& prefix, size_t num_rows) {
+      if (!ckpt.has(prefix + ".offsets", CKPT_UINT64, num_rows + 1, 1)) return false;
+      auto offsets = ckpt.array<uint64_t>(prefix + ".offsets");
+      if (offsets[0] != 0) return false;
+      for (size_t idx = 0; idx < num_rows; ++idx) {
+        if (offsets[idx + 1] < offsets[idx]) return false;
+      }
+      return ckpt.has(prefix + ".ids", CKPT_UINT64, offsets[num_rows], 1);
+    };
+    if (!ckpt.has("neighbors.offsets", CKPT_UINT64) || ckpt.section("neighbors.offsets").rows == 0) {
+      return checkpoint_error(error, "Corrupted similarity neighbors");
+    }
+    size_t num_rows = ckpt.section("neighbors.offsets").rows - 1;
+    if (!csr_layout("neighbors", num_rows)
+        || !ckpt.has("neighbors.sims", CKPT_DOUBLE, ckpt.section("neighbors.ids").rows, 1)) {
+      return checkpoint_error(error, "Corrupted similarity neighbors");
+    }
+    // neighbours are of the index group, so their ids index the lists
+    for (auto id : ckpt.array<uint64_t>("neighbors.ids")) {
+      if (id >= num_rows) return checkpoint_error(error, "Corrupted similarity neighbors");
+    }
+    if (!csr_layout("index_data", num_rows)) {
+      return checkpoint_error(error, "Corrupted similarity index data");
+    }
+    return true;
+  }
+
+  virtual void read_checkpoint(const Checkpoint& ckpt) {
+    RecsysModelBase::read_checkpoint(ckpt);
+    auto offsets = ckpt.array<uint64_t>("neighbors.offsets");
+    auto ids = ckpt.array<uint64_t>("neighbors.ids");
+    auto sims = ckpt.array<double>("neighbors.sims");
+    topk_neighbors_.assign(offsets.size() - 1, {});
+    for (size_t idx = 0; idx < topk_neighbors_.size(); ++idx) {
+      auto& neighbors = topk_neighbors_[idx];
+      for (size_t pos = offsets[idx]; pos < offsets[idx + 1]; ++pos) {
+        neighbors.emplace_back(ids[pos], sims[pos]);
+      }
+    }
+
+    offsets = ckpt.array<uint64_t>("index_data.offsets");
+    ids = ckpt.array<uint64_t>("index_data.ids");
+    index_data_pair.clear();
+    data_index_pair.clear();
+    for (size_t idx = 0; idx < topk_neighbors_.size(); ++idx) {
+      if (offsets[idx] == offsets[idx + 1]) continue;
+      index_data_pair[idx].assign(ids.begin() + offsets[idx], ids.begin() + offsets[idx + 1]);
+    }
+  }
+
  protected:
   std::vector<std::vector<std::pair<size_t, double>>> topk_neighbors_;  
   std::unordered_map<size_t, std::vector<size_t>> data_index_pair;
@@ -0,0 +1,183 @@
+#ifndef _LIBCF_STRATA_HPP_
+#define _LIBCF_STRATA_HPP_
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include <base/data.hpp>
+#include <base/memory.hpp>
+#include <base/parallel.hpp>
+#include <base/random.hpp>
+
+namespace libcf {
+
+/**
+ *  DSGD schedule of an SGD epoch (Gemulla et al., 2011). Users and items
+ *  are dealt into P blocks each, cutting the interactions into P x P
+ *  blocks. A sub-epoch trains the P blocks of one stratum, (ub, ub + shift
+ *  mod P) for every user block ub, side by side: they share no user and no
+ *  item, so no row of the factors is written by two threads and no lock is
+ *  needed. An epoch runs the P strata in a random order.
+ *
+ *  Each block draws from its own engine, seeded by the epoch seed, the
+ *  sub-epoch and the block, and losses are summed in block order, so an
+ *  epoch only depends on the seed and P, not on the number of threads.
+ *  Models sample negative items inside the item block they train.
+ */
+class StrataSchedule {
+ public:
+  typedef std::unordered_map<size_t, double> ItemMap;
+
+  /** The entries [begin, end) of a block belong to user uid
+   */
+  struct StratumUser {
+    size_t uid;
+    const ItemMap* rated;   // the user's whole history
+    size_t begin, end;
+  };
+
+  struct Block {
+    std::vector<StratumUser> users;
+    std::vector<std::pair<size_t, double>> entries;   // (item, rating)
+  };
+
+  /** Cut the interactions of table into num_strata x num_strata blocks.
+   *  The table must outlive the use of the blocks.
+   */
+  void build(const InteractionTable& table, size_t num_users, size_t num_items,
+             size_t num_strata) {
+    CHECK_GT(num_strata, 0);
+    num_strata_ = num_strata;
+    std::vector<size_t> user_counts(num_users, 0), item_counts(num_items, 0);
+    for (auto& p : table) {
+      user_counts[p.first] = p.second.size();
+      for (auto& q : p.second) {
+        ++item_counts[q.first];
+      }
+    }
+    user_block_ = deal(user_counts);
+    item_block_ = deal(item_counts);
+
+    item_blocks_.assign(num_strata_, std::vector<size_t>());
+    for (size_t iid = 0; iid < num_items; ++iid) {
+      item_blocks_[item_block_[iid]].push_back(iid);
+    }
+
+    blocks_.assign(num_strata_ * num_strata_, Block());
+    num_entries_ = 0;
+    for (size_t uid = 0; uid < num_users; ++uid) {
+      auto fit = table.find(uid);
+      if (fit == table.end() || fit->second.empty()) continue;
+      size_t ub = user_block_[uid];
+      for (size_t ib = 0; ib < num_strata_; ++ib) {
+        auto& block = blocks_[ub * num_strata_ + ib];
+        block.users.push_back({uid, &fit->second, block.entries.size(), block.entries.size()});
+      }
+      // hash order is fixed for a given table
+      for (auto& q : fit->second) {
+        blocks_[ub * num_strata_ + item_block_[q.first]].entries.push_back(q);
+      }
+      for (size_t ib = 0; ib < num_strata_; ++ib) {
+        auto& block = blocks_[ub * num_strata_ + ib];
+        block.users.back().end = block.entries.size();
+        if (block.users.back().begin == block.users.back().end) {
+          block.users.pop_back();
+        }
+      }
+      num_entries_ += fit->second.size();
+    }
+  }
+
+  size_t num_strata() const { return num_strata_; }
+  size_t num_entries() const { return num_entries_; }
+  bool empty() const { return blocks_.empty(); }
+
+  const Block& block(size_t ub, size_t ib) const {
+    return blocks_[ub * num_strata_ + ib];
+  }
+
+  /** True if the user has not rated every item of block ib
+   */
+  bool has_negative_item(size_t ib, const StratumUser& user) const {
+    return user.end - user.begin < item_blocks_[ib].size();
+  }
+
+  /** Uniform item of block ib the user has not rated, see has_negative_item
+   */
+  size_t sample_negative_item(size_t ib, const ItemMap& rated, Random::rng_type& rng) const {
+    auto& items = item_blocks_[ib];
+    while (true) {
+      size_t iid = items[rng() % items.size()];
+      if (!rated.count(iid)) return iid;
+    }
+  }
+
+  /** One epoch. fn(ub, ib, rng) trains block (ub, ib) and returns its
+   *  loss; the blocks of a stratum run on num_hardware_threads threads.
+   *  Returns the summed loss.
+   */
+  double run(size_t seed,
+             const std::function<double (size_t, size_t, Random::rng_type&)>& fn) const {
+    CHECK(!empty());
+    Random::rng_type rng(seed);
+    std::vector<size_t> shifts(num_strata_);
+    std::iota(shifts.begin(), shifts.end(), 0);
+    std::shuffle(shifts.begin(), shifts.end(), rng);
+
+    double rets = 0.;
+    std::vector<double> losses(num_strata_);
+    for (size_t sub = 0; sub < num_strata_; ++sub) {
+      size_t shift = shifts[sub];
+      parallel_for(0, num_strata_, [&](size_t ub) {
+        std::seed_seq seq({seed & 0xffffffff, seed >> 32, sub, ub});
+        Random::rng_type block_rng(seq);
+        losses[ub] = fn(ub, (ub + shift) % num_strata_, block_rng);
+      });
+      for (auto& loss : losses) {
+        rets += loss;
+      }
+    }
+    return rets;
+  }
+
+  size_t memory_bytes() const {
+    size_t rets = owned_bytes(user_block_) + owned_bytes(item_block_)
+        + owned_bytes(item_blocks_) + heap_bytes(blocks_.capacity() * sizeof(Block));
+    for (auto& block : blocks_) {
+      rets += heap_bytes(block.users.capacity() * sizeof(StratumUser))
+          + heap_bytes(block.entries.capacity() * sizeof(std::pair<size_t, double>));
+    }
+    return rets;
+  }
+
+ private:
+  // deal the ids into blocks by descending count, snaking so that the
+  // blocks get about the same number of interactions
+  std::vector<size_t> deal(const std::vector<size_t>& counts) const {
+    std::vector<size_t> ids(counts.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    std::stable_sort(ids.begin(), ids.end(), [&](size_t a, size_t b) {
+      return counts[a] > counts[b];
+    });
+    std::vector<size_t> rets(counts.size());
+    for (size_t idx = 0; idx < ids.size(); ++idx) {
+      size_t round = idx / num_strata_, pos = idx % num_strata_;
+      rets[ids[idx]] = round % 2 == 0 ? pos : num_strata_ - 1 - pos;
+    }
+    return rets;
+  }
+
+ private:
+  size_t num_strata_ = 0;
+  size_t num_entries_ = 0;
+  std::vector<size_t> user_block_, item_block_;
+  std::vector<std::vector<size_t>> item_blocks_;   // the items of each item block
+  std::vector<Block> blocks_;                      // row major by user block
+};
+
+} // namespace
+
+#endif // _LIBCF_STRATA_HPP_
@@ -25,12 +25,13 @@ class UserCF : public SimilarityBase {
     CHECK_LT(uid, topk_neighbors_.size());
     auto& similar_users = topk_neighbors_[uid];
     std::unordered_map<size_t, double> topk_rets;
+    ItemMask rated_mask(item_mask(), rated_map);
     
     for (auto& user_sim_pair : similar_users) {
       CHECK(index_data_pair.count(user_sim_pair.first));
       auto& sim_index_data_pair = index_data_pair.at(user_sim_pair.first);    
       for (auto& item_id : sim_index_data_pair) {
-        if (rated_map.count(item_id)) 
+        if (rated_mask.test(item_id)) 
           continue;
         if (topk_rets.count(item_id)) {
           topk_rets[item_id] += user_sim_pair.second;
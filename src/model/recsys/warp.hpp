@@ -61,6 +61,7 @@ class WARP : public IMF {
   }
 
   virtual void train_one_iteration(const Data& train_data) {
+    LIBCF_TRACE_SCOPE("warp.train_one_iteration");
     for (size_t uid = 0; uid < num_users_; ++uid) {
       auto fit = user_rated_items_.find(uid);
       CHECK(fit != user_rated_items_.end());
@@ -0,0 +1,158 @@
+#ifndef _LIBCF_LOAD_GENERATOR_HPP_
+#define _LIBCF_LOAD_GENERATOR_HPP_
+
+#include <vector>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+
+#include <base/json.hpp>
+#include <base/latency.hpp>
+#include <model/recsys/recsys_model_base.hpp>
+
+namespace libcf {
+
+struct LoadConfig {
+  LoadConfig() = default;
+  size_t num_threads = 1;      // concurrent clients
+  double arrival_rate = 0.;    // requests / sec over all clients, 0 for a closed loop
+  double duration = 10.;       // secs measured
+  double warmup = 1.;          // secs run before the measurement
+  size_t topk = 10;
+  size_t seed = 20141119;
+};
+
+struct LoadResult {
+  LatencyHistogram latency;    // ns
+  size_t num_requests = 0;
+  double secs = 0.;
+
+  double qps() const {
+    return secs > 0. ? num_requests / secs : 0.;
+  }
+
+  void write_json(JsonWriter& json) const {
+    json.add("requests", num_requests);
+    json.add("secs", secs);
+    json.add("qps", qps());
+    json.begin_object("latency_us");
+    json.add("min", latency.min() / 1e3);
+    json.add("mean", latency.mean() / 1e3);
+    for (auto& p : {std::make_pair("p50", 50.), std::make_pair("p90", 90.),
+                    std::make_pair("p99", 99.), std::make_pair("p999", 99.9)}) {
+      json.add(p.first, latency.percentile(p.second) / 1e3);
+    }
+    json.add("max", latency.max() / 1e3);
+    json.end_object();
+  }
+};
+
+/**
+ *  Replays a stream of uids against a model's recommend from
+ *  num_threads client threads and records the latency of every request.
+ *
+ *  With arrival_rate 0 the clients run a closed loop: each sends its
+ *  next request when the previous one returns, which measures the peak
+ *  throughput. Otherwise each client sends at Poisson arrival times
+ *  (arrival_rate / num_threads per client) and latencies are measured
+ *  from the intended send time, so queueing behind a slow request is
+ *  counted instead of hidden (coordinated omission).
+ *
+ *  Client t replays stream[t], stream[t + num_threads], ... wrapping
+ *  around; rated_items gives the items excluded for every user.
+ *
+ *  Example:
+ *
+ *    LoadGenerator gen(model, rated_items, uids, LoadConfig());
+ *    auto result = gen.run();
+ *    LOG(INFO) << result.qps() << " QPS, p99 " << result.latency.percentile(99.) << " ns";
+ */
+class LoadGenerator {
+ public:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::unordered_map<size_t, std::unordered_map<size_t, double>> RatedItems;
+
+  LoadGenerator(const RecsysModelBase& model, const RatedItems& rated_items,
+                const std::vector<size_t>& stream, const LoadConfig& cfg) :
+      model_(model), rated_items_(rated_items), stream_(stream), cfg_(cfg) {
+    CHECK_GT(cfg_.num_threads, 0);
+    CHECK_GT(stream_.size(), 0);
+    CHECK_GE(cfg_.arrival_rate, 0.);
+    for (auto& uid : stream_) {
+      CHECK_LT(uid, model_.num_users());
+    }
+  }
+
+  LoadResult run() const {
+    std::vector<LatencyHistogram> latencies(cfg_.num_threads);
+    std::vector<size_t> counts(cfg_.num_threads, 0);
+    auto start = Clock::now();
+    auto measure_start = start + to_duration(cfg_.warmup);
+    auto end = measure_start + to_duration(cfg_.duration);
+
+    std::vector<std::thread> clients;
+    for (size_t tid = 0; tid < cfg_.num_threads; ++tid) {
+      clients.emplace_back([&, tid]() {
+        std::mt19937_64 rng(cfg_.seed + tid);
+        std::exponential_distribution<> gap(
+            cfg_.arrival_rate > 0. ? cfg_.arrival_rate / cfg_.num_threads : 1.);
+        auto next = start;
+        size_t pos = tid;
+        while (true) {
+          Clock::time_point intended;
+          if (cfg_.arrival_rate > 0.) {
+            next += to_duration(gap(rng));
+            if (next >= end) break;
+            std::this_thread::sleep_until(next);
+            intended = next;
+          } else {
+            intended = Clock::now();
+            if (intended >= end) break;
+          }
+          size_t uid = stream_[pos % stream_.size()];
+          pos += cfg_.num_threads;
+          model_.recommend(uid, cfg_.topk, rated_items(uid));
+          auto done = Clock::now();
+          if (intended >= measure_start) {
+            latencies[tid].record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(done - intended).count());
+            ++counts[tid];
+          }
+        }
+      });
+    }
+    for (auto& t : clients) {
+      t.join();
+    }
+
+    LoadResult result;
+    for (size_t tid = 0; tid < cfg_.num_threads; ++tid) {
+      result.latency.merge(latencies[tid]);
+      result.num_requests += counts[tid];
+    }
+    result.secs = cfg_.duration;
+    return result;
+  }
+
+ private:
+  static Clock::duration to_duration(double secs) {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(secs));
+  }
+
+  const std::unordered_map<size_t, double>& rated_items(size_t uid) const {
+    static const std::unordered_map<size_t, double> empty;
+    auto fit = rated_items_.find(uid);
+    return fit != rated_items_.end() ? fit->second : empty;
+  }
+
+ private:
+  const RecsysModelBase& model_;
+  const RatedItems& rated_items_;
+  const std::vector<size_t>& stream_;
+  LoadConfig cfg_;
+};
+
+} // namespace
+
+#endif // _LIBCF_LOAD_GENERATOR_HPP_
@@ -0,0 +1,157 @@
+#ifndef _LIBCF_MODEL_HANDLE_HPP_
+#define _LIBCF_MODEL_HANDLE_HPP_
+
+#include <string>
+#include <memory>
+
+#include <base/csr.hpp>
+#include <base/timer.hpp>
+#include <base/io/checkpoint.hpp>
+#include <base/parallel/epoch.hpp>
+#include <model/recsys/imf.hpp>
+#include <model/recsys/cdae.hpp>
+#include <model/recsys/itemcf.hpp>
+#include <model/recsys/usercf.hpp>
+
+namespace libcf {
+
+// model options that checkpoints do not record
+struct ModelLoadConfig {
+  ModelLoadConfig() = default;
+  RetrievalType retrieval = EXACT_MIPS;
+  bool linear = false;            // CDAE
+  bool tanh = false;              // CDAE
+  double corruption_ratio = 0.;   // CDAE
+};
+
+/**
+ *  Everything recommend needs from one checkpoint: the model ready for
+ *  recommend (retrieval indexes built), the mapped user dictionary and
+ *  the training histories to exclude. Immutable once loaded, so it can
+ *  be shared by request threads through a ModelHandle.
+ */
+struct ModelVersion {
+  ModelVersion(const std::string& filename, const ModelLoadConfig& cfg) {
+    std::string error;
+    CHECK(init(filename, cfg, &error)) << error;
+  }
+
+  /** As the constructor, but returns null and sets error if filename
+   *  cannot be served, e.g. a truncated or corrupt checkpoint
+   */
+  static std::unique_ptr<ModelVersion> load(const std::string& filename,
+                                            const ModelLoadConfig& cfg, std::string* error) {
+    std::unique_ptr<ModelVersion> rets(new ModelVersion());
+    if (!rets->init(filename, cfg, error)) return nullptr;
+    return rets;
+  }
+
+  ModelVersion(const ModelVersion&) = delete;
+  ModelVersion& operator=(const ModelVersion&) = delete;
+
+  std::string filename;
+  std::string type;
+  std::shared_ptr<const Checkpoint> ckpt;  // backs model, users and exclusions
+  std::unique_ptr<RecsysModelBase> model;
+  std::unique_ptr<MappedDictionary> users;
+  CSRIndex exclusions;
+
+ private:
+  ModelVersion() = default;
+
+  // everything is validated before the model reads ckpt in place, so a
+  // bad file fails here rather than on a CHECK in the model
+  bool init(const std::string& filename, const ModelLoadConfig& cfg, std::string* error) {
+    Timer timer;
+    this->filename = filename;
+    auto fail = [&](const std::string& what) {
+      if (error) *error = what + " in " + filename;
+      return false;
+    };
+    ckpt = Checkpoint::open(filename, error);
+    if (!ckpt) return false;
+    if (!ckpt->has("model.type", CKPT_BYTES)) return fail("No model type");
+    type = ckpt->bytes("model.type");
+    if (type == "IMF") {
+      if (!ckpt->has("uv", CKPT_DOUBLE)) return fail("No IMF user factors");
+      IMFConfig config;
+      config.num_dim = ckpt->section("uv").cols;
+      config.retrieval = cfg.retrieval;
+      model.reset(new IMF(config));
+    } else if (type == "CDAE") {
+      if (!ckpt->has("W", CKPT_DOUBLE)) return fail("No CDAE item weights");
+      CDAEConfig config;
+      config.num_dim = ckpt->section("W").cols;
+      config.asymmetric = ckpt->has("V");
+      config.user_factor = ckpt->has("Wu");
+      config.linear_function = ckpt->has("Uu");
+      config.linear = cfg.linear;
+      config.tanh = cfg.tanh;
+      config.corruption_ratio = cfg.corruption_ratio;
+      config.retrieval = cfg.retrieval;
+      model.reset(new CDAE(config));
+    } else if (type == "SIMILARITY") {
+      if (!ckpt->has("model.groups", CKPT_UINT64, 2, 1)) return fail("No similarity groups");
+      if (ckpt->array<uint64_t>("model.groups")[0] == 0) {
+        model.reset(new UserCF());
+      } else {
+        model.reset(new ItemCF());
+      }
+    } else {
+      return fail("Unknown model type " + type);
+    }
+    // CDAE encodes a user from the training history, without it every
+    // user would be served the recommendations of an empty history
+    if (type == "CDAE" && !ckpt->has("history.offsets")) {
+      return fail("CDAE checkpoint without training histories");
+    }
+    std::string reason;
+    if (!model->check_checkpoint(*ckpt, &reason)) return fail(reason);
+    if (ckpt->array<uint64_t>("model.shape")[1] > UINT32_MAX) return fail("Too many items to serve");
+    if (ckpt->has("users.meta") && !MappedDictionary::valid(*ckpt, "users")) {
+      return fail("Corrupted user dictionary");
+    }
+    // the model reads its parameters and histories in place from ckpt
+    model->load_checkpoint(ckpt);
+    model->pre_recommend();
+
+    if (ckpt->has("users.meta")) {
+      users.reset(new MappedDictionary(*ckpt, "users"));
+    }
+    exclusions = model->history_index();
+    if (exclusions.num_ids() == 0) {
+      LOG(WARNING) << "Checkpoint without training histories, rated items are not excluded";
+    }
+    LOG(INFO) << "Loaded " << type << " model with " << model->num_users() << " users and "
+        << model->num_items() << " items from " << filename << " in " << timer;
+    return true;
+  }
+};
+
+/** The served model, swapped without stopping the readers
+ */
+typedef EpochPtr<ModelVersion> ModelHandle;
+
+/** Load filename off the request path, swap it in and wait until the
+ *  requests in flight on the old version drain, then free it. If
+ *  filename cannot be loaded the current version keeps serving and
+ *  false is returned.
+ */
+inline bool reload_model(ModelHandle& handle, const std::string& filename,
+                         const ModelLoadConfig& cfg) {
+  Timer timer;
+  std::string error;
+  std::unique_ptr<ModelVersion> version = ModelVersion::load(filename, cfg, &error);
+  if (!version) {
+    LOG(ERROR) << "Failed to reload the model, keep serving the current one: " << error;
+    return false;
+  }
+  handle.reset(std::move(version));
+  handle.synchronize();
+  LOG(INFO) << "Reloaded model from " << filename << " in " << timer;
+  return true;
+}
+
+} // namespace
+
+#endif // _LIBCF_MODEL_HANDLE_HPP_
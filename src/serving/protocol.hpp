@@ -0,0 +1,140 @@
+#ifndef _LIBCF_PROTOCOL_HPP_
+#define _LIBCF_PROTOCOL_HPP_
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <unistd.h>
+
+namespace libcf {
+
+/**
+ *  Binary protocol of the recommendation server, in host byte order
+ *  (the server only listens locally).
+ *
+ *  A request is a RequestHeader followed by key_size bytes of the raw
+ *  user id. A response is a ResponseHeader followed by num_items uint32
+ *  item indexes, best first; the indexes refer to the "items" dictionary
+ *  of the model's checkpoint.
+ *
+ *  Requests on one connection may be pipelined; responses carry the
+ *  request_id and may come back in any order.
+ */
+struct RequestHeader {
+  uint32_t request_id;
+  uint16_t topk;
+  uint16_t key_size;
+};
+
+struct ResponseHeader {
+  uint32_t request_id;
+  uint16_t status;     // ResponseStatus
+  uint16_t num_items;
+};
+
+static_assert(sizeof(RequestHeader) == 8, "unexpected request layout");
+static_assert(sizeof(ResponseHeader) == 8, "unexpected response layout");
+
+enum ResponseStatus {
+  RESPONSE_OK = 0,
+  RESPONSE_UNKNOWN_USER = 1
+};
+
+/** Write all of n bytes, returns false if the peer is gone
+ */
+inline bool write_full(int fd, const void* buf, size_t n) {
+  const char* p = static_cast<const char*>(buf);
+  while (n > 0) {
+    ssize_t ret = ::write(fd, p, n);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+    p += ret;
+    n -= ret;
+  }
+  return true;
+}
+
+/** Buffered reads from a file descriptor, so that small messages do not
+ *  cost one syscall each
+ */
+class FdReader {
+ public:
+  explicit FdReader(int fd, size_t buffer_size = 1 << 16) :
+      fd_(fd), buffer_(buffer_size) {}
+
+  /** Read exactly n bytes, returns false on end of file or error
+   */
+  bool read(void* buf, size_t n) {
+    char* out = static_cast<char*>(buf);
+    while (n > 0) {
+      if (pos_ == end_ && !fill()) return false;
+      size_t len = std::min(n, end_ - pos_);
+      std::memcpy(out, buffer_.data() + pos_, len);
+      pos_ += len;
+      out += len;
+      n -= len;
+    }
+    return true;
+  }
+
+ private:
+  bool fill() {
+    while (true) {
+      ssize_t ret = ::read(fd_, buffer_.data(), buffer_.size());
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret <= 0) return false;
+      pos_ = 0;
+      end_ = ret;
+      return true;
+    }
+  }
+
+ private:
+  int fd_;
+  std::vector<char> buffer_;
+  size_t pos_ = 0;
+  size_t end_ = 0;
+};
+
+inline bool read_request(FdReader& reader, RequestHeader& header, std::string& key) {
+  if (!reader.read(&header, sizeof(header))) return false;
+  key.resize(header.key_size);
+  return header.key_size == 0 || reader.read(&key[0], header.key_size);
+}
+
+inline bool write_request(int fd, uint32_t request_id, size_t topk, const std::string& key) {
+  std::string buf(sizeof(RequestHeader) + key.size(), '\0');
+  RequestHeader header;
+  header.request_id = request_id;
+  header.topk = static_cast<uint16_t>(std::min<size_t>(topk, UINT16_MAX));
+  header.key_size = static_cast<uint16_t>(std::min<size_t>(key.size(), UINT16_MAX));
+  std::memcpy(&buf[0], &header, sizeof(header));
+  std::memcpy(&buf[sizeof(header)], key.data(), header.key_size);
+  return write_full(fd, buf.data(), sizeof(header) + header.key_size);
+}
+
+inline bool read_response(FdReader& reader, ResponseHeader& header, std::vector<uint32_t>& items) {
+  if (!reader.read(&header, sizeof(header))) return false;
+  items.resize(header.num_items);
+  return header.num_items == 0 || reader.read(items.data(), items.size() * sizeof(uint32_t));
+}
+
+/** Append one response to buf, so a batch is sent with one write per connection
+ */
+inline void append_response(std::string& buf, uint32_t request_id, uint16_t status,
+                            const uint32_t* items, size_t num_items) {
+  ResponseHeader header;
+  header.request_id = request_id;
+  header.status = status;
+  header.num_items = static_cast<uint16_t>(num_items);
+  buf.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  buf.append(reinterpret_cast<const char*>(items), num_items * sizeof(uint32_t));
+}
+
+} // namespace
+
+#endif // _LIBCF_PROTOCOL_HPP_
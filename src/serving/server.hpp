@@ -0,0 +1,402 @@
+#ifndef _LIBCF_SERVER_HPP_
+#define _LIBCF_SERVER_HPP_
+
+#include <list>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <unordered_map>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <base/csr.hpp>
+#include <base/timer.hpp>
+#include <base/latency.hpp>
+#include <base/parallel/threadsafe_queue.hpp>
+#include <serving/protocol.hpp>
+#include <serving/model_handle.hpp>
+
+namespace libcf {
+
+struct ServerConfig {
+  ServerConfig() = default;
+  size_t max_batch_size = 256;   // requests scored by one recommend_batch call
+  size_t batch_window_us = 200;  // wait at most this long for more requests
+  size_t max_topk = 1000;
+  double stats_interval = 10.;   // secs between stats reports, 0 for none
+};
+
+/**
+ *  Serves recommend requests (see serving/protocol.hpp) for the model of
+ *  a ModelHandle over a Unix domain socket or a pair of file
+ *  descriptors, e.g. stdin / stdout.
+ *
+ *  One thread per connection reads and parses requests; a single
+ *  batching thread collects the requests that arrive within
+ *  batch_window_us of the first one (up to max_batch_size), scores them
+ *  with one recommend_batch call and hands the responses to a writer
+ *  thread per connection, one buffer per connection and batch, so a
+ *  slow client only delays its own responses. The threads and the fd of
+ *  a connection are released once it closes and its requests are
+ *  answered. topk is capped by max_topk and the number of items; a user
+ *  with fewer items left gets a shorter list. Latency is measured from
+ *  reading a request to handing its response to the writer; p50 / p99
+ *  / p999 and QPS are logged every stats_interval secs and at stop.
+ *
+ *  Each batch maps its user ids and scores them on one model version,
+ *  so the handle can be swapped (see reload_model) while requests are
+ *  queued: none is dropped, a batch that started on the old version
+ *  finishes on it.
+ *
+ *  Example:
+ *
+ *    ModelHandle handle(std::unique_ptr<ModelVersion>(new ModelVersion("model.ckpt", cfg)));
+ *    RecommendServer server(handle, ServerConfig());
+ *    server.serve_unix_socket("/tmp/libcf.sock");  // until request_stop()
+ *    server.stop();
+ */
+class RecommendServer {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  RecommendServer(const ModelHandle& handle, const ServerConfig& cfg) :
+      handle_(handle), cfg_(cfg) {
+    CHECK_GT(cfg_.max_batch_size, 0);
+    CHECK_LE(cfg_.max_topk, UINT16_MAX);
+    batcher_ = std::thread([this]() { run_batcher(); });
+  }
+
+  ~RecommendServer() {
+    stop();
+  }
+
+  /** Serve the requests of one connection until in_fd reaches end of file
+   */
+  void serve(int in_fd, int out_fd) {
+    serve_connection(std::make_shared<Connection>(out_fd, false), in_fd);
+  }
+
+  /** Accept connections on a Unix domain socket at path until request_stop
+   */
+  void serve_unix_socket(const std::string& path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    CHECK_LT(path.size(), sizeof(addr.sun_path)) << "Socket path too long: " << path;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_GE(listen_fd, 0) << "Failed to create socket";
+    ::unlink(path.c_str());
+    CHECK_EQ(::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+        << "Failed to bind " << path;
+    CHECK_EQ(::listen(listen_fd, 128), 0) << "Failed to listen on " << path;
+    LOG(INFO) << "Listening on " << path;
+
+    std::list<Reader> readers;
+    while (!stopping_) {
+      reap_readers(readers);
+      pollfd pfd;
+      pfd.fd = listen_fd;
+      pfd.events = POLLIN;
+      if (::poll(&pfd, 1, 200) <= 0) continue;
+      int fd = ::accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) continue;
+      readers.emplace_back();
+      Reader& r = readers.back();
+      r.conn = std::make_shared<Connection>(fd, true);
+      r.thread = std::thread([this, &r]() {
+        serve_connection(r.conn, r.conn->fd);
+        r.done = true;
+      });
+    }
+    // wake up the readers of idle connections
+    for (auto& r : readers) {
+      ::shutdown(r.conn->fd, SHUT_RD);
+    }
+    for (auto& r : readers) {
+      r.thread.join();
+    }
+    ::close(listen_fd);
+    ::unlink(path.c_str());
+  }
+
+  /** Make serve_unix_socket return, safe to call from a signal handler
+   */
+  void request_stop() {
+    stopping_ = true;
+  }
+
+  /** Answer the queued requests, stop the batching thread and report
+   */
+  void stop() {
+    request_stop();
+    if (closed_.exchange(true)) return;
+    batcher_.join();
+    flush_interval(0., false);
+    report(total_latency_, total_requests_, total_batches_, total_timer_.elapsed());
+  }
+
+  // cumulative stats, read them after stop
+  const LatencyHistogram& latency() const { return total_latency_; }
+  size_t num_requests() const { return total_requests_; }
+  size_t num_batches() const { return total_batches_; }
+
+ private:
+  /** A client connection. The batching thread queues responses with
+   *  send, the connection's writer thread writes them.
+   */
+  struct Connection {
+    Connection(int fd, bool owned) : fd(fd), owned(owned) {}
+    ~Connection() { if (owned) ::close(fd); }
+
+    // a request of the connection was queued
+    void expect() {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++pending;
+    }
+
+    // the responses buf of num_requests requests
+    void send(std::string&& buf, size_t num_requests) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        outbox.push_back(std::move(buf));
+        pending -= num_requests;
+      }
+      cond.notify_one();
+    }
+
+    // no more requests will be read
+    void finish() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading = false;
+      }
+      cond.notify_one();
+    }
+
+    // write the responses until finish and every request is answered;
+    // once the client is gone the rest are dropped
+    void write_responses() {
+      bool ok = true;
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true) {
+        cond.wait(lock, [this]() { return !outbox.empty() || (!reading && pending == 0); });
+        if (outbox.empty()) return;
+        std::string buf = std::move(outbox.front());
+        outbox.pop_front();
+        lock.unlock();
+        ok = ok && write_full(fd, buf.data(), buf.size());
+        lock.lock();
+      }
+    }
+
+    int fd;
+    bool owned;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::string> outbox;
+    size_t pending = 0;  // requests queued but not answered
+    bool reading = true;
+  };
+
+  struct Reader {
+    std::thread thread;
+    std::shared_ptr<Connection> conn;
+    std::atomic<bool> done{false};
+  };
+
+  // join the readers of closed connections, which releases their fds
+  static void reap_readers(std::list<Reader>& readers) {
+    for (auto it = readers.begin(); it != readers.end();) {
+      if (it->done) {
+        it->thread.join();
+        it = readers.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  struct PendingRequest {
+    std::shared_ptr<Connection> conn;
+    uint32_t request_id;
+    uint16_t topk;
+    std::string key;
+    Clock::time_point arrival;
+  };
+
+  void serve_connection(std::shared_ptr<Connection> conn, int in_fd) {
+    std::thread writer([conn]() { conn->write_responses(); });
+    FdReader reader(in_fd);
+    RequestHeader header;
+    std::string key;
+    while (read_request(reader, header, key)) {
+      PendingRequest req;
+      req.arrival = Clock::now();
+      req.conn = conn;
+      req.request_id = header.request_id;
+      req.topk = std::min<size_t>(header.topk, cfg_.max_topk);
+      req.key.swap(key);
+      conn->expect();
+      queue_.push(std::move(req));
+    }
+    conn->finish();
+    writer.join();
+  }
+
+  // the uid of a raw user id, the keys are the uids in decimal if the
+  // checkpoint has no user dictionary
+  static size_t find_user(const ModelVersion& version, const std::string& key) {
+    size_t uid = kNoItem;
+    if (version.users) {
+      uid = version.users->find(key);
+    } else if (!key.empty()) {
+      char* end = nullptr;
+      uid = std::strtoull(key.c_str(), &end, 10);
+      if (end != key.c_str() + key.size()) uid = kNoItem;
+    }
+    return uid < version.model->num_users() ? uid : kNoItem;
+  }
+
+  void run_batcher() {
+    std::vector<PendingRequest> batch;
+    batch.reserve(cfg_.max_batch_size);
+    while (true) {
+      PendingRequest req;
+      if (!queue_.wait_and_pop_for(req, std::chrono::milliseconds(100))) {
+        if (closed_) break;
+        maybe_report();
+        continue;
+      }
+      batch.push_back(std::move(req));
+      auto deadline = Clock::now() + std::chrono::microseconds(cfg_.batch_window_us);
+      while (batch.size() < cfg_.max_batch_size
+             && queue_.wait_and_pop_until(req, deadline)) {
+        batch.push_back(std::move(req));
+      }
+      process(batch);
+      batch.clear();
+      maybe_report();
+    }
+  }
+
+  void process(std::vector<PendingRequest>& batch) {
+    auto version = handle_.read();
+    batch_uids_.clear();
+    uids_.clear();
+    // no list is longer than the items, short ones are padded with kNoItem
+    size_t num_items = version->model->num_items();
+    size_t topk = 0;
+    for (auto& req : batch) {
+      size_t uid = find_user(*version, req.key);
+      batch_uids_.push_back(uid);
+      if (uid != kNoItem) {
+        uids_.push_back(uid);
+        topk = std::max<size_t>(topk, std::min<size_t>(req.topk, num_items));
+      }
+    }
+    rec_lists_.resize(uids_.size() * topk);
+    if (!uids_.empty() && topk > 0) {
+      version->model->recommend_batch(uids_.data(), uids_.size(), topk,
+                                      version->exclusions, rec_lists_.data());
+    }
+
+    // one buffer per connection, each reply trimmed to its own topk
+    std::unordered_map<Connection*, std::pair<std::string, size_t>> outputs;
+    std::vector<uint32_t> items;
+    size_t pos = 0;
+    for (size_t idx = 0; idx < batch.size(); ++idx) {
+      auto& req = batch[idx];
+      auto& output = outputs[req.conn.get()];
+      ++output.second;
+      if (batch_uids_[idx] == kNoItem) {
+        append_response(output.first, req.request_id, RESPONSE_UNKNOWN_USER, nullptr, 0);
+        continue;
+      }
+      const size_t* rec_list = rec_lists_.data() + (pos++) * topk;
+      size_t req_topk = std::min<size_t>(req.topk, topk);
+      items.clear();
+      for (size_t idx = 0; idx < req_topk && rec_list[idx] != kNoItem; ++idx) {
+        items.push_back(static_cast<uint32_t>(rec_list[idx]));
+      }
+      append_response(output.first, req.request_id, RESPONSE_OK, items.data(), items.size());
+    }
+    for (auto& p : outputs) {
+      p.first->send(std::move(p.second.first), p.second.second);
+    }
+
+    auto now = Clock::now();
+    for (auto& req : batch) {
+      uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - req.arrival).count();
+      interval_latency_.record(ns);
+    }
+    interval_requests_ += batch.size();
+    ++interval_batches_;
+  }
+
+  void maybe_report() {
+    double secs = interval_timer_.elapsed();
+    if (cfg_.stats_interval <= 0. || secs < cfg_.stats_interval) return;
+    flush_interval(secs, true);
+  }
+
+  void flush_interval(double secs, bool log) {
+    if (log && interval_requests_ > 0) {
+      report(interval_latency_, interval_requests_, interval_batches_, secs);
+    }
+    total_latency_.merge(interval_latency_);
+    total_requests_ += interval_requests_;
+    total_batches_ += interval_batches_;
+    interval_latency_.reset();
+    interval_requests_ = 0;
+    interval_batches_ = 0;
+    interval_timer_.reset();
+  }
+
+  void report(const LatencyHistogram& hist, size_t num_requests,
+              size_t num_batches, double secs) const {
+    LOG(INFO) << "Served " << num_requests << " requests in " << num_batches << " batches ("
+        << (num_batches ? static_cast<double>(num_requests) / num_batches : 0.) << " per batch), "
+        << (secs > 0. ? num_requests / secs : 0.) << " QPS, latency us: "
+        << "p50 " << hist.percentile(50.) / 1e3
+        << ", p99 " << hist.percentile(99.) / 1e3
+        << ", p999 " << hist.percentile(99.9) / 1e3
+        << ", max " << hist.max() / 1e3;
+  }
+
+ private:
+  const ModelHandle& handle_;
+  ServerConfig cfg_;
+
+  ThreadsafeQueue<PendingRequest> queue_;
+  std::thread batcher_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<bool> closed_{false};
+
+  // owned by the batching thread
+  std::vector<size_t> batch_uids_;
+  std::vector<size_t> uids_;
+  std::vector<size_t> rec_lists_;
+  LatencyHistogram interval_latency_;
+  size_t interval_requests_ = 0;
+  size_t interval_batches_ = 0;
+  Timer interval_timer_;
+  LatencyHistogram total_latency_;
+  size_t total_requests_ = 0;
+  size_t total_batches_ = 0;
+  Timer total_timer_;
+};
+
+} // namespace
+
+#endif // _LIBCF_SERVER_HPP_
@@ -0,0 +1,134 @@
+#ifndef _LIBCF_ONLINE_HPP_
+#define _LIBCF_ONLINE_HPP_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <base/data.hpp>
+#include <base/io.hpp>
+#include <base/timer.hpp>
+
+namespace libcf {
+
+struct OnlineConfig {
+  OnlineConfig() = default;
+  size_t batch_size = 10000;  // events per update
+  size_t num_passes = 1;      // training passes over every affected user per update
+};
+
+/**
+ *  Keeps a trained recsys model (IMF, BPR, CDAE) warm on a stream of
+ *  new interactions instead of retraining it.
+ *
+ *  Events are read in batches. Every batch
+ *
+ *    1. maps the raw user / item strings through the training data's
+ *       dictionaries, adding unseen users and items (DataInfo::add_feature),
+ *    2. grows the model's parameters for the new ids,
+ *    3. appends the new interactions to the users' histories,
+ *    4. runs num_passes training passes over the users with new
+ *       interactions only, and
+ *    5. patches the model's caches and retrieval indexes with the
+ *       items that changed (see RecsysModelBase::end_online_update).
+ *
+ *  The parameters grow geometrically (see reserve_rows), so new ids
+ *  cost O(1) amortized copies each. Apart from those reallocations and
+ *  the retrieval index rebuilds past their update ratio (see
+ *  MIPSIndex::update), the cost of a batch depends on the affected
+ *  users and items rather than on the size of the model. Not safe to
+ *  run concurrently with recommend.
+ *
+ *  Example:
+ *
+ *    OnlineTrainer<IMF> trainer(*solver.get_model(), train, OnlineConfig());
+ *    trainer.consume("events.txt", line_parser);  // a file or a named pipe
+ */
+template <class Model>
+class OnlineTrainer {
+ public:
+  typedef std::pair<std::string, std::string> Event;  // (user, item)
+
+  OnlineTrainer(Model& model, const Data& train_data, const OnlineConfig& cfg) :
+      model_(model), data_info_(train_data.get_data_info()), cfg_(cfg) {
+    CHECK_GE(data_info_->feature_group_infos_.size(), 2);
+    CHECK_GT(cfg_.batch_size, 0);
+  }
+
+  /** Read events until the end of the file, the parser returns the
+   *  user and the item first (see Data::load). Returns the num of events.
+   */
+  size_t consume(const std::string& filename, const Data::LineParser& parser) {
+    Timer timer;
+    File f(filename, "r");
+    std::vector<Event> events;
+    events.reserve(cfg_.batch_size);
+    size_t num_events = 0;
+    std::string line;
+    while (f.good()) {
+      f.read_line(line);
+      if (line.size() == 0) continue;
+      auto rets = parser(line);
+      if (rets.size() < 2) continue;
+      events.emplace_back(rets[0], rets[1]);
+      if (events.size() == cfg_.batch_size) {
+        num_events += update(events);
+        events.clear();
+      }
+    }
+    num_events += update(events);
+    f.close();
+    LOG(INFO) << "Consumed " << num_events << " events from " << filename << " in " << timer;
+    return num_events;
+  }
+
+  /** Apply one batch of events, returns the num of events
+   */
+  size_t update(const std::vector<Event>& events) {
+    if (events.empty()) return 0;
+    Timer timer;
+    auto& users = data_info_->feature_group_infos_[0];
+    auto& items = data_info_->feature_group_infos_[1];
+    size_t old_num_users = users.size();
+    size_t old_num_items = items.size();
+
+    std::vector<std::pair<size_t, size_t>> pairs;
+    pairs.reserve(events.size());
+    for (auto& e : events) {
+      pairs.emplace_back(data_info_->add_feature(0, e.first), data_info_->add_feature(1, e.second));
+    }
+    model_.grow(users.size(), items.size());
+
+    model_.begin_online_update();
+    std::vector<size_t> uids;
+    for (auto& p : pairs) {
+      if (model_.add_interaction(p.first, p.second)) {
+        uids.push_back(p.first);
+      }
+    }
+    std::sort(uids.begin(), uids.end());
+    uids.erase(std::unique(uids.begin(), uids.end()), uids.end());
+    for (size_t pass = 0; pass < cfg_.num_passes; ++pass) {
+      for (auto& uid : uids) {
+        model_.train_one_user(uid);
+      }
+    }
+    model_.end_online_update(uids);
+
+    LOG(INFO) << "Online update of " << events.size() << " events: "
+        << uids.size() << " users trained, "
+        << users.size() - old_num_users << " new users, "
+        << items.size() - old_num_items << " new items in " << timer;
+    return events.size();
+  }
+
+ private:
+  Model& model_;
+  std::shared_ptr<DataInfo> data_info_;
+  OnlineConfig cfg_;
+};
+
+} // namespace
+
+#endif // _LIBCF_ONLINE_HPP_
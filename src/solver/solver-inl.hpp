@@ -1,4 +1,6 @@
 #include <solver/solver.hpp>
+#include <base/io/file.hpp>
+#include <base/trace.hpp>
 
 namespace libcf {
   
@@ -6,81 +8,200 @@ template<class Model>
 void Solver<Model>::train(const Data& train_data, 
                               const Data& validation_data,
                               const std::vector<EvalType>& eval_types) {
+  LIBCF_TRACE_SCOPE("solver.train");
 
+  train_loss_ = 0;
 
-  double train_loss = 0;
-
-  std::vector<std::shared_ptr<Evaluation<Model>>> evaluations(eval_types.size());
+  evaluations_.assign(eval_types.size(), nullptr);
   for (size_t idx = 0; idx < eval_types.size(); ++idx) {
-    evaluations[idx] = Evaluation<Model>::create(eval_types[idx]);
+    evaluations_[idx] = Evaluation<Model>::create(eval_types[idx]);
   }
 
-  size_t iteration = 0;
-  model_->reset(train_data);
-  pre_train(train_data, validation_data);
+  iteration_ = 0;
+  profiler_ = PhaseProfiler();
+  PhaseProfiler* profiler = profile_ ? &profiler_ : nullptr;
+  profiler_.begin_epoch(iteration_);
+  {
+    ScopedPhase scope(profiler, PHASE_DATA_PREP);
+    LIBCF_TRACE_SCOPE("solver.data_prep");
+    model_->reset(train_data);
+    model_->set_loss_accumulation(loss_mode_ == FUSED_LOSS);
+    model_->set_profiler(profiler);
+    pre_train(train_data, validation_data);
+  }
+  trained_ = true;
 
-  Timer t;
+  timer_.reset();
   
-  LOG(INFO) << std::string(110, '-') << std::endl;
-  {
+  if (log_progress_) {
+    LOG(INFO) << std::string(110, '-') << std::endl;
     std::stringstream ss;
     ss << std::setfill(' ') << std::setw(5) << "Iters" << "|"
         << std::setw(8) << "Time"  << "|" 
         << std::setw(10) << "Train Loss" << "|";
     if(validation_data.size() > 0) {
-      for (size_t idx = 0; idx < eval_types.size(); ++idx) 
-        ss << evaluations[idx]->evaluation_type() << "|";
+      for (size_t idx = 0; idx < evaluations_.size(); ++idx) 
+        ss << evaluations_[idx]->evaluation_type() << "|";
     } 
     LOG(INFO) << ss.str();
   }
 
-  if (iteration % eval_iterations == 0)
-  {
-    std::stringstream ss;
-    ss << std::setw(5) << iteration << "|"
-        << std::setw(8) << std::setprecision(3) << t.elapsed() << "|"
-        << std::setw(10) << std::setprecision(5) << train_loss << "|";
-    if (validation_data.size() > 0) {
-      for (size_t idx = 0; idx < eval_types.size(); ++idx) 
-        ss << evaluations[idx]->evaluate(*model_, validation_data, train_data) << "|";
-    }
-    LOG(INFO) << ss.str();
+  if (iteration_ % eval_iterations == 0) {
+    evaluate(train_data, validation_data);
   }
+  if (profiler) end_profile_epoch();
+
+  run_iterations(train_data, validation_data, max_iteration_);
+}
+
+template<class Model>
+void Solver<Model>::resume(const Data& train_data,
+                           const Data& validation_data,
+                           size_t num_iterations) {
+  LIBCF_TRACE_SCOPE("solver.resume");
+  CHECK(trained_) << "resume continues a train";
+  CHECK_GT(num_iterations, 0);
+  model_->set_profiler(profile_ ? &profiler_ : nullptr);
+  run_iterations(train_data, validation_data, iteration_ + num_iterations);
+}
+
+template<class Model>
+void Solver<Model>::restore(const std::vector<EvalType>& eval_types, size_t iteration) {
+  evaluations_.assign(eval_types.size(), nullptr);
+  for (size_t idx = 0; idx < eval_types.size(); ++idx) {
+    evaluations_[idx] = Evaluation<Model>::create(eval_types[idx]);
+  }
+  iteration_ = iteration;
+  train_loss_ = 0.;
+  profiler_ = PhaseProfiler();
+  model_->set_loss_accumulation(loss_mode_ == FUSED_LOSS);
+  trained_ = true;
+  timer_.reset();
+}
+
+template<class Model>
+void Solver<Model>::run_iterations(const Data& train_data,
+                                   const Data& validation_data,
+                                   size_t last_iteration) {
+  PhaseProfiler* profiler = profile_ ? &profiler_ : nullptr;
 
   bool stop = false;
   while(!stop) {
 
-    train_one_iteration(train_data);
-
-    train_loss = model_->current_loss(train_data);
+    profiler_.begin_epoch(iteration_ + 1);
+    LIBCF_TRACE_SCOPE("solver.iteration");
+    if (profiler) {
+      // the model times its sampling and forward steps, the rest is update
+      auto start = PhaseProfiler::Clock::now();
+      train_one_iteration(train_data);
+      auto& epoch = profiler_.current();
+      double update_secs = std::chrono::duration<double>(PhaseProfiler::Clock::now() - start).count()
+          - epoch.phase_secs[PHASE_SAMPLING] - epoch.phase_secs[PHASE_FORWARD];
+      epoch.phase_secs[PHASE_UPDATE] += std::max(update_secs, 0.);
+      // models without a training pass, e.g. POP, count nothing
+      if (epoch.updates > 0) {
+        profiler_.add_interactions(train_data.size());
+      }
+    } else {
+      train_one_iteration(train_data);
+    }
 
-    iteration ++;
-    if (iteration % eval_iterations == 0)
+    iteration_ ++;
     {
-      std::stringstream ss;
-      ss << std::setw(5) << iteration << "|"
-          << std::setw(8) << std::setprecision(3) << t.elapsed() << "|"
-          << std::setw(10) << std::setprecision(5) << train_loss << "|";
-      if (validation_data.size() > 0) {
-        for (size_t idx = 0; idx < eval_types.size(); ++idx) 
-          ss << evaluations[idx]->evaluate(*model_, validation_data, train_data) << "|";
-      }
-      LOG(INFO) << ss.str();
+      ScopedPhase scope(profiler, PHASE_LOSS);
+      LIBCF_TRACE_SCOPE("solver.loss");
+      train_loss_ = this->train_loss(train_data, iteration_ % eval_iterations == 0);
     }
 
+    if (iteration_ % eval_iterations == 0) {
+      evaluate(train_data, validation_data);
+    }
+    if (profiler) end_profile_epoch();
+
     // check conditions
-    if (iteration >= max_iteration_) {
+    if (iteration_ >= last_iteration) {
       stop = true;
     }
     // other conditions
   }
 
-  LOG(INFO) << std::string(110, '-') << std::endl;
+  if (log_progress_) {
+    LOG(INFO) << std::string(110, '-') << std::endl;
+    if (profiler) {
+      LOG(INFO) << "Profile " << PhaseProfiler::summary(profiler_.total());
+    }
+  }
+  model_->set_profiler(nullptr);
+}
+
+template<class Model>
+void Solver<Model>::evaluate(const Data& train_data, const Data& validation_data) {
+  ScopedPhase scope(profile_ ? &profiler_ : nullptr, PHASE_EVALUATION);
+  LIBCF_TRACE_SCOPE("solver.evaluation");
+  std::stringstream ss;
+  ss << std::setw(5) << iteration_ << "|"
+      << std::setw(8) << std::setprecision(3) << timer_.elapsed() << "|"
+      << std::setw(10) << std::setprecision(5) << train_loss_ << "|";
+  if (validation_data.size() > 0) {
+    for (size_t idx = 0; idx < evaluations_.size(); ++idx) 
+      ss << evaluations_[idx]->evaluate(*model_, validation_data, train_data) << "|";
+  }
+  if (log_progress_) {
+    LOG(INFO) << ss.str();
+  }
+}
+
+template<class Model>
+std::vector<std::pair<std::string, double>> Solver<Model>::last_metrics() const {
+  std::vector<std::pair<std::string, double>> rets;
+  for (auto& evaluation : evaluations_) {
+    auto columns = evaluation->columns();
+    auto& values = evaluation->last_values();
+    for (size_t idx = 0; idx < std::min(columns.size(), values.size()); ++idx) {
+      rets.emplace_back(columns[idx], values[idx]);
+    }
+  }
+  return rets;
+}
+
+template<class Model>
+void Solver<Model>::end_profile_epoch() {
+  profiler_.end_epoch();
+  if (profile_file_.empty()) return;
+  JsonWriter json;
+  json.begin_object();
+  if (!profile_label_.empty()) {
+    json.add("label", profile_label_);
+  }
+  profiler_.epochs().back().write_json(json);
+  json.end_object();
+  File f(profile_file_, "a");
+  f.write_line(json.str());
+  f.close();
+}
+
+template<class Model>
+double Solver<Model>::train_loss(const Data& train_data, bool eval_iteration) const {
+  switch (loss_mode_) {
+    case FULL_LOSS:
+      return model_->current_loss(train_data);
+    case EVAL_LOSS:
+      // the loss is only reported on evaluation iterations
+      return eval_iteration ? model_->current_loss(train_data) : 0.;
+    case SAMPLED_LOSS:
+      return model_->current_loss(train_data, loss_sample_size_);
+    case FUSED_LOSS:
+      return model_->accumulated_data_loss(train_data) + model_->penalty_loss();
+    case NO_LOSS:
+    default:
+      return 0.;
+  }
 }
 
 template<class Model>
 void Solver<Model>::test(const Data& test_data,
                          const std::vector<EvalType>& eval_types) {
+  LIBCF_TRACE_SCOPE("solver.test");
 
   Timer t;
   std::vector<std::shared_ptr<Evaluation<Model>>> evaluations(eval_types.size());
@@ -2,16 +2,52 @@
 #define _LIBCF_SOLVER_HPP_
 
 #include <memory>
+#include <string>
+#include <vector>
+#include <utility>
 
 #include <base/data.hpp>
+#include <base/timer.hpp>
+#include <base/profiler.hpp>
 #include <model/evaluation.hpp>
 
 namespace libcf {
 
+enum TrainLossMode {
+  FULL_LOSS = 0, // full pass over the training data after every iteration
+  EVAL_LOSS,     // full pass only on evaluation iterations
+  SAMPLED_LOSS,  // estimated on a fixed subsample of size loss_sample_size
+  FUSED_LOSS,    // accumulated by the model during the training pass
+  NO_LOSS
+};
+
+struct SolverConfig {
+  SolverConfig() = default;
+  SolverConfig(const SolverConfig& oth) = default;
+
+  size_t max_iteration = 1;
+  size_t eval_iterations = 1;
+  TrainLossMode loss_mode = FULL_LOSS;
+  size_t loss_sample_size = 1000;
+  bool profile = false;          // time the phases of every epoch, see PhaseProfiler
+  std::string profile_file = ""; // append the epochs as JSON lines, implies profile
+  std::string profile_label = "";
+  bool log_progress = true;      // log the evaluation table, off for sweep trials
+};
+
 template<class Model>
 class Solver {
  public:
   
+  Solver(Model& model, const SolverConfig& cfg) :
+      max_iteration_(cfg.max_iteration), eval_iterations(cfg.eval_iterations),
+      loss_mode_(cfg.loss_mode), loss_sample_size_(cfg.loss_sample_size),
+      profile_(cfg.profile || !cfg.profile_file.empty()),
+      profile_file_(cfg.profile_file), profile_label_(cfg.profile_label),
+      log_progress_(cfg.log_progress),
+      model_(std::make_shared<Model>(model))
+  {}
+
   Solver(Model& model, size_t max_iteration, size_t eval_iterations=1) :
       max_iteration_(max_iteration), eval_iterations(eval_iterations),
       model_(std::make_shared<Model>(model))
@@ -24,6 +60,12 @@ class Solver {
     return model_;
   }
 
+  /** Per-epoch phase times of the last train, empty unless profiling
+   */
+  const PhaseProfiler& profiler() const {
+    return profiler_;
+  }
+
   virtual void pre_train(const Data&, const Data&) {
     // do nothing 
   }
@@ -36,13 +78,73 @@ class Solver {
              const Data& validation_data = Data(),
              const std::vector<EvalType>& eval_types = {});
 
+  /** Continue the last train for num_iterations more iterations on the
+   *  same data sets, e.g. to run a job in slices. max_iteration only
+   *  bounds train.
+   */
+  virtual void resume(const Data& train_data,
+                      const Data& validation_data,
+                      size_t num_iterations);
+
+  /** Take get_model() as trained for iteration iterations, e.g. after
+   *  loading a checkpoint into it, so that resume continues it
+   */
+  virtual void restore(const std::vector<EvalType>& eval_types, size_t iteration);
+
+  /** Iterations trained so far
+   */
+  size_t iteration() const {
+    return iteration_;
+  }
+
+  /** Training loss of the last iteration
+   */
+  double last_train_loss() const {
+    return train_loss_;
+  }
+
+  /** (column, value) of the last evaluation on the validation data,
+   *  e.g. ("MAP@10", 0.12)
+   */
+  std::vector<std::pair<std::string, double>> last_metrics() const;
+
   virtual void test(const Data& test_data,
             const std::vector<EvalType>& eval_types = {});
 
+ protected:
+  /** Training loss after one iteration according to loss_mode_
+   */
+  double train_loss(const Data& train_data, bool eval_iteration) const;
+
+  /** Train until iteration last_iteration, at least one iteration
+   */
+  void run_iterations(const Data& train_data, const Data& validation_data,
+                      size_t last_iteration);
+
+  /** Evaluate the current iteration and log a row of the table
+   */
+  void evaluate(const Data& train_data, const Data& validation_data);
+
+  /** Closes the current epoch of the profiler and appends it to profile_file_
+   */
+  void end_profile_epoch();
+
  protected:
   size_t max_iteration_ = 1;
   size_t eval_iterations = 1;
+  TrainLossMode loss_mode_ = FULL_LOSS;
+  size_t loss_sample_size_ = 1000;
+  bool profile_ = false;
+  std::string profile_file_;
+  std::string profile_label_;
+  bool log_progress_ = true;
+  PhaseProfiler profiler_;
   std::shared_ptr<Model> model_;
+  std::vector<std::shared_ptr<Evaluation<Model>>> evaluations_;
+  size_t iteration_ = 0;
+  double train_loss_ = 0.;
+  bool trained_ = false;
+  Timer timer_;
 };
 
 } // namespace 
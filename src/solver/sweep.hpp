@@ -0,0 +1,636 @@
+#ifndef _LIBCF_SWEEP_HPP_
+#define _LIBCF_SWEEP_HPP_
+
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include <base/data.hpp>
+#include <base/timer.hpp>
+#include <base/random.hpp>
+#include <base/io/file.hpp>
+#include <base/io/file_utils.hpp>
+#include <base/parallel/worker_pool.hpp>
+#include <solver/solver.hpp>
+
+namespace libcf {
+
+/** One configuration of a sweep, parameter name -> value as spelled in the spec
+ */
+typedef std::map<std::string, std::string> SweepParams;
+
+inline std::string to_string(const SweepParams& params) {
+  std::stringstream ss;
+  for (auto& p : params) {
+    if (ss.tellp() > 0) ss << " ";
+    ss << p.first << "=" << p.second;
+  }
+  return ss.str();
+}
+
+/**
+ *  The values to try for each parameter. A point of the grid picks one
+ *  value per parameter; random search draws distinct points of the grid.
+ *
+ *  Written inline as "learn_rate=0.1;cratio=0,0.2,0.4;asym=true,false",
+ *  or as a file of "name : v1,v2,..." lines.
+ */
+class SweepSpec {
+ public:
+  SweepSpec() = default;
+
+  static SweepSpec parse(const std::string& spec) {
+    SweepSpec rets;
+    for (auto& param : split_line(spec, ";")) {
+      auto splits = split_line(param, "= ");
+      CHECK_EQ(splits.size(), 2) << "Expect name=v1,v2,... but got " << param;
+      rets.add(splits[0], split_line(splits[1], ","));
+    }
+    return rets;
+  }
+
+  static SweepSpec load(const std::string& filename) {
+    SweepSpec rets;
+    for (auto& p : read_config_file(filename)) {
+      rets.add(p.first, split_line(p.second, ","));
+    }
+    return rets;
+  }
+
+  SweepSpec& add(const std::string& name, const std::vector<std::string>& values) {
+    CHECK(!values.empty()) << "No values for " << name;
+    for (auto& param : params_) {
+      CHECK_NE(param.first, name) << "Duplicated parameter " << name;
+    }
+    params_.emplace_back(name, values);
+    return *this;
+  }
+
+  size_t num_params() const { return params_.size(); }
+
+  size_t num_points() const {
+    size_t rets = 1;
+    for (auto& param : params_) {
+      CHECK_LE(rets, std::numeric_limits<size_t>::max() / param.second.size())
+          << "Too many grid points";
+      rets *= param.second.size();
+    }
+    return rets;
+  }
+
+  /** The idx-th point of the grid, the last parameter varying fastest
+   */
+  SweepParams point(size_t idx) const {
+    CHECK_LT(idx, num_points());
+    SweepParams rets;
+    for (auto it = params_.rbegin(); it != params_.rend(); ++it) {
+      rets[it->first] = it->second[idx % it->second.size()];
+      idx /= it->second.size();
+    }
+    return rets;
+  }
+
+  std::vector<SweepParams> grid() const {
+    std::vector<SweepParams> rets(num_points());
+    for (size_t idx = 0; idx < rets.size(); ++idx) {
+      rets[idx] = point(idx);
+    }
+    return rets;
+  }
+
+  /** n distinct points drawn with Random, the whole grid if it is smaller
+   */
+  std::vector<SweepParams> sample(size_t n) const {
+    size_t num_points = this->num_points();
+    if (n >= num_points) return grid();
+    std::uniform_int_distribution<size_t> dist(0, num_points - 1);
+    std::unordered_set<size_t> drawn;
+    std::vector<SweepParams> rets;
+    rets.reserve(n);
+    while (rets.size() < n) {
+      size_t idx = dist(Random::rng);
+      if (drawn.insert(idx).second) {
+        rets.push_back(point(idx));
+      }
+    }
+    return rets;
+  }
+
+ private:
+  std::vector<std::pair<std::string, std::vector<std::string>>> params_;
+};
+
+/** Outcome of one trial of a sweep
+ */
+struct SweepResult {
+  size_t trial = 0;
+  SweepParams params;
+  size_t iterations = 0;
+  double train_secs = 0.;   // training and evaluation of the trial alone
+  double train_loss = 0.;
+  std::vector<std::pair<std::string, double>> metrics;  // of the last evaluation
+
+  double metric(const std::string& name) const {
+    for (auto& p : metrics) {
+      if (p.first == name) return p.second;
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+};
+
+struct SweepConfig {
+  SweepConfig() = default;
+
+  size_t num_workers = 1;        // trials trained at the same time
+  size_t threads_per_trial = 1;  // threads of the parallel loops inside a trial
+  size_t max_active = 0;         // trials holding a model, 0 for 2 x num_workers
+  size_t slice_iterations = 1;   // iterations per turn, 0 trains a trial in one turn
+  std::string metric = "MAP@10"; // orders the results
+  bool maximize = true;
+  size_t seed = 20141119;        // trial i draws from Random seeded with seed + i
+};
+
+/**
+ *  Multi-fidelity schedule of Sweep::run_hyperband. A bracket trains its
+ *  trials in rungs: every trial gets the rung's budget of iterations,
+ *  then the best 1 / eta go on to a budget eta times larger, up to
+ *  max_iteration of the SolverConfig. Bracket s starts at
+ *  max_iteration / eta^s iterations; the largest s starts at
+ *  min_iterations. One bracket of the largest s is successive halving,
+ *  the brackets down to s = 0 (no halving) are Hyperband, which splits
+ *  the configurations among them.
+ */
+struct HyperbandConfig {
+  HyperbandConfig() = default;
+
+  size_t min_iterations = 1;
+  double eta = 3.;
+  size_t num_brackets = 1;             // 0 for all of them
+  std::string checkpoint_dir = "/tmp"; // the trials' models between rungs
+};
+
+/**
+ *  Trains one model per configuration on a data set loaded once.
+ *
+ *  Every trial reads the same train and validation sets, so the
+ *  interaction tables the models and the evaluations index are built
+ *  once and shared read-only (see Data::interaction_table).
+ *
+ *  run trains every configuration for max_iteration iterations. The
+ *  trials run on a WorkerPool in turns of slice_iterations iterations;
+ *  an unfinished trial goes to the back of the queue, so the active
+ *  trials progress evenly and a slow configuration does not hold a
+ *  worker until it finishes. At most max_active models are alive at
+ *  once, the next configuration starts when a trial finishes.
+ *
+ *  run_hyperband stops the bad configurations early, see HyperbandConfig.
+ *  Between rungs each model waits in a checkpoint with its optimizer
+ *  state, so a promoted trial resumes instead of training again, and only
+ *  the models being trained are in memory. The model needs
+ *  save_checkpoint and resume_checkpoint, see RecsysModelBase.
+ *
+ *  Each trial has its own Random stream which follows it from worker
+ *  to worker, so the sampling of a trial does not depend on the schedule.
+ *
+ *  Example:
+ *
+ *    Sweep<CDAE> sweep([](const SweepParams& params) {
+ *      CDAEConfig config;
+ *      config.corruption_ratio = std::stod(params.at("cratio"));
+ *      return CDAE(config);
+ *    }, solver_config, sweep_config);
+ *    auto results = sweep.run(SweepSpec::parse("cratio=0,0.2,0.4").grid(),
+ *                             train, test, {TOPN});
+ *    Sweep<CDAE>::write_table(results, "sweep.tsv");
+ */
+template <class Model>
+class Sweep {
+ public:
+  typedef std::function<Model (const SweepParams&)> ModelFactory;
+
+  Sweep(const ModelFactory& factory, const SolverConfig& solver_config,
+        const SweepConfig& config) :
+      factory_(factory), solver_config_(solver_config), config_(config) {
+    CHECK_GT(config_.num_workers, 0);
+    CHECK_GT(solver_config_.max_iteration, 0);
+    solver_config_.log_progress = false;
+    // one profile file can not take the epochs of concurrent trials
+    solver_config_.profile_file.clear();
+  }
+
+  /** Results of the trials, best first by config.metric
+   */
+  std::vector<SweepResult> run(const std::vector<SweepParams>& points,
+                               const Data& train_data,
+                               const Data& validation_data,
+                               const std::vector<EvalType>& eval_types);
+
+  /** Results of the trials, the ones trained longest first, then by
+   *  config.metric
+   */
+  std::vector<SweepResult> run_hyperband(const std::vector<SweepParams>& points,
+                                         const Data& train_data,
+                                         const Data& validation_data,
+                                         const std::vector<EvalType>& eval_types,
+                                         const HyperbandConfig& hyperband_config);
+
+  /** Iterations of all the trials of the last run
+   */
+  size_t total_iterations() const { return total_iterations_; }
+
+  static void write_table(const std::vector<SweepResult>& results,
+                          const std::string& filename);
+
+  static std::string format_table(const std::vector<SweepResult>& results);
+
+ private:
+  struct Trial {
+    size_t idx = 0;
+    std::unique_ptr<Solver<Model>> solver;
+    Random::rng_type rng;
+    double secs = 0.;
+    size_t iterations = 0;
+    std::string checkpoint;   // the model between rungs, empty if none
+  };
+
+  std::vector<Trial> make_trials(size_t num_trials) const;
+
+  /** Train the trial up to last_iteration, from its checkpoint if it has one
+   */
+  void advance(Trial& trial, const SweepParams& params, size_t last_iteration,
+               const Data& train_data, const Data& validation_data,
+               const std::vector<EvalType>& eval_types);
+
+  SweepResult result_of(const Trial& trial, const SweepParams& params) const;
+
+  void sort_results(std::vector<SweepResult>& results) const;
+
+  // sorted columns of the params and the metrics
+  static std::vector<std::string> param_columns(const std::vector<SweepResult>& results);
+  static std::vector<std::vector<std::string>> table_rows(const std::vector<SweepResult>& results);
+
+ private:
+  ModelFactory factory_;
+  SolverConfig solver_config_;
+  SweepConfig config_;
+  size_t total_iterations_ = 0;
+};
+
+template <class Model>
+std::vector<typename Sweep<Model>::Trial> Sweep<Model>::make_trials(size_t num_trials) const {
+  std::vector<Trial> trials(num_trials);
+  for (size_t idx = 0; idx < num_trials; ++idx) {
+    trials[idx].idx = idx;
+    trials[idx].rng.seed(config_.seed + idx);
+  }
+  return trials;
+}
+
+template <class Model>
+void Sweep<Model>::advance(Trial& trial, const SweepParams& params, size_t last_iteration,
+                           const Data& train_data, const Data& validation_data,
+                           const std::vector<EvalType>& eval_types) {
+  CHECK_GT(last_iteration, trial.iterations);
+  // the trial's own Random stream on whichever worker it lands
+  std::swap(Random::rng, trial.rng);
+  Timer timer;
+  if (trial.solver) {
+    trial.solver->resume(train_data, validation_data, last_iteration - trial.iterations);
+  } else {
+    SolverConfig solver_config = solver_config_;
+    solver_config.max_iteration = last_iteration;
+    Model model = factory_(params);
+    trial.solver.reset(new Solver<Model>(model, solver_config));
+    if (trial.checkpoint.empty()) {
+      trial.solver->train(train_data, validation_data, eval_types);
+    } else {
+      trial.solver->get_model()->resume_checkpoint(trial.checkpoint, train_data);
+      trial.solver->restore(eval_types, trial.iterations);
+      trial.solver->resume(train_data, validation_data, last_iteration - trial.iterations);
+    }
+  }
+  trial.iterations = trial.solver->iteration();
+  trial.secs += timer.elapsed();
+  std::swap(Random::rng, trial.rng);
+}
+
+template <class Model>
+SweepResult Sweep<Model>::result_of(const Trial& trial, const SweepParams& params) const {
+  CHECK(trial.solver != nullptr);
+  SweepResult result;
+  result.trial = trial.idx;
+  result.params = params;
+  result.iterations = trial.iterations;
+  result.train_secs = trial.secs;
+  result.train_loss = trial.solver->last_train_loss();
+  result.metrics = trial.solver->last_metrics();
+  return result;
+}
+
+template <class Model>
+void Sweep<Model>::sort_results(std::vector<SweepResult>& results) const {
+  bool maximize = config_.maximize;
+  const std::string& metric = config_.metric;
+  std::stable_sort(results.begin(), results.end(),
+                   [&](const SweepResult& a, const SweepResult& b) {
+                     if (a.iterations != b.iterations) return a.iterations > b.iterations;
+                     double va = a.metric(metric), vb = b.metric(metric);
+                     if (std::isnan(vb)) return !std::isnan(va);
+                     if (std::isnan(va)) return false;
+                     return maximize ? va > vb : va < vb;
+                   });
+}
+
+template <class Model>
+std::vector<SweepResult> Sweep<Model>::run(const std::vector<SweepParams>& points,
+                                           const Data& train_data,
+                                           const Data& validation_data,
+                                           const std::vector<EvalType>& eval_types) {
+  LIBCF_TRACE_SCOPE("sweep.run");
+  Timer timer;
+  size_t max_iteration = solver_config_.max_iteration;
+  size_t slice = config_.slice_iterations > 0 ?
+      std::min(config_.slice_iterations, max_iteration) : max_iteration;
+  size_t max_active = config_.max_active > 0 ? config_.max_active : 2 * config_.num_workers;
+
+  // build the shared indexes before the trials race for them
+  train_data.interaction_table();
+  if (validation_data.size() > 0) {
+    validation_data.interaction_table();
+  }
+
+  std::vector<SweepResult> results(points.size());
+  std::vector<Trial> trials = make_trials(points.size());
+  std::mutex mut;
+  size_t next_trial = 0, num_finished = 0;
+
+  WorkerPool pool(config_.num_workers, config_.threads_per_trial);
+
+  std::function<void (size_t)> run_turn = [&](size_t idx) {
+    Trial& trial = trials[idx];
+    advance(trial, points[idx], std::min(trial.iterations + slice, max_iteration),
+            train_data, validation_data, eval_types);
+    if (trial.iterations < max_iteration) {
+      pool.submit([&, idx]() { run_turn(idx); });
+      return;
+    }
+
+    SweepResult& result = results[idx];
+    result = result_of(trial, points[idx]);
+    trial.solver.reset();  // frees the model
+
+    std::lock_guard<std::mutex> lock(mut);
+    ++num_finished;
+    std::stringstream ss;
+    ss << "Trial " << num_finished << "/" << points.size()
+        << " {" << to_string(result.params) << "} " << config_.metric << ": "
+        << result.metric(config_.metric) << " in " << result.train_secs << " secs";
+    LOG(INFO) << ss.str();
+    if (next_trial < points.size()) {
+      size_t next = next_trial++;
+      pool.submit([&, next]() { run_turn(next); });
+    }
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    for (; next_trial < std::min(max_active, points.size()); ++next_trial) {
+      size_t next = next_trial;
+      pool.submit([&, next]() { run_turn(next); });
+    }
+  }
+  pool.wait();
+
+  total_iterations_ = points.size() * max_iteration;
+  sort_results(results);
+  LOG(INFO) << "Trained " << points.size() << " configurations with "
+      << config_.num_workers << " workers in " << timer;
+  return results;
+}
+
+template <class Model>
+std::vector<SweepResult> Sweep<Model>::run_hyperband(const std::vector<SweepParams>& points,
+                                                     const Data& train_data,
+                                                     const Data& validation_data,
+                                                     const std::vector<EvalType>& eval_types,
+                                                     const HyperbandConfig& hyperband_config) {
+  LIBCF_TRACE_SCOPE("sweep.run_hyperband");
+  Timer timer;
+  double eta = hyperband_config.eta;
+  size_t max_iteration = solver_config_.max_iteration;
+  size_t min_iterations = std::min(std::max<size_t>(hyperband_config.min_iterations, 1),
+                                   max_iteration);
+  CHECK_GT(eta, 1.);
+
+  // bracket s has s + 1 rungs and starts at max_iteration / eta^s
+  size_t max_bracket = static_cast<size_t>(
+      std::floor(std::log(static_cast<double>(max_iteration) / min_iterations) / std::log(eta) + 1e-9));
+  size_t num_brackets = hyperband_config.num_brackets > 0 ?
+      std::min(hyperband_config.num_brackets, max_bracket + 1) : max_bracket + 1;
+
+  // the configurations of each bracket, in Hyperband's proportions
+  std::vector<double> shares(num_brackets);
+  for (size_t b = 0; b < num_brackets; ++b) {
+    size_t s = max_bracket - b;
+    shares[b] = std::ceil((max_bracket + 1.) / (s + 1.) * std::pow(eta, s));
+  }
+  double total_share = std::accumulate(shares.begin(), shares.end(), 0.);
+  std::vector<size_t> bracket_ends(num_brackets);
+  double cumulated = 0.;
+  for (size_t b = 0; b < num_brackets; ++b) {
+    cumulated += shares[b];
+    bracket_ends[b] = static_cast<size_t>(std::round(points.size() * cumulated / total_share));
+  }
+
+  train_data.interaction_table();
+  if (validation_data.size() > 0) {
+    validation_data.interaction_table();
+  }
+
+  std::vector<SweepResult> results(points.size());
+  std::vector<Trial> trials = make_trials(points.size());
+  total_iterations_ = 0;
+  std::mutex mut;
+  std::string checkpoint_prefix = hyperband_config.checkpoint_dir + "/libcf_sweep_"
+      + std::to_string(getpid()) + "_";
+
+  WorkerPool pool(config_.num_workers, config_.threads_per_trial);
+
+  size_t bracket_begin = 0;
+  for (size_t b = 0; b < num_brackets; ++b) {
+    size_t s = max_bracket - b;
+    std::vector<size_t> alive(bracket_ends[b] - bracket_begin);
+    std::iota(alive.begin(), alive.end(), bracket_begin);
+    bracket_begin = bracket_ends[b];
+
+    for (size_t rung = 0; rung <= s && !alive.empty(); ++rung) {
+      size_t budget = rung == s ? max_iteration : std::max<size_t>(1, static_cast<size_t>(
+          std::round(max_iteration / std::pow(eta, s - rung))));
+      bool last_rung = (rung == s);
+      // the bad ones stop here, the others wait in a checkpoint
+      for (auto idx : alive) {
+        pool.submit([&, idx, budget, last_rung]() {
+          Trial& trial = trials[idx];
+          size_t start = trial.iterations;
+          if (budget <= start) return;  // rounded to the last rung's budget
+          advance(trial, points[idx], budget, train_data, validation_data, eval_types);
+          results[idx] = result_of(trial, points[idx]);
+          if (!last_rung) {
+            trial.checkpoint = checkpoint_prefix + std::to_string(idx) + ".ckpt";
+            // resume_checkpoint takes the histories from train_data
+            trial.solver->get_model()->save_checkpoint(trial.checkpoint, true, false);
+          }
+          trial.solver.reset();
+          std::lock_guard<std::mutex> lock(mut);
+          total_iterations_ += trial.iterations - start;
+        });
+      }
+      pool.wait();
+
+      // promote the best 1 / eta
+      std::vector<SweepResult> rung_results;
+      for (auto idx : alive) {
+        rung_results.push_back(results[idx]);
+      }
+      sort_results(rung_results);
+      size_t num_promoted = last_rung ? 0
+          : std::max<size_t>(1, static_cast<size_t>(alive.size() / eta));
+      std::stringstream ss;
+      ss << "Bracket " << s << " rung " << rung << ": " << alive.size()
+          << " configurations at " << budget << " iterations, best {"
+          << to_string(rung_results.front().params) << "} " << config_.metric << ": "
+          << rung_results.front().metric(config_.metric) << ", promoting " << num_promoted;
+      LOG(INFO) << ss.str();
+      alive.clear();
+      for (size_t idx = 0; idx < rung_results.size(); ++idx) {
+        size_t trial = rung_results[idx].trial;
+        if (idx < num_promoted) {
+          alive.push_back(trial);
+        } else if (!trials[trial].checkpoint.empty()) {
+          std::remove(trials[trial].checkpoint.c_str());
+          trials[trial].checkpoint.clear();
+        }
+      }
+    }
+  }
+
+  for (auto& trial : trials) {
+    if (!trial.checkpoint.empty()) {
+      std::remove(trial.checkpoint.c_str());
+    }
+  }
+  sort_results(results);
+  LOG(INFO) << "Trained " << points.size() << " configurations in " << num_brackets
+      << " brackets for " << total_iterations_ << " iterations ("
+      << points.size() * max_iteration << " for the full grid) with "
+      << config_.num_workers << " workers in " << timer;
+  return results;
+}
+
+template <class Model>
+std::vector<std::string> Sweep<Model>::param_columns(const std::vector<SweepResult>& results) {
+  std::vector<std::string> rets;
+  for (auto& result : results) {
+    for (auto& p : result.params) {
+      if (std::find(rets.begin(), rets.end(), p.first) == rets.end()) {
+        rets.push_back(p.first);
+      }
+    }
+  }
+  std::sort(rets.begin(), rets.end());
+  return rets;
+}
+
+template <class Model>
+std::vector<std::vector<std::string>> Sweep<Model>::table_rows(const std::vector<SweepResult>& results) {
+  std::vector<std::vector<std::string>> rows;
+  auto params = param_columns(results);
+  std::vector<std::string> metrics;
+  if (!results.empty()) {
+    for (auto& p : results.front().metrics) {
+      metrics.push_back(p.first);
+    }
+  }
+
+  std::vector<std::string> header{"trial"};
+  header.insert(header.end(), params.begin(), params.end());
+  header.insert(header.end(), {"iterations", "secs", "train_loss"});
+  header.insert(header.end(), metrics.begin(), metrics.end());
+  rows.push_back(header);
+
+  auto format = [](double v) {
+    std::stringstream ss;
+    ss << std::setprecision(5) << v;
+    return ss.str();
+  };
+  for (auto& result : results) {
+    std::vector<std::string> row{std::to_string(result.trial)};
+    for (auto& name : params) {
+      auto fit = result.params.find(name);
+      row.push_back(fit != result.params.end() ? fit->second : "-");
+    }
+    row.push_back(std::to_string(result.iterations));
+    row.push_back(format(result.train_secs));
+    row.push_back(format(result.train_loss));
+    for (auto& name : metrics) {
+      row.push_back(format(result.metric(name)));
+    }
+    rows.push_back(std::move(row));
+  }
+  return rows;
+}
+
+/** Tab separated, one header line and one line per trial
+ */
+template <class Model>
+void Sweep<Model>::write_table(const std::vector<SweepResult>& results,
+                               const std::string& filename) {
+  File f(filename, "w");
+  CHECK(f.good()) << "Cannot open " << filename;
+  for (auto& row : table_rows(results)) {
+    f.write_line(join_iterators_with_separator(row.begin(), row.end(), "\t"));
+  }
+  f.close();
+  LOG(INFO) << "Wrote " << results.size() << " sweep results to " << filename;
+}
+
+/** Aligned for the log
+ */
+template <class Model>
+std::string Sweep<Model>::format_table(const std::vector<SweepResult>& results) {
+  auto rows = table_rows(results);
+  std::vector<size_t> widths;
+  for (auto& row : rows) {
+    widths.resize(std::max(widths.size(), row.size()), 0);
+    for (size_t col = 0; col < row.size(); ++col) {
+      widths[col] = std::max(widths[col], row[col].size());
+    }
+  }
+  std::stringstream ss;
+  for (auto& row : rows) {
+    ss << std::endl;
+    for (size_t col = 0; col < row.size(); ++col) {
+      ss << std::setw(widths[col]) << row[col] << (col + 1 < row.size() ? "|" : "");
+    }
+  }
+  return ss.str();
+}
+
+} // namespace
+
+#endif // _LIBCF_SWEEP_HPP_
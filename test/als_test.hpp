@@ -0,0 +1,202 @@
+#include <cstdlib>
+
+#include "gtest/gtest.h"
+
+#include <base/csr.hpp>
+#include <base/data.hpp>
+#include <base/synthetic.hpp>
+#include <model/recsys/als.hpp>
+#include <model/recsys/wrmf.hpp>
+#include <model/recsys/eals.hpp>
+#include <solver/solver.hpp>
+
+TEST(als, test_csr_matrix) {
+  using namespace libcf;
+  InteractionTable table;
+  table[0] = {{3, 1.}, {1, 2.}};
+  table[2] = {{1, 3.}};
+  CSRMatrix rows(table, 3);
+  EXPECT_EQ(rows.num_rows(), 3);
+  EXPECT_EQ(rows.num_entries(), 3);
+  ASSERT_EQ(rows.row_size(0), 2);
+  EXPECT_EQ(rows.row_size(1), 0);
+  EXPECT_EQ(rows.ids(0)[0], 1);
+  EXPECT_EQ(rows.values(0)[0], 2.);
+  EXPECT_EQ(rows.ids(0)[1], 3);
+
+  CSRMatrix cols(table, 4, true);
+  EXPECT_EQ(cols.num_rows(), 4);
+  ASSERT_EQ(cols.row_size(1), 2);
+  EXPECT_EQ(cols.ids(1)[0], 0);
+  EXPECT_EQ(cols.values(1)[0], 2.);
+  EXPECT_EQ(cols.ids(1)[1], 2);
+  EXPECT_EQ(cols.values(1)[1], 3.);
+  EXPECT_EQ(cols.row_size(3), 1);
+}
+
+TEST(als, test_als) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 300;
+  synthetic_config.num_items = 400;
+  synthetic_config.num_interactions = 6000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  ALSConfig config;
+  config.num_dim = 8;
+  config.lambda = 0.1;
+  int saved_threads = FLAGS_num_thread;
+  std::vector<DMatrix> item_vecs;
+  for (int num_threads : {1, 3}) {
+    FLAGS_num_thread = num_threads;
+    std::srand(3);
+    ALS model(config);
+    model.reset(train);
+    double last_loss = model.current_loss(train);
+    for (size_t iter = 0; iter < 4; ++iter) {
+      model.train_one_iteration(train);
+      // each half-sweep minimizes the objective exactly
+      double loss = model.current_loss(train);
+      EXPECT_LE(loss, last_loss * (1. + 1e-9));
+      last_loss = loss;
+    }
+    item_vecs.push_back(model.get_item_vecs());
+
+    // the item rows solve their normal equations over the observed users
+    DMatrix P = model.get_user_vecs();
+    DMatrix Q = model.get_item_vecs();
+    auto& table = *train.interaction_table();
+    for (size_t iid = 0; iid < 20; ++iid) {
+      DMatrix A = DMatrix::Identity(config.num_dim, config.num_dim) * config.lambda;
+      DVector b = DVector::Zero(config.num_dim);
+      for (auto& p : table) {
+        auto fit = p.second.find(iid);
+        if (fit == p.second.end()) continue;
+        A += P.row(p.first).transpose() * P.row(p.first);
+        b += fit->second * P.row(p.first).transpose();
+      }
+      DVector residual = A * Q.row(iid).transpose() - b;
+      EXPECT_LT(residual.norm(), 1e-6 * (1. + b.norm()));
+    }
+  }
+  FLAGS_num_thread = saved_threads;
+  // rows are independent within a half-sweep, so threads do not matter
+  EXPECT_TRUE(item_vecs[0] == item_vecs[1]);
+}
+
+TEST(als, test_wrmf) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 300;
+  synthetic_config.num_items = 400;
+  synthetic_config.num_interactions = 6000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  WRMFConfig config;
+  config.num_dim = 8;
+  config.lambda = 0.1;
+  config.solver = CHOLESKY;
+  std::srand(3);
+  WRMF exact(config);
+  exact.reset(train);
+  std::vector<double> exact_losses;
+  for (size_t iter = 0; iter < 5; ++iter) {
+    exact.train_one_iteration(train);
+    exact_losses.push_back(exact.current_loss(train));
+    if (iter > 0) {
+      // each half-sweep minimizes the objective exactly
+      EXPECT_LE(exact_losses[iter], exact_losses[iter - 1] * (1. + 1e-9));
+    }
+  }
+
+  // the item rows solve their full normal equations, over every user
+  DMatrix P = exact.get_user_vecs();
+  DMatrix Q = exact.get_item_vecs();
+  auto& table = *train.interaction_table();
+  size_t num_users = P.rows();
+  for (size_t iid = 0; iid < 20; ++iid) {
+    DMatrix A = DMatrix::Identity(config.num_dim, config.num_dim) * config.lambda;
+    DVector b = DVector::Zero(config.num_dim);
+    for (size_t uid = 0; uid < num_users; ++uid) {
+      auto fit = table.find(uid);
+      bool observed = fit != table.end() && fit->second.count(iid);
+      double confidence = observed ? 1. + config.scalar * fit->second.at(iid) : 1.;
+      A += confidence * P.row(uid).transpose() * P.row(uid);
+      if (observed) {
+        b += confidence * P.row(uid).transpose();
+      }
+    }
+    DVector residual = A * Q.row(iid).transpose() - b;
+    EXPECT_LT(residual.norm(), 1e-6 * (1. + b.norm()));
+  }
+
+  // a few warm-started CG steps a row end up close to the exact solves
+  config.solver = CONJUGATE_GRADIENT;
+  config.cg_steps = 3;
+  std::srand(3);
+  WRMF cg(config);
+  cg.reset(train);
+  double cg_loss = 0.;
+  for (size_t iter = 0; iter < 5; ++iter) {
+    cg.train_one_iteration(train);
+    cg_loss = cg.current_loss(train);
+  }
+  LOG(INFO) << "WRMF loss after 5 sweeps, Cholesky " << exact_losses.back() << ", CG " << cg_loss;
+  EXPECT_LT(cg_loss, exact_losses.back() * 1.05);
+
+  SolverConfig solver_config;
+  solver_config.max_iteration = 3;
+  Solver<WRMF> solver(cg, solver_config);
+  solver.train(train, test, {TOPN});
+  EXPECT_GT(solver.last_metrics()[7].second, 0.);
+}
+
+TEST(als, test_eals) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 300;
+  synthetic_config.num_items = 400;
+  synthetic_config.num_interactions = 6000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  EALSConfig config;
+  config.num_dim = 16;
+  config.c0 = 64.;
+  int saved_threads = FLAGS_num_thread;
+  std::vector<DMatrix> user_vecs;
+  for (int num_threads : {1, 3}) {
+    FLAGS_num_thread = num_threads;
+    std::srand(5);
+    EALS model(config);
+    model.reset(train);
+    double last_loss = model.current_loss(train);
+    for (size_t iter = 0; iter < 4; ++iter) {
+      model.train_one_iteration(train);
+      // every coordinate step is exact, so no sweep increases the loss
+      double loss = model.current_loss(train);
+      EXPECT_LE(loss, last_loss * (1. + 1e-9));
+      last_loss = loss;
+    }
+    EXPECT_LT(model.max_prediction_drift(), 1e-9);
+    user_vecs.push_back(model.get_user_vecs());
+  }
+  FLAGS_num_thread = saved_threads;
+  // rows are independent within a half-sweep, so threads do not matter
+  EXPECT_TRUE(user_vecs[0] == user_vecs[1]);
+
+  EALS model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 3;
+  Solver<EALS> solver(model, solver_config);
+  solver.train(train, test, {TOPN});
+  EXPECT_GT(solver.last_metrics()[7].second, 0.);
+}
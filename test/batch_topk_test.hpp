@@ -0,0 +1,111 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
+
+#include <base/mat.hpp>
+#include <base/csr.hpp>
+#include <base/topk.hpp>
+#include <base/utils.hpp>
+#include <model/recsys/batch_topk.hpp>
+
+#include "gtest/gtest.h"
+
+TEST(batch_topk, test_csr_index) {
+  using namespace libcf;
+  std::unordered_map<size_t, std::unordered_map<size_t, double>> rows;
+  rows[0] = {{5, 1.}, {2, 1.}, {9, 1.}};
+  rows[2] = {{1, 1.}};
+  CSRIndex csr(rows, 4);
+  EXPECT_EQ(csr.num_rows(), 4);
+  EXPECT_EQ(csr.num_ids(), 4);
+  EXPECT_EQ(csr.row_size(0), 3);
+  EXPECT_EQ(csr.row_size(1), 0);
+  EXPECT_EQ(csr.row_size(3), 0);
+  std::vector<size_t> row0(csr.row(0).begin(), csr.row(0).end());
+  EXPECT_EQ(row0, (std::vector<size_t>{2, 5, 9}));
+  EXPECT_EQ(*csr.row(2).begin(), 1);
+}
+
+TEST(batch_topk, test_batch_against_single_user) {
+  using namespace libcf;
+  size_t num_users = 300;
+  size_t num_items = 5000;
+  size_t num_dim = 16;
+  size_t topk = 10;
+
+  DMatrix user_vecs = DMatrix::Random(num_users, num_dim);
+  DMatrix item_vecs = DMatrix::Random(num_items, num_dim);
+  DVector item_bias = DVector::Random(num_items);
+
+  std::unordered_map<size_t, std::unordered_map<size_t, double>> rated;
+  for (size_t uid = 0; uid < num_users; ++uid) {
+    for (size_t idx = 0; idx < 50; ++idx) {
+      rated[uid][rand() % num_items] = 1.;
+    }
+  }
+  CSRIndex exclusions(rated, num_users);
+
+  std::vector<size_t> uids(num_users);
+  std::iota(uids.begin(), uids.end(), 0);
+  std::reverse(uids.begin(), uids.end());
+
+  std::vector<size_t> rec_lists(num_users * topk);
+  libcf::time_function([&]() {
+    batch_inner_product_topk(item_vecs, item_bias,
+                             [&](size_t uid, DMatrix::RowXpr row) { row = user_vecs.row(uid); },
+                             uids.data(), uids.size(), topk, exclusions, rec_lists.data(),
+                             64, 1000);
+  }, "batch topk");
+
+  libcf::time_function([&]() {
+    for (size_t idx = 0; idx < uids.size(); ++idx) {
+      size_t uid = uids[idx];
+      DVector scores = item_vecs * user_vecs.row(uid).transpose() + item_bias;
+      TopK<double> topk_items(topk);
+      for (size_t iid = 0; iid < num_items; ++iid) {
+        if (rated[uid].count(iid)) continue;
+        topk_items.push(iid, scores(iid));
+      }
+      auto expected = topk_items.get_sorted_ids();
+      for (size_t k = 0; k < topk; ++k) {
+        EXPECT_NEAR(scores(rec_lists[idx * topk + k]), scores(expected[k]), 1e-10);
+        EXPECT_EQ(rated[uid].count(rec_lists[idx * topk + k]), 0);
+      }
+    }
+  }, "single user topk");
+}
+
+TEST(batch_topk, test_short_lists) {
+  using namespace libcf;
+  size_t num_items = 20;
+  size_t num_dim = 4;
+  size_t topk = 5;
+
+  DMatrix user_vecs = DMatrix::Random(3, num_dim);
+  DMatrix item_vecs = DMatrix::Random(num_items, num_dim);
+
+  // user 0 has 3 items left, user 1 none, user 2 all of them
+  std::unordered_map<size_t, std::unordered_map<size_t, double>> rated;
+  for (size_t iid = 0; iid < num_items; ++iid) {
+    if (iid != 4 && iid != 11 && iid != 17) rated[0][iid] = 1.;
+    rated[1][iid] = 1.;
+  }
+  CSRIndex exclusions(rated, 3);
+
+  std::vector<size_t> uids{0, 1, 2};
+  std::vector<size_t> rec_lists(uids.size() * topk);
+  batch_inner_product_topk(item_vecs, DVector(),
+                           [&](size_t uid, DMatrix::RowXpr row) { row = user_vecs.row(uid); },
+                           uids.data(), uids.size(), topk, exclusions, rec_lists.data(), 2, 8);
+
+  std::vector<size_t> left(rec_lists.begin(), rec_lists.begin() + 3);
+  std::sort(left.begin(), left.end());
+  EXPECT_EQ(left, (std::vector<size_t>{4, 11, 17}));
+  for (size_t k = 3; k < 2 * topk; ++k) {
+    EXPECT_EQ(rec_lists[k], kNoItem);
+  }
+  for (size_t k = 2 * topk; k < 3 * topk; ++k) {
+    EXPECT_NE(rec_lists[k], kNoItem);
+  }
+}
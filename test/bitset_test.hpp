@@ -0,0 +1,84 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
+
+#include <base/bitset.hpp>
+#include <base/utils.hpp>
+#include <base/random.hpp>
+
+#include "gtest/gtest.h"
+
+TEST(bitset, test_bitset) {
+  using namespace libcf;
+  DenseBitset bits(130);
+  EXPECT_EQ(bits.size(), 130);
+  EXPECT_EQ(bits.count(), 0);
+  bits.set(0);
+  bits.set(64);
+  bits.set(129);
+  EXPECT_TRUE(bits.test(0));
+  EXPECT_TRUE(bits.test(64));
+  EXPECT_TRUE(bits.test(129));
+  EXPECT_FALSE(bits.test(1));
+  EXPECT_FALSE(bits.test(63));
+  EXPECT_EQ(bits.count(), 3);
+  bits.reset(64);
+  EXPECT_FALSE(bits.test(64));
+  EXPECT_EQ(bits.count(), 2);
+  bits.clear();
+  EXPECT_EQ(bits.count(), 0);
+
+  std::unordered_map<size_t, double> rated{{3, 1.}, {70, 1.}, {100, 1.}};
+  {
+    ScopedBitsetMask<std::unordered_map<size_t, double>> mask(bits, rated);
+    for (size_t idx = 0; idx < bits.size(); ++idx) {
+      EXPECT_EQ(mask.test(idx), rated.count(idx) > 0);
+    }
+  }
+  EXPECT_EQ(bits.count(), 0);
+
+  // an id out of range fails before any bit is set
+  std::vector<size_t> foreign{5, 130};
+  EXPECT_DEATH((ScopedBitsetMask<std::vector<size_t>>(bits, foreign)), "out of the range");
+}
+
+TEST(bitset, test_bitset_against_hashtable) {
+  using namespace libcf;
+  size_t num_items = 100000;
+  size_t num_users = 100;
+  size_t num_rated = 200;
+
+  std::vector<std::unordered_map<size_t, double>> user_rated_items(num_users);
+  for (auto& rated : user_rated_items) {
+    while (rated.size() < num_rated) {
+      rated[Random::uniform(size_t(0), num_items)] = 1.;
+    }
+  }
+
+  // count the items left for scoring for every user
+  size_t hashtable_cnt = 0;
+  libcf::time_function([&]() {
+    for (auto& rated : user_rated_items) {
+      for (size_t iid = 0; iid < num_items; ++iid) {
+        if (rated.count(iid)) continue;
+        ++hashtable_cnt;
+      }
+    }
+  }, "hashtable exclusion");
+
+  size_t bitset_cnt = 0;
+  DenseBitset bits(num_items);
+  libcf::time_function([&]() {
+    for (auto& rated : user_rated_items) {
+      ScopedBitsetMask<std::unordered_map<size_t, double>> mask(bits, rated);
+      for (size_t iid = 0; iid < num_items; ++iid) {
+        if (mask.test(iid)) continue;
+        ++bitset_cnt;
+      }
+    }
+  }, "bitset exclusion");
+
+  EXPECT_EQ(hashtable_cnt, num_users * (num_items - num_rated));
+  EXPECT_EQ(bitset_cnt, hashtable_cnt);
+}
@@ -0,0 +1,162 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/utils.hpp>
+#include <model/recsys/cdae.hpp>
+#include <solver/solver.hpp>
+
+TEST(cdae, test_hidden_cache) {
+  using namespace libcf;
+  std::string sample_data("./test_data/sample_movielens_data.txt");
+
+  auto line_parser = [&](const std::string& line) {
+    auto rets = split_line(line, ": ");
+    CHECK_EQ(rets.size(), 4);
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  };
+  
+  Data data;
+  data.load(sample_data, RECSYS, line_parser);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  CDAEConfig config;
+  config.lt = SQUARE;
+  config.corruption_ratio = 0.2;
+  config.retrieval = BRUTE_FORCE;
+  CDAE cdae_model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 2;
+  Solver<CDAE> solver(cdae_model, solver_config);
+  solver.train(train, test, {TOPN});
+  auto model = solver.get_model();
+
+  size_t num_users = train.feature_group_total_dimension(0);
+  size_t num_items = train.feature_group_total_dimension(1);
+  auto rated = train.get_feature_pair_label_hashtable(0, 1);
+
+  model->clear_hidden_cache();
+  std::vector<std::vector<size_t>> uncached(num_users);
+  libcf::time_function([&]() {
+    for (size_t uid = 0; uid < num_users; ++uid) {
+      uncached[uid] = model->recommend(uid, 10, rated[uid]);
+    }
+  }, "CDAE recommend without hidden cache");
+
+  model->pre_recommend();
+  EXPECT_TRUE(model->has_cached_hidden(0));
+  auto& histories = model->history_table();
+  libcf::time_function([&]() {
+    for (size_t uid = 0; uid < num_users; ++uid) {
+      EXPECT_EQ(model->recommend(uid, 10, histories.at(uid)), uncached[uid]);
+    }
+  }, "CDAE recommend with hidden cache");
+
+  // the cache answers for the user's own history only, not for another
+  // rated set of the same size
+  std::unordered_map<size_t, double> other;
+  for (size_t iid = num_items; iid-- > 0 && other.size() < rated[0].size(); ) {
+    if (!rated[0].count(iid)) other[iid] = 1.;
+  }
+  auto cached_other = model->recommend(0, 10, other);
+  model->clear_hidden_cache();
+  EXPECT_EQ(model->recommend(0, 10, other), cached_other);
+  model->pre_recommend();
+
+  // the same for recommend_batch and its exclusions
+  std::vector<size_t> uids(num_users);
+  std::iota(uids.begin(), uids.end(), 0);
+  std::vector<size_t> rec_lists(num_users * 10);
+  CSRIndex exclusions = model->history_index();
+  model->recommend_batch(uids.data(), num_users, 10, exclusions, rec_lists.data());
+  for (size_t uid = 0; uid < num_users; ++uid) {
+    EXPECT_EQ(std::vector<size_t>(rec_lists.begin() + uid * 10, rec_lists.begin() + (uid + 1) * 10),
+              uncached[uid]);
+  }
+  std::unordered_map<size_t, std::unordered_map<size_t, double>> other_rows{{0, other}};
+  model->recommend_batch(uids.data(), 1, 10, CSRIndex(other_rows, num_users), rec_lists.data());
+  EXPECT_EQ(std::vector<size_t>(rec_lists.begin(), rec_lists.begin() + 10), cached_other);
+
+  // grow a history: the incremental update matches a rebuild
+  std::vector<size_t> new_items;
+  for (size_t iid = 0; iid < num_items && new_items.size() < 5; ++iid) {
+    if (!rated[0].count(iid)) {
+      new_items.push_back(iid);
+      rated[0][iid] = 1.;
+    }
+  }
+  model->add_user_items(0, new_items);
+  EXPECT_TRUE(model->has_cached_hidden(0));
+  auto incremental = model->recommend(0, 10, model->history_table().at(0));
+  model->build_hidden_cache();
+  EXPECT_EQ(model->recommend(0, 10, model->history_table().at(0)), incremental);
+  model->clear_hidden_cache();
+  EXPECT_EQ(model->recommend(0, 10, rated[0]), incremental);
+
+  // exclusions built before the change no longer match the cache
+  model->pre_recommend();
+  model->recommend_batch(uids.data(), 1, 10, exclusions, rec_lists.data());
+  model->clear_hidden_cache();
+  std::vector<size_t> expected(10);
+  model->recommend_batch(uids.data(), 1, 10, exclusions, expected.data());
+  EXPECT_EQ(std::vector<size_t>(rec_lists.begin(), rec_lists.begin() + 10), expected);
+
+  // fold-in without steps reproduces the hidden values of a known user
+  model->pre_recommend();
+  std::vector<size_t> history;
+  for (auto& p : rated[1]) {
+    history.push_back(p.first);
+  }
+  EXPECT_TRUE(model->fold_in(history, 0, 1).isApprox(model->get_user_representations().row(1).transpose()));
+  EXPECT_EQ(model->recommend_fold_in(history, 10, 0, 1), model->recommend(1, 10, rated[1]));
+
+  // a new user: a few steps on the user factor lower the expected
+  // reconstruction loss, with num_neg = 5 negatives per rated item
+  auto reconstruction_loss = [&](const DVector& z) {
+    double loss = 0.;
+    for (auto& iid : history) {
+      double y = model->get_output_values(z, iid);
+      loss += (y - 1.) * (y - 1.);
+    }
+    double negative_loss = 0.;
+    for (size_t iid = 0; iid < num_items; ++iid) {
+      double y = model->get_output_values(z, iid);
+      negative_loss += y * y / num_items;
+    }
+    return loss + 5. * history.size() * negative_loss;
+  };
+  DVector z0, z10;
+  libcf::time_function([&]() { z0 = model->fold_in(history); }, "CDAE fold-in");
+  libcf::time_function([&]() { z10 = model->fold_in(history, 10); }, "CDAE fold-in, 10 steps");
+  EXPECT_LT(reconstruction_loss(z10), reconstruction_loss(z0));
+
+  // the negatives come from Random, so a seeded fold-in is reproducible
+  Random::seed(3);
+  DVector seeded = model->fold_in(history, 10);
+  Random::seed(3);
+  EXPECT_TRUE(model->fold_in(history, 10) == seeded);
+
+  // a history of every item leaves no negatives to draw
+  std::vector<size_t> all_items(num_items);
+  std::iota(all_items.begin(), all_items.end(), 0);
+  EXPECT_EQ(model->fold_in(all_items, 2).size(), config.num_dim);
+
+  // a history with repeats longer than the item set leaves one item,
+  // the rest of the list is padding
+  std::vector<size_t> repeated(all_items.begin() + 1, all_items.end());
+  repeated.insert(repeated.end(), all_items.begin() + 1, all_items.end());
+  auto short_list = model->recommend_fold_in(repeated, 10);
+  EXPECT_EQ(short_list[0], 0);
+  EXPECT_EQ(std::count(short_list.begin(), short_list.end(), kNoItem), 9);
+  EXPECT_DEATH(model->fold_in({num_items}), "Unknown item");
+
+  auto rec_list = model->recommend_fold_in(history, 10, 10);
+  EXPECT_EQ(rec_list.size(), 10);
+  for (auto& iid : rec_list) {
+    EXPECT_EQ(rated[1].count(iid), 0);
+  }
+}
@@ -0,0 +1,237 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/utils.hpp>
+#include <base/io/checkpoint.hpp>
+#include <model/recsys/imf.hpp>
+#include <model/recsys/cdae.hpp>
+#include <model/recsys/usercf.hpp>
+#include <solver/solver.hpp>
+
+TEST(checkpoint, test_format) {
+  using namespace libcf;
+  DMatrix m = DMatrix::Random(7, 3);
+  DVector v = DVector::Random(5);
+  FeatureGroupInfo fg_info(SPARSE_BINARY);
+  for (auto& key : {"b", "a", "ccc", "", "bb"}) {
+    fg_info.get_index(key);
+  }
+
+  std::string filename("/tmp/libcf_checkpoint_test.ckpt");
+  {
+    CheckpointWriter writer;
+    writer.add("m", m);
+    writer.add("v", v);
+    writer.add("ids", std::vector<uint64_t>{3, 1, 4});
+    writer.add("type", std::string("TEST"));
+    writer.add_dictionary("dict", fg_info);
+    writer.save(filename);
+  }
+
+  for (bool use_mmap : {true, false}) {
+    Checkpoint ckpt(filename, use_mmap);
+    EXPECT_EQ(ckpt.mapped(), use_mmap);
+    EXPECT_EQ(ckpt.section("m").offset % kCheckpointAlignment, 0);
+    EXPECT_EQ(ckpt.section("v").offset % kCheckpointAlignment, 0);
+    EXPECT_TRUE(ckpt.matrix("m").isApprox(m));
+    EXPECT_TRUE(ckpt.vector("v").isApprox(v));
+    auto ids = ckpt.array<uint64_t>("ids");
+    EXPECT_EQ(std::vector<uint64_t>(ids.begin(), ids.end()), std::vector<uint64_t>({3, 1, 4}));
+    EXPECT_EQ(ckpt.bytes("type"), "TEST");
+    EXPECT_FALSE(ckpt.has("missing"));
+
+    auto dict = ckpt.dictionary("dict");
+    EXPECT_EQ(dict.size(), fg_info.size());
+    for (size_t idx = 0; idx < fg_info.size(); ++idx) {
+      EXPECT_EQ(dict.raw_str(idx), fg_info.raw_str(idx));
+      EXPECT_EQ(dict.find(fg_info.raw_str(idx)), idx);
+    }
+    EXPECT_EQ(dict.find("c"), size_t(-1));
+    EXPECT_EQ(dict.find("cccc"), size_t(-1));
+    auto copy = dict.to_feature_group_info();
+    EXPECT_EQ(copy.size(), fg_info.size());
+    EXPECT_EQ(copy.get_index("ccc", false), fg_info.get_index("ccc", false));
+  }
+}
+
+TEST(checkpoint, test_corrupt_files) {
+  using namespace libcf;
+  std::string filename("/tmp/libcf_checkpoint_corrupt.ckpt");
+  DMatrix m = DMatrix::Random(7, 3);
+  DVector ratings = DVector::Ones(2);
+  auto save = [&](const std::vector<uint64_t>& history_ids) {
+    CheckpointWriter writer;
+    writer.add("m", m);
+    writer.add("model.shape", std::vector<uint64_t>{2, 3});
+    writer.add("history.offsets", std::vector<uint64_t>{0, 1, 2});
+    writer.add("history.ids", history_ids);
+    writer.add("history.ratings", ratings);
+    writer.save(filename);
+  };
+
+  // rewrite a field of the table entry of section name
+  auto patch = [&](const std::string& name, uint64_t CheckpointSection::* field, uint64_t value) {
+    std::string contents;
+    {
+      File f(filename, "rb");
+      contents.resize(f.size());
+      f.read(&contents[0], contents.size());
+      f.close();
+    }
+    auto header = reinterpret_cast<CheckpointHeader*>(&contents[0]);
+    auto table = reinterpret_cast<CheckpointSection*>(&contents[header->table_offset]);
+    for (size_t idx = 0; idx < header->num_sections; ++idx) {
+      if (name == table[idx].name) table[idx].*field = value;
+    }
+    File f(filename, "wb");
+    f.write(contents.data(), contents.size());
+    f.close();
+  };
+
+  save({1, 2});
+  Checkpoint(filename).matrix("m");
+  // the end of the section wraps around
+  patch("m", &CheckpointSection::offset, uint64_t(-kCheckpointAlignment));
+  EXPECT_DEATH(Checkpoint{filename}, "Truncated checkpoint");
+  // more rows than bytes
+  save({1, 2});
+  patch("m", &CheckpointSection::rows, 1000);
+  EXPECT_DEATH(Checkpoint{filename}, "Corrupted checkpoint section m");
+  save({1, 2});
+  patch("m", &CheckpointSection::rows, uint64_t(1) << 62);
+  EXPECT_DEATH(Checkpoint{filename}, "Corrupted checkpoint section m");
+
+  // histories served in place are checked against the item count
+  save({1, 3});
+  IMF model;
+  EXPECT_DEATH(model.load_checkpoint(filename), "Corrupted training histories");
+}
+
+TEST(checkpoint, test_models) {
+  using namespace libcf;
+  std::string sample_data("./test_data/sample_movielens_data.txt");
+
+  auto line_parser = [&](const std::string& line) {
+    auto rets = split_line(line, ": ");
+    CHECK_EQ(rets.size(), 4);
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  };
+
+  Data data;
+  data.load(sample_data, RECSYS, line_parser);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+  size_t num_users = train.feature_group_total_dimension(0);
+  auto rated = train.get_feature_pair_label_hashtable(0, 1);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 2;
+
+  // the loaded model recommends as the trained one
+  auto expect_same = [&](const RecsysModelBase& trained, RecsysModelBase& loaded) {
+    loaded.pre_recommend();
+    for (size_t uid = 0; uid < num_users; ++uid) {
+      EXPECT_EQ(loaded.recommend(uid, 10, rated[uid]), trained.recommend(uid, 10, rated[uid]));
+    }
+  };
+
+  std::string filename("/tmp/libcf_checkpoint_model.ckpt");
+  {
+    IMFConfig config;
+    config.num_dim = 20;
+    IMF imf_model(config);
+    Solver<IMF> solver(imf_model, solver_config);
+    solver.train(train, test, {TOPN});
+    auto model = solver.get_model();
+    model->pre_recommend();
+    model->save_checkpoint(filename);
+    size_t full_size = Checkpoint(filename).size();
+    IMF loaded(config);
+    loaded.load_checkpoint(filename);
+    expect_same(*model, loaded);
+
+    model->save_checkpoint(filename, false);
+    EXPECT_LT(Checkpoint(filename).size(), full_size);
+    IMF serving(config);
+    serving.load_checkpoint(filename);
+    expect_same(*model, serving);
+
+    Checkpoint ckpt(filename);
+    auto users = ckpt.dictionary("users");
+    EXPECT_EQ(users.size(), num_users);
+    EXPECT_EQ(users.find("1"), train.get_data_info()->feature_group_infos_[0].get_index("1", false));
+  }
+
+  {
+    CDAEConfig config;
+    config.lt = SQUARE;
+    config.corruption_ratio = 0.2;
+    config.retrieval = BRUTE_FORCE;
+    CDAE cdae_model(config);
+    Solver<CDAE> solver(cdae_model, solver_config);
+    solver.train(train, test, {TOPN});
+    auto model = solver.get_model();
+    model->pre_recommend();
+    model->save_checkpoint(filename);
+    CDAE loaded(config);
+    loaded.load_checkpoint(filename, false);
+    expect_same(*model, loaded);
+    EXPECT_TRUE(loaded.has_cached_hidden(0));
+
+    // the histories are read in place, rows sorted as history_index
+    CSRIndex trained_history = model->history_index();
+    CSRIndex loaded_history = loaded.history_index();
+    ASSERT_EQ(loaded_history.num_ids(), trained_history.num_ids());
+    for (size_t uid = 0; uid < num_users; ++uid) {
+      EXPECT_TRUE(std::equal(loaded_history.row(uid).begin(), loaded_history.row(uid).end(),
+                             trained_history.row(uid).begin()));
+    }
+    std::vector<size_t> uids(num_users);
+    std::iota(uids.begin(), uids.end(), 0);
+    std::vector<size_t> expected(num_users * 10), actual(num_users * 10);
+    model->recommend_batch(uids.data(), num_users, 10, trained_history, expected.data());
+    loaded.recommend_batch(uids.data(), num_users, 10, loaded_history, actual.data());
+    EXPECT_EQ(actual, expected);
+
+    // a loaded model saves what it read, and training resumes on copies
+    std::string resaved("/tmp/libcf_checkpoint_resaved.ckpt");
+    loaded.save_checkpoint(resaved);
+    CDAE reloaded(config);
+    reloaded.load_checkpoint(resaved);
+    expect_same(*model, reloaded);
+    CDAE resumed(config);
+    resumed.resume_checkpoint(resaved, train);
+    expect_same(*model, resumed);
+    resumed.train_one_iteration(train);
+
+    // serving checkpoints keep the histories by default
+    model->save_checkpoint(filename, false);
+    EXPECT_TRUE(Checkpoint(filename).has("history.offsets"));
+    CDAE serving(config);
+    serving.load_checkpoint(filename);
+    expect_same(*model, serving);
+    EXPECT_TRUE(serving.has_cached_hidden(0));
+
+    // without them the rated sets are given by the caller
+    model->save_checkpoint(filename, false, false);
+    EXPECT_FALSE(Checkpoint(filename).has("history.offsets"));
+    CDAE bare(config);
+    bare.load_checkpoint(filename);
+    expect_same(*model, bare);
+  }
+
+  {
+    UserCF usercf_model(Jaccard, 20);
+    Solver<UserCF> solver(usercf_model);
+    solver.train(train, test, {TOPN});
+    auto model = solver.get_model();
+    model->save_checkpoint(filename);
+    UserCF loaded(Jaccard, 20);
+    loaded.load_checkpoint(filename);
+    EXPECT_EQ(loaded.get_neighbors(), model->get_neighbors());
+    expect_same(*model, loaded);
+  }
+}
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <unordered_set>
+
+#include <base/mat.hpp>
+#include <base/bitset.hpp>
+#include <base/utils.hpp>
+#include <model/recsys/mips.hpp>
+#include <model/recsys/hnsw.hpp>
+
+#include "gtest/gtest.h"
+
+TEST(hnsw, test_hnsw_recall_against_exact) {
+  using namespace libcf;
+  size_t num_items = 20000;
+  size_t num_dim = 16;
+  size_t num_queries = 200;
+  size_t topk = 10;
+
+  DMatrix items = DMatrix::Random(num_items, num_dim);
+  DVector bias = DVector::Random(num_items) * 0.1;
+  DMatrix queries = DMatrix::Random(num_queries, num_dim);
+
+  MIPSIndex exact_index;
+  exact_index.build(items, bias);
+
+  HNSWConfig cfg;
+  cfg.M = 16;
+  cfg.ef_construction = 100;
+  HNSWIndex index(cfg);
+  libcf::time_function([&]() {
+    index.build(items, bias);
+  }, "HNSW build");
+  EXPECT_EQ(index.size(), num_items);
+
+  DenseBitset excluded(num_items);
+  excluded.set(0);
+  excluded.set(1);
+
+  std::vector<std::vector<size_t>> expected(num_queries);
+  libcf::time_function([&]() {
+    for (size_t qid = 0; qid < num_queries; ++qid) {
+      expected[qid] = exact_index.search(queries.row(qid).transpose(), topk, excluded);
+    }
+  }, "Exact MIPS search");
+
+  // recall@k rises with ef_search
+  double prev_recall = 0.;
+  for (size_t ef_search : {10, 50, 200}) {
+    index.set_ef_search(ef_search);
+    size_t hits = 0;
+    libcf::time_function([&]() {
+      for (size_t qid = 0; qid < num_queries; ++qid) {
+        auto rets = index.search(queries.row(qid).transpose(), topk, excluded);
+        ASSERT_EQ(rets.size(), topk);
+        std::unordered_set<size_t> truth(expected[qid].begin(), expected[qid].end());
+        for (auto& iid : rets) {
+          EXPECT_FALSE(excluded.test(iid));
+          hits += truth.count(iid);
+        }
+      }
+    }, "HNSW search");
+    double recall = static_cast<double>(hits) / (num_queries * topk);
+    LOG(INFO) << "HNSW ef_search " << ef_search << " recall@" << topk << " " << recall;
+    EXPECT_GE(recall + 0.02, prev_recall);
+    prev_recall = recall;
+  }
+  EXPECT_GT(prev_recall, 0.95);
+}
+
+TEST(hnsw, test_hnsw_save_load) {
+  using namespace libcf;
+  size_t num_items = 2000;
+  size_t num_dim = 8;
+  DMatrix items = DMatrix::Random(num_items, num_dim);
+  DVector bias = DVector::Random(num_items);
+
+  HNSWIndex index;
+  index.build(items, bias);
+  index.save("/tmp/libcf_hnsw_test.bin");
+
+  HNSWIndex loaded;
+  loaded.load("/tmp/libcf_hnsw_test.bin");
+  EXPECT_EQ(loaded.size(), num_items);
+  EXPECT_EQ(loaded.config().M, index.config().M);
+
+  DenseBitset excluded(num_items);
+  for (size_t qid = 0; qid < 10; ++qid) {
+    DVector q = DVector::Random(num_dim);
+    EXPECT_EQ(index.search(q, 10, excluded), loaded.search(q, 10, excluded));
+  }
+}
@@ -2,7 +2,12 @@
 #include <numeric>
 #include <algorithm>
 
+#include <base/data.hpp>
+#include <base/utils.hpp>
 #include <model/loss.hpp>
+#include <model/recsys/imf.hpp>
+#include <model/recsys/pmf.hpp>
+#include <model/recsys/bpr.hpp>
 
 #include "gtest/gtest.h"
 
@@ -12,7 +17,37 @@ TEST(loss, test_gradient) {
 
 }
 
-
-
-
-
+TEST(loss, test_data_loss) {
+  using namespace libcf;
+  std::string sample_data("./test_data/sample_movielens_data.txt");
+
+  auto line_parser = [&](const std::string& line) {
+    auto rets = split_line(line, ": ");
+    CHECK_EQ(rets.size(), 4);
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  };
+
+  Data data;
+  data.load(sample_data, RECSYS, line_parser);
+  size_t num_users = data.feature_group_total_dimension(0);
+
+  IMFConfig imf_config;
+  imf_config.retrieval = BRUTE_FORCE;
+  PMFConfig pmf_config;
+  BPRConfig bpr_config;
+  bpr_config.retrieval = BRUTE_FORCE;
+  IMF imf(imf_config);
+  PMF pmf(pmf_config);
+  BPR bpr(bpr_config);
+  std::vector<RecsysModelBase*> models{&imf, &pmf, &bpr};
+  for (auto model : models) {
+    model->reset(data);
+    model->train_one_iteration(data);
+    double full = model->data_loss(data);
+    EXPECT_GT(full, 0.);
+    // reproducible, and the sampled loss estimates it
+    EXPECT_EQ(model->data_loss(data), full);
+    EXPECT_NEAR(model->data_loss(data, num_users), full, 1e-9 * full);
+    EXPECT_NEAR(model->data_loss(data, num_users / 2), full, 0.5 * full);
+  }
+}
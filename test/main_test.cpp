@@ -8,6 +8,23 @@
 #include "model_test.hpp"
 #include "loss_test.hpp"
 #include "heap_test.hpp"
+#include "topk_test.hpp"
+#include "bitset_test.hpp"
+#include "mips_test.hpp"
+#include "hnsw_test.hpp"
+#include "quantize_test.hpp"
+#include "batch_topk_test.hpp"
+#include "cdae_test.hpp"
+#include "online_test.hpp"
+#include "checkpoint_test.hpp"
+#include "server_test.hpp"
+#include "synthetic_test.hpp"
+#include "profiler_test.hpp"
+#include "trace_test.hpp"
+#include "memory_test.hpp"
+#include "sweep_test.hpp"
+#include "strata_test.hpp"
+#include "als_test.hpp"
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
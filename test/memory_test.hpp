@@ -0,0 +1,91 @@
+#include <malloc.h>
+#include <unordered_map>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/memory.hpp>
+#include <base/synthetic.hpp>
+#include <model/recsys/imf.hpp>
+#include <model/recsys/cdae.hpp>
+
+TEST(memory, test_accounting_against_malloc) {
+  using namespace libcf;
+  EXPECT_EQ(heap_bytes(0), 0);
+  EXPECT_EQ(heap_bytes(1), 32);
+  EXPECT_EQ(heap_bytes(24), 32);
+  EXPECT_EQ(heap_bytes(100), 112);
+
+  // the shape of user_rated_items_
+  size_t before = mallinfo2().uordblks;
+  {
+    std::unordered_map<size_t, std::unordered_map<size_t, double>> history;
+    for (size_t uid = 0; uid < 2000; ++uid) {
+      auto& item_map = history[uid];
+      for (size_t idx = 0; idx < 1 + uid % 50; ++idx) {
+        item_map[idx * 7 + uid] = 1.;
+      }
+    }
+    size_t allocated = mallinfo2().uordblks - before;
+    size_t accounted = owned_bytes(history);
+    EXPECT_NEAR(static_cast<double>(accounted) / allocated, 1., 0.05);
+
+    DMatrix m(300, 20);
+    EXPECT_EQ(memory_bytes(m), heap_bytes(300 * 20 * sizeof(double)));
+  }
+
+  MemoryReport report;
+  report.add("a", 10).add("b", 20).add("a", 5);
+  EXPECT_EQ(report.entries().size(), 2);
+  EXPECT_EQ(report.bytes("a"), 15);
+  EXPECT_EQ(report.total(), 35);
+  EXPECT_EQ(format_bytes(512), "512 B");
+  EXPECT_EQ(format_bytes(3 * 1024 * 1024 / 2), "1.5 MB");
+  EXPECT_GT(peak_rss_bytes(), 0);
+  EXPECT_GT(current_rss_bytes(), 0);
+  EXPECT_GE(peak_rss_bytes(), current_rss_bytes() / 2);
+}
+
+TEST(memory, test_projection_against_accounting) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 2000;
+  synthetic_config.num_items = 3000;
+  synthetic_config.num_interactions = 40000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  size_t num_users = data.feature_group_total_dimension(0);
+  size_t num_items = data.feature_group_total_dimension(1);
+
+  auto actual = data.memory_usage();
+  auto projected = Data::projected_memory(data.size(), num_users, num_items);
+  EXPECT_NEAR(static_cast<double>(projected.bytes("data.instances")) / actual.bytes("data.instances"), 1., 0.2);
+  EXPECT_NEAR(static_cast<double>(projected.bytes("data.dictionaries")) / actual.bytes("data.dictionaries"), 1., 0.2);
+
+  {
+    IMFConfig config;
+    config.num_dim = 16;
+    IMF model(config);
+    model.reset(data);
+    MemoryReport report;
+    model.memory_usage(report);
+    auto projected = IMF::projected_memory(config, num_users, num_items, data.size());
+    EXPECT_EQ(report.bytes("model.matrices"), projected.bytes("model.matrices"));
+    EXPECT_EQ(report.bytes("model.adagrad"), projected.bytes("model.adagrad"));
+    EXPECT_NEAR(static_cast<double>(projected.bytes("model.user_rated_items"))
+                / report.bytes("model.user_rated_items"), 1., 0.2);
+  }
+  {
+    CDAEConfig config;
+    config.num_dim = 16;
+    config.asymmetric = true;
+    CDAE model(config);
+    model.reset(data);
+    MemoryReport report;
+    model.memory_usage(report);
+    auto projected = CDAE::projected_memory(config, num_users, num_items, data.size());
+    EXPECT_EQ(report.bytes("model.matrices"), projected.bytes("model.matrices"));
+    EXPECT_EQ(report.bytes("model.adagrad"), projected.bytes("model.adagrad"));
+    EXPECT_EQ(report.bytes("model.hidden_cache"), 0);
+  }
+}
@@ -0,0 +1,49 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+
+#include <base/mat.hpp>
+#include <base/topk.hpp>
+#include <base/bitset.hpp>
+#include <base/utils.hpp>
+#include <model/recsys/mips.hpp>
+
+#include "gtest/gtest.h"
+
+TEST(mips, test_mips_against_brute_force) {
+  using namespace libcf;
+  size_t num_items = 20000;
+  size_t num_dim = 16;
+  size_t topk = 10;
+
+  // item norms spread over two orders of magnitude
+  DMatrix items = DMatrix::Random(num_items, num_dim);
+  for (size_t iid = 0; iid < num_items; ++iid) {
+    items.row(iid) *= std::pow(10., -2. * iid / num_items);
+  }
+  DVector bias = DVector::Random(num_items) * 0.1;
+
+  MIPSIndex index(32);
+  index.build(items, bias);
+  EXPECT_EQ(index.size(), num_items);
+
+  DenseBitset excluded(num_items);
+  excluded.set(0);
+  excluded.set(1);
+
+  for (size_t qid = 0; qid < 20; ++qid) {
+    DVector q = DVector::Random(num_dim);
+    DVector scores = items * q + bias;
+    TopK<double> brute_force(topk);
+    for (size_t iid = 0; iid < num_items; ++iid) {
+      if (excluded.test(iid)) continue;
+      brute_force.push(iid, scores(iid));
+    }
+    auto expected = brute_force.get_sorted_ids();
+    auto rets = index.search(q, topk, excluded);
+    ASSERT_EQ(rets.size(), topk);
+    for (size_t idx = 0; idx < topk; ++idx) {
+      EXPECT_NEAR(scores(rets[idx]), scores(expected[idx]), 1e-12);
+    }
+  }
+}
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <unordered_set>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/utils.hpp>
+#include <base/bitset.hpp>
+#include <model/recsys/mips.hpp>
+#include <model/recsys/hnsw.hpp>
+#include <model/recsys/quantized.hpp>
+#include <model/recsys/imf.hpp>
+#include <solver/solver.hpp>
+#include <solver/online.hpp>
+
+TEST(online, test_index_updates) {
+  using namespace libcf;
+  size_t num_items = 5000;
+  size_t num_new = 50;
+  size_t num_dim = 16;
+  size_t topk = 10;
+
+  DMatrix items = DMatrix::Random(num_items, num_dim);
+  DVector bias = DVector::Random(num_items) * 0.1;
+  MIPSIndex mips_index;
+  mips_index.build(items, bias);
+  QuantizedIndex quant_index;
+  quant_index.build(items, bias);
+  HNSWIndex hnsw_index;
+  hnsw_index.build(items, bias);
+
+  // drift some items as a training pass would, and append new ones
+  std::vector<size_t> changed;
+  for (size_t iid = 0; iid < num_items; iid += 97) {
+    items.row(iid) += DRowVector::Random(num_dim) * 0.1;
+    changed.push_back(iid);
+  }
+  grow_rows(items, num_items + num_new, 0.);
+  grow_rows(bias, num_items + num_new, 0.);
+  items.bottomRows(num_new) = DMatrix::Random(num_new, num_dim);
+  bias.tail(num_new) = DVector::Random(num_new) * 0.1;
+
+  mips_index.update(items, bias, changed);
+  EXPECT_EQ(mips_index.size(), num_items + num_new);
+  EXPECT_EQ(mips_index.num_updated(), changed.size() + num_new);
+  EXPECT_LT(mips_index.num_updated(), (num_items + num_new) / 5);
+  quant_index.update(items, bias, changed);
+  EXPECT_EQ(quant_index.size(), num_items + num_new);
+  hnsw_index.update(items, bias, changed);
+  EXPECT_EQ(hnsw_index.size(), num_items + num_new);
+
+  MIPSIndex fresh_mips;
+  fresh_mips.build(items, bias);
+  QuantizedIndex fresh_quant;
+  fresh_quant.build(items, bias);
+
+  DenseBitset excluded(num_items + num_new);
+  excluded.set(changed[1]);
+  excluded.set(num_items);
+  size_t hits = 0;
+  size_t num_queries = 100;
+  for (size_t qid = 0; qid < num_queries; ++qid) {
+    DVector q = DVector::Random(num_dim);
+    auto expected = fresh_mips.search(q, topk, excluded);
+    EXPECT_EQ(mips_index.search(q, topk, excluded), expected);
+    EXPECT_EQ(quant_index.search(q, topk, excluded), fresh_quant.search(q, topk, excluded));
+    std::unordered_set<size_t> truth(expected.begin(), expected.end());
+    for (auto& iid : hnsw_index.search(q, topk, excluded)) {
+      EXPECT_FALSE(excluded.test(iid));
+      hits += truth.count(iid);
+    }
+  }
+  double recall = static_cast<double>(hits) / (num_queries * topk);
+  LOG(INFO) << "HNSW recall@" << topk << " after update " << recall;
+  EXPECT_GT(recall, 0.9);
+
+  // past max_update_ratio the index is rebuilt
+  std::vector<size_t> all_items(items.rows());
+  std::iota(all_items.begin(), all_items.end(), 0);
+  mips_index.update(items, bias, all_items);
+  EXPECT_EQ(mips_index.num_updated(), 0);
+}
+
+TEST(online, test_online_trainer) {
+  using namespace libcf;
+  std::string sample_data("./test_data/sample_movielens_data.txt");
+
+  auto line_parser = [&](const std::string& line) {
+    auto rets = split_line(line, ": ");
+    CHECK_EQ(rets.size(), 4);
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  };
+
+  Data data;
+  data.load(sample_data, RECSYS, line_parser);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  IMFConfig config;
+  config.num_dim = 20;
+  IMF imf_model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 5;
+  Solver<IMF> solver(imf_model, solver_config);
+  solver.train(train, test, {TOPN});
+  auto model = solver.get_model();
+  model->pre_recommend();
+
+  size_t num_users = train.feature_group_total_dimension(0);
+  size_t num_items = train.feature_group_total_dimension(1);
+
+  // a new user, a new item and more items for user "1"
+  std::string events_file("/tmp/libcf_online_events.txt");
+  {
+    File f(events_file, "w");
+    for (auto& item : {"122", "185", "231", "292", "316"}) {
+      for (auto& user : {"1", "2", "new_user"}) {
+        f.write_line(std::string(user) + "::" + item + "::5::0");
+      }
+    }
+    f.write_line("new_user::new_item::5::0");
+  }
+  OnlineConfig online_config;
+  online_config.batch_size = 16;
+  online_config.num_passes = 2;
+  OnlineTrainer<IMF> trainer(*model, train, online_config);
+  EXPECT_EQ(trainer.consume(events_file, line_parser), 16);
+
+  EXPECT_EQ(train.feature_group_total_dimension(0), num_users + 1);
+  EXPECT_EQ(train.feature_group_total_dimension(1), num_items + 1);
+  EXPECT_EQ(train.total_dimensions(), num_users + num_items + 2);
+  EXPECT_EQ(train.feature_group_start_idx(1), num_users + 1);
+  EXPECT_EQ(model->num_users(), num_users + 1);
+  EXPECT_EQ(model->num_items(), num_items + 1);
+
+  // the patched index still returns the exact top-k
+  auto rated = train.get_feature_pair_label_hashtable(0, 1);
+  auto& users = train.get_data_info()->feature_group_infos_[0];
+  size_t new_uid = users.get_index("new_user", false);
+  EXPECT_EQ(new_uid, num_users);
+  auto& items = train.get_data_info()->feature_group_infos_[1];
+  for (size_t uid : {size_t(0), size_t(1), new_uid}) {
+    std::unordered_map<size_t, double> rated_items = rated[uid];
+    for (auto& item : {"122", "185", "231", "292", "316"}) {
+      rated_items[items.get_index(item, false)] = 1.;
+    }
+    auto rets = model->recommend(uid, 10, rated_items);
+    EXPECT_EQ(rets, model->RecsysModelBase::recommend(uid, 10, rated_items));
+    for (auto& iid : rets) {
+      EXPECT_FALSE(rated_items.count(iid));
+    }
+  }
+}
+
+TEST(online, test_reserve_rows) {
+  using namespace libcf;
+  DMatrix m = DMatrix::Ones(4, 3);
+  size_t num_grows = 0;
+  for (size_t rows = 5; rows <= 1000; ++rows) {
+    size_t capacity = m.rows();
+    reserve_rows(m, rows, 0.);
+    EXPECT_GE(static_cast<size_t>(m.rows()), rows);
+    if (static_cast<size_t>(m.rows()) != capacity) ++num_grows;
+  }
+  // geometric growth: O(log) reallocations rather than one per row
+  EXPECT_LE(num_grows, 20);
+  EXPECT_TRUE(m.topRows(4).isOnes());
+  EXPECT_TRUE(m.bottomRows(m.rows() - 4).isZero());
+}
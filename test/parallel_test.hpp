@@ -3,6 +3,7 @@
 #include <numeric>
 #include <cstdlib>
 #include <ctime>
+#include <set>
 
 #include "gtest/gtest.h"
 #include "glog/logging.h"
@@ -98,6 +99,32 @@ TEST(test_parallel, lambda) {
 
 }
 
+TEST(test_parallel, worker_random_streams) {
+  using namespace libcf;
+  size_t num_threads = 4;
+  int saved_threads = FLAGS_num_thread;
+  FLAGS_num_thread = num_threads;
+  auto draw = [&]() {
+    std::vector<uint64_t> draws(num_threads);
+    in_parallel([&](size_t thread_id, size_t) {
+      draws[thread_id] = Random::rng();
+    });
+    return draws;
+  };
+  Random::seed(17);
+  auto first = draw();
+  auto second = draw();
+  Random::seed(17);
+  auto again = draw();
+  FLAGS_num_thread = saved_threads;
+  // workers draw distinct streams, reproducible from the seed and new
+  // for every parallel call
+  std::set<uint64_t> distinct(first.begin(), first.end());
+  EXPECT_EQ(distinct.size(), num_threads);
+  EXPECT_TRUE(first == again);
+  EXPECT_FALSE(first == second);
+}
+
 TEST(test_parallel, test_thread_pool) {  
 
   std::vector<size_t> vec(100, 0);
@@ -182,3 +209,59 @@ TEST(test_parallel, test_more_thread_pool) {
   }
 }
 
+
+#include <base/parallel/epoch.hpp>
+
+TEST(test_parallel, epoch_ptr) {
+  // every value read must still be alive, every retired value is freed
+  struct Value {
+    explicit Value(size_t v, std::atomic<int>& alive) : v(v), alive(alive) { ++alive; }
+    ~Value() { v = 0; --alive; }
+    size_t v;
+    std::atomic<int>& alive;
+  };
+  std::atomic<int> alive(0);
+  {
+    libcf::EpochPtr<Value> handle(std::unique_ptr<Value>(new Value(1, alive)), 8);
+    std::atomic<bool> done(false);
+    std::atomic<size_t> num_reads(0);
+    std::vector<std::thread> readers;
+    for (size_t tid = 0; tid < 4; ++tid) {
+      readers.emplace_back([&]() {
+        size_t last = 0;
+        while (!done) {
+          auto value = handle.read();
+          size_t v = value->v;
+          EXPECT_GT(v, 0);
+          EXPECT_GE(v, last);  // never goes back to a retired value
+          last = v;
+          std::this_thread::yield();
+          EXPECT_EQ(value->v, v);
+          ++num_reads;
+        }
+      });
+    }
+    for (size_t v = 2; v <= 200; ++v) {
+      // let the readers in before every swap
+      size_t reads = num_reads;
+      while (num_reads == reads) {
+        std::this_thread::yield();
+      }
+      handle.reset(std::unique_ptr<Value>(new Value(v, alive)));
+      if (v % 10 == 0) {
+        handle.synchronize();
+        EXPECT_EQ(alive, 1);
+      }
+    }
+    done = true;
+    for (auto& t : readers) {
+      t.join();
+    }
+    EXPECT_EQ(handle.reclaim(), 0);
+    EXPECT_EQ(alive, 1);
+    EXPECT_EQ(handle.read()->v, 200);
+    EXPECT_GE(num_reads, 199);
+    LOG(INFO) << num_reads << " reads during 199 swaps";
+  }
+  EXPECT_EQ(alive, 0);
+}
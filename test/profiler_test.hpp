@@ -0,0 +1,84 @@
+#include <cstdio>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/io/file.hpp>
+#include <base/profiler.hpp>
+#include <base/synthetic.hpp>
+#include <model/recsys/imf.hpp>
+#include <model/recsys/pmf.hpp>
+#include <solver/solver.hpp>
+
+TEST(profiler, test_phase_profile) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 200;
+  synthetic_config.num_items = 500;
+  synthetic_config.num_interactions = 5000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  std::string filename("/tmp/libcf_profiler_test.json");
+  std::remove(filename.c_str());
+
+  IMFConfig config;
+  IMF imf_model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 3;
+  solver_config.profile_file = filename;
+  solver_config.profile_label = "imf";
+  Solver<IMF> solver(imf_model, solver_config);
+  solver.train(train, test, {TOPN});
+
+  // epoch 0 is data preparation and the first evaluation
+  auto& epochs = solver.profiler().epochs();
+  ASSERT_EQ(epochs.size(), 4);
+  EXPECT_GT(epochs[0].phase_secs[PHASE_DATA_PREP], 0.);
+  EXPECT_GT(epochs[0].phase_secs[PHASE_EVALUATION], 0.);
+  EXPECT_EQ(epochs[0].updates, 0);
+  for (size_t it = 1; it < epochs.size(); ++it) {
+    auto& epoch = epochs[it];
+    EXPECT_EQ(epoch.iteration, it);
+    EXPECT_EQ(epoch.phase_secs[PHASE_DATA_PREP], 0.);
+    EXPECT_GT(epoch.phase_secs[PHASE_SAMPLING], 0.);
+    EXPECT_GT(epoch.phase_secs[PHASE_FORWARD], 0.);
+    EXPECT_GT(epoch.phase_secs[PHASE_UPDATE], 0.);
+    EXPECT_GT(epoch.phase_secs[PHASE_LOSS], 0.);
+    EXPECT_EQ(epoch.interactions, train.size());
+    EXPECT_EQ(epoch.updates, train.size() * (1 + config.num_neg));
+    EXPECT_GT(epoch.rate(epoch.updates), 0.);
+  }
+  auto total = solver.profiler().total();
+  EXPECT_EQ(total.interactions, 3 * train.size());
+
+  // one JSON line per epoch
+  File f(filename, "r");
+  std::string line;
+  size_t num_lines = 0;
+  while (f.read_line(line)) {
+    EXPECT_NE(line.find("\"label\":\"imf\""), std::string::npos);
+    EXPECT_NE(line.find("\"updates_per_sec\""), std::string::npos);
+    ++num_lines;
+  }
+  EXPECT_EQ(num_lines, epochs.size());
+
+  // parallel SGD counts the updates of every block
+  PMFConfig pmf_config;
+  pmf_config.num_strata = 2;
+  PMF pmf_model(pmf_config);
+  solver_config.max_iteration = 1;
+  solver_config.profile_file = "";
+  solver_config.profile = true;
+  Solver<PMF> pmf_solver(pmf_model, solver_config);
+  pmf_solver.train(train, test, {RMSE});
+  ASSERT_EQ(pmf_solver.profiler().epochs().size(), 2);
+  EXPECT_EQ(pmf_solver.profiler().epochs()[1].updates, train.size());
+
+  // without profiling nothing is recorded
+  Solver<IMF> plain(imf_model, 1);
+  plain.train(train);
+  EXPECT_TRUE(plain.profiler().epochs().empty());
+}
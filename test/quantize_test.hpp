@@ -0,0 +1,119 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <unordered_set>
+
+#include <base/mat.hpp>
+#include <base/bitset.hpp>
+#include <base/utils.hpp>
+#include <base/quantize.hpp>
+#include <model/recsys/mips.hpp>
+#include <model/recsys/quantized.hpp>
+
+#include "gtest/gtest.h"
+
+TEST(quantize, test_quantize_kernels) {
+  using namespace libcf;
+  for (size_t n : {1, 15, 16, 33, 64, 100}) {
+    std::vector<int8_t> a(n), b(n);
+    int32_t expected = 0;
+    for (size_t idx = 0; idx < n; ++idx) {
+      a[idx] = static_cast<int8_t>(rand() % 255 - 127);
+      b[idx] = static_cast<int8_t>(rand() % 255 - 127);
+      expected += a[idx] * b[idx];
+    }
+    EXPECT_EQ(dot_int8(a.data(), b.data(), n), expected);
+
+    std::vector<uint16_t> h(n);
+    std::vector<float> f(n);
+    double fp_expected = 0.;
+    for (size_t idx = 0; idx < n; ++idx) {
+      float x = static_cast<float>(Random::uniform() * 2. - 1.);
+      h[idx] = float_to_half(x);
+      f[idx] = static_cast<float>(Random::uniform());
+      EXPECT_NEAR(half_to_float(h[idx]), x, 1e-3);
+      fp_expected += half_to_float(h[idx]) * f[idx];
+    }
+    EXPECT_NEAR(dot_fp16(h.data(), f.data(), n), fp_expected, 1e-4);
+  }
+
+  EXPECT_EQ(half_to_float(float_to_half(1.f)), 1.f);
+  EXPECT_EQ(half_to_float(float_to_half(-2.5f)), -2.5f);
+  EXPECT_EQ(half_to_float(float_to_half(0.f)), 0.f);
+  EXPECT_EQ(half_to_float(float_to_half(65504.f)), 65504.f);
+
+  std::vector<double> x{0.5, -1., 0.25};
+  std::vector<int8_t> q(3);
+  float scale = quantize_int8(x.data(), x.size(), q.data());
+  EXPECT_NEAR(scale, 1. / 127., 1e-7);
+  EXPECT_EQ(q[1], -127);
+  EXPECT_EQ(q[0], 64);
+}
+
+TEST(quantize, test_quantized_recall_against_exact) {
+  using namespace libcf;
+  size_t num_items = 50000;
+  size_t num_dim = 32;
+  size_t num_queries = 100;
+  size_t topk = 10;
+
+  DMatrix items = DMatrix::Random(num_items, num_dim);
+  DVector bias = DVector::Random(num_items) * 0.1;
+  DMatrix queries = DMatrix::Random(num_queries, num_dim);
+
+  DenseBitset excluded(num_items);
+  excluded.set(0);
+  excluded.set(1);
+
+  std::vector<std::vector<size_t>> expected(num_queries);
+  libcf::time_function([&]() {
+    DVector scores;
+    for (size_t qid = 0; qid < num_queries; ++qid) {
+      scores.noalias() = items * queries.row(qid).transpose();
+      scores += bias;
+      TopK<double> topk_items(topk);
+      for (size_t iid = 0; iid < num_items; ++iid) {
+        if (excluded.test(iid)) continue;
+        topk_items.push(iid, scores(iid));
+      }
+      expected[qid] = topk_items.get_sorted_ids();
+    }
+  }, "Double precision scan");
+
+  for (auto type : {QUANT_INT8, QUANT_FP16}) {
+    for (size_t rerank_size : {0, 100}) {
+      QuantizedConfig cfg;
+      cfg.type = type;
+      cfg.rerank_size = rerank_size;
+      QuantizedIndex index(cfg);
+      index.build(items, bias);
+      EXPECT_EQ(index.size(), num_items);
+      // item data read per query against num_items * num_dim doubles
+      double traffic_ratio = static_cast<double>(num_items * num_dim * sizeof(double))
+          / index.memory_bytes();
+      EXPECT_GT(traffic_ratio, type == QUANT_INT8 ? 5. : 3.);
+
+      size_t hits = 0;
+      libcf::time_function([&]() {
+        for (size_t qid = 0; qid < num_queries; ++qid) {
+          auto rets = index.search(queries.row(qid).transpose(), topk, excluded, items, bias);
+          ASSERT_EQ(rets.size(), topk);
+          std::unordered_set<size_t> truth(expected[qid].begin(), expected[qid].end());
+          for (auto& iid : rets) {
+            EXPECT_FALSE(excluded.test(iid));
+            hits += truth.count(iid);
+          }
+        }
+      }, type == QUANT_INT8 ? "int8 scan" : "fp16 scan");
+      double recall = static_cast<double>(hits) / (num_queries * topk);
+      LOG(INFO) << (type == QUANT_INT8 ? "int8" : "fp16")
+          << " rerank " << rerank_size << " recall@" << topk << " " << recall
+          << " traffic reduction " << traffic_ratio << "x";
+      if (rerank_size > 0) {
+        EXPECT_GT(recall, 0.99);
+      } else {
+        EXPECT_GT(recall, type == QUANT_INT8 ? 0.8 : 0.95);
+      }
+    }
+  }
+}
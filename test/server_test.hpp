@@ -0,0 +1,401 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/utils.hpp>
+#include <base/json.hpp>
+#include <base/latency.hpp>
+#include <base/random.hpp>
+#include <model/recsys/imf.hpp>
+#include <solver/solver.hpp>
+#include <serving/server.hpp>
+#include <serving/load_generator.hpp>
+
+TEST(server, test_latency_histogram) {
+  using namespace libcf;
+  LatencyHistogram hist;
+  EXPECT_EQ(hist.percentile(50.), 0);
+  for (uint64_t v = 1; v <= 100000; ++v) {
+    hist.record(v);
+  }
+  EXPECT_EQ(hist.count(), 100000);
+  EXPECT_EQ(hist.min(), 1);
+  EXPECT_EQ(hist.max(), 100000);
+  EXPECT_NEAR(hist.mean(), 50000.5, 1e-6);
+  // within the bucket precision
+  for (double q : {1., 50., 99., 99.9}) {
+    double expected = q * 1000.;
+    EXPECT_GE(hist.percentile(q), expected);
+    EXPECT_LE(hist.percentile(q), expected * (1. + 1. / LatencyHistogram::kSubBuckets));
+  }
+  EXPECT_EQ(hist.percentile(100.), 100000);
+
+  for (uint64_t v : {uint64_t(0), uint64_t(31), uint64_t(32), uint64_t(1) << 40, ~uint64_t(0)}) {
+    size_t idx = LatencyHistogram::bucket(v);
+    EXPECT_LT(idx, size_t(LatencyHistogram::kNumBuckets));
+    EXPECT_GE(LatencyHistogram::upper_bound(idx), v);
+  }
+
+  LatencyHistogram other;
+  other.record(1000000, 10);
+  hist.merge(other);
+  EXPECT_EQ(hist.count(), 100010);
+  EXPECT_EQ(hist.max(), 1000000);
+}
+
+TEST(server, test_recommend_server) {
+  using namespace libcf;
+  std::string sample_data("./test_data/sample_movielens_data.txt");
+
+  auto line_parser = [&](const std::string& line) {
+    auto rets = split_line(line, ": ");
+    CHECK_EQ(rets.size(), 4);
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  };
+
+  Data data;
+  data.load(sample_data, RECSYS, line_parser);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  IMFConfig config;
+  config.num_dim = 20;
+  IMF imf_model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 2;
+  Solver<IMF> solver(imf_model, solver_config);
+  solver.train(train, test, {TOPN});
+  auto model = solver.get_model();
+  model->pre_recommend();
+
+  std::string filename("/tmp/libcf_server_test.ckpt");
+  model->save_checkpoint(filename);
+  ModelHandle handle(std::unique_ptr<ModelVersion>(new ModelVersion(filename, ModelLoadConfig())));
+  Checkpoint ckpt(filename);
+  MappedDictionary users(ckpt, "users");
+  CSRIndex exclusions = model->history_index();
+
+  size_t num_users = model->num_users();
+  size_t topk = 5;
+  std::vector<size_t> uids(num_users);
+  std::iota(uids.begin(), uids.end(), 0);
+  std::vector<size_t> expected(num_users * topk);
+  model->recommend_batch(uids.data(), num_users, topk, exclusions, expected.data());
+
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ServerConfig server_config;
+  server_config.batch_window_us = 1000;
+  server_config.stats_interval = 0.;
+  RecommendServer server(handle, server_config);
+  std::thread server_thread([&]() { server.serve(fds[1], fds[1]); });
+
+  // pipeline every user twice and one unknown user
+  size_t num_requests = 0;
+  for (size_t round = 0; round < 2; ++round) {
+    for (size_t uid = 0; uid < num_users; ++uid) {
+      EXPECT_TRUE(write_request(fds[0], num_requests++, topk, users.raw_str(uid)));
+    }
+  }
+  EXPECT_TRUE(write_request(fds[0], num_requests++, topk, "unknown_user"));
+
+  // swap in a reloaded model while requests are queued, none is dropped
+  std::thread reloader([&]() { reload_model(handle, filename, ModelLoadConfig()); });
+  std::this_thread::sleep_for(std::chrono::microseconds(300));
+  size_t num_before = num_requests;
+  for (size_t uid = 0; uid < num_users; ++uid) {
+    EXPECT_TRUE(write_request(fds[0], num_requests++, topk, std::to_string(uid + 1)));
+  }
+  reloader.join();
+
+  FdReader reader(fds[0]);
+  ResponseHeader header;
+  std::vector<uint32_t> items;
+  for (size_t idx = 0; idx < num_requests; ++idx) {
+    ASSERT_TRUE(read_response(reader, header, items));
+    ASSERT_LT(header.request_id, num_requests);
+    if (header.request_id == num_before - 1) {
+      EXPECT_EQ(header.status, RESPONSE_UNKNOWN_USER);
+      EXPECT_EQ(header.num_items, 0);
+      continue;
+    }
+    EXPECT_EQ(header.status, RESPONSE_OK);
+    size_t uid = header.request_id < num_before ? header.request_id % num_users
+        : users.find(std::to_string(header.request_id - num_before + 1));
+    for (size_t pos = 0; pos < topk; ++pos) {
+      if (pos < items.size()) {
+        EXPECT_EQ(items[pos], expected[uid * topk + pos]);
+      } else {
+        EXPECT_EQ(expected[uid * topk + pos], kNoItem);
+      }
+    }
+  }
+
+  ::shutdown(fds[0], SHUT_WR);
+  server_thread.join();
+  server.stop();
+  EXPECT_EQ(handle.epoch(), 2);
+  EXPECT_EQ(server.num_requests(), num_requests);
+  EXPECT_LT(server.num_batches(), num_requests);
+  EXPECT_EQ(server.latency().count(), num_requests);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST(server, test_topk_and_connections) {
+  using namespace libcf;
+  std::string sample_data("./test_data/sample_movielens_data.txt");
+  auto line_parser = [&](const std::string& line) {
+    auto rets = split_line(line, ": ");
+    CHECK_EQ(rets.size(), 4);
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  };
+  Data data;
+  data.load(sample_data, RECSYS, line_parser);
+
+  IMFConfig config;
+  config.num_dim = 10;
+  IMF imf_model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 1;
+  Solver<IMF> solver(imf_model, solver_config);
+  solver.train(data, Data(), {});
+  auto model = solver.get_model();
+  std::string filename("/tmp/libcf_server_topk_test.ckpt");
+  model->save_checkpoint(filename);
+  ModelHandle handle(std::unique_ptr<ModelVersion>(new ModelVersion(filename, ModelLoadConfig())));
+  Checkpoint ckpt(filename);
+  MappedDictionary users(ckpt, "users");
+  CSRIndex exclusions = model->history_index();
+  size_t num_items = model->num_items();
+
+  ServerConfig server_config;
+  server_config.max_topk = UINT16_MAX;
+  server_config.batch_window_us = 1000;
+  server_config.stats_interval = 0.;
+  RecommendServer server(handle, server_config);
+
+  // a topk past the items left in the same batch as a small one: each
+  // reply is trimmed to its own topk and the server keeps running
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  std::thread server_thread([&]() { server.serve(fds[1], fds[1]); });
+  EXPECT_TRUE(write_request(fds[0], 0, UINT16_MAX, users.raw_str(0)));
+  EXPECT_TRUE(write_request(fds[0], 1, 5, users.raw_str(1)));
+  FdReader reader(fds[0]);
+  ResponseHeader header;
+  std::vector<uint32_t> items;
+  for (size_t idx = 0; idx < 2; ++idx) {
+    ASSERT_TRUE(read_response(reader, header, items));
+    EXPECT_EQ(header.status, RESPONSE_OK);
+    size_t uid = header.request_id;
+    size_t expected = uid == 0 ? num_items - exclusions.row_size(0) : 5;
+    EXPECT_EQ(items.size(), expected);
+    std::sort(items.begin(), items.end());
+    EXPECT_EQ(std::unique(items.begin(), items.end()), items.end());
+    for (auto& iid : items) {
+      EXPECT_FALSE(std::binary_search(exclusions.row(uid).begin(), exclusions.row(uid).end(), iid));
+    }
+  }
+  ::shutdown(fds[0], SHUT_WR);
+  server_thread.join();
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  // closed connections give their fds back while the server runs
+  auto count_fds = []() {
+    size_t rets = 0;
+    DIR* dir = ::opendir("/proc/self/fd");
+    while (::readdir(dir)) ++rets;
+    ::closedir(dir);
+    return rets;
+  };
+  std::string path("/tmp/libcf_server_test.sock");
+  std::thread socket_thread([&]() { server.serve_unix_socket(path); });
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size());
+  size_t baseline = 0;
+  for (size_t idx = 0; idx < 20; ++idx) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    while (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_TRUE(write_request(fd, idx, 5, users.raw_str(idx % users.size())));
+    FdReader client(fd);
+    ASSERT_TRUE(read_response(client, header, items));
+    EXPECT_EQ(header.request_id, idx);
+    ::close(fd);
+    if (idx == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      baseline = count_fds();
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  EXPECT_EQ(count_fds(), baseline);
+  server.request_stop();
+  socket_thread.join();
+  server.stop();
+  EXPECT_EQ(server.num_requests(), 22);
+}
+
+TEST(server, test_reload_corrupt_model) {
+  using namespace libcf;
+  std::string sample_data("./test_data/sample_movielens_data.txt");
+  auto line_parser = [&](const std::string& line) {
+    auto rets = split_line(line, ": ");
+    CHECK_EQ(rets.size(), 4);
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  };
+  Data data;
+  data.load(sample_data, RECSYS, line_parser);
+
+  IMFConfig config;
+  config.num_dim = 10;
+  IMF imf_model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 1;
+  Solver<IMF> solver(imf_model, solver_config);
+  solver.train(data, Data(), {});
+  auto model = solver.get_model();
+  std::string filename("/tmp/libcf_server_reload_test.ckpt");
+  model->save_checkpoint(filename);
+  ModelHandle handle(std::unique_ptr<ModelVersion>(new ModelVersion(filename, ModelLoadConfig())));
+  Checkpoint ckpt(filename);
+  MappedDictionary users(ckpt, "users");
+
+  std::string error;
+  EXPECT_EQ(ModelVersion::load("/tmp/libcf_no_such_model.ckpt", ModelLoadConfig(), &error), nullptr);
+  EXPECT_FALSE(error.empty());
+
+  std::ifstream in(filename, std::ios::binary);
+  std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::string corrupt("/tmp/libcf_server_reload_corrupt.ckpt");
+  auto write_file = [&](const std::string& bytes) {
+    std::ofstream out(corrupt, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+  };
+  // a half copied file, then a well formed one with a history id past
+  // the items: neither replaces the served model
+  write_file(content.substr(0, content.size() / 2));
+  EXPECT_FALSE(reload_model(handle, corrupt, ModelLoadConfig()));
+  std::string bad_ids = content;
+  uint64_t bad_id = model->num_items();
+  std::memcpy(&bad_ids[ckpt.section("history.ids").offset], &bad_id, sizeof(bad_id));
+  write_file(bad_ids);
+  error.clear();
+  EXPECT_EQ(ModelVersion::load(corrupt, ModelLoadConfig(), &error), nullptr);
+  EXPECT_NE(error.find("Corrupted training histories"), std::string::npos);
+  EXPECT_FALSE(reload_model(handle, corrupt, ModelLoadConfig()));
+  EXPECT_EQ(handle.epoch(), 1);
+
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ServerConfig server_config;
+  server_config.stats_interval = 0.;
+  RecommendServer server(handle, server_config);
+  std::thread server_thread([&]() { server.serve(fds[1], fds[1]); });
+  EXPECT_TRUE(write_request(fds[0], 0, 5, users.raw_str(0)));
+  FdReader reader(fds[0]);
+  ResponseHeader header;
+  std::vector<uint32_t> items;
+  ASSERT_TRUE(read_response(reader, header, items));
+  EXPECT_EQ(header.status, RESPONSE_OK);
+  EXPECT_EQ(items.size(), 5);
+  ::shutdown(fds[0], SHUT_WR);
+  server_thread.join();
+  server.stop();
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  EXPECT_TRUE(reload_model(handle, filename, ModelLoadConfig()));
+  EXPECT_EQ(handle.epoch(), 2);
+}
+
+TEST(server, test_json_writer) {
+  using namespace libcf;
+  JsonWriter json;
+  json.begin_object();
+  json.add("name", std::string("a\"b"));
+  json.add("n", 3);
+  json.add("ok", true);
+  json.begin_array("xs").value(1.5).value(std::nan("")).end_array();
+  json.begin_object("empty").end_object();
+  json.end_object();
+  EXPECT_EQ(json.str(), "{\"name\":\"a\\\"b\",\"n\":3,\"ok\":true,\"xs\":[1.5,null],\"empty\":{}}");
+}
+
+TEST(server, test_load_generator) {
+  using namespace libcf;
+  std::mt19937_64 rng(0);
+  ZipfDistribution zipf(100, 1.);
+  std::vector<size_t> counts(100, 0);
+  for (size_t idx = 0; idx < 100000; ++idx) {
+    size_t k = zipf(rng);
+    ASSERT_LT(k, 100);
+    ++counts[k];
+  }
+  EXPECT_GT(counts[0], counts[1]);
+  EXPECT_GT(counts[1], counts[10]);
+  EXPECT_GT(counts[10], counts[99]);
+
+  std::string sample_data("./test_data/sample_movielens_data.txt");
+  auto line_parser = [&](const std::string& line) {
+    auto rets = split_line(line, ": ");
+    CHECK_EQ(rets.size(), 4);
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  };
+  Data data;
+  data.load(sample_data, RECSYS, line_parser);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  IMFConfig config;
+  config.num_dim = 10;
+  IMF imf_model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 1;
+  Solver<IMF> solver(imf_model, solver_config);
+  solver.train(train, test, {TOPN});
+  auto model = solver.get_model();
+  model->pre_recommend();
+
+  auto rated_items = train.get_feature_pair_label_hashtable(0, 1);
+  std::vector<size_t> stream;
+  for (auto& ins : test) {
+    stream.push_back(ins.get_feature_group_index(0, 0));
+  }
+
+  // closed loop, then Poisson arrivals well below the peak throughput
+  for (double rate : {0., 500.}) {
+    LoadConfig load_config;
+    load_config.num_threads = 2;
+    load_config.arrival_rate = rate;
+    load_config.duration = 0.2;
+    load_config.warmup = 0.05;
+    LoadGenerator generator(*model, rated_items, stream, load_config);
+    auto result = generator.run();
+    EXPECT_GT(result.num_requests, 0);
+    EXPECT_EQ(result.latency.count(), result.num_requests);
+    EXPECT_GT(result.qps(), 0.);
+    if (rate > 0.) {
+      EXPECT_LT(result.qps(), rate * 2.);
+    }
+    JsonWriter json;
+    json.begin_object();
+    result.write_json(json);
+    json.end_object();
+    EXPECT_NE(json.str().find("\"p99\":"), std::string::npos);
+  }
+}
@@ -0,0 +1,154 @@
+#include <cstdlib>
+#include <set>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/synthetic.hpp>
+#include <model/recsys/strata.hpp>
+#include <model/recsys/imf.hpp>
+#include <model/recsys/pmf.hpp>
+#include <model/recsys/bpr.hpp>
+#include <solver/solver.hpp>
+
+TEST(strata, test_schedule) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 300;
+  synthetic_config.num_items = 400;
+  synthetic_config.num_interactions = 6000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  auto& table = *data.interaction_table();
+  size_t num_users = data.feature_group_total_dimension(0);
+  size_t num_items = data.feature_group_total_dimension(1);
+
+  size_t num_strata = 4;
+  StrataSchedule strata;
+  strata.build(table, num_users, num_items, num_strata);
+  EXPECT_EQ(strata.num_strata(), num_strata);
+
+  // every interaction is in one block, and the blocks are about even
+  size_t num_interactions = 0;
+  for (auto& p : table) num_interactions += p.second.size();
+  EXPECT_EQ(strata.num_entries(), num_interactions);
+  std::set<std::pair<size_t, size_t>> seen;
+  std::vector<size_t> user_block(num_users, num_strata), item_block(num_items, num_strata);
+  for (size_t ub = 0; ub < num_strata; ++ub) {
+    for (size_t ib = 0; ib < num_strata; ++ib) {
+      auto& block = strata.block(ub, ib);
+      EXPECT_GT(block.entries.size(), num_interactions / num_strata / num_strata / 2);
+      for (auto& user : block.users) {
+        EXPECT_TRUE(user_block[user.uid] == num_strata || user_block[user.uid] == ub);
+        user_block[user.uid] = ub;
+        for (size_t pos = user.begin; pos < user.end; ++pos) {
+          size_t iid = block.entries[pos].first;
+          EXPECT_TRUE(item_block[iid] == num_strata || item_block[iid] == ib);
+          item_block[iid] = ib;
+          EXPECT_TRUE(table.at(user.uid).count(iid));
+          EXPECT_TRUE(seen.emplace(user.uid, iid).second);
+        }
+      }
+    }
+  }
+  EXPECT_EQ(seen.size(), num_interactions);
+
+  // a sub-epoch covers each user block and item block once, an epoch
+  // covers every block once
+  std::vector<std::pair<size_t, size_t>> runs;
+  std::mutex mut;
+  double loss = strata.run(7, [&](size_t ub, size_t ib, Random::rng_type& block_rng) {
+    std::lock_guard<std::mutex> lock(mut);
+    runs.emplace_back(ub, ib);
+    auto& block = strata.block(ub, ib);
+    for (auto& user : block.users) {
+      if (!strata.has_negative_item(ib, user)) continue;
+      size_t jid = strata.sample_negative_item(ib, *user.rated, block_rng);
+      EXPECT_EQ(item_block[jid], ib);
+      EXPECT_FALSE(user.rated->count(jid));
+    }
+    return 1.;
+  });
+  EXPECT_EQ(loss, num_strata * num_strata);
+  ASSERT_EQ(runs.size(), num_strata * num_strata);
+  std::set<std::pair<size_t, size_t>> distinct(runs.begin(), runs.end());
+  EXPECT_EQ(distinct.size(), runs.size());
+  for (size_t sub = 0; sub < num_strata; ++sub) {
+    std::set<size_t> ubs, ibs;
+    for (size_t idx = sub * num_strata; idx < (sub + 1) * num_strata; ++idx) {
+      ubs.insert(runs[idx].first);
+      ibs.insert(runs[idx].second);
+    }
+    EXPECT_EQ(ubs.size(), num_strata);
+    EXPECT_EQ(ibs.size(), num_strata);
+  }
+}
+
+// trains a model from a fixed seed and returns its user and item vectors
+template <class Model, class Config>
+std::pair<libcf::DMatrix, libcf::DMatrix> train_strata_model(const Config& config,
+                                                             const libcf::Data& train,
+                                                             const libcf::Data& test,
+                                                             size_t num_threads,
+                                                             double* map = nullptr) {
+  using namespace libcf;
+  int saved_threads = FLAGS_num_thread;
+  FLAGS_num_thread = num_threads;
+  std::srand(11);
+  Random::seed(11);
+  Model model(config);
+  SolverConfig solver_config;
+  solver_config.max_iteration = 3;
+  Solver<Model> solver(model, solver_config);
+  if (map) {
+    solver.train(train, test, {TOPN});
+    *map = solver.last_metrics()[7].second;
+  } else {
+    solver.train(train);
+  }
+  FLAGS_num_thread = saved_threads;
+  return std::make_pair(solver.get_model()->get_user_vecs(), solver.get_model()->get_item_vecs());
+}
+
+TEST(strata, test_parallel_sgd) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 300;
+  synthetic_config.num_items = 400;
+  synthetic_config.num_interactions = 6000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  // the same seed gives the same model on 1 and 4 threads
+  IMFConfig imf_config;
+  imf_config.num_strata = 4;
+  auto imf_1 = train_strata_model<IMF>(imf_config, train, test, 1);
+  auto imf_4 = train_strata_model<IMF>(imf_config, train, test, 4);
+  EXPECT_TRUE(imf_1.first == imf_4.first);
+  EXPECT_TRUE(imf_1.second == imf_4.second);
+
+  BPRConfig bpr_config;
+  bpr_config.num_strata = 4;
+  auto bpr_1 = train_strata_model<BPR>(bpr_config, train, test, 1);
+  auto bpr_4 = train_strata_model<BPR>(bpr_config, train, test, 4);
+  EXPECT_TRUE(bpr_1.first == bpr_4.first);
+  EXPECT_TRUE(bpr_1.second == bpr_4.second);
+
+  PMFConfig pmf_config;
+  pmf_config.num_strata = 4;
+  auto pmf_1 = train_strata_model<PMF>(pmf_config, train, test, 1);
+  auto pmf_4 = train_strata_model<PMF>(pmf_config, train, test, 4);
+  EXPECT_TRUE(pmf_1.first == pmf_4.first);
+  EXPECT_TRUE(pmf_1.second == pmf_4.second);
+
+  // and ranks the held out items about as well as serial SGD
+  double serial_map = 0., strata_map = 0.;
+  imf_config.num_strata = 0;
+  train_strata_model<IMF>(imf_config, train, test, 1, &serial_map);
+  imf_config.num_strata = 4;
+  train_strata_model<IMF>(imf_config, train, test, 4, &strata_map);
+  LOG(INFO) << "IMF MAP@10 serial " << serial_map << ", 4 x 4 strata " << strata_map;
+  EXPECT_GT(strata_map, 0.5 * serial_map);
+}
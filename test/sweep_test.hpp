@@ -0,0 +1,273 @@
+#include <atomic>
+#include <cstdio>
+#include <set>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/synthetic.hpp>
+#include <base/parallel/worker_pool.hpp>
+#include <model/recsys/imf.hpp>
+#include <solver/solver.hpp>
+#include <solver/sweep.hpp>
+
+TEST(sweep, test_worker_pool) {
+  using namespace libcf;
+  WorkerPool pool(3, 2);
+  std::atomic<size_t> num_turns(0);
+  std::atomic<size_t> max_limit(0);
+  std::vector<size_t> turns(10, 0);
+  // each job requeues itself until it has run 5 turns
+  std::function<void (size_t)> turn = [&](size_t job) {
+    ++num_turns;
+    max_limit = std::max<size_t>(max_limit, thread_parallelism_limit());
+    if (++turns[job] < 5) {
+      pool.submit([&, job]() { turn(job); });
+    }
+  };
+  for (size_t job = 0; job < turns.size(); ++job) {
+    pool.submit([&, job]() { turn(job); });
+  }
+  pool.wait();
+  EXPECT_EQ(num_turns, 50);
+  EXPECT_EQ(turns, std::vector<size_t>(10, 5));
+  EXPECT_EQ(max_limit, 2);
+  // the pool takes new work after a wait
+  pool.submit([&]() { ++num_turns; });
+  pool.wait();
+  EXPECT_EQ(num_turns, 51);
+}
+
+TEST(sweep, test_spec) {
+  using namespace libcf;
+  auto spec = SweepSpec::parse("learn_rate=0.1;cratio=0,0.5,1;asym=true,false");
+  EXPECT_EQ(spec.num_params(), 3);
+  EXPECT_EQ(spec.num_points(), 6);
+  auto grid = spec.grid();
+  ASSERT_EQ(grid.size(), 6);
+  EXPECT_EQ(to_string(grid[0]), "asym=true cratio=0 learn_rate=0.1");
+  EXPECT_EQ(to_string(grid[1]), "asym=false cratio=0 learn_rate=0.1");
+  EXPECT_EQ(to_string(grid[5]), "asym=false cratio=1 learn_rate=0.1");
+
+  std::string filename("/tmp/libcf_sweep_test.spec");
+  {
+    File f(filename, "w");
+    f.write_line("cratio : 0,0.5,1");
+    f.write_line("asym : true,false");
+    f.close();
+  }
+  EXPECT_EQ(SweepSpec::load(filename).num_points(), 6);
+
+  auto samples = spec.sample(4);
+  ASSERT_EQ(samples.size(), 4);
+  std::set<std::string> distinct;
+  for (auto& params : samples) {
+    distinct.insert(to_string(params));
+  }
+  EXPECT_EQ(distinct.size(), 4);
+  EXPECT_EQ(spec.sample(10).size(), 6);
+}
+
+TEST(sweep, test_shared_interaction_table) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 200;
+  synthetic_config.num_items = 300;
+  synthetic_config.num_interactions = 3000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  auto table = train.interaction_table();
+  EXPECT_EQ(table, train.interaction_table());
+  Data copy = train;
+  EXPECT_EQ(table, copy.interaction_table());
+  EXPECT_EQ(*table, train.get_feature_pair_label_hashtable(0, 1));
+
+  // models reset on the data set read the same table: held by the
+  // data sets, by this test and by each model
+  IMFConfig config;
+  IMF a(config), b(config);
+  a.reset(train);
+  b.reset(train);
+  EXPECT_EQ(table.use_count(), 4);
+
+  // an online update copies the model's histories first
+  size_t uid = 0;
+  size_t iid = 0;
+  while (table->at(uid).count(iid)) ++iid;
+  EXPECT_TRUE(a.add_interaction(uid, iid));
+  EXPECT_EQ(table->at(uid).count(iid), 0);
+  EXPECT_EQ(table.use_count(), 3);
+  EXPECT_EQ(table, train.interaction_table());
+
+  // once an index owns its copy it writes in place, and a copy of the
+  // index copies again before writing
+  InteractionIndex index(table);
+  index[uid][iid] = 1.;
+  const InteractionTable* owned = &index.table();
+  EXPECT_NE(owned, table.get());
+  index[uid][iid] = 2.;
+  EXPECT_EQ(&index.table(), owned);
+  InteractionIndex copy_index = index;
+  copy_index[uid][iid] = 3.;
+  EXPECT_EQ(index.table().at(uid).at(iid), 2.);
+  EXPECT_EQ(copy_index.table().at(uid).at(iid), 3.);
+}
+
+TEST(sweep, test_sweep_imf) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 300;
+  synthetic_config.num_items = 400;
+  synthetic_config.num_interactions = 6000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  // resume continues where train stopped
+  {
+    IMFConfig config;
+    IMF imf_model(config);
+    SolverConfig solver_config;
+    solver_config.max_iteration = 2;
+    Solver<IMF> solver(imf_model, solver_config);
+    solver.train(train, test, {TOPN});
+    EXPECT_EQ(solver.iteration(), 2);
+    solver.resume(train, test, 3);
+    EXPECT_EQ(solver.iteration(), 5);
+    auto metrics = solver.last_metrics();
+    ASSERT_EQ(metrics.size(), 9);
+    EXPECT_EQ(metrics[7].first, "MAP@10");
+    EXPECT_GT(metrics[7].second, 0.);
+  }
+
+  SolverConfig solver_config;
+  solver_config.max_iteration = 3;
+  SweepConfig sweep_config;
+  sweep_config.num_workers = 2;
+  sweep_config.max_active = 3;
+  sweep_config.slice_iterations = 1;
+  Sweep<IMF> sweep([](const SweepParams& params) {
+    IMFConfig config;
+    config.num_dim = std::stoi(params.at("num_dim"));
+    config.learn_rate = std::stod(params.at("learn_rate"));
+    return IMF(config);
+  }, solver_config, sweep_config);
+  auto points = SweepSpec::parse("num_dim=4,8;learn_rate=0.01,0.1,0.2").grid();
+  auto results = sweep.run(points, train, test, {TOPN});
+
+  ASSERT_EQ(results.size(), 6);
+  std::set<size_t> trials;
+  for (size_t idx = 0; idx < results.size(); ++idx) {
+    trials.insert(results[idx].trial);
+    EXPECT_EQ(results[idx].iterations, 3);
+    EXPECT_EQ(results[idx].params, points[results[idx].trial]);
+    EXPECT_FALSE(std::isnan(results[idx].metric("MAP@10")));
+    if (idx > 0) {
+      EXPECT_GE(results[idx - 1].metric("MAP@10"), results[idx].metric("MAP@10"));
+    }
+  }
+  EXPECT_EQ(trials.size(), 6);
+
+  std::string filename("/tmp/libcf_sweep_test.tsv");
+  Sweep<IMF>::write_table(results, filename);
+  size_t num_lines = 0;
+  FileLineReader reader(filename);
+  reader.set_line_callback([&](const std::string& line, size_t line_num) {
+    auto columns = split_line(line, "\t");
+    EXPECT_EQ(columns.size(), 1 + 2 + 3 + 9);
+    if (line_num == 0) {
+      EXPECT_EQ(columns[1], "learn_rate");
+    }
+    ++num_lines;
+  });
+  reader.load();
+  EXPECT_EQ(num_lines, 7);
+}
+
+TEST(sweep, test_hyperband) {
+  using namespace libcf;
+  SyntheticConfig synthetic_config;
+  synthetic_config.num_users = 300;
+  synthetic_config.num_items = 400;
+  synthetic_config.num_interactions = 6000;
+  Data data;
+  SyntheticDataGenerator(synthetic_config).generate(data);
+  Data train, test;
+  data.random_split_by_feature_group(train, test, 0, 0.2);
+
+  // a model resumed from its checkpoint trains on as the one in memory
+  {
+    IMFConfig config;
+    config.num_dim = 8;
+    IMF imf_model(config);
+    SolverConfig solver_config;
+    solver_config.max_iteration = 2;
+    Solver<IMF> trained(imf_model, solver_config);
+    trained.train(train, test, {TOPN});
+    std::string filename("/tmp/libcf_sweep_test.ckpt");
+    trained.get_model()->save_checkpoint(filename, true);
+
+    Solver<IMF> restored(imf_model, solver_config);
+    restored.get_model()->resume_checkpoint(filename, train);
+    restored.restore({TOPN}, 2);
+
+    Random::seed(7);
+    trained.resume(train, test, 2);
+    Random::seed(7);
+    restored.resume(train, test, 2);
+    EXPECT_EQ(restored.iteration(), 4);
+    auto restored_metrics = restored.last_metrics();
+    auto trained_metrics = trained.last_metrics();
+    ASSERT_EQ(restored_metrics.size(), 9);
+    for (size_t idx = 0; idx < 8; ++idx) {  // all but TestTime
+      EXPECT_EQ(restored_metrics[idx], trained_metrics[idx]);
+    }
+    for (auto& ins : test) {
+      EXPECT_EQ(restored.get_model()->predict(ins), trained.get_model()->predict(ins));
+    }
+  }
+
+  SolverConfig solver_config;
+  solver_config.max_iteration = 9;
+  SweepConfig sweep_config;
+  sweep_config.num_workers = 2;
+  Sweep<IMF> sweep([](const SweepParams& params) {
+    IMFConfig config;
+    config.num_dim = std::stoi(params.at("num_dim"));
+    config.learn_rate = std::stod(params.at("learn_rate"));
+    return IMF(config);
+  }, solver_config, sweep_config);
+  HyperbandConfig hyperband_config;
+  hyperband_config.min_iterations = 1;
+  hyperband_config.eta = 3.;
+
+  // successive halving: 9 at 1 iteration, 3 at 3 and 1 at 9
+  auto points = SweepSpec::parse("num_dim=2,4,8;learn_rate=0.01,0.05,0.1").grid();
+  auto results = sweep.run_hyperband(points, train, test, {TOPN}, hyperband_config);
+  ASSERT_EQ(results.size(), 9);
+  std::vector<size_t> iterations;
+  for (auto& result : results) {
+    iterations.push_back(result.iterations);
+    EXPECT_FALSE(std::isnan(result.metric("MAP@10")));
+  }
+  EXPECT_EQ(iterations, std::vector<size_t>({9, 3, 3, 1, 1, 1, 1, 1, 1}));
+  EXPECT_GE(results[1].metric("MAP@10"), results[2].metric("MAP@10"));
+  EXPECT_EQ(sweep.total_iterations(), 9 * 1 + 3 * 2 + 1 * 6);
+
+  // Hyperband: brackets of 9, 5 and 3 configurations starting at 1, 3 and 9
+  points = SweepSpec::parse("num_dim=2,4,8,16;learn_rate=0.01,0.02,0.05,0.1,0.2").sample(17);
+  hyperband_config.num_brackets = 0;
+  results = sweep.run_hyperband(points, train, test, {TOPN}, hyperband_config);
+  ASSERT_EQ(results.size(), 17);
+  size_t num_full = 0;
+  for (auto& result : results) {
+    if (result.iterations == 9) ++num_full;
+  }
+  // 1 of successive halving, 1 of the bracket at 3 and all 3 of the one at 9
+  EXPECT_EQ(num_full, 5);
+  EXPECT_EQ(sweep.total_iterations(), (9 + 3 * 2 + 6) + (5 * 3 + 6) + 3 * 9);
+}
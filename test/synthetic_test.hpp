@@ -0,0 +1,128 @@
+#include <map>
+#include <unordered_set>
+
+#include "gtest/gtest.h"
+
+#include <base/data.hpp>
+#include <base/io.hpp>
+#include <base/synthetic.hpp>
+
+TEST(synthetic, test_user_order) {
+  using namespace libcf;
+  SyntheticConfig config;
+  config.num_users = 1000;
+  config.num_items = 5000;
+  config.num_interactions = 20000;
+  config.timestamps = true;
+  config.block_size = 100;
+  SyntheticDataGenerator gen(config);
+  EXPECT_EQ(gen.num_blocks(), 10);
+
+  size_t total = 0;
+  std::map<size_t, size_t> activity;
+  std::vector<size_t> popularity(config.num_items, 0);
+  for (size_t idx = 0; idx < gen.num_blocks(); ++idx) {
+    auto interactions = gen.block(idx);
+    std::map<size_t, std::unordered_set<size_t>> user_items;
+    std::map<size_t, size_t> last_time;
+    for (auto& x : interactions) {
+      ASSERT_GE(x.user, idx * config.block_size);
+      ASSERT_LT(x.user, (idx + 1) * config.block_size);
+      ASSERT_LT(x.item, config.num_items);
+      EXPECT_TRUE(user_items[x.user].insert(x.item).second);
+      EXPECT_GE(x.time, last_time[x.user]);
+      last_time[x.user] = x.time;
+      ++activity[x.user];
+      ++popularity[x.item];
+    }
+    total += interactions.size();
+  }
+  // every user, about num_interactions in total, skewed both ways
+  EXPECT_EQ(activity.size(), config.num_users);
+  EXPECT_GT(total, config.num_interactions * 0.9);
+  EXPECT_LT(total, config.num_interactions * 1.2);
+  size_t max_activity = 0;
+  for (auto& p : activity) {
+    max_activity = std::max(max_activity, p.second);
+  }
+  EXPECT_GT(max_activity, 20 * total / config.num_users);
+  std::sort(popularity.rbegin(), popularity.rend());
+  EXPECT_GT(popularity[0], 10 * popularity[config.num_items / 2]);
+
+  // the same blocks for the same seed
+  auto first = gen.block(3);
+  auto again = SyntheticDataGenerator(config).block(3);
+  ASSERT_EQ(first.size(), again.size());
+  for (size_t idx = 0; idx < first.size(); ++idx) {
+    EXPECT_EQ(first[idx].user, again[idx].user);
+    EXPECT_EQ(first[idx].item, again[idx].item);
+  }
+}
+
+TEST(synthetic, test_time_order) {
+  using namespace libcf;
+  SyntheticConfig config;
+  config.num_users = 100;
+  config.num_items = 50;
+  config.num_interactions = 1000;
+  config.order = TIME_ORDER;
+  config.timestamps = true;
+  config.block_size = 64;
+  SyntheticDataGenerator gen(config);
+
+  std::string filename("/tmp/libcf_synthetic_test.txt");
+  EXPECT_EQ(gen.write_text(filename), config.num_interactions);
+
+  size_t num_lines = 0;
+  size_t last_time = 0;
+  File f(filename, "r");
+  std::string line;
+  while (f.good()) {
+    f.read_line(line);
+    if (line.empty()) continue;
+    auto rets = split_line(line, " ");
+    ASSERT_EQ(rets.size(), 3);
+    EXPECT_LT(std::stoul(rets[0]), config.num_users);
+    EXPECT_LT(std::stoul(rets[1]), config.num_items);
+    EXPECT_GE(std::stoul(rets[2]), last_time);
+    last_time = std::stoul(rets[2]);
+    ++num_lines;
+  }
+  f.close();
+  EXPECT_EQ(num_lines, config.num_interactions);
+
+  // the same output whatever the thread count
+  auto read_all = [](const std::string& filename) {
+    std::string rets, line;
+    File f(filename, "r");
+    while (f.good()) {
+      f.read_line(line);
+      rets += line + "\n";
+    }
+    f.close();
+    return rets;
+  };
+  int num_thread = FLAGS_num_thread;
+  FLAGS_num_thread = 3;
+  std::string parallel_filename("/tmp/libcf_synthetic_test.parallel.txt");
+  gen.write_text(parallel_filename);
+  FLAGS_num_thread = num_thread;
+  EXPECT_EQ(read_all(parallel_filename), read_all(filename));
+
+  // generate gives the data loading the text gives
+  Data loaded, generated;
+  loaded.load(filename, RECSYS, [&](const std::string& line) {
+    auto rets = split_line(line, " ");
+    return std::vector<std::string>{rets[0], rets[1], "1"};
+  });
+  gen.generate(generated);
+  ASSERT_EQ(generated.size(), loaded.size());
+  EXPECT_EQ(generated.feature_group_total_dimension(0), loaded.feature_group_total_dimension(0));
+  EXPECT_EQ(generated.feature_group_total_dimension(1), loaded.feature_group_total_dimension(1));
+  for (size_t idx = 0; idx < generated.size(); ++idx) {
+    EXPECT_EQ(generated.data()[idx].get_feature_group_index(0, 0),
+              loaded.data()[idx].get_feature_group_index(0, 0));
+    EXPECT_EQ(generated.data()[idx].get_feature_group_index(1, 0),
+              loaded.data()[idx].get_feature_group_index(1, 0));
+  }
+}
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+
+#include <base/heap.hpp>
+#include <base/topk.hpp>
+#include <base/utils.hpp>
+#include <base/random.hpp>
+
+#include "gtest/gtest.h"
+
+TEST(topk, test_topk) {
+  using namespace libcf;
+  {
+    std::vector<double> v{10., 20., 30., 5., 15.};
+    TopK<double> topk(3);
+    for (size_t idx = 0; idx < v.size(); ++idx) {
+      topk.push(idx, v[idx]);
+    }
+    EXPECT_EQ(topk.size(), 3);
+    EXPECT_EQ(topk.threshold(), 15.);
+    EXPECT_FALSE(topk.accepts(15.));
+    EXPECT_TRUE(topk.accepts(16.));
+    auto ids = topk.get_sorted_ids();
+    EXPECT_EQ(ids[0], 2);
+    EXPECT_EQ(ids[1], 1);
+    EXPECT_EQ(ids[2], 4);
+  }
+  {
+    // keep the smallest scores
+    std::vector<double> v{10., 20., 30., 5., 15.};
+    TopK<double, std::less<double>> topk(2);
+    topk.push_block(v.data(), 0, v.size());
+    auto data = topk.get_sorted_data();
+    EXPECT_EQ(data[0].first, 3);
+    EXPECT_EQ(data[1].first, 0);
+    EXPECT_EQ(data[1].second, 10.);
+  }
+  {
+    // ties are won by the candidate pushed first
+    TopK<double> topk(2);
+    for (size_t idx = 0; idx < 5; ++idx) {
+      topk.push(idx, 1.);
+    }
+    auto ids = topk.get_sorted_ids();
+    EXPECT_EQ(ids[0], 0);
+    EXPECT_EQ(ids[1], 1);
+  }
+}
+
+TEST(topk, test_topk_against_heap) {
+  using namespace libcf;
+  size_t num_items = 1000000;
+  size_t topk = 10;
+  std::vector<double> scores(num_items);
+  for (auto& s : scores) {
+    s = Random::uniform();
+  }
+
+  std::vector<std::pair<size_t, double>> heap_rets;
+  libcf::time_function([&]() {
+    Heap<std::pair<size_t, double>> topk_heap(sort_by_second_desc<size_t, double>, topk);
+    for (size_t iid = 0; iid < num_items; ++iid) {
+      if (topk_heap.size() < topk) {
+        topk_heap.push({iid, scores[iid]});
+      } else {
+        topk_heap.push_and_pop({iid, scores[iid]});
+      }
+    }
+    heap_rets = topk_heap.get_sorted_data();
+  }, "Heap");
+
+  std::vector<std::pair<size_t, double>> topk_rets;
+  libcf::time_function([&]() {
+    TopK<double> topk_items(topk);
+    for (size_t iid = 0; iid < num_items; ++iid) {
+      topk_items.push(iid, scores[iid]);
+    }
+    topk_rets = topk_items.get_sorted_data();
+  }, "TopK push");
+
+  std::vector<std::pair<size_t, double>> block_rets;
+  libcf::time_function([&]() {
+    TopK<double> topk_items(topk);
+    topk_items.push_block(scores.data(), 0, num_items);
+    block_rets = topk_items.get_sorted_data();
+  }, "TopK push_block");
+
+  ASSERT_EQ(heap_rets.size(), topk);
+  ASSERT_EQ(topk_rets.size(), topk);
+  ASSERT_EQ(block_rets.size(), topk);
+  for (size_t idx = 0; idx < topk; ++idx) {
+    EXPECT_EQ(heap_rets[idx].first, topk_rets[idx].first);
+    EXPECT_EQ(heap_rets[idx].first, block_rets[idx].first);
+  }
+}
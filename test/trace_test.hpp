@@ -0,0 +1,79 @@
+#include <thread>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include <base/trace.hpp>
+#include <base/io/file.hpp>
+
+TEST(trace, test_trace_buffer) {
+  using namespace libcf;
+  static const char* names[] = {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j"};
+  TraceBuffer buffer(0, 4);
+  for (size_t idx = 0; idx < 10; ++idx) {
+    buffer.record(names[idx], idx, idx + 1);
+  }
+  // the ring keeps the latest events, oldest first
+  auto events = buffer.events();
+  EXPECT_EQ(buffer.num_recorded(), 10);
+  ASSERT_EQ(events.size(), 4);
+  for (size_t idx = 0; idx < events.size(); ++idx) {
+    EXPECT_EQ(events[idx].name, names[6 + idx]);
+    EXPECT_EQ(events[idx].begin, 6 + idx);
+  }
+  buffer.clear();
+  EXPECT_TRUE(buffer.events().empty());
+}
+
+TEST(trace, test_chrome_export) {
+  using namespace libcf;
+  auto& tracer = Tracer::instance();
+  tracer.clear();
+  {
+    TraceScope scope("disabled");
+  }
+  tracer.enable();
+  {
+    TraceScope outer("outer");
+    TraceScope inner("inner");
+  }
+  // short-lived threads reuse the lanes of finished ones
+  for (size_t round = 0; round < 8; ++round) {
+    std::thread worker([]() { TraceScope scope("worker"); });
+    worker.join();
+  }
+  tracer.disable();
+  EXPECT_LE(tracer.num_lanes(), 2);
+
+  size_t num_outer = 0, num_inner = 0, num_worker = 0;
+  double outer_begin = 0., outer_dur = 0., inner_begin = 0., inner_dur = 0.;
+  tracer.for_each_event([&](size_t lane, const char* name, double begin_ns, double dur_ns) {
+    std::string str(name);
+    EXPECT_NE(str, "disabled");
+    if (str == "outer") {
+      ++num_outer; outer_begin = begin_ns; outer_dur = dur_ns;
+    } else if (str == "inner") {
+      ++num_inner; inner_begin = begin_ns; inner_dur = dur_ns;
+    } else if (str == "worker") {
+      ++num_worker;
+    }
+  });
+  EXPECT_EQ(num_outer, 1);
+  EXPECT_EQ(num_inner, 1);
+  EXPECT_EQ(num_worker, 8);
+  // inner is nested in outer
+  EXPECT_GE(inner_begin, outer_begin);
+  EXPECT_LE(inner_begin + inner_dur, outer_begin + outer_dur + 1.);
+
+  std::string filename("/tmp/libcf_trace_test.json");
+  EXPECT_EQ(tracer.write_chrome_json(filename), 10);
+  File f(filename, "r");
+  std::string line, content;
+  while (f.read_line(line)) {
+    content += line;
+  }
+  EXPECT_EQ(content.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["), 0);
+  EXPECT_NE(content.find("\"name\":\"inner\",\"ph\":\"X\""), std::string::npos);
+  EXPECT_EQ(content.substr(content.size() - 2), "]}");
+  tracer.clear();
+}